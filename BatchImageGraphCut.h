@@ -0,0 +1,331 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BatchImageGraphCut_H
+#define BatchImageGraphCut_H
+
+// Submodules
+#include "Mask/ForegroundBackgroundSegmentMask.h"
+
+#include "BitMask.h"
+#include "DataTerm.h"
+#include "GridMaxFlow.h"
+#include "SmoothnessTerm.h"
+#include "Trace.h"
+
+// ITK
+#include "itkImage.h"
+
+// STL
+#include <vector>
+
+// Boost
+#include <boost/graph/adjacency_list.hpp>
+
+/** The max flow solvers BatchImageGraphCut can use. Both find the same minimum cut. */
+enum class MaxFlowBackendEnum { BOOST, GRID };
+
+/** Segment an image with a graph cut whose t-links come from a DataTerm.
+  * This is the batch counterpart of ImageGraphCut: rather than calling a likelihood function per pixel,
+  * the terminal capacities of the whole image are requested from the data term in a single call.
+  * The n-links follow the GrabCut paper: gamma * exp(-beta ||Ia - Ib||^2) / dist(a, b). */
+template <typename TImage>
+class BatchImageGraphCut
+{
+public:
+    /** The type of a list of pixels/indexes. */
+    typedef std::vector<itk::Index<2> > IndexContainer;
+
+    /** Constructor */
+    BatchImageGraphCut();
+
+    /** Provide the image to segment. The image is not copied and must outlive the segmentation. */
+    void SetImage(TImage* const image);
+
+    /** Provide the data term that supplies the t-link costs. */
+    void SetDataTerm(DataTerm* const dataTerm);
+
+    /** Pixels that must be foreground. */
+    void SetSources(const IndexContainer& sources);
+
+    /** Pixels that must be background. */
+    void SetSinks(const IndexContainer& sinks);
+
+    /** Make the FOREGROUND pixels of a mask (of the size of the image) sources, without listing them. */
+    void SetSources(const ForegroundBackgroundSegmentMask* const mask);
+
+    /** Make the BACKGROUND pixels of a mask (of the size of the image) sinks, without listing them. */
+    void SetSinks(const ForegroundBackgroundSegmentMask* const mask);
+
+    /** Make the set pixels of a bit mask (of the size of the image) sources. */
+    void SetSources(const BitMask& mask);
+
+    /** Make the set pixels of a bit mask (of the size of the image) sinks. */
+    void SetSinks(const BitMask& mask);
+
+    /** Provide precomputed n-link weights for the image, e.g. to share them between several cuts of the same image.
+      * Their gamma and connectivity are used. Without them BuildGraph() computes its own. */
+    void SetSmoothnessTerm(const SmoothnessTerm* const smoothnessTerm);
+
+    /** Set the weight of the smoothness term (50 in the GrabCut paper) when the n-link weights are computed here. */
+    void SetGamma(const float gamma)
+    {
+        this->OwnSmoothnessTerm.SetGamma(gamma);
+    }
+
+    /** Use 8-connected (the default) or 4-connected n-links when the n-link weights are computed here. */
+    void SetEightConnected(const bool eightConnected)
+    {
+        this->OwnSmoothnessTerm.SetEightConnected(eightConnected);
+    }
+
+    /** Choose the max flow solver: GridMaxFlow (the default), which stores the grid implicitly, or Boost's
+      * boykov_kolmogorov_max_flow on an adjacency_list. Takes effect at the next BuildGraph(). */
+    void SetMaxFlowBackend(const MaxFlowBackendEnum backend)
+    {
+        this->MaxFlowBackend = backend;
+    }
+
+    /** Build the graph only over the bounding box of the unconstrained pixels, with the constrained pixels contracted into
+      * the terminals (their n-links to unconstrained pixels are added to the t-links of those pixels), rather than over the
+      * whole image (the default). The data term is only asked for the costs of that box. The cut is the same.
+      * Takes effect at the next BuildGraph(). */
+    void SetCropToUnconstrained(const bool cropToUnconstrained)
+    {
+        this->CropToUnconstrained = cropToUnconstrained;
+    }
+
+    /** Get the region of the image covered by the graph built by BuildGraph(). */
+    const itk::ImageRegion<2>& GetGraphRegion() const
+    {
+        return this->GraphRegion;
+    }
+
+    /** Set how many threads the GRID max flow solver may use. The cut does not depend on it. */
+    void SetNumberOfThreads(const unsigned int numberOfThreads)
+    {
+        this->GridFlow.SetNumberOfThreads(numberOfThreads);
+    }
+
+    /** Build the graph, set its terminal capacities and cut it. */
+    void PerformSegmentation();
+
+    /** Create the graph nodes and the n-links. The t-links are created with zero capacity.
+      * The hard constraints must have been set, since they decide which pixels a cropped graph covers. */
+    void BuildGraph();
+
+    /** Fill the t-link capacities from the data term and the hard constraints. */
+    void SetTerminalCapacities();
+
+    /** Bring the t-links up to date with the data term and the hard constraints after a Solve(), keeping the flow found so far
+      * (dynamic graph cuts, Kohli and Torr). The residual graph becomes the new graph and only the difference between the new
+      * and the previous t-link capacities is applied to it, so the next Solve() only has to push the flow that changed.
+      * Before the first Solve() this is the same as SetTerminalCapacities(). */
+    void UpdateTerminalCapacities();
+
+    /** Compute the minimum cut and store it in the segment bits. */
+    void Solve();
+
+    /** Get the resulting segmentation: the foreground pixels are set. The next Solve() overwrites it. */
+    const BitMask& GetSegmentBits() const
+    {
+        return this->SegmentBits;
+    }
+
+    /** Get the resulting segmentation as a mask. It is made from the segment bits the first time it is asked for after a
+      * Solve(); every Solve() makes a new mask and leaves the previous one untouched. */
+    ForegroundBackgroundSegmentMask* GetSegmentMask();
+
+    /** Get the Gibbs energy of the cut found by the last Solve(): the data term plus the smoothness term.
+      * The terms that only involve hard-constrained pixels are left out, since their labels cannot change; energies of
+      * cuts with the same hard constraints can be compared, whether the graph was cropped or not. */
+    double GetEnergy() const
+    {
+        return this->DataEnergy + this->SmoothnessEnergy;
+    }
+
+    /** Get the data part of the energy: the sum of the costs of the labels of the unconstrained pixels. */
+    double GetDataEnergy() const
+    {
+        return this->DataEnergy;
+    }
+
+    /** Get the smoothness part of the energy: the sum of the n-link weights between pixels with different labels. */
+    double GetSmoothnessEnergy() const
+    {
+        return this->SmoothnessEnergy;
+    }
+
+    /** Get the wall time (in seconds) the max flow of the last Solve() took. */
+    double GetMaxFlowDuration() const
+    {
+        return this->MaxFlowDuration;
+    }
+
+    /** Get the wall time (in seconds) the energy computation of the last Solve() took. */
+    double GetEnergyDuration() const
+    {
+        return this->EnergyDuration;
+    }
+
+    /** Get the number of nodes of the graph (the pixels of the graph region). */
+    unsigned int GetNumberOfNodes() const
+    {
+        return this->GraphWidth * this->GraphHeight;
+    }
+
+    /** Get the number of n-links of the graph (pairs of neighboring nodes). */
+    unsigned int GetNumberOfEdges() const
+    {
+        return this->NumberOfEdges;
+    }
+
+    /** Get the number of bytes the graph holds between cuts: the solver's graph, the hard constraints and the t-link
+      * capacities (approximate for the BOOST backend, whose vertices and edges are allocated by Boost). */
+    size_t GetNumberOfBytes() const;
+
+    /** Get the number of bytes the search queues of the last Solve() took at their largest (GRID backend only). */
+    size_t GetQueueBytes() const
+    {
+        return this->MaxFlowBackend == MaxFlowBackendEnum::GRID ? this->GridFlow.GetQueueBytes() : 0;
+    }
+
+protected:
+
+    /** The per-pixel hard constraints. */
+    enum ConstraintEnum { UNCONSTRAINED, SOURCE, SINK };
+
+    typedef boost::adjacency_list_traits<boost::vecS, boost::vecS, boost::directedS> GraphTraitsType;
+
+    typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::directedS,
+        boost::property<boost::vertex_color_t, boost::default_color_type,
+        boost::property<boost::vertex_distance_t, long,
+        boost::property<boost::vertex_predecessor_t, GraphTraitsType::edge_descriptor> > >,
+        boost::property<boost::edge_capacity_t, float,
+        boost::property<boost::edge_residual_capacity_t, float,
+        boost::property<boost::edge_reverse_t, GraphTraitsType::edge_descriptor> > > > GraphType;
+
+    typedef GraphTraitsType::vertex_descriptor VertexDescriptor;
+    typedef GraphTraitsType::edge_descriptor EdgeDescriptor;
+
+    /** Add an edge and its reverse edge with the given capacities. Returns the forward edge. */
+    EdgeDescriptor AddEdgePair(const VertexDescriptor from, const VertexDescriptor to,
+                               const float capacity, const float reverseCapacity);
+
+    /** Compute the t-link capacities of every pixel from the data term and the hard constraints.
+      * Returns the total cost that was subtracted from both t-links of the unconstrained pixels. */
+    double ComputeTerminalCapacities(std::vector<float>& sourceCapacities, std::vector<float>& sinkCapacities);
+
+    /** Compute the energy of the segment bits from the t-link capacities and the n-link weights. */
+    void ComputeEnergy();
+
+    /** Call function(p, q, direction, pInGraph, qInGraph, weight) for every pair of neighboring pixels p, q (q after p in
+      * the SmoothnessTerm direction) of which at least one is in the graph region. */
+    template <typename TFunction>
+    void ForEachNeighborPair(const SmoothnessTerm* const smoothness, const TFunction& function) const;
+
+    /** Get whether pixel (x, y) (relative to the image origin) is in the graph region. */
+    bool IsInGraph(const unsigned int x, const unsigned int y) const
+    {
+        return x - this->GraphOffset[0] < this->GraphWidth && y - this->GraphOffset[1] < this->GraphHeight;
+    }
+
+    /** Get the graph node of pixel p (an offset in the image buffer) in the graph region. */
+    unsigned int GetNode(const unsigned int p) const
+    {
+        const unsigned int width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+        return (p / width - this->GraphOffset[1]) * this->GraphWidth + (p % width - this->GraphOffset[0]);
+    }
+
+    /** The image to segment. */
+    TImage* Image = nullptr;
+
+    /** The data term. */
+    DataTerm* Data = nullptr;
+
+    /** The hard constraints, one per pixel. */
+    std::vector<unsigned char> Constraints;
+
+    /** Whether the graph only covers the unconstrained pixels. */
+    bool CropToUnconstrained = false;
+
+    /** The part of the image the graph covers, as an image region and as an offset and size relative to the image origin.
+      * Node y * GraphWidth + x is pixel (GraphOffset[0] + x, GraphOffset[1] + y). */
+    itk::ImageRegion<2> GraphRegion;
+    unsigned int GraphOffset[2] = {0, 0};
+    unsigned int GraphWidth = 0;
+    unsigned int GraphHeight = 0;
+
+    /** The number of n-links of the graph. */
+    unsigned int NumberOfEdges = 0;
+
+    /** The t-link capacities of the contracted n-links of every node (empty if nothing is contracted). */
+    std::vector<float> ContractedSourceCapacities;
+    std::vector<float> ContractedSinkCapacities;
+
+    /** The max flow solver to use. */
+    MaxFlowBackendEnum MaxFlowBackend = MaxFlowBackendEnum::GRID;
+
+    /** The grid solver (GRID backend). */
+    GridMaxFlow GridFlow;
+
+    /** The graph (BOOST backend). Node n is vertex n, followed by the source and the sink. */
+    GraphType Graph;
+
+    /** The source -> node edge of every node. */
+    std::vector<EdgeDescriptor> SourceEdges;
+
+    /** The node -> sink edge of every node. */
+    std::vector<EdgeDescriptor> SinkEdges;
+
+    /** The t-link capacities that were last applied, before any flow was pushed. */
+    std::vector<float> SourceCapacities;
+    std::vector<float> SinkCapacities;
+
+    /** The cost subtracted from both t-links of the unconstrained pixels, part of the data energy of every cut. */
+    double CommonDataCost = 0;
+
+    /** The energy of the last cut. */
+    double DataEnergy = 0;
+    double SmoothnessEnergy = 0;
+
+    /** The timings of the last Solve(). */
+    double MaxFlowDuration = 0;
+    double EnergyDuration = 0;
+
+    /** Whether the graph carries the flow of a previous Solve(). */
+    bool HasFlow = false;
+
+    /** The capacity of the t-link that enforces a hard constraint. It exceeds the sum of the n-links of any pixel. */
+    float HardConstraintCapacity = 0;
+
+    /** The n-link weights provided with SetSmoothnessTerm(), if any. */
+    const SmoothnessTerm* Smoothness = nullptr;
+
+    /** The n-link weights computed by BuildGraph() when none were provided. */
+    SmoothnessTerm OwnSmoothnessTerm;
+
+    /** The resulting segmentation, one bit per pixel. */
+    BitMask SegmentBits;
+
+    /** The resulting segmentation as a mask, once it has been asked for (null until then). */
+    ForegroundBackgroundSegmentMask::Pointer SegmentMask;
+};
+
+#include "BatchImageGraphCut.hpp"
+
+#endif
@@ -0,0 +1,678 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BatchImageGraphCut_HPP
+#define BatchImageGraphCut_HPP
+
+#include "BatchImageGraphCut.h"
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+// Boost
+#include <boost/graph/boykov_kolmogorov_max_flow.hpp>
+
+template <typename TImage>
+BatchImageGraphCut<TImage>::BatchImageGraphCut()
+{
+    this->SegmentMask = ForegroundBackgroundSegmentMask::New();
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetImage(TImage* const image)
+{
+    if(image->GetBufferedRegion() != image->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("BatchImageGraphCut::SetImage: the whole image must be buffered!");
+    }
+
+    this->Image = image;
+    this->HasFlow = false;
+
+    const unsigned int numberOfPixels = image->GetLargestPossibleRegion().GetNumberOfPixels();
+    this->Constraints.assign(numberOfPixels, UNCONSTRAINED);
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetDataTerm(DataTerm* const dataTerm)
+{
+    this->Data = dataTerm;
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetSmoothnessTerm(const SmoothnessTerm* const smoothnessTerm)
+{
+    this->Smoothness = smoothnessTerm;
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetSources(const IndexContainer& sources)
+{
+    const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+    for(unsigned int i = 0; i < sources.size(); ++i)
+    {
+        const unsigned int offset = (sources[i][1] - region.GetIndex()[1]) * region.GetSize()[0] +
+                                    (sources[i][0] - region.GetIndex()[0]);
+        this->Constraints[offset] = SOURCE;
+    }
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetSinks(const IndexContainer& sinks)
+{
+    const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+    for(unsigned int i = 0; i < sinks.size(); ++i)
+    {
+        const unsigned int offset = (sinks[i][1] - region.GetIndex()[1]) * region.GetSize()[0] +
+                                    (sinks[i][0] - region.GetIndex()[0]);
+        this->Constraints[offset] = SINK;
+    }
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetSources(const ForegroundBackgroundSegmentMask* const mask)
+{
+    if(mask->GetLargestPossibleRegion().GetSize() != this->Image->GetLargestPossibleRegion().GetSize())
+    {
+        throw std::runtime_error("BatchImageGraphCut::SetSources: the mask and the image have different sizes!");
+    }
+
+    const ForegroundBackgroundSegmentMask::PixelType* labels = mask->GetBufferPointer();
+    for(unsigned int p = 0; p < this->Constraints.size(); ++p)
+    {
+        if(labels[p] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND)
+        {
+            this->Constraints[p] = SOURCE;
+        }
+    }
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetSinks(const ForegroundBackgroundSegmentMask* const mask)
+{
+    if(mask->GetLargestPossibleRegion().GetSize() != this->Image->GetLargestPossibleRegion().GetSize())
+    {
+        throw std::runtime_error("BatchImageGraphCut::SetSinks: the mask and the image have different sizes!");
+    }
+
+    const ForegroundBackgroundSegmentMask::PixelType* labels = mask->GetBufferPointer();
+    for(unsigned int p = 0; p < this->Constraints.size(); ++p)
+    {
+        if(labels[p] == ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND)
+        {
+            this->Constraints[p] = SINK;
+        }
+    }
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetSources(const BitMask& mask)
+{
+    if(mask.GetWidth() != this->Image->GetLargestPossibleRegion().GetSize()[0] ||
+       mask.GetHeight() != this->Image->GetLargestPossibleRegion().GetSize()[1])
+    {
+        throw std::runtime_error("BatchImageGraphCut::SetSources: the mask and the image have different sizes!");
+    }
+
+    mask.ForEachSetBit([this](const unsigned int p)
+    {
+        this->Constraints[p] = SOURCE;
+    });
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetSinks(const BitMask& mask)
+{
+    if(mask.GetWidth() != this->Image->GetLargestPossibleRegion().GetSize()[0] ||
+       mask.GetHeight() != this->Image->GetLargestPossibleRegion().GetSize()[1])
+    {
+        throw std::runtime_error("BatchImageGraphCut::SetSinks: the mask and the image have different sizes!");
+    }
+
+    mask.ForEachSetBit([this](const unsigned int p)
+    {
+        this->Constraints[p] = SINK;
+    });
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::PerformSegmentation()
+{
+    BuildGraph();
+    SetTerminalCapacities();
+    Solve();
+}
+
+template <typename TImage>
+typename BatchImageGraphCut<TImage>::EdgeDescriptor BatchImageGraphCut<TImage>::AddEdgePair(
+    const VertexDescriptor from, const VertexDescriptor to, const float capacity, const float reverseCapacity)
+{
+    const EdgeDescriptor edge = boost::add_edge(from, to, this->Graph).first;
+    const EdgeDescriptor reverseEdge = boost::add_edge(to, from, this->Graph).first;
+
+    boost::put(boost::edge_capacity, this->Graph, edge, capacity);
+    boost::put(boost::edge_capacity, this->Graph, reverseEdge, reverseCapacity);
+    boost::put(boost::edge_reverse, this->Graph, edge, reverseEdge);
+    boost::put(boost::edge_reverse, this->Graph, reverseEdge, edge);
+
+    return edge;
+}
+
+template <typename TImage>
+template <typename TFunction>
+void BatchImageGraphCut<TImage>::ForEachNeighborPair(const SmoothnessTerm* const smoothness, const TFunction& function) const
+{
+    const unsigned int width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = this->Image->GetLargestPossibleRegion().GetSize()[1];
+    const unsigned int numberOfDirections = smoothness->GetEightConnected() ? 4 : 2;
+    const int neighborOffsets[4] = {1, static_cast<int>(width), static_cast<int>(width) + 1, static_cast<int>(width) - 1};
+    const float* weights[4] = {nullptr, nullptr, nullptr, nullptr};
+    for(unsigned int direction = 0; direction < numberOfDirections; ++direction)
+    {
+        weights[direction] = smoothness->GetWeights(static_cast<SmoothnessTerm::DirectionEnum>(direction));
+    }
+
+    if(this->GraphRegion.GetNumberOfPixels() == 0)
+    {
+        return;
+    }
+
+    // A pair with a pixel in the graph region has its first pixel in the region grown by one pixel
+    const unsigned int xBegin = this->GraphOffset[0] > 0 ? this->GraphOffset[0] - 1 : 0;
+    const unsigned int yBegin = this->GraphOffset[1] > 0 ? this->GraphOffset[1] - 1 : 0;
+    const unsigned int xEnd = std::min(this->GraphOffset[0] + this->GraphWidth + 1, width);
+    const unsigned int yEnd = std::min(this->GraphOffset[1] + this->GraphHeight + 1, height);
+
+    for(unsigned int y = yBegin; y < yEnd; ++y)
+    {
+        for(unsigned int x = xBegin; x < xEnd; ++x)
+        {
+            const unsigned int p = y * width + x;
+            const bool hasNeighbor[4] = {x + 1 < width, y + 1 < height, x + 1 < width && y + 1 < height, x > 0 && y + 1 < height};
+            const int neighborX[4] = {1, 0, 1, -1};
+            const int neighborY[4] = {0, 1, 1, 1};
+
+            for(unsigned int direction = 0; direction < numberOfDirections; ++direction)
+            {
+                if(!hasNeighbor[direction])
+                {
+                    continue;
+                }
+
+                const bool pInGraph = IsInGraph(x, y);
+                const bool qInGraph = IsInGraph(x + neighborX[direction], y + neighborY[direction]);
+                if(pInGraph || qInGraph)
+                {
+                    function(p, p + neighborOffsets[direction], direction, pInGraph, qInGraph, weights[direction][p]);
+                }
+            }
+        }
+    }
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::BuildGraph()
+{
+    const unsigned int width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = this->Image->GetLargestPossibleRegion().GetSize()[1];
+
+    this->HasFlow = false;
+
+    const SmoothnessTerm* smoothness = this->Smoothness;
+    if(!smoothness)
+    {
+        this->OwnSmoothnessTerm.Compute(this->Image);
+        smoothness = &this->OwnSmoothnessTerm;
+    }
+    if(!smoothness->IsComputed() || smoothness->GetWidth() != width || smoothness->GetHeight() != height)
+    {
+        throw std::runtime_error("BatchImageGraphCut::BuildGraph: the smoothness term was not computed for this image!");
+    }
+
+    // The graph covers the whole image, or only the bounding box of the unconstrained pixels
+    unsigned int xBegin = 0;
+    unsigned int yBegin = 0;
+    unsigned int xEnd = width;
+    unsigned int yEnd = height;
+    if(this->CropToUnconstrained)
+    {
+        xBegin = width;
+        yBegin = height;
+        xEnd = 0;
+        yEnd = 0;
+        for(unsigned int y = 0; y < height; ++y)
+        {
+            for(unsigned int x = 0; x < width; ++x)
+            {
+                if(this->Constraints[y * width + x] == UNCONSTRAINED)
+                {
+                    xBegin = std::min(xBegin, x);
+                    yBegin = std::min(yBegin, y);
+                    xEnd = std::max(xEnd, x + 1);
+                    yEnd = std::max(yEnd, y + 1);
+                }
+            }
+        }
+        if(xEnd <= xBegin)
+        {
+            xBegin = xEnd = yBegin = yEnd = 0; // Every pixel is constrained
+        }
+    }
+
+    this->GraphOffset[0] = xBegin;
+    this->GraphOffset[1] = yBegin;
+    this->GraphWidth = xEnd - xBegin;
+    this->GraphHeight = yEnd - yBegin;
+    itk::Index<2> graphIndex = this->Image->GetLargestPossibleRegion().GetIndex();
+    graphIndex[0] += xBegin;
+    graphIndex[1] += yBegin;
+    itk::Size<2> graphSize;
+    graphSize[0] = this->GraphWidth;
+    graphSize[1] = this->GraphHeight;
+    this->GraphRegion = itk::ImageRegion<2>(graphIndex, graphSize);
+    const unsigned int numberOfNodes = this->GraphWidth * this->GraphHeight;
+
+    const bool useBoost = this->MaxFlowBackend == MaxFlowBackendEnum::BOOST;
+    if(useBoost)
+    {
+        this->Graph = GraphType(numberOfNodes + 2);
+    }
+    else
+    {
+        this->Graph = GraphType();
+        this->GridFlow.Initialize(this->GraphWidth, this->GraphHeight, smoothness->GetEightConnected());
+    }
+
+    // A constrained pixel of a cropped graph is contracted into its terminal: its n-links to unconstrained pixels become
+    // t-links of those pixels, and it stays behind as an isolated node
+    const bool contract = this->CropToUnconstrained;
+    this->ContractedSourceCapacities.assign(contract ? numberOfNodes : 0, 0.0f);
+    this->ContractedSinkCapacities.assign(contract ? numberOfNodes : 0, 0.0f);
+
+    // The hard constraint capacity must exceed the total n-link capacity of any single pixel
+    std::vector<float> nLinkSums(numberOfNodes, 0);
+    this->NumberOfEdges = 0;
+
+    const GridMaxFlow::DirectionEnum gridDirections[4] = {GridMaxFlow::EAST, GridMaxFlow::SOUTH, GridMaxFlow::SOUTH_EAST,
+                                                          GridMaxFlow::SOUTH_WEST};
+    ForEachNeighborPair(smoothness, [&](const unsigned int p, const unsigned int q, const unsigned int direction,
+                                        const bool pInGraph, const bool qInGraph, const float weight)
+    {
+        if(contract)
+        {
+            const bool pConstrained = this->Constraints[p] != UNCONSTRAINED;
+            const bool qConstrained = this->Constraints[q] != UNCONSTRAINED;
+            if(pConstrained && qConstrained)
+            {
+                return; // Neither label can change
+            }
+            if(pConstrained || qConstrained)
+            {
+                // Unconstrained pixels are always in the graph
+                const unsigned int node = GetNode(pConstrained ? q : p);
+                const unsigned char constraint = this->Constraints[pConstrained ? p : q];
+                (constraint == SOURCE ? this->ContractedSourceCapacities : this->ContractedSinkCapacities)[node] += weight;
+                return;
+            }
+        }
+        else if(!pInGraph || !qInGraph)
+        {
+            return;
+        }
+
+        const unsigned int pNode = GetNode(p);
+        const unsigned int qNode = GetNode(q);
+        if(useBoost)
+        {
+            AddEdgePair(pNode, qNode, weight, weight);
+        }
+        else
+        {
+            this->GridFlow.SetNeighborCapacity(pNode, gridDirections[direction], weight);
+            this->GridFlow.SetNeighborCapacity(qNode, static_cast<GridMaxFlow::DirectionEnum>(gridDirections[direction] ^ 1), weight);
+        }
+        nLinkSums[pNode] += weight;
+        nLinkSums[qNode] += weight;
+        this->NumberOfEdges++;
+    });
+
+    if(useBoost)
+    {
+        const VertexDescriptor source = numberOfNodes;
+        const VertexDescriptor sink = numberOfNodes + 1;
+        this->SourceEdges.resize(numberOfNodes);
+        this->SinkEdges.resize(numberOfNodes);
+        for(unsigned int node = 0; node < numberOfNodes; ++node)
+        {
+            this->SourceEdges[node] = AddEdgePair(source, node, 0, 0);
+            this->SinkEdges[node] = AddEdgePair(node, sink, 0, 0);
+        }
+    }
+    else
+    {
+        std::vector<EdgeDescriptor>().swap(this->SourceEdges);
+        std::vector<EdgeDescriptor>().swap(this->SinkEdges);
+    }
+
+    this->HardConstraintCapacity = 1.0f;
+    if(numberOfNodes > 0)
+    {
+        this->HardConstraintCapacity += *std::max_element(nLinkSums.begin(), nLinkSums.end());
+    }
+
+    GRABCUT_TRACE_COUNTER("graph nodes", numberOfNodes);
+    GRABCUT_TRACE_COUNTER("graph edges", this->NumberOfEdges);
+}
+
+template <typename TImage>
+double BatchImageGraphCut<TImage>::ComputeTerminalCapacities(std::vector<float>& sourceCapacities, std::vector<float>& sinkCapacities)
+{
+    if(!this->Data)
+    {
+        throw std::runtime_error("BatchImageGraphCut::ComputeTerminalCapacities: no data term was provided!");
+    }
+
+    const unsigned int width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int numberOfNodes = this->GraphWidth * this->GraphHeight;
+    const bool contract = this->CropToUnconstrained;
+
+    // One request for the whole graph. Cutting source->p puts p in the background, so that edge carries the background cost (and vice versa)
+    sourceCapacities.resize(numberOfNodes);
+    sinkCapacities.resize(numberOfNodes);
+    if(numberOfNodes > 0)
+    {
+        this->Data->ComputeCosts(this->GraphRegion, sinkCapacities.data(), sourceCapacities.data());
+    }
+
+    double commonCost = 0;
+    for(unsigned int y = 0; y < this->GraphHeight; ++y)
+    {
+        const unsigned char* constraints = this->Constraints.data() + (this->GraphOffset[1] + y) * width + this->GraphOffset[0];
+        for(unsigned int x = 0; x < this->GraphWidth; ++x)
+        {
+            const unsigned int node = y * this->GraphWidth + x;
+            if(constraints[x] == SOURCE)
+            {
+                sourceCapacities[node] = contract ? 0 : this->HardConstraintCapacity;
+                sinkCapacities[node] = 0;
+            }
+            else if(constraints[x] == SINK)
+            {
+                sourceCapacities[node] = 0;
+                sinkCapacities[node] = contract ? 0 : this->HardConstraintCapacity;
+            }
+            else
+            {
+                // Subtracting the same amount from both t-links changes the energy by a constant only
+                const float common = std::min(sourceCapacities[node], sinkCapacities[node]);
+                sourceCapacities[node] -= common;
+                sinkCapacities[node] -= common;
+                commonCost += common;
+            }
+        }
+    }
+
+    return commonCost;
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::SetTerminalCapacities()
+{
+    this->CommonDataCost = ComputeTerminalCapacities(this->SourceCapacities, this->SinkCapacities);
+
+    // The contracted n-links are part of the t-links but not of the data costs
+    const bool contracted = !this->ContractedSourceCapacities.empty();
+    for(unsigned int node = 0; node < this->SourceCapacities.size(); ++node)
+    {
+        const float sourceCapacity = this->SourceCapacities[node] + (contracted ? this->ContractedSourceCapacities[node] : 0.0f);
+        const float sinkCapacity = this->SinkCapacities[node] + (contracted ? this->ContractedSinkCapacities[node] : 0.0f);
+        if(this->MaxFlowBackend == MaxFlowBackendEnum::GRID)
+        {
+            this->GridFlow.SetTerminalCapacities(node, sourceCapacity, sinkCapacity);
+        }
+        else
+        {
+            boost::put(boost::edge_capacity, this->Graph, this->SourceEdges[node], sourceCapacity);
+            boost::put(boost::edge_capacity, this->Graph, this->SinkEdges[node], sinkCapacity);
+        }
+    }
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::UpdateTerminalCapacities()
+{
+    if(!this->HasFlow)
+    {
+        SetTerminalCapacities();
+        return;
+    }
+
+    std::vector<float> sourceCapacities;
+    std::vector<float> sinkCapacities;
+    this->CommonDataCost = ComputeTerminalCapacities(sourceCapacities, sinkCapacities);
+
+    if(this->MaxFlowBackend == MaxFlowBackendEnum::GRID)
+    {
+        // The grid solver keeps its residuals and folds both t-links of a pixel into one signed residual
+        for(unsigned int p = 0; p < sourceCapacities.size(); ++p)
+        {
+            this->GridFlow.AddTerminalCapacities(p, sourceCapacities[p] - this->SourceCapacities[p],
+                                                 sinkCapacities[p] - this->SinkCapacities[p]);
+        }
+        this->SourceCapacities.swap(sourceCapacities);
+        this->SinkCapacities.swap(sinkCapacities);
+        return;
+    }
+
+    // The residual graph of the previous cut has the same minimum cuts as the original graph, so it becomes the new graph
+    // (the solver starts from the capacities, not from the residuals)
+    for(VertexDescriptor vertex = 0; vertex < boost::num_vertices(this->Graph); ++vertex)
+    {
+        typename boost::graph_traits<GraphType>::out_edge_iterator edge, edgeEnd;
+        for(boost::tie(edge, edgeEnd) = boost::out_edges(vertex, this->Graph); edge != edgeEnd; ++edge)
+        {
+            boost::put(boost::edge_capacity, this->Graph, *edge, boost::get(boost::edge_residual_capacity, this->Graph, *edge));
+        }
+    }
+
+    for(unsigned int p = 0; p < sourceCapacities.size(); ++p)
+    {
+        // Apply the change of each t-link to its residual. A t-link that would become negative is fixed by adding the same
+        // amount to both t-links of the pixel, which again only changes the energy by a constant.
+        float sourceResidual = boost::get(boost::edge_residual_capacity, this->Graph, this->SourceEdges[p]) +
+                               (sourceCapacities[p] - this->SourceCapacities[p]);
+        float sinkResidual = boost::get(boost::edge_residual_capacity, this->Graph, this->SinkEdges[p]) +
+                             (sinkCapacities[p] - this->SinkCapacities[p]);
+        const float common = std::min(sourceResidual, sinkResidual);
+        sourceResidual -= common;
+        sinkResidual -= common;
+
+        boost::put(boost::edge_capacity, this->Graph, this->SourceEdges[p], sourceResidual);
+        boost::put(boost::edge_capacity, this->Graph, this->SinkEdges[p], sinkResidual);
+
+        // Flow into the source or out of the sink never crosses a cut, so the reverse t-links are dropped
+        boost::put(boost::edge_capacity, this->Graph, boost::get(boost::edge_reverse, this->Graph, this->SourceEdges[p]), 0.0f);
+        boost::put(boost::edge_capacity, this->Graph, boost::get(boost::edge_reverse, this->Graph, this->SinkEdges[p]), 0.0f);
+    }
+
+    this->SourceCapacities.swap(sourceCapacities);
+    this->SinkCapacities.swap(sinkCapacities);
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::Solve()
+{
+    const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+    const unsigned int width = region.GetSize()[0];
+    const unsigned int height = region.GetSize()[1];
+    const unsigned int numberOfNodes = this->GraphWidth * this->GraphHeight;
+
+    // The mask of the previous cut (if it was asked for) is left to whoever holds it
+    this->SegmentMask = nullptr;
+
+    // The pixels outside of the graph (and the contracted ones) are all constrained
+    this->SegmentBits.SetSize(width, height);
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        BitMask::WordType* row = this->SegmentBits.GetRow(y);
+        const unsigned char* constraints = this->Constraints.data() + y * width;
+        for(unsigned int x = 0; x < width; ++x)
+        {
+            row[x / BitMask::BitsPerWord] |= static_cast<BitMask::WordType>(constraints[x] == SOURCE) << (x % BitMask::BitsPerWord);
+        }
+    }
+
+    const std::chrono::steady_clock::time_point maxFlowStart = std::chrono::steady_clock::now();
+    std::vector<unsigned char> isSource(numberOfNodes, 0);
+    if(numberOfNodes > 0)
+    {
+        if(this->MaxFlowBackend == MaxFlowBackendEnum::GRID)
+        {
+            this->GridFlow.ComputeMaxFlow();
+            for(unsigned int node = 0; node < numberOfNodes; ++node)
+            {
+                isSource[node] = this->GridFlow.IsSource(node);
+            }
+        }
+        else
+        {
+            const VertexDescriptor source = numberOfNodes;
+            const VertexDescriptor sink = numberOfNodes + 1;
+
+            boost::boykov_kolmogorov_max_flow(this->Graph, source, sink);
+
+            // Pixels in the source tree of the final residual graph are foreground
+            const boost::default_color_type sourceColor = boost::get(boost::vertex_color, this->Graph, source);
+            for(unsigned int node = 0; node < numberOfNodes; ++node)
+            {
+                isSource[node] = boost::get(boost::vertex_color, this->Graph, node) == sourceColor;
+            }
+        }
+    }
+    this->HasFlow = true;
+    const std::chrono::steady_clock::time_point maxFlowEnd = std::chrono::steady_clock::now();
+    this->MaxFlowDuration = std::chrono::duration<double>(maxFlowEnd - maxFlowStart).count();
+    GRABCUT_TRACE_EVENT("max flow", maxFlowStart, maxFlowEnd);
+    if(this->MaxFlowBackend == MaxFlowBackendEnum::GRID)
+    {
+        GRABCUT_TRACE_COUNTER("augmenting paths", this->GridFlow.GetNumberOfAugmentations());
+        GRABCUT_TRACE_COUNTER("orphans", this->GridFlow.GetNumberOfOrphans());
+    }
+
+    const bool contracted = this->CropToUnconstrained;
+    for(unsigned int y = 0; y < this->GraphHeight; ++y)
+    {
+        for(unsigned int x = 0; x < this->GraphWidth; ++x)
+        {
+            const unsigned int p = (this->GraphOffset[1] + y) * width + this->GraphOffset[0] + x;
+            if(contracted && this->Constraints[p] != UNCONSTRAINED)
+            {
+                continue;
+            }
+            this->SegmentBits.Set(this->GraphOffset[0] + x, this->GraphOffset[1] + y, isSource[y * this->GraphWidth + x]);
+        }
+    }
+
+    const std::chrono::steady_clock::time_point energyStart = std::chrono::steady_clock::now();
+    ComputeEnergy();
+    const std::chrono::steady_clock::time_point energyEnd = std::chrono::steady_clock::now();
+    this->EnergyDuration = std::chrono::duration<double>(energyEnd - energyStart).count();
+    GRABCUT_TRACE_EVENT("energy", energyStart, energyEnd);
+}
+
+template <typename TImage>
+void BatchImageGraphCut<TImage>::ComputeEnergy()
+{
+    const unsigned int width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+    const BitMask& labels = this->SegmentBits;
+
+    // A background pixel cuts its source -> p edge, a foreground pixel its p -> sink edge
+    double dataEnergy = this->CommonDataCost;
+    for(unsigned int y = 0; y < this->GraphHeight; ++y)
+    {
+        double rowDataEnergy = 0;
+        for(unsigned int x = 0; x < this->GraphWidth; ++x)
+        {
+            const unsigned int p = (this->GraphOffset[1] + y) * width + this->GraphOffset[0] + x;
+            const unsigned int node = y * this->GraphWidth + x;
+            if(this->Constraints[p] == UNCONSTRAINED)
+            {
+                rowDataEnergy += labels.Get(this->GraphOffset[0] + x, this->GraphOffset[1] + y) ? this->SinkCapacities[node] :
+                                                                                                  this->SourceCapacities[node];
+            }
+        }
+        dataEnergy += rowDataEnergy;
+    }
+
+    // Every pair with an unconstrained pixel has a pixel in the graph, so only the pairs with different labels are
+    // visited, a word of pixels at a time, and checked for one
+    double smoothnessEnergy = 0;
+    const SmoothnessTerm* smoothness = this->Smoothness ? this->Smoothness : &this->OwnSmoothnessTerm;
+    const unsigned int numberOfDirections = smoothness->GetEightConnected() ? 4 : 2;
+    const int neighborX[4] = {1, 0, 1, -1};
+    const unsigned int neighborY[4] = {0, 1, 1, 1};
+    for(unsigned int direction = 0; direction < numberOfDirections; ++direction)
+    {
+        const float* weights = smoothness->GetWeights(static_cast<SmoothnessTerm::DirectionEnum>(direction));
+        const unsigned int neighborOffset = neighborY[direction] * width + neighborX[direction];
+        labels.ForEachDifferentNeighbor(neighborX[direction], neighborY[direction], [&](const unsigned int p)
+        {
+            if(this->Constraints[p] == UNCONSTRAINED || this->Constraints[p + neighborOffset] == UNCONSTRAINED)
+            {
+                smoothnessEnergy += weights[p];
+            }
+        });
+    }
+
+    this->DataEnergy = dataEnergy;
+    this->SmoothnessEnergy = smoothnessEnergy;
+}
+
+template <typename TImage>
+size_t BatchImageGraphCut<TImage>::GetNumberOfBytes() const
+{
+    size_t bytes = this->Constraints.size() * sizeof(unsigned char) +
+                   (this->ContractedSourceCapacities.size() + this->ContractedSinkCapacities.size() +
+                    this->SourceCapacities.size() + this->SinkCapacities.size()) * sizeof(float) +
+                   (this->SourceEdges.size() + this->SinkEdges.size()) * sizeof(EdgeDescriptor);
+
+    if(this->MaxFlowBackend == MaxFlowBackendEnum::GRID)
+    {
+        return bytes + this->GridFlow.GetNumberOfBytes();
+    }
+
+    // Each vertex holds its properties and a vector of out edges; each edge is a target and a pointer to its properties
+    typedef typename GraphType::edge_property_type EdgeProperties;
+    bytes += boost::num_vertices(this->Graph) * sizeof(typename GraphType::stored_vertex) +
+             boost::num_edges(this->Graph) * (sizeof(EdgeProperties) + sizeof(VertexDescriptor) + sizeof(void*));
+    return bytes;
+}
+
+template <typename TImage>
+ForegroundBackgroundSegmentMask* BatchImageGraphCut<TImage>::GetSegmentMask()
+{
+    if(this->SegmentMask.IsNull())
+    {
+        this->SegmentMask = this->SegmentBits.ToMask();
+    }
+    return this->SegmentMask;
+}
+
+#endif
@@ -0,0 +1,307 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BitMask.h"
+
+// STL
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+void BitMask::SetSize(const unsigned int width, const unsigned int height)
+{
+    this->Width = width;
+    this->Height = height;
+    this->WordsPerRow = (width + BitsPerWord - 1) / BitsPerWord;
+    this->Words.assign(static_cast<size_t>(this->WordsPerRow) * height, 0);
+}
+
+void BitMask::Fill(const bool value)
+{
+    std::fill(this->Words.begin(), this->Words.end(), value ? ~static_cast<WordType>(0) : 0);
+    if(value)
+    {
+        ClearPadding();
+    }
+}
+
+void BitMask::ClearPadding()
+{
+    if(this->WordsPerRow == 0)
+    {
+        return;
+    }
+
+    const WordType lastWordMask = GetLastWordMask();
+    for(unsigned int y = 0; y < this->Height; ++y)
+    {
+        GetRow(y)[this->WordsPerRow - 1] &= lastWordMask;
+    }
+}
+
+void BitMask::CheckSize(const BitMask& other, const char* const method) const
+{
+    if(other.Width != this->Width || other.Height != this->Height)
+    {
+        throw std::runtime_error(std::string("BitMask::") + method + ": the masks have different sizes!");
+    }
+}
+
+void BitMask::FromMask(const ForegroundBackgroundSegmentMask* const mask, const ForegroundBackgroundSegmentMaskPixelTypeEnum value)
+{
+    const unsigned int width = mask->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = mask->GetLargestPossibleRegion().GetSize()[1];
+    SetSize(width, height);
+
+    const ForegroundBackgroundSegmentMask::PixelType* labels = mask->GetBufferPointer();
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        WordType* row = GetRow(y);
+        const ForegroundBackgroundSegmentMask::PixelType* rowLabels = labels + static_cast<size_t>(y) * width;
+        for(unsigned int w = 0; w < this->WordsPerRow; ++w)
+        {
+            const unsigned int begin = w * BitsPerWord;
+            const unsigned int end = std::min(begin + BitsPerWord, width);
+            WordType word = 0;
+            for(unsigned int x = begin; x < end; ++x)
+            {
+                word |= static_cast<WordType>(rowLabels[x] == value) << (x - begin);
+            }
+            row[w] = word;
+        }
+    }
+}
+
+ForegroundBackgroundSegmentMask::Pointer BitMask::ToMask() const
+{
+    itk::Size<2> size;
+    size[0] = this->Width;
+    size[1] = this->Height;
+
+    ForegroundBackgroundSegmentMask::Pointer mask = ForegroundBackgroundSegmentMask::New();
+    mask->SetRegions(itk::ImageRegion<2>(size));
+    mask->Allocate();
+
+    ForegroundBackgroundSegmentMask::PixelType* labels = mask->GetBufferPointer();
+    for(unsigned int y = 0; y < this->Height; ++y)
+    {
+        const WordType* row = GetRow(y);
+        ForegroundBackgroundSegmentMask::PixelType* rowLabels = labels + static_cast<size_t>(y) * this->Width;
+        for(unsigned int x = 0; x < this->Width; ++x)
+        {
+            rowLabels[x] = (row[x / BitsPerWord] >> (x % BitsPerWord)) & 1 ? ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND :
+                                                                              ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND;
+        }
+    }
+
+    return mask;
+}
+
+size_t BitMask::Count() const
+{
+    size_t count = 0;
+    for(const WordType word : this->Words)
+    {
+        count += CountBits(word);
+    }
+    return count;
+}
+
+size_t BitMask::CountDifferences(const BitMask& other) const
+{
+    CheckSize(other, "CountDifferences");
+
+    size_t count = 0;
+    for(size_t i = 0; i < this->Words.size(); ++i)
+    {
+        count += CountBits(this->Words[i] ^ other.Words[i]);
+    }
+    return count;
+}
+
+void BitMask::And(const BitMask& other)
+{
+    CheckSize(other, "And");
+
+    for(size_t i = 0; i < this->Words.size(); ++i)
+    {
+        this->Words[i] &= other.Words[i];
+    }
+}
+
+void BitMask::Or(const BitMask& other)
+{
+    CheckSize(other, "Or");
+
+    for(size_t i = 0; i < this->Words.size(); ++i)
+    {
+        this->Words[i] |= other.Words[i];
+    }
+}
+
+void BitMask::AndNot(const BitMask& other)
+{
+    CheckSize(other, "AndNot");
+
+    for(size_t i = 0; i < this->Words.size(); ++i)
+    {
+        this->Words[i] &= ~other.Words[i];
+    }
+}
+
+void BitMask::Invert()
+{
+    for(WordType& word : this->Words)
+    {
+        word = ~word;
+    }
+    ClearPadding();
+}
+
+void BitMask::Dilate(const unsigned int radius)
+{
+    if(this->WordsPerRow == 0)
+    {
+        return;
+    }
+
+    // Past the size of the mask a larger radius sets nothing more
+    const unsigned int horizontalRadius = std::min(radius, this->Width);
+    const unsigned int verticalRadius = std::min(radius, this->Height);
+    const WordType lastWordMask = GetLastWordMask();
+
+    // Each pass ORs every pixel with its left and right neighbors; bit 63 of a word is next to bit 0 of the next one
+    for(unsigned int y = 0; y < this->Height; ++y)
+    {
+        WordType* row = GetRow(y);
+        for(unsigned int pass = 0; pass < horizontalRadius; ++pass)
+        {
+            WordType previous = 0;
+            for(unsigned int w = 0; w < this->WordsPerRow; ++w)
+            {
+                const WordType word = row[w];
+                const WordType next = w + 1 < this->WordsPerRow ? row[w + 1] : 0;
+                row[w] = word | (word << 1) | (previous >> (BitsPerWord - 1)) | (word >> 1) | (next << (BitsPerWord - 1));
+                previous = word;
+            }
+            row[this->WordsPerRow - 1] &= lastWordMask;
+        }
+    }
+
+    // Each pass ORs every row with the rows above and below it; the row above has already been changed, so its
+    // previous words are kept aside
+    std::vector<WordType> previousRow(this->WordsPerRow);
+    std::vector<WordType> currentRow(this->WordsPerRow);
+    for(unsigned int pass = 0; pass < verticalRadius; ++pass)
+    {
+        std::fill(previousRow.begin(), previousRow.end(), 0);
+        for(unsigned int y = 0; y < this->Height; ++y)
+        {
+            WordType* row = GetRow(y);
+            const WordType* nextRow = y + 1 < this->Height ? GetRow(y + 1) : nullptr;
+            std::copy(row, row + this->WordsPerRow, currentRow.begin());
+            for(unsigned int w = 0; w < this->WordsPerRow; ++w)
+            {
+                row[w] |= previousRow[w] | (nextRow ? nextRow[w] : 0);
+            }
+            previousRow.swap(currentRow);
+        }
+    }
+}
+
+void BitMask::Erode(const unsigned int radius)
+{
+    // The cleared pixels grow into the set ones; the padding stays 0, so the outside of the mask grows nothing
+    Invert();
+    Dilate(radius);
+    Invert();
+}
+
+BitMask BitMask::GetBoundary() const
+{
+    BitMask boundary;
+    boundary.SetSize(this->Width, this->Height);
+    if(this->WordsPerRow == 0)
+    {
+        return boundary;
+    }
+
+    // Bit x of a horizontal difference word is pixel x against pixel x + 1; the last pixel of a row has no right
+    // neighbor, so its bit (against the padding) is dropped
+    const unsigned int lastBit = (this->Width - 1) % BitsPerWord;
+    const WordType lastDifferenceMask = GetLastWordMask() & ~(static_cast<WordType>(1) << lastBit);
+    for(unsigned int y = 0; y < this->Height; ++y)
+    {
+        const WordType* row = GetRow(y);
+        const WordType* nextRow = y + 1 < this->Height ? GetRow(y + 1) : nullptr;
+        WordType* boundaryRow = boundary.GetRow(y);
+        WordType* nextBoundaryRow = nextRow ? boundary.GetRow(y + 1) : nullptr;
+        WordType previousDifference = 0;
+        for(unsigned int w = 0; w < this->WordsPerRow; ++w)
+        {
+            const WordType next = w + 1 < this->WordsPerRow ? row[w + 1] : 0;
+            WordType difference = row[w] ^ ((row[w] >> 1) | (next << (BitsPerWord - 1)));
+            if(w + 1 == this->WordsPerRow)
+            {
+                difference &= lastDifferenceMask;
+            }
+
+            // Both pixels of a differing pair are on the boundary
+            boundaryRow[w] |= difference | (difference << 1) | (previousDifference >> (BitsPerWord - 1));
+            previousDifference = difference;
+
+            if(nextRow)
+            {
+                const WordType verticalDifference = row[w] ^ nextRow[w];
+                boundaryRow[w] |= verticalDifference;
+                nextBoundaryRow[w] |= verticalDifference;
+            }
+        }
+    }
+
+    return boundary;
+}
+
+void BitMask::GetOffsets(const bool value, std::vector<unsigned int>& offsets) const
+{
+    const size_t numberOfSetPixels = Count();
+    offsets.clear();
+    offsets.reserve(value ? numberOfSetPixels : static_cast<size_t>(this->Width) * this->Height - numberOfSetPixels);
+    if(this->WordsPerRow == 0)
+    {
+        return;
+    }
+
+    const WordType lastWordMask = GetLastWordMask();
+    for(unsigned int y = 0; y < this->Height; ++y)
+    {
+        const WordType* row = GetRow(y);
+        const unsigned int rowOffset = y * this->Width;
+        for(unsigned int w = 0; w < this->WordsPerRow; ++w)
+        {
+            WordType bits = value ? row[w] : ~row[w];
+            if(w + 1 == this->WordsPerRow)
+            {
+                bits &= lastWordMask;
+            }
+            for(; bits != 0; bits &= bits - 1)
+            {
+                offsets.push_back(rowOffset + w * BitsPerWord + GetLowestBit(bits));
+            }
+        }
+    }
+}
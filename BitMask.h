@@ -0,0 +1,272 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BitMask_H
+#define BitMask_H
+
+// Submodules
+#include "Mask/ForegroundBackgroundSegmentMask.h"
+
+// STL
+#include <cstddef>
+#include <vector>
+
+/** A binary image packed one bit per pixel, 64 pixels to a word. Pixel (x, y) is bit x % 64 of word x / 64 of row y;
+  * every row starts at a new word and the bits past the end of a row are always 0. The set operations, the counts and
+  * the morphology work on whole words, so a mask of the whole image is read in a 32nd of the memory traffic of a
+  * ForegroundBackgroundSegmentMask (4 bytes per pixel). GrabCut keeps its labels and hard constraints as BitMasks and
+  * only converts from and to ForegroundBackgroundSegmentMask at its interface. */
+class BitMask
+{
+public:
+    /** The type of the words the bits are packed into. */
+    typedef unsigned long long WordType;
+
+    /** The number of pixels per word. */
+    static const unsigned int BitsPerWord = 64;
+
+    /** Set the size of the mask, with every pixel cleared. */
+    void SetSize(const unsigned int width, const unsigned int height);
+
+    /** Get the size of the mask. */
+    unsigned int GetWidth() const
+    {
+        return this->Width;
+    }
+    unsigned int GetHeight() const
+    {
+        return this->Height;
+    }
+
+    /** Get the number of words of each row. */
+    unsigned int GetWordsPerRow() const
+    {
+        return this->WordsPerRow;
+    }
+
+    /** Get the number of bytes of the bits. */
+    size_t GetNumberOfBytes() const
+    {
+        return this->Words.size() * sizeof(WordType);
+    }
+
+    /** Set every pixel (true) or clear every pixel (false). */
+    void Fill(const bool value);
+
+    /** Get whether pixel (x, y) is set. */
+    bool Get(const unsigned int x, const unsigned int y) const
+    {
+        return (this->Words[y * this->WordsPerRow + x / BitsPerWord] >> (x % BitsPerWord)) & 1;
+    }
+
+    /** Set (true) or clear (false) pixel (x, y). */
+    void Set(const unsigned int x, const unsigned int y, const bool value)
+    {
+        WordType& word = this->Words[y * this->WordsPerRow + x / BitsPerWord];
+        const WordType bit = static_cast<WordType>(1) << (x % BitsPerWord);
+        word = value ? word | bit : word & ~bit;
+    }
+
+    /** Get the words of a row. The bits past the end of the row must be left 0. */
+    WordType* GetRow(const unsigned int y)
+    {
+        return this->Words.data() + static_cast<size_t>(y) * this->WordsPerRow;
+    }
+    const WordType* GetRow(const unsigned int y) const
+    {
+        return this->Words.data() + static_cast<size_t>(y) * this->WordsPerRow;
+    }
+
+    /** Take the size of a mask, and set the pixels that have a value in it and clear the others. */
+    void FromMask(const ForegroundBackgroundSegmentMask* const mask, const ForegroundBackgroundSegmentMaskPixelTypeEnum value);
+
+    /** Make a new mask of the same size, with the set pixels FOREGROUND and the others BACKGROUND. */
+    ForegroundBackgroundSegmentMask::Pointer ToMask() const;
+
+    /** Count the set pixels. */
+    size_t Count() const;
+
+    /** Count the pixels that differ from those of a mask of the same size. */
+    size_t CountDifferences(const BitMask& other) const;
+
+    /** Keep the pixels that are set in both masks. */
+    void And(const BitMask& other);
+
+    /** Set the pixels that are set in either mask. */
+    void Or(const BitMask& other);
+
+    /** Clear the pixels that are set in another mask. */
+    void AndNot(const BitMask& other);
+
+    /** Set the cleared pixels and clear the set ones. */
+    void Invert();
+
+    /** Set every pixel within a chessboard distance of radius of a set pixel (a dilation by a square of 2 * radius + 1
+      * pixels across). The square is separable, so the rows are dilated with shifts of whole words and then OR'ed with
+      * their vertical neighbors. */
+    void Dilate(const unsigned int radius);
+
+    /** Clear every pixel within a chessboard distance of radius of a cleared pixel. Pixels outside of the mask do not
+      * clear anything. */
+    void Erode(const unsigned int radius);
+
+    /** Get the pixels that differ from one of their 4 neighbors: both sides of every boundary between set and cleared
+      * pixels. */
+    BitMask GetBoundary() const;
+
+    /** Fill the offsets (y * width + x) of the pixels that are set (true) or cleared (false), in row-major order. */
+    void GetOffsets(const bool value, std::vector<unsigned int>& offsets) const;
+
+    /** Call function(offset) for the offset (y * width + x) of every set pixel, in row-major order. */
+    template <typename TFunction>
+    void ForEachSetBit(const TFunction& function) const;
+
+    /** Call function(offset) for the offset (y * width + x) of every pixel that differs from its neighbor
+      * (x + neighborX, y + neighborY), where neighborX is -1, 0 or 1 and neighborY is 0 or 1, and the neighbor is in the
+      * mask. A word of pixels is compared with a word of neighbors at once. */
+    template <typename TFunction>
+    void ForEachDifferentNeighbor(const int neighborX, const unsigned int neighborY, const TFunction& function) const;
+
+    /** Count the set bits of a word. */
+    static unsigned int CountBits(const WordType word)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(word);
+#else
+        unsigned int count = 0;
+        for(WordType bits = word; bits != 0; bits &= bits - 1)
+        {
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    /** Get whether the mask has no pixels. */
+    bool IsEmpty() const
+    {
+        return this->Words.empty();
+    }
+
+    /** Get the index of the lowest set bit of a word, which must not be 0. */
+    static unsigned int GetLowestBit(const WordType word)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(word);
+#else
+        unsigned int bit = 0;
+        while(!((word >> bit) & 1))
+        {
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+protected:
+
+    /** Get the bits of the last word of a row that are in the row. */
+    WordType GetLastWordMask() const
+    {
+        const unsigned int usedBits = this->Width - (this->WordsPerRow - 1) * BitsPerWord;
+        return usedBits == BitsPerWord ? ~static_cast<WordType>(0) : (static_cast<WordType>(1) << usedBits) - 1;
+    }
+
+    /** Clear the bits past the end of every row. */
+    void ClearPadding();
+
+    /** Throw unless another mask has the same size. */
+    void CheckSize(const BitMask& other, const char* const method) const;
+
+    /** The size of the mask. */
+    unsigned int Width = 0;
+    unsigned int Height = 0;
+
+    /** The number of words of each row. */
+    unsigned int WordsPerRow = 0;
+
+    /** The bits, row after row. */
+    std::vector<WordType> Words;
+};
+
+template <typename TFunction>
+void BitMask::ForEachSetBit(const TFunction& function) const
+{
+    for(unsigned int y = 0; y < this->Height; ++y)
+    {
+        const WordType* row = GetRow(y);
+        const unsigned int rowOffset = y * this->Width;
+        for(unsigned int w = 0; w < this->WordsPerRow; ++w)
+        {
+            for(WordType bits = row[w]; bits != 0; bits &= bits - 1)
+            {
+                function(rowOffset + w * BitsPerWord + GetLowestBit(bits));
+            }
+        }
+    }
+}
+
+template <typename TFunction>
+void BitMask::ForEachDifferentNeighbor(const int neighborX, const unsigned int neighborY, const TFunction& function) const
+{
+    if(this->WordsPerRow == 0 || neighborY >= this->Height)
+    {
+        return;
+    }
+
+    // The first (last) pixel of a row has no left (right) neighbor
+    const WordType lastWordMask = GetLastWordMask();
+    const WordType lastBit = static_cast<WordType>(1) << ((this->Width - 1) % BitsPerWord);
+    const WordType firstWordMask = neighborX < 0 ? ~static_cast<WordType>(1) : ~static_cast<WordType>(0);
+    const WordType lastNeighborMask = neighborX > 0 ? lastWordMask & ~lastBit : lastWordMask;
+
+    for(unsigned int y = 0; y + neighborY < this->Height; ++y)
+    {
+        const WordType* row = GetRow(y);
+        const WordType* neighborRow = GetRow(y + neighborY);
+        const unsigned int rowOffset = y * this->Width;
+        for(unsigned int w = 0; w < this->WordsPerRow; ++w)
+        {
+            // Bit x of the neighbors is pixel x + neighborX of the neighbor row
+            WordType neighbors = neighborRow[w];
+            if(neighborX > 0)
+            {
+                neighbors = (neighbors >> 1) | (w + 1 < this->WordsPerRow ? neighborRow[w + 1] << (BitsPerWord - 1) : 0);
+            }
+            else if(neighborX < 0)
+            {
+                neighbors = (neighbors << 1) | (w > 0 ? neighborRow[w - 1] >> (BitsPerWord - 1) : 0);
+            }
+
+            WordType bits = row[w] ^ neighbors;
+            if(w == 0)
+            {
+                bits &= firstWordMask;
+            }
+            if(w + 1 == this->WordsPerRow)
+            {
+                bits &= lastNeighborMask;
+            }
+            for(; bits != 0; bits &= bits - 1)
+            {
+                function(rowOffset + w * BitsPerWord + GetLowestBit(bits));
+            }
+        }
+    }
+}
+
+#endif
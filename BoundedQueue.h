@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BoundedQueue_H
+#define BoundedQueue_H
+
+// STL
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/** A queue between the stages of a pipeline, shared by any number of producer and consumer threads.
+  * It holds a bounded number of items: Push() waits while the queue is full, so a slow stage holds back the stages that
+  * feed it instead of letting the items pile up in memory (unlike SnapshotWriter, nothing is ever dropped).
+  * Once every producer is done, Close() lets the consumers drain the queue and then stop. */
+template <typename T>
+class BoundedQueue
+{
+public:
+    /** At most capacity items wait in the queue. */
+    BoundedQueue(const unsigned int capacity);
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /** Add an item, waiting while the queue is full. Returns false (and drops the item) if the queue was closed. */
+    bool Push(T item);
+
+    /** Take the oldest item, waiting while the queue is empty. Returns false once the queue is closed and empty. */
+    bool Pop(T& item);
+
+    /** Stop accepting items; Pop() returns the remaining ones and then false. */
+    void Close();
+
+    /** Get the largest number of items that waited in the queue at once. */
+    unsigned int GetMaximumSize();
+
+protected:
+
+    /** The maximum number of waiting items. */
+    unsigned int Capacity;
+
+    /** The waiting items. */
+    std::deque<T> Items;
+
+    /** Whether Close() was called. */
+    bool Closed = false;
+
+    /** The largest size the queue had. */
+    unsigned int MaximumSize = 0;
+
+    /** Guards everything above. */
+    std::mutex Mutex;
+
+    /** Signalled when an item is added or the queue is closed. */
+    std::condition_variable NotEmpty;
+
+    /** Signalled when an item is taken or the queue is closed. */
+    std::condition_variable NotFull;
+};
+
+#include "BoundedQueue.hpp"
+
+#endif
@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BoundedQueue_HPP
+#define BoundedQueue_HPP
+
+#include "BoundedQueue.h"
+
+// STL
+#include <algorithm>
+#include <utility>
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(const unsigned int capacity) : Capacity(capacity > 0 ? capacity : 1)
+{
+}
+
+template <typename T>
+bool BoundedQueue<T>::Push(T item)
+{
+    {
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        this->NotFull.wait(lock, [this]() { return this->Items.size() < this->Capacity || this->Closed; });
+        if(this->Closed)
+        {
+            return false;
+        }
+        this->Items.push_back(std::move(item));
+        this->MaximumSize = std::max<unsigned int>(this->MaximumSize, this->Items.size());
+    }
+    this->NotEmpty.notify_one();
+    return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::Pop(T& item)
+{
+    {
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        this->NotEmpty.wait(lock, [this]() { return !this->Items.empty() || this->Closed; });
+        if(this->Items.empty())
+        {
+            return false; // Closed, and every item has been taken
+        }
+        item = std::move(this->Items.front());
+        this->Items.pop_front();
+    }
+    this->NotFull.notify_one();
+    return true;
+}
+
+template <typename T>
+void BoundedQueue<T>::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Closed = true;
+    }
+    this->NotEmpty.notify_all();
+    this->NotFull.notify_all();
+}
+
+template <typename T>
+unsigned int BoundedQueue<T>::GetMaximumSize()
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    return this->MaximumSize;
+}
+
+#endif
@@ -0,0 +1,150 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ColorLikelihoodLookupTable.h"
+
+// STL
+#include <algorithm>
+#include <stdexcept>
+
+ColorLikelihoodLookupTable::ColorLikelihoodLookupTable()
+{
+    // With no colors, every (r,g) range is empty
+    this->RedGreenOffsets.resize(256 * 256 + 1, 0);
+}
+
+void ColorLikelihoodLookupTable::SetMode(const LikelihoodCacheModeEnum mode)
+{
+    if(mode == LikelihoodCacheModeEnum::NONE)
+    {
+        throw std::runtime_error("ColorLikelihoodLookupTable::SetMode: the table must be QUANTIZED or EXACT!");
+    }
+
+    if(mode != this->Mode)
+    {
+        this->Mode = mode;
+        this->Valid = false;
+    }
+}
+
+void ColorLikelihoodLookupTable::SetBitsPerChannel(const unsigned int bitsPerChannel)
+{
+    if(bitsPerChannel < 1 || bitsPerChannel > 8)
+    {
+        throw std::runtime_error("ColorLikelihoodLookupTable::SetBitsPerChannel: bits per channel must be between 1 and 8!");
+    }
+
+    if(bitsPerChannel != this->BitsPerChannel)
+    {
+        this->BitsPerChannel = bitsPerChannel;
+        this->Valid = false;
+    }
+}
+
+void ColorLikelihoodLookupTable::SetColors(std::vector<unsigned int> colors)
+{
+    std::sort(colors.begin(), colors.end());
+    colors.erase(std::unique(colors.begin(), colors.end()), colors.end());
+
+    this->Blues.resize(colors.size());
+    std::fill(this->RedGreenOffsets.begin(), this->RedGreenOffsets.end(), 0);
+
+    // Count the colors of each (r,g) pair, then turn the counts into start offsets
+    for(unsigned int i = 0; i < colors.size(); ++i)
+    {
+        this->Blues[i] = colors[i] & 0xFF;
+        this->RedGreenOffsets[((colors[i] >> 8) & 0xFFFF) + 1]++;
+    }
+
+    for(unsigned int redGreen = 0; redGreen < 256 * 256; ++redGreen)
+    {
+        this->RedGreenOffsets[redGreen + 1] += this->RedGreenOffsets[redGreen];
+    }
+
+    this->ExactColors.swap(colors);
+    this->Valid = false;
+}
+
+void ColorLikelihoodLookupTable::Build(const GaussianMixtureBatchEvaluator& foregroundEvaluator,
+                                       const GaussianMixtureBatchEvaluator& backgroundEvaluator)
+{
+    this->ForegroundEvaluator = &foregroundEvaluator;
+    this->BackgroundEvaluator = &backgroundEvaluator;
+
+    // Lay the colors of all entries out as planar buffers so both models are evaluated in one vectorized pass each
+    std::vector<float> red;
+    std::vector<float> green;
+    std::vector<float> blue;
+
+    if(this->Mode == LikelihoodCacheModeEnum::QUANTIZED)
+    {
+        const unsigned int binsPerChannel = 1u << this->BitsPerChannel;
+        const unsigned int shift = 8 - this->BitsPerChannel;
+
+        // Evaluate each cell at its center so the quantization error is at most half a cell in each channel
+        const float halfCell = ((1u << shift) - 1) / 2.0f;
+
+        const unsigned int numberOfEntries = binsPerChannel * binsPerChannel * binsPerChannel;
+        red.resize(numberOfEntries);
+        green.resize(numberOfEntries);
+        blue.resize(numberOfEntries);
+
+        unsigned int entry = 0;
+        for(unsigned int r = 0; r < binsPerChannel; ++r)
+        {
+            for(unsigned int g = 0; g < binsPerChannel; ++g)
+            {
+                for(unsigned int b = 0; b < binsPerChannel; ++b)
+                {
+                    red[entry] = (r << shift) + halfCell;
+                    green[entry] = (g << shift) + halfCell;
+                    blue[entry] = (b << shift) + halfCell;
+                    entry++;
+                }
+            }
+        }
+    }
+    else
+    {
+        red.resize(this->ExactColors.size());
+        green.resize(this->ExactColors.size());
+        blue.resize(this->ExactColors.size());
+
+        for(unsigned int entry = 0; entry < this->ExactColors.size(); ++entry)
+        {
+            const unsigned int color = this->ExactColors[entry];
+            red[entry] = (color >> 16) & 0xFF;
+            green[entry] = (color >> 8) & 0xFF;
+            blue[entry] = color & 0xFF;
+        }
+    }
+
+    const unsigned int numberOfEntries = red.size();
+    std::vector<float> foregroundCosts(numberOfEntries);
+    std::vector<float> backgroundCosts(numberOfEntries);
+    foregroundEvaluator.EvaluateNegativeLogLikelihood(red.data(), green.data(), blue.data(), numberOfEntries, foregroundCosts.data());
+    backgroundEvaluator.EvaluateNegativeLogLikelihood(red.data(), green.data(), blue.data(), numberOfEntries, backgroundCosts.data());
+
+    this->Costs.resize(2 * numberOfEntries);
+    for(unsigned int entry = 0; entry < numberOfEntries; ++entry)
+    {
+        this->Costs[2 * entry] = foregroundCosts[entry];
+        this->Costs[2 * entry + 1] = backgroundCosts[entry];
+    }
+
+    this->Valid = true;
+}
@@ -0,0 +1,177 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ColorLikelihoodLookupTable_H
+#define ColorLikelihoodLookupTable_H
+
+// STL
+#include <vector>
+
+#include "GaussianMixtureBatchEvaluator.h"
+
+/** How the foreground/background likelihoods of 8-bit RGB colors are cached between EM fits.
+  * NONE evaluates the mixture models for every pixel.
+  * QUANTIZED evaluates the models once per cell of a color cube with a configurable number of bits per channel.
+  * EXACT evaluates the models once per distinct color that occurs in the image. */
+enum class LikelihoodCacheModeEnum { NONE, QUANTIZED, EXACT };
+
+/** A table of foreground and background data costs (negative log-likelihoods) indexed by 8-bit RGB color.
+  * The table is rebuilt from the mixture models after every EM fit, after which a cost
+  * query is a table read instead of a full mixture model evaluation. */
+class ColorLikelihoodLookupTable
+{
+public:
+    /** Constructor */
+    ColorLikelihoodLookupTable();
+
+    /** Choose between a quantized color cube and the exact set of colors from SetColors(). NONE is not valid here. */
+    void SetMode(const LikelihoodCacheModeEnum mode);
+
+    /** Get the current mode. */
+    LikelihoodCacheModeEnum GetMode() const
+    {
+        return this->Mode;
+    }
+
+    /** Set how many of the most significant bits of each channel are kept in QUANTIZED mode (1 to 8). */
+    void SetBitsPerChannel(const unsigned int bitsPerChannel);
+
+    /** Get the number of bits per channel used in QUANTIZED mode. */
+    unsigned int GetBitsPerChannel() const
+    {
+        return this->BitsPerChannel;
+    }
+
+    /** Provide the colors (packed as 0xRRGGBB) for which EXACT mode should hold an entry. Duplicates are allowed. */
+    void SetColors(std::vector<unsigned int> colors);
+
+    /** Get the number of distinct colors provided to SetColors(). */
+    unsigned int GetNumberOfColors() const
+    {
+        return this->Blues.size();
+    }
+
+    /** Evaluate both mixture models for every entry of the table. The evaluators must outlive the table or the next Build(). */
+    void Build(const GaussianMixtureBatchEvaluator& foregroundEvaluator, const GaussianMixtureBatchEvaluator& backgroundEvaluator);
+
+    /** Determine if Build() has been called since the last change of mode, bits or colors. */
+    bool IsValid() const
+    {
+        return this->Valid;
+    }
+
+    /** Get the number of entries that were evaluated by the last Build(). */
+    unsigned int GetNumberOfEntries() const
+    {
+        return this->Costs.size() / 2;
+    }
+
+    /** Get the number of bytes of the table (the costs and, in EXACT mode, the colors they belong to). */
+    size_t GetNumberOfBytes() const
+    {
+        return this->Costs.size() * sizeof(float) + this->RedGreenOffsets.size() * sizeof(unsigned int) +
+               this->Blues.size() * sizeof(unsigned char) + this->ExactColors.size() * sizeof(unsigned int);
+    }
+
+    /** Look up the foreground cost of a color. */
+    float GetForegroundCost(const unsigned char r, const unsigned char g, const unsigned char b) const
+    {
+        const unsigned int entry = this->GetEntry(r, g, b);
+        if(entry < this->Blues.size() || this->Mode == LikelihoodCacheModeEnum::QUANTIZED)
+        {
+            return this->Costs[2 * entry];
+        }
+        return this->ForegroundEvaluator->EvaluateNegativeLogLikelihood(r, g, b);
+    }
+
+    /** Look up the background cost of a color. */
+    float GetBackgroundCost(const unsigned char r, const unsigned char g, const unsigned char b) const
+    {
+        const unsigned int entry = this->GetEntry(r, g, b);
+        if(entry < this->Blues.size() || this->Mode == LikelihoodCacheModeEnum::QUANTIZED)
+        {
+            return this->Costs[2 * entry + 1];
+        }
+        return this->BackgroundEvaluator->EvaluateNegativeLogLikelihood(r, g, b);
+    }
+
+protected:
+
+    /** Find the table entry of a color. In EXACT mode a color that was not provided to SetColors()
+      * returns the number of colors, in which case the lookup falls back to evaluating the models. */
+    unsigned int GetEntry(const unsigned char r, const unsigned char g, const unsigned char b) const
+    {
+        if(this->Mode == LikelihoodCacheModeEnum::QUANTIZED)
+        {
+            const unsigned int shift = 8 - this->BitsPerChannel;
+            return ((static_cast<unsigned int>(r >> shift) << (2 * this->BitsPerChannel)) |
+                    (static_cast<unsigned int>(g >> shift) << this->BitsPerChannel) |
+                    static_cast<unsigned int>(b >> shift));
+        }
+
+        // EXACT: the colors are sorted, so all colors sharing (r,g) are a contiguous range of blue values
+        const unsigned int redGreen = (static_cast<unsigned int>(r) << 8) | g;
+        unsigned int first = this->RedGreenOffsets[redGreen];
+        unsigned int last = this->RedGreenOffsets[redGreen + 1];
+        while(first < last)
+        {
+            const unsigned int middle = (first + last) / 2;
+            if(this->Blues[middle] < b)
+            {
+                first = middle + 1;
+            }
+            else
+            {
+                last = middle;
+            }
+        }
+
+        if(first < this->RedGreenOffsets[redGreen + 1] && this->Blues[first] == b)
+        {
+            return first;
+        }
+
+        return this->Blues.size();
+    }
+
+    /** The caching mode. */
+    LikelihoodCacheModeEnum Mode = LikelihoodCacheModeEnum::QUANTIZED;
+
+    /** The number of bits per channel in QUANTIZED mode. */
+    unsigned int BitsPerChannel = 5;
+
+    /** Interleaved (foreground, background) cost pairs, one pair per entry. */
+    std::vector<float> Costs;
+
+    /** For every (r << 8 | g) the first index into Blues with that red/green, plus one final end offset (EXACT mode). */
+    std::vector<unsigned int> RedGreenOffsets;
+
+    /** The blue value of every distinct color, sorted by packed color (EXACT mode). */
+    std::vector<unsigned char> Blues;
+
+    /** The distinct packed colors, in the same order as Blues (EXACT mode). */
+    std::vector<unsigned int> ExactColors;
+
+    /** The evaluators the table was built from, used for colors missing from the table in EXACT mode. */
+    const GaussianMixtureBatchEvaluator* ForegroundEvaluator = nullptr;
+    const GaussianMixtureBatchEvaluator* BackgroundEvaluator = nullptr;
+
+    /** Whether the costs match the current mode, bits and colors. */
+    bool Valid = false;
+};
+
+#endif
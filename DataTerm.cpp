@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DataTerm.h"
+
+// STL
+#include <algorithm>
+#include <stdexcept>
+
+void PrecomputedDataTerm::SetCostImages(CostImageType* const foregroundCosts, CostImageType* const backgroundCosts)
+{
+    if(foregroundCosts->GetLargestPossibleRegion() != backgroundCosts->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("PrecomputedDataTerm::SetCostImages: the cost images must have the same region!");
+    }
+
+    this->ForegroundCosts = foregroundCosts;
+    this->BackgroundCosts = backgroundCosts;
+}
+
+void PrecomputedDataTerm::ComputeCosts(const itk::ImageRegion<2>& region, float* foregroundCosts, float* backgroundCosts)
+{
+    const itk::ImageRegion<2> costRegion = this->ForegroundCosts->GetBufferedRegion();
+    if(!costRegion.IsInside(region))
+    {
+        throw std::runtime_error("PrecomputedDataTerm::ComputeCosts: the requested region is outside of the cost images!");
+    }
+
+    const unsigned int costWidth = costRegion.GetSize()[0];
+    const unsigned int width = region.GetSize()[0];
+    const unsigned int height = region.GetSize()[1];
+    const float* foreground = this->ForegroundCosts->GetBufferPointer();
+    const float* background = this->BackgroundCosts->GetBufferPointer();
+
+    for(unsigned int row = 0; row < height; ++row)
+    {
+        const unsigned int offset = (region.GetIndex()[1] - costRegion.GetIndex()[1] + row) * costWidth +
+                                    (region.GetIndex()[0] - costRegion.GetIndex()[0]);
+        std::copy(foreground + offset, foreground + offset + width, foregroundCosts + row * width);
+        std::copy(background + offset, background + offset + width, backgroundCosts + row * width);
+    }
+}
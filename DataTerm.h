@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DataTerm_H
+#define DataTerm_H
+
+// ITK
+#include "itkImage.h"
+
+/** Supplies the cost of labeling each pixel foreground or background.
+  * The graph cut asks for the costs of a whole region in one call, so implementations can fill
+  * them in bulk (vectorized, from a table, or by copying) rather than being called once per pixel. */
+class DataTerm
+{
+public:
+    /** The type of a precomputed cost image. */
+    typedef itk::Image<float, 2> CostImageType;
+
+    virtual ~DataTerm() {}
+
+    /** Fill the costs of every pixel of a region. Both outputs are row-major with the region's width as the row stride.
+      * Costs are typically negative log-likelihoods and must be finite. */
+    virtual void ComputeCosts(const itk::ImageRegion<2>& region, float* foregroundCosts, float* backgroundCosts) = 0;
+};
+
+/** A data term that serves costs from images computed ahead of time by the caller. */
+class PrecomputedDataTerm : public DataTerm
+{
+public:
+    /** Provide the cost images. They must cover every region that will be requested, and must outlive this object. */
+    void SetCostImages(CostImageType* const foregroundCosts, CostImageType* const backgroundCosts);
+
+    /** Copy the requested region out of the cost images. */
+    void ComputeCosts(const itk::ImageRegion<2>& region, float* foregroundCosts, float* backgroundCosts);
+
+protected:
+    /** The cost of labeling each pixel foreground. */
+    CostImageType* ForegroundCosts = nullptr;
+
+    /** The cost of labeling each pixel background. */
+    CostImageType* BackgroundCosts = nullptr;
+};
+
+#endif
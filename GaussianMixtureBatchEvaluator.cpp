@@ -0,0 +1,406 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GaussianMixtureBatchEvaluator.h"
+#include "VectorMath.h"
+
+// Submodules
+#include "ExpectationMaximization/Model.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+const float GaussianMixtureBatchEvaluator::MaximumCost = -std::log(std::numeric_limits<float>::min());
+
+GaussianMixtureBatchEvaluator::GaussianMixtureBatchEvaluator()
+{
+    this->InstructionSet = GetBestInstructionSet();
+}
+
+InstructionSetEnum GaussianMixtureBatchEvaluator::GetBestInstructionSet()
+{
+#ifdef GRABCUT_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+    {
+        return InstructionSetEnum::AVX512;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return InstructionSetEnum::AVX2;
+    }
+#endif
+    return InstructionSetEnum::SCALAR;
+}
+
+void GaussianMixtureBatchEvaluator::SetInstructionSet(const InstructionSetEnum instructionSet)
+{
+    const InstructionSetEnum best = GetBestInstructionSet();
+    if(static_cast<int>(instructionSet) > static_cast<int>(best))
+    {
+        throw std::runtime_error("GaussianMixtureBatchEvaluator::SetInstructionSet: the instruction set is not supported by this CPU!");
+    }
+    this->InstructionSet = instructionSet;
+}
+
+void GaussianMixtureBatchEvaluator::SetMixtureModel(const MixtureModel& mixtureModel)
+{
+    const std::vector<Model*> models = mixtureModel.GetModels();
+
+    this->Components.clear();
+    for(unsigned int modelId = 0; modelId < models.size(); ++modelId)
+    {
+        const Model* model = models[modelId];
+        const double weight = model->GetMixingCoefficient();
+        if(!(weight > 0))
+        {
+            continue; // A component that cannot contribute
+        }
+
+        const Eigen::VectorXd mean = model->GetMean();
+        Eigen::MatrixXd covariance = model->GetVariance();
+        if(mean.size() != 3 || covariance.rows() != 3 || covariance.cols() != 3)
+        {
+            throw std::runtime_error("GaussianMixtureBatchEvaluator::SetMixtureModel: only 3 dimensional models are supported!");
+        }
+
+        // A component fit to (nearly) identical colors can have a singular covariance; regularize it just enough to factor it
+        Eigen::LLT<Eigen::MatrixXd> cholesky(covariance);
+        double jitter = 1e-6 * std::max(covariance.trace() / 3.0, 1.0);
+        while(cholesky.info() != Eigen::Success)
+        {
+            covariance += jitter * Eigen::MatrixXd::Identity(3, 3);
+            cholesky.compute(covariance);
+            jitter *= 10;
+        }
+
+        const Eigen::MatrixXd lower = cholesky.matrixL();
+        const Eigen::MatrixXd inverseLower = lower.triangularView<Eigen::Lower>().solve(Eigen::MatrixXd::Identity(3, 3));
+
+        double logDeterminant = 0;
+        for(unsigned int d = 0; d < 3; ++d)
+        {
+            logDeterminant += 2.0 * std::log(lower(d, d));
+        }
+
+        Component component;
+        for(unsigned int d = 0; d < 3; ++d)
+        {
+            component.Mean[d] = mean(d);
+        }
+        component.InverseCholesky[0] = inverseLower(0, 0);
+        component.InverseCholesky[1] = inverseLower(1, 0);
+        component.InverseCholesky[2] = inverseLower(1, 1);
+        component.InverseCholesky[3] = inverseLower(2, 0);
+        component.InverseCholesky[4] = inverseLower(2, 1);
+        component.InverseCholesky[5] = inverseLower(2, 2);
+        component.LogNormalizer = std::log(weight) - 0.5 * (3.0 * std::log(2.0 * M_PI) + logDeterminant);
+
+        this->Components.push_back(component);
+    }
+}
+
+float GaussianMixtureBatchEvaluator::LogWeightedDensity(const Component& component, const float red, const float green, const float blue)
+{
+    const float dx = red - component.Mean[0];
+    const float dy = green - component.Mean[1];
+    const float dz = blue - component.Mean[2];
+    const float* l = component.InverseCholesky;
+    const float y0 = l[0] * dx;
+    const float y1 = l[1] * dx + l[2] * dy;
+    const float y2 = l[3] * dx + l[4] * dy + l[5] * dz;
+    return component.LogNormalizer - 0.5f * (y0 * y0 + y1 * y1 + y2 * y2);
+}
+
+float GaussianMixtureBatchEvaluator::EvaluateLikelihood(const float red, const float green, const float blue) const
+{
+    float likelihood = 0;
+    for(unsigned int componentId = 0; componentId < this->Components.size(); ++componentId)
+    {
+        likelihood += std::exp(LogWeightedDensity(this->Components[componentId], red, green, blue));
+    }
+    return likelihood;
+}
+
+float GaussianMixtureBatchEvaluator::EvaluateNegativeLogLikelihood(const float red, const float green, const float blue) const
+{
+    float maximum = -std::numeric_limits<float>::infinity();
+    for(unsigned int componentId = 0; componentId < this->Components.size(); ++componentId)
+    {
+        maximum = std::max(maximum, LogWeightedDensity(this->Components[componentId], red, green, blue));
+    }
+    if(maximum == -std::numeric_limits<float>::infinity())
+    {
+        return MaximumCost; // No components, or none with a density at this color
+    }
+
+    float sum = 0;
+    for(unsigned int componentId = 0; componentId < this->Components.size(); ++componentId)
+    {
+        sum += std::exp(LogWeightedDensity(this->Components[componentId], red, green, blue) - maximum);
+    }
+
+    return -(maximum + std::log(sum));
+}
+
+void GaussianMixtureBatchEvaluator::EvaluateLikelihood(const float* red, const float* green, const float* blue,
+                                                       const unsigned int numberOfColors, float* likelihoods) const
+{
+    unsigned int done = 0;
+    if(this->InstructionSet == InstructionSetEnum::AVX512)
+    {
+        done = EvaluateLikelihoodAVX512(red, green, blue, numberOfColors, likelihoods);
+    }
+    else if(this->InstructionSet == InstructionSetEnum::AVX2)
+    {
+        done = EvaluateLikelihoodAVX2(red, green, blue, numberOfColors, likelihoods);
+    }
+
+    EvaluateLikelihoodScalar(red + done, green + done, blue + done, numberOfColors - done, likelihoods + done);
+}
+
+void GaussianMixtureBatchEvaluator::EvaluateNegativeLogLikelihood(const float* red, const float* green, const float* blue,
+                                                                  const unsigned int numberOfColors, float* costs) const
+{
+    unsigned int done = 0;
+    if(this->InstructionSet == InstructionSetEnum::AVX512)
+    {
+        done = EvaluateNegativeLogLikelihoodAVX512(red, green, blue, numberOfColors, costs);
+    }
+    else if(this->InstructionSet == InstructionSetEnum::AVX2)
+    {
+        done = EvaluateNegativeLogLikelihoodAVX2(red, green, blue, numberOfColors, costs);
+    }
+
+    EvaluateNegativeLogLikelihoodScalar(red + done, green + done, blue + done, numberOfColors - done, costs + done);
+}
+
+void GaussianMixtureBatchEvaluator::EvaluateLikelihoodScalar(const float* red, const float* green, const float* blue,
+                                                             const unsigned int numberOfColors, float* likelihoods) const
+{
+    for(unsigned int i = 0; i < numberOfColors; ++i)
+    {
+        likelihoods[i] = EvaluateLikelihood(red[i], green[i], blue[i]);
+    }
+}
+
+void GaussianMixtureBatchEvaluator::EvaluateNegativeLogLikelihoodScalar(const float* red, const float* green, const float* blue,
+                                                                        const unsigned int numberOfColors, float* costs) const
+{
+    for(unsigned int i = 0; i < numberOfColors; ++i)
+    {
+        costs[i] = EvaluateNegativeLogLikelihood(red[i], green[i], blue[i]);
+    }
+}
+
+#ifdef GRABCUT_HAVE_X86_KERNELS
+
+// GCC's own AVX-512 headers trip -Wmaybe-uninitialized (their _mm512_undefined_* helpers)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+namespace
+{
+    GRABCUT_TARGET_AVX2 inline __m256 LogWeightedDensityAVX2(const float* mean, const float* l, const float logNormalizer,
+                                                             const __m256 r, const __m256 g, const __m256 b)
+    {
+        const __m256 dx = _mm256_sub_ps(r, _mm256_set1_ps(mean[0]));
+        const __m256 dy = _mm256_sub_ps(g, _mm256_set1_ps(mean[1]));
+        const __m256 dz = _mm256_sub_ps(b, _mm256_set1_ps(mean[2]));
+        const __m256 y0 = _mm256_mul_ps(_mm256_set1_ps(l[0]), dx);
+        const __m256 y1 = _mm256_fmadd_ps(_mm256_set1_ps(l[1]), dx, _mm256_mul_ps(_mm256_set1_ps(l[2]), dy));
+        const __m256 y2 = _mm256_fmadd_ps(_mm256_set1_ps(l[3]), dx,
+                                          _mm256_fmadd_ps(_mm256_set1_ps(l[4]), dy, _mm256_mul_ps(_mm256_set1_ps(l[5]), dz)));
+        const __m256 q = _mm256_fmadd_ps(y0, y0, _mm256_fmadd_ps(y1, y1, _mm256_mul_ps(y2, y2)));
+        return _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), q, _mm256_set1_ps(logNormalizer));
+    }
+
+    GRABCUT_TARGET_AVX512 inline __m512 LogWeightedDensityAVX512(const float* mean, const float* l, const float logNormalizer,
+                                                                 const __m512 r, const __m512 g, const __m512 b)
+    {
+        const __m512 dx = _mm512_sub_ps(r, _mm512_set1_ps(mean[0]));
+        const __m512 dy = _mm512_sub_ps(g, _mm512_set1_ps(mean[1]));
+        const __m512 dz = _mm512_sub_ps(b, _mm512_set1_ps(mean[2]));
+        const __m512 y0 = _mm512_mul_ps(_mm512_set1_ps(l[0]), dx);
+        const __m512 y1 = _mm512_fmadd_ps(_mm512_set1_ps(l[1]), dx, _mm512_mul_ps(_mm512_set1_ps(l[2]), dy));
+        const __m512 y2 = _mm512_fmadd_ps(_mm512_set1_ps(l[3]), dx,
+                                          _mm512_fmadd_ps(_mm512_set1_ps(l[4]), dy, _mm512_mul_ps(_mm512_set1_ps(l[5]), dz)));
+        const __m512 q = _mm512_fmadd_ps(y0, y0, _mm512_fmadd_ps(y1, y1, _mm512_mul_ps(y2, y2)));
+        return _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), q, _mm512_set1_ps(logNormalizer));
+    }
+}
+
+GRABCUT_TARGET_AVX2 unsigned int GaussianMixtureBatchEvaluator::EvaluateLikelihoodAVX2(
+    const float* red, const float* green, const float* blue, const unsigned int numberOfColors, float* likelihoods) const
+{
+    const unsigned int end = numberOfColors - numberOfColors % 8;
+    for(unsigned int i = 0; i < end; i += 8)
+    {
+        const __m256 r = _mm256_loadu_ps(red + i);
+        const __m256 g = _mm256_loadu_ps(green + i);
+        const __m256 b = _mm256_loadu_ps(blue + i);
+
+        __m256 sum = _mm256_setzero_ps();
+        for(unsigned int k = 0; k < this->Components.size(); ++k)
+        {
+            const Component& component = this->Components[k];
+            const __m256 logDensity = LogWeightedDensityAVX2(component.Mean, component.InverseCholesky, component.LogNormalizer, r, g, b);
+            sum = _mm256_add_ps(sum, VectorMath::ExpAVX2(logDensity));
+        }
+        _mm256_storeu_ps(likelihoods + i, sum);
+    }
+    return end;
+}
+
+GRABCUT_TARGET_AVX2 unsigned int GaussianMixtureBatchEvaluator::EvaluateNegativeLogLikelihoodAVX2(
+    const float* red, const float* green, const float* blue, const unsigned int numberOfColors, float* costs) const
+{
+    if(this->Components.empty())
+    {
+        return 0; // The scalar path produces the maximum costs
+    }
+
+    const unsigned int end = numberOfColors - numberOfColors % 8;
+    for(unsigned int i = 0; i < end; i += 8)
+    {
+        const __m256 r = _mm256_loadu_ps(red + i);
+        const __m256 g = _mm256_loadu_ps(green + i);
+        const __m256 b = _mm256_loadu_ps(blue + i);
+
+        // log-sum-exp: the Mahalanobis terms are cheap enough to recompute rather than store
+        const Component& first = this->Components[0];
+        __m256 maximum = LogWeightedDensityAVX2(first.Mean, first.InverseCholesky, first.LogNormalizer, r, g, b);
+        for(unsigned int k = 1; k < this->Components.size(); ++k)
+        {
+            const Component& component = this->Components[k];
+            const __m256 logDensity = LogWeightedDensityAVX2(component.Mean, component.InverseCholesky, component.LogNormalizer, r, g, b);
+            maximum = _mm256_max_ps(maximum, logDensity);
+        }
+
+        __m256 sum = _mm256_setzero_ps();
+        for(unsigned int k = 0; k < this->Components.size(); ++k)
+        {
+            const Component& component = this->Components[k];
+            const __m256 logDensity = LogWeightedDensityAVX2(component.Mean, component.InverseCholesky, component.LogNormalizer, r, g, b);
+            sum = _mm256_add_ps(sum, VectorMath::ExpAVX2(_mm256_sub_ps(logDensity, maximum)));
+        }
+
+        // Where every density is 0 the log-sum-exp is NaN; those colors get the maximum cost, like the scalar path
+        const __m256 logLikelihood = _mm256_add_ps(maximum, VectorMath::LogAVX2(sum));
+        const __m256 noDensity = _mm256_cmp_ps(maximum, _mm256_set1_ps(-std::numeric_limits<float>::infinity()), _CMP_EQ_OQ);
+        _mm256_storeu_ps(costs + i, _mm256_blendv_ps(_mm256_sub_ps(_mm256_setzero_ps(), logLikelihood),
+                                                     _mm256_set1_ps(MaximumCost), noDensity));
+    }
+    return end;
+}
+
+GRABCUT_TARGET_AVX512 unsigned int GaussianMixtureBatchEvaluator::EvaluateLikelihoodAVX512(
+    const float* red, const float* green, const float* blue, const unsigned int numberOfColors, float* likelihoods) const
+{
+    const unsigned int end = numberOfColors - numberOfColors % 16;
+    for(unsigned int i = 0; i < end; i += 16)
+    {
+        const __m512 r = _mm512_loadu_ps(red + i);
+        const __m512 g = _mm512_loadu_ps(green + i);
+        const __m512 b = _mm512_loadu_ps(blue + i);
+
+        __m512 sum = _mm512_setzero_ps();
+        for(unsigned int k = 0; k < this->Components.size(); ++k)
+        {
+            const Component& component = this->Components[k];
+            const __m512 logDensity = LogWeightedDensityAVX512(component.Mean, component.InverseCholesky, component.LogNormalizer, r, g, b);
+            sum = _mm512_add_ps(sum, VectorMath::ExpAVX512(logDensity));
+        }
+        _mm512_storeu_ps(likelihoods + i, sum);
+    }
+    return end;
+}
+
+GRABCUT_TARGET_AVX512 unsigned int GaussianMixtureBatchEvaluator::EvaluateNegativeLogLikelihoodAVX512(
+    const float* red, const float* green, const float* blue, const unsigned int numberOfColors, float* costs) const
+{
+    if(this->Components.empty())
+    {
+        return 0;
+    }
+
+    const unsigned int end = numberOfColors - numberOfColors % 16;
+    for(unsigned int i = 0; i < end; i += 16)
+    {
+        const __m512 r = _mm512_loadu_ps(red + i);
+        const __m512 g = _mm512_loadu_ps(green + i);
+        const __m512 b = _mm512_loadu_ps(blue + i);
+
+        const Component& first = this->Components[0];
+        __m512 maximum = LogWeightedDensityAVX512(first.Mean, first.InverseCholesky, first.LogNormalizer, r, g, b);
+        for(unsigned int k = 1; k < this->Components.size(); ++k)
+        {
+            const Component& component = this->Components[k];
+            const __m512 logDensity = LogWeightedDensityAVX512(component.Mean, component.InverseCholesky, component.LogNormalizer, r, g, b);
+            maximum = _mm512_max_ps(maximum, logDensity);
+        }
+
+        __m512 sum = _mm512_setzero_ps();
+        for(unsigned int k = 0; k < this->Components.size(); ++k)
+        {
+            const Component& component = this->Components[k];
+            const __m512 logDensity = LogWeightedDensityAVX512(component.Mean, component.InverseCholesky, component.LogNormalizer, r, g, b);
+            sum = _mm512_add_ps(sum, VectorMath::ExpAVX512(_mm512_sub_ps(logDensity, maximum)));
+        }
+
+        const __m512 logLikelihood = _mm512_add_ps(maximum, VectorMath::LogAVX512(sum));
+        const __mmask16 noDensity = _mm512_cmp_ps_mask(maximum, _mm512_set1_ps(-std::numeric_limits<float>::infinity()), _CMP_EQ_OQ);
+        _mm512_storeu_ps(costs + i, _mm512_mask_blend_ps(noDensity, _mm512_sub_ps(_mm512_setzero_ps(), logLikelihood),
+                                                         _mm512_set1_ps(MaximumCost)));
+    }
+    return end;
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+unsigned int GaussianMixtureBatchEvaluator::EvaluateLikelihoodAVX2(const float*, const float*, const float*,
+                                                                   const unsigned int, float*) const
+{
+    return 0;
+}
+
+unsigned int GaussianMixtureBatchEvaluator::EvaluateNegativeLogLikelihoodAVX2(const float*, const float*, const float*,
+                                                                              const unsigned int, float*) const
+{
+    return 0;
+}
+
+unsigned int GaussianMixtureBatchEvaluator::EvaluateLikelihoodAVX512(const float*, const float*, const float*,
+                                                                     const unsigned int, float*) const
+{
+    return 0;
+}
+
+unsigned int GaussianMixtureBatchEvaluator::EvaluateNegativeLogLikelihoodAVX512(const float*, const float*, const float*,
+                                                                                const unsigned int, float*) const
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GaussianMixtureBatchEvaluator_H
+#define GaussianMixtureBatchEvaluator_H
+
+// STL
+#include <vector>
+
+// Submodules
+#include "ExpectationMaximization/MixtureModel.h"
+
+/** The instruction sets the batch evaluator can run on. */
+enum class InstructionSetEnum { SCALAR, AVX2, AVX512 };
+
+/** Evaluate a 3D Gaussian mixture model for many colors at once.
+  * The per-component Cholesky factors, inverses and log-normalizers are derived once in SetMixtureModel(),
+  * and the colors are passed as planar (structure-of-arrays) red/green/blue buffers so that 8 (AVX2) or
+  * 16 (AVX-512) colors are evaluated per instruction. The instruction set is chosen at runtime. */
+class GaussianMixtureBatchEvaluator
+{
+public:
+    /** Constructor. Selects the best instruction set supported by this CPU. */
+    GaussianMixtureBatchEvaluator();
+
+    /** Precompute the per-component terms of a 3 dimensional mixture model. */
+    void SetMixtureModel(const MixtureModel& mixtureModel);
+
+    /** Get the number of components with a non-zero mixing coefficient. */
+    unsigned int GetNumberOfComponents() const
+    {
+        return this->Components.size();
+    }
+
+    /** Force an instruction set. Requesting one that the CPU does not support throws. */
+    void SetInstructionSet(const InstructionSetEnum instructionSet);
+
+    /** Get the instruction set that Evaluate* will use. */
+    InstructionSetEnum GetInstructionSet() const
+    {
+        return this->InstructionSet;
+    }
+
+    /** Get the best instruction set supported by this CPU. */
+    static InstructionSetEnum GetBestInstructionSet();
+
+    /** Compute the weighted likelihood sum_k w_k N(x; mu_k, Sigma_k) of each color. */
+    void EvaluateLikelihood(const float* red, const float* green, const float* blue,
+                            const unsigned int numberOfColors, float* likelihoods) const;
+
+    /** Compute -log(sum_k w_k N(x; mu_k, Sigma_k)) of each color. This is evaluated with a log-sum-exp,
+      * so it stays finite for colors far from every component, where the likelihood itself underflows. A color that no
+      * component can explain at all (every component was dropped, or every density is 0) costs MaximumCost. */
+    void EvaluateNegativeLogLikelihood(const float* red, const float* green, const float* blue,
+                                       const unsigned int numberOfColors, float* costs) const;
+
+    /** Compute the weighted likelihood of a single color. */
+    float EvaluateLikelihood(const float red, const float green, const float blue) const;
+
+    /** Compute the negative log-likelihood of a single color. */
+    float EvaluateNegativeLogLikelihood(const float red, const float green, const float blue) const;
+
+    /** The cost of a color of zero likelihood: -log(FLT_MIN), as when the likelihood is clamped to the smallest float.
+      * The costs become graph capacities, so they must never be infinite. */
+    static const float MaximumCost;
+
+protected:
+
+    /** The precomputed terms of one component. The Mahalanobis distance is |L^-1 (x - mu)|^2
+      * with the lower triangular L^-1 stored row by row. */
+    struct Component
+    {
+        float Mean[3];
+        float InverseCholesky[6]; // l00, l10, l11, l20, l21, l22
+        float LogNormalizer; // log(w) - 0.5 * (3 log(2 pi) + log|Sigma|)
+    };
+
+    /** The components with a non-zero mixing coefficient. */
+    std::vector<Component> Components;
+
+    /** The instruction set to evaluate with. */
+    InstructionSetEnum InstructionSet;
+
+    /** Compute log(w_k N(x)) of one color for one component. */
+    static float LogWeightedDensity(const Component& component, const float red, const float green, const float blue);
+
+    /** The scalar kernels, also used for the colors left over after the last full vector. */
+    void EvaluateLikelihoodScalar(const float* red, const float* green, const float* blue,
+                                  const unsigned int numberOfColors, float* likelihoods) const;
+    void EvaluateNegativeLogLikelihoodScalar(const float* red, const float* green, const float* blue,
+                                             const unsigned int numberOfColors, float* costs) const;
+
+    /** The vector kernels. Each returns the number of colors it handled (a multiple of the vector width). */
+    unsigned int EvaluateLikelihoodAVX2(const float* red, const float* green, const float* blue,
+                                        const unsigned int numberOfColors, float* likelihoods) const;
+    unsigned int EvaluateNegativeLogLikelihoodAVX2(const float* red, const float* green, const float* blue,
+                                                   const unsigned int numberOfColors, float* costs) const;
+    unsigned int EvaluateLikelihoodAVX512(const float* red, const float* green, const float* blue,
+                                          const unsigned int numberOfColors, float* likelihoods) const;
+    unsigned int EvaluateNegativeLogLikelihoodAVX512(const float* red, const float* green, const float* blue,
+                                                     const unsigned int numberOfColors, float* costs) const;
+};
+
+#endif
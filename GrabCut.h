@@ -20,12 +20,26 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 // Submodules
 #include "Mask/ForegroundBackgroundSegmentMask.h"
-#include "ImageGraphCutSegmentation/ImageGraphCut.h"
+
+#include "BatchImageGraphCut.h"
+#include "BitMask.h"
+#include "DataTerm.h"
+#include "SmoothnessTerm.h"
+#include "SnapshotWriter.h"
+#include "Superpixels.h"
+#include "TaskGraph.h"
 
 // ITK
 #include "itkImage.h"
 
 // STL
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
 #include <vector>
 
 // Eigen
@@ -33,9 +47,41 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "ExpectationMaximization/MixtureModel.h"
 
-/** Perform GrabCut segmentation on an image.  */
+#include "ColorLikelihoodLookupTable.h"
+#include "GaussianMixtureBatchEvaluator.h"
+#include "HardAssignmentMixture.h"
+#include "ParallelExpectationMaximization.h"
+
+/** How the channels of an external image buffer are laid out: all channels of a pixel together (RGBRGB...), or one
+  * plane per channel (RR...GG...BB...). */
+enum class ChannelLayoutEnum { INTERLEAVED, PLANAR };
+
+/** Why PerformSegmentation() stopped iterating. ENERGY_INCREASED means the energy rose instead of decreasing, which
+  * approximate model fits (a subsample, superpixels) can cause; the iterations stop since they no longer improve it. */
+enum class StopReasonEnum { NOT_RUN, MAX_ITERATIONS, ENERGY_CONVERGED, ENERGY_INCREASED, MASK_CONVERGED };
+
+/** How the mixture models are fitted to the pixels of their label each iteration: by EM, where every pixel belongs to
+  * every component in proportion to its likelihood, or by hard assignment, as in the GrabCut paper, where every pixel
+  * belongs to its most likely component only. */
+enum class MixtureFittingEnum { EXPECTATION_MAXIMIZATION, HARD_ASSIGNMENT };
+
+/** The parts of a segmentation that are timed separately: counting the pixels of each label, packing their colors into
+  * the matrix of their label, the two EM fits or the hard assignment of the pixels to components, the likelihood
+  * update, the graph construction (n-links, constraints and t-links), the max flow, writing the labels back into a
+  * mask, and the energy of the cut. */
+enum class GrabCutStageEnum { MASK_SCAN, MATRIX_PACKING, FOREGROUND_EM, BACKGROUND_EM, COMPONENT_ASSIGNMENT,
+                              LIKELIHOOD_UPDATE, GRAPH_BUILD, MAX_FLOW, MASK_COPY_BACK, ENERGY, NUMBER_OF_STAGES };
+
+/** The structures whose memory a segmentation accounts for: the image, the label masks, the EM data matrices (the
+  * colors of the pixels of each label), the n-link weights, the graph, the max flow search queues, the likelihood cache
+  * with the t-link cost buffers, and the superpixels. */
+enum class GrabCutMemoryEnum { IMAGE, MASKS, EM_MATRICES, N_LINK_WEIGHTS, GRAPH, SOLVER_QUEUES, LIKELIHOODS, SUPERPIXELS,
+                               NUMBER_OF_STRUCTURES };
+
+/** Perform GrabCut segmentation on an image.
+  * GrabCut is also the DataTerm of its graph cut: the t-link costs of the whole image are filled in bulk from the mixture models. */
 template <typename TImage>
-class GrabCut
+class GrabCut : public DataTerm
 {
 public:
     // Typedefs
@@ -47,19 +93,206 @@ public:
     /** The type of a list of pixels/indexes. */
     typedef std::vector<itk::Index<2> > IndexContainer;
 
-    /** Provide the image to segment. */
+    /** Provide the image to segment. The image is used by reference, not copied: it must not be changed while it is being
+      * segmented (or while snapshots of it are being written). The whole image must be buffered. */
     void SetImage(TImage* const image);
 
-    /** Provide the image to segment. */
+    /** Provide the image to segment as a caller-owned buffer of width x height pixels, whose rows start rowStride
+      * components apart (planes are height * rowStride components apart in the PLANAR layout).
+      * A tightly packed INTERLEAVED buffer (rowStride == width * components per pixel) is wrapped without copying and
+      * must outlive the segmentation; any other layout is converted into an image once. The snapshots of a wrapped
+      * buffer (SetSnapshotWriter()) read it on the writer thread, so a segmentation of it waits for the writer to
+      * Flush() before it returns. */
+    void SetImage(const typename TImage::PixelType::ComponentType* const buffer, const unsigned int width,
+                  const unsigned int height, const unsigned int rowStride,
+                  const ChannelLayoutEnum layout = ChannelLayoutEnum::INTERLEAVED);
+
+    /** Provide the initial mask. The mask is shared, not copied: it is only read, and must not be changed while it is
+      * being used. Its background pixels are hard constraints, the rest starts as foreground. */
     void SetInitialMask(ForegroundBackgroundSegmentMask* const mask);
 
     /** Get the image that we are segmenting. */
     TImage* GetImage();
 
-    /** Do the GrabCut segmentation (The main driver function). */
+    /** Do the GrabCut segmentation (The main driver function).
+      * Iterates until one of the stopping criteria is met: the maximum number of iterations, a relative energy decrease
+      * below SetMinRelativeEnergyDecrease() or a fraction of flipped pixels below SetMinFlippedPixelFraction(). */
     void PerformSegmentation();
 
-    /** Get the current/final segmentation mask. */
+    /** Segment the image again, starting from the current mixture models (those of the last segmentation) and a
+      * segmentation of a similar image, such as the previous frame of a video. The pixels farther than bandWidth from
+      * the boundary of that segmentation keep their labels (an erosion of its foreground stays foreground and the
+      * complement of a dilation stays background); the band in between is iterated on, with the EM refits, for at most
+      * maxIterations iterations or until the other stopping criteria are met. */
+    void RefineSegmentation(ForegroundBackgroundSegmentMask* const segmentation, const unsigned int bandWidth,
+                            const unsigned int maxIterations);
+
+    /** Compute the mean cost (negative log-likelihood) of the labels of a segmentation of the image under the current
+      * mixture models, i.e. how well the models and the segmentation explain the image. */
+    double ComputeMeanDataCost(const ForegroundBackgroundSegmentMask* const segmentation);
+
+    /** Whether there are mixture models, fitted by a segmentation, to start from. */
+    bool HasMixtureModels() const
+    {
+        return this->ForegroundModels.GetNumberOfModels() > 0 && this->BackgroundModels.GetNumberOfModels() > 0;
+    }
+
+    /** Segment with a pyramid of this many levels (1, the default, segments the full resolution image only).
+      * The full GrabCut iterations run on the image downsampled by 2^(levels - 1). At each finer level the segmentation is
+      * upsampled, and only the pixels within SetPyramidBandWidth() of its boundary are cut again; the mixture models start
+      * from those of the coarser level. Levels are not made smaller than 32 pixels across. */
+    void SetNumberOfPyramidLevels(const unsigned int numberOfPyramidLevels)
+    {
+        this->NumberOfPyramidLevels = std::max(numberOfPyramidLevels, 1u);
+    }
+
+    /** Set how far (in pixels of that level) from the propagated boundary pixels are cut again at each finer pyramid level. */
+    void SetPyramidBandWidth(const unsigned int pyramidBandWidth)
+    {
+        this->PyramidBandWidth = pyramidBandWidth;
+    }
+
+    /** Set how many EM iterations refit the mixture models at each finer pyramid level (0, the default, keeps the models of
+      * the coarser level and cuts once). With EM, the finer levels iterate until the stopping criteria are met. */
+    void SetPyramidEMIterations(const unsigned int pyramidEMIterations)
+    {
+        this->PyramidEMIterations = pyramidEMIterations;
+    }
+
+    /** Segment superpixels of about this size (in pixels across) instead of pixels (0, the default, segments pixels).
+      * The image is over-segmented once (SLIC) into superpixels that do not cross the boundary of the hard background.
+      * The GrabCut iterations then fit the mixture models to the superpixels' color statistics and cut a graph with one
+      * node per superpixel, whose edges are weighted by the length of the shared boundary and the difference of the
+      * mean colors. Finally the pixels within SetSuperpixelBandWidth() of the boundary of that segmentation are cut once
+      * with the fitted models. GetEnergies() and GetFlippedPixels() only report this last (pixel) cut; GetStopReason()
+      * reports why the superpixel iterations stopped. This takes precedence over the pyramid. */
+    void SetSuperpixelSize(const unsigned int superpixelSize)
+    {
+        this->SuperpixelSize = superpixelSize;
+        this->SuperpixelsAreComputed = false;
+    }
+
+    /** Set the weight of the spatial distance against the color distance of the superpixel clustering (the SLIC m,
+      * default 40 for 0-255 channels). Larger values give more regular superpixels that follow the image edges less closely. */
+    void SetSuperpixelCompactness(const float superpixelCompactness)
+    {
+        this->SuperpixelCompactness = superpixelCompactness;
+        this->SuperpixelsAreComputed = false;
+    }
+
+    /** Set how far (in pixels) from the boundary of the superpixel segmentation pixels are cut again (4 by default). */
+    void SetSuperpixelBandWidth(const unsigned int superpixelBandWidth)
+    {
+        this->SuperpixelBandWidth = superpixelBandWidth;
+    }
+
+    /** Set the maximum number of GrabCut iterations (10 by default). */
+    void SetMaxIterations(const unsigned int maxIterations)
+    {
+        this->MaxIterations = std::max(maxIterations, 1u);
+    }
+
+    /** Stop when the energy decreased by less than this fraction of the previous energy, or increased (0 disables this
+      * criterion). */
+    void SetMinRelativeEnergyDecrease(const double minRelativeEnergyDecrease)
+    {
+        this->MinRelativeEnergyDecrease = minRelativeEnergyDecrease;
+    }
+
+    /** Stop when less than this fraction of the pixels changed label in an iteration (0 stops only when none changed). */
+    void SetMinFlippedPixelFraction(const double minFlippedPixelFraction)
+    {
+        this->MinFlippedPixelFraction = minFlippedPixelFraction;
+    }
+
+    /** Get the number of iterations the last PerformSegmentation() ran. */
+    unsigned int GetNumberOfIterations() const
+    {
+        return this->Energies.size();
+    }
+
+    /** Get the Gibbs energy (data + smoothness) of the segmentation after each iteration. */
+    const std::vector<double>& GetEnergies() const
+    {
+        return this->Energies;
+    }
+
+    /** Get the number of pixels that changed label in each iteration. */
+    const std::vector<unsigned int>& GetFlippedPixels() const
+    {
+        return this->FlippedPixels;
+    }
+
+    /** Get why the last PerformSegmentation() stopped. */
+    StopReasonEnum GetStopReason() const
+    {
+        return this->StopReason;
+    }
+
+    /** Get a readable description of a stop reason. */
+    static const char* GetStopReasonName(const StopReasonEnum stopReason);
+
+    /** Get the wall time (in seconds) the last segmentation spent in a stage, summed over its iterations (and pyramid
+      * levels). The EM fits and the graph construction run concurrently, so the stages can add up to more than the total. */
+    double GetStageDuration(const GrabCutStageEnum stage) const
+    {
+        return this->StageDurations[static_cast<unsigned int>(stage)];
+    }
+
+    /** Get the name of a stage. */
+    static const char* GetStageName(const GrabCutStageEnum stage);
+
+    /** Get the most memory (in bytes) a structure held at once during the last segmentation (and its pyramid levels). */
+    size_t GetPeakMemoryUsage(const GrabCutMemoryEnum structure) const
+    {
+        return this->PeakMemory[static_cast<unsigned int>(structure)];
+    }
+
+    /** Get the most memory (in bytes) the structures held together at once during the last segmentation. What is not
+      * one of them (allocator overhead, ITK, thread stacks, the caller's data) is not included. */
+    size_t GetPeakMemoryUsage() const
+    {
+        return this->PeakTotalMemory;
+    }
+
+    /** Measure the resident set size of the process at the end of every stage (off by default). Every measurement
+      * reads /proc/self/statm, which costs more than the shortest stages. */
+    void SetMeasureStageResidentSetSizes(const bool measureStageResidentSetSizes)
+    {
+        this->MeasureStageResidentSetSizes = measureStageResidentSetSizes;
+    }
+
+    /** Get the largest resident set size of the process (in bytes) at the end of a stage of the last segmentation, or 0
+      * where it cannot be measured or SetMeasureStageResidentSetSizes() is off. It includes everything else the process
+      * holds. */
+    size_t GetStageResidentSetSize(const GrabCutStageEnum stage) const
+    {
+        return this->StageResidentSetSizes[static_cast<unsigned int>(stage)];
+    }
+
+    /** Get the name of a structure. */
+    static const char* GetMemoryStructureName(const GrabCutMemoryEnum structure);
+
+    /** Estimate the most memory (in bytes) a structure will hold while an image of this size is segmented with the
+      * current settings. The estimate assumes the worst case (the graph covers the whole image, every node is queued, every
+      * pixel has its own color), so it is meant for deciding whether a job fits before it is started. */
+    size_t EstimateMemoryUsage(const itk::Size<2>& size, const GrabCutMemoryEnum structure) const;
+
+    /** Estimate the memory of all the structures together: the sum of their estimates. */
+    size_t EstimateMemoryUsage(const itk::Size<2>& size) const;
+
+    /** Write the segmented image of every iteration to filePrefix<iteration>.png on a SnapshotWriter (none by default).
+      * The coarser pyramid levels write to filePrefixcoarse_<iteration>.png (one more coarse_ per level).
+      * The iteration only queues the encoding and writing, which the writer drops if it falls behind.
+      * The writer must outlive the segmentation; pass nullptr to stop writing snapshots. */
+    void SetSnapshotWriter(SnapshotWriter* const snapshotWriter, const std::string& filePrefix = "result_")
+    {
+        this->Snapshots = snapshotWriter;
+        this->SnapshotFilePrefix = filePrefix;
+    }
+
+    /** Get the current/final segmentation mask. It is made from the segmentation bits the first time it is asked for
+      * after a cut; a mask is never changed once it has been handed out, so it can be kept. */
     ForegroundBackgroundSegmentMask* GetSegmentationMask();
 
     /** Get the resulting segmented image (the foreground pixels, with background pixels zeroed). */
@@ -71,38 +304,263 @@ public:
     /** Compute the likelihood that a pixel belongs to the background mixture model. */
     float BackgroundLikelihood(const typename TImage::PixelType& pixel);
 
+    /** Fill the negative log-likelihoods of the foreground and background mixture models for a region of the image. */
+    void ComputeCosts(const itk::ImageRegion<2>& region, float* foregroundCosts, float* backgroundCosts);
+
     /** Specify how many EM iterations to run during each GrabCut iteration. */
     void SetNumberOfEMIterations(const unsigned int numberOfEMIterations)
     {
         this->NumberOfEMIterations = numberOfEMIterations;
     }
 
+    /** Choose how the first EM fits spread the components of the mixture models over the colors: along the principal
+      * axis (the default), by the Orchard-Bouman color quantization of the GrabCut paper, or by k-means++ on a subsample.
+      * The last two start EM close to a fit, so it needs fewer of its SetNumberOfEMIterations() to converge. Fits that
+      * start from models of an earlier fit (the next iteration, a coarser pyramid level, a refinement) are not affected. */
+    void SetModelInitialization(const MixtureInitializationEnum modelInitialization)
+    {
+        this->ModelInitialization = modelInitialization;
+    }
+
+    /** Set the seed of the k-means++ initialization and of the EM subsamples. Segmentations with the same seed are the
+      * same. */
+    void SetSeed(const unsigned int seed)
+    {
+        this->Seed = seed;
+    }
+
+    /** Choose how the mixture models are fitted each iteration (EXPECTATION_MAXIMIZATION by default). With
+      * HARD_ASSIGNMENT, SetNumberOfEMIterations() sets the rounds of assigning every pixel to its most likely component
+      * and re-estimating the components from their pixels. The component of every pixel is kept from one round and one
+      * iteration to the next, and only the pixels that change component or label update the statistics of the
+      * components. The rows of the image are split over SetNumberOfThreads() threads. The first fit spreads the
+      * components over the colors as set by SetModelInitialization(), without any EM iterations. The superpixel fits
+      * (SetSuperpixelSize()) always use EM. */
+    void SetMixtureFitting(const MixtureFittingEnum mixtureFitting)
+    {
+        this->MixtureFitting = mixtureFitting;
+    }
+
+    /** Fit each mixture model to at most this many of the pixels of its label (0, the default, fits all of them). The
+      * pixels of a label are split, in row-major order, into as many strata of consecutive pixels as there are samples,
+      * and one pixel is drawn from each, so every part of the image is represented by as many samples as it has pixels.
+      * The superpixel fits (SetSuperpixelSize()) are not sampled. */
+    void SetEMSampleSize(const unsigned int emSampleSize)
+    {
+        this->EMSampleSize = emSampleSize;
+    }
+
+    /** After fitting a subsample (SetEMSampleSize()), run one more EM iteration over all of the pixels of the label. */
+    void SetEMFullDataIteration(const bool emFullDataIteration)
+    {
+        this->EMFullDataIteration = emFullDataIteration;
+    }
+
+    /** Set how many threads an iteration may use. The foreground EM, the background EM and the graph construction run
+      * concurrently, and each of them and the max flow is split over the threads as well. */
+    void SetNumberOfThreads(const unsigned int numberOfThreads)
+    {
+        this->NumberOfThreads = std::max(numberOfThreads, 1u);
+    }
+
+    /** Print the progress of a segmentation (its iterations, energies and fits) to std::cout (the default). It is
+      * printed by the thread that called the segmentation; the stages that run concurrently hold their messages until
+      * the iteration is done, so they are never interleaved. */
+    void SetVerbose(const bool verbose)
+    {
+        this->Verbose = verbose;
+    }
+
+    /** Whether the progress of a segmentation is printed. */
+    bool GetVerbose() const
+    {
+        return this->Verbose;
+    }
+
+    /** Keep the graph (and the flow found in it) from one iteration to the next and only update its t-links (the default),
+      * rather than building and solving a new graph every iteration. Both give the same minimum cut. */
+    void SetReuseGraph(const bool reuseGraph)
+    {
+        this->ReuseGraph = reuseGraph;
+    }
+
+    /** Build the graph only over the bounding box of the pixels that are not hard background, with the hard background
+      * pixels contracted into the sink (the default), rather than over the whole image. The cut is the same, but the
+      * pixels outside of the box are neither graph nodes nor evaluated against the mixture models. The EM fits still use
+      * all background pixels. */
+    void SetCropGraph(const bool cropGraph)
+    {
+        this->CropGraph = cropGraph;
+        this->GraphIsBuilt = false;
+    }
+
+    /** Choose how the foreground/background likelihoods are cached between EM fits.
+      * QUANTIZED and EXACT require an image with 3 unsigned char components per pixel. */
+    void SetLikelihoodCacheMode(const LikelihoodCacheModeEnum mode);
+
+    /** Set how many bits per channel the QUANTIZED likelihood cache keeps (1 to 8). */
+    void SetLikelihoodCacheBitsPerChannel(const unsigned int bitsPerChannel)
+    {
+        this->LikelihoodTable.SetBitsPerChannel(bitsPerChannel);
+    }
+
 protected:
 
-    /** Create random models and add them to the mixture models.*/
+    /** Create identical models and add them to the mixture models. The first EM fits spread them over the colors as set
+      * by SetModelInitialization(). */
     void InitializeModels(const unsigned int numberOfModels);
 
-    /** Construct a data matrix from a selection of pixel indices. Every pixel is a column in the matrix. */
-    Eigen::MatrixXd CreateMatrixFromPixels(const std::vector<typename TImage::PixelType>& pixels);
+    /** Pack the colors of the pixels of each label of the segmentation into ForegroundData and BackgroundData, in one pass
+      * over the image. The matrices are sized from the counts of the segmentation bits, so nothing is reallocated. */
+    void PartitionPixels();
+
+    /** Perform EM on a collection of pixels (one per column) according to a mixture model, or on a subsample of them
+      * (SetEMSampleSize()). The data is moved into the EM rather than copied. */
+    MixtureModel ClusterPixels(Eigen::MatrixXd&& data, const MixtureModel& mixtureModel,
+                               const unsigned int numberOfEMIterations, std::ostream& progress);
 
-    /** Perform EM on a collection of pixels according to a mixture model. */
-    MixtureModel ClusterPixels(const std::vector<typename TImage::PixelType>& pixels, const MixtureModel& mixtureModel);
+    /** Fit both mixture models by hard assignment, for up to numberOfRounds rounds of assigning the pixels to components
+      * and re-estimating the components. */
+    void FitByHardAssignment(const unsigned int numberOfRounds, std::ostream& progress);
+
+    /** Forget the components of the pixels, so the next hard assignment starts from the statistics of no pixels. */
+    void ClearComponentLabels();
+
+    /** Draw one pixel (column) from each of numberOfSamples equal strata of consecutive pixels. */
+    Eigen::MatrixXd SamplePixels(const Eigen::MatrixXd& data, const unsigned int numberOfSamples) const;
+
+    /** Perform EM on all of a collection of pixels, which is accounted for in EM_MATRICES and released with the EM. Its
+      * iterations are reported on progress. */
+    MixtureModel FitMixtureModel(Eigen::MatrixXd&& data, const MixtureModel& mixtureModel,
+                                 const unsigned int numberOfEMIterations, std::ostream& progress);
+
+    /** Compute the GMM of the foreground pixels packed by PartitionPixels(). */
+    void ClusterForeground(const unsigned int numberOfEMIterations, std::ostream& progress);
+
+    /** Compute the GMM of the background pixels packed by PartitionPixels(). */
+    void ClusterBackground(const unsigned int numberOfEMIterations, std::ostream& progress);
 
     /** Compute the GMMs for both the foreground pixels and background pixels. */
     void ClusterForegroundAndBackground();
 
-    /** Do one iteration of the GrabCut algorithm. */
-    void PerformIteration();
+    /** Do one iteration of the GrabCut algorithm. Returns the number of pixels that changed label. */
+    unsigned int PerformIteration(const unsigned int numberOfEMIterations);
+
+    /** Perform iterations until a stopping criterion is met. */
+    void Iterate(const unsigned int maxIterations, const unsigned int numberOfEMIterations);
+
+    /** Get which stopping criterion, if any, an iteration met, given the energies of the iterations before it. */
+    StopReasonEnum CheckStoppingCriteria(const std::vector<double>& previousEnergies, const double energy,
+                                         const unsigned int flippedPixels, const unsigned int iteration,
+                                         const unsigned int maxIterations) const;
+
+    /** Iterate on the superpixel graph, then cut the band around the boundary of its segmentation. */
+    void PerformSuperpixelSegmentation();
+
+    /** Perform EM on the superpixels of one label, each weighted by its number of pixels and carrying its scatter. */
+    MixtureModel ClusterSuperpixels(const std::vector<unsigned char>& isForeground, const bool foreground,
+                                    const MixtureModel& mixtureModel, const unsigned int numberOfEMIterations);
+
+    /** Fill the negative log-likelihood of the mean color of every superpixel under both mixture models, times its size. */
+    void ComputeSuperpixelCosts(std::vector<float>& foregroundCosts, std::vector<float>& backgroundCosts);
+
+    /** Segment a half resolution copy of the image, then cut the band around its upsampled boundary. */
+    void PerformPyramidSegmentation();
+
+    /** Halve the size of an image (each pixel is the mean of the 2x2 pixels it covers). */
+    static typename TImage::Pointer DownsampleImage(const TImage* const image);
+
+    /** Halve the size of a mask (a pixel is background only if the 2x2 pixels it covers are). */
+    static ForegroundBackgroundSegmentMask::Pointer DownsampleMask(const ForegroundBackgroundSegmentMask* const mask);
+
+    /** Copy the means, variances and mixing coefficients of one mixture model to another with as many models. */
+    static void CopyModelParameters(const MixtureModel& source, MixtureModel& destination);
+
+    /** Upsample the segmentation (the foreground bits) of the coarser pyramid level into the segmentation, and fix the
+      * labels of the pixels away from its boundary in RefinementSinks and RefinementSources. */
+    void PropagateSegmentation(const BitMask& coarseForeground);
+
+    /** Make a segmentation (its foreground bits) the segmentation, and fix the labels of its pixels farther than bandWidth
+      * from its boundary in RefinementSinks and RefinementSources. */
+    void ConstrainToBand(const BitMask& foreground, const unsigned int bandWidth);
+
+    /** Add the time since start to the duration of a stage. Stages running on different threads may add concurrently. */
+    void AddStageDuration(const GrabCutStageEnum stage, const std::chrono::steady_clock::time_point& start);
+
+    /** Account for memory a structure allocated (positive) or released (negative), and update the peaks.
+      * Stages running on different threads may account concurrently. */
+    void AddMemoryUsage(const GrabCutMemoryEnum structure, const long long bytes);
+
+    /** Account for a structure now holding this much memory. */
+    void SetMemoryUsage(const GrabCutMemoryEnum structure, const size_t bytes);
+
+    /** Account for memory a structure held only during a call that has already returned (such as the search queues of
+      * the max flow): the peaks are raised as if it had been allocated and released again. */
+    void RecordTransientMemoryUsage(const GrabCutMemoryEnum structure, const size_t bytes);
+
+    /** Account for the structures that are kept between iterations (the image, the masks, the n-link weights, the graph,
+      * the likelihood cache and the superpixels) at their current size. */
+    void UpdateHeldMemoryUsage();
 
-    /** The segmentation mask. */
+    /** Forget the memory accounting of the last segmentation. */
+    void ResetMemoryUsage();
+
+    /** Queue the segmented image of an iteration on the snapshot writer. */
+    void WriteSnapshot(const unsigned int iteration);
+
+    /** Wait for the queued snapshots if they read a buffer of the caller, which may be freed once the segmentation
+      * returns. */
+    void FinishSnapshots();
+
+    /** Precompute the likelihood evaluation (and rebuild the likelihood cache, if one is enabled) from the current mixture models. */
+    void UpdateLikelihoods(std::ostream& progress);
+
+    /** Get the stream the progress is printed to: std::cout, or a stream that discards it (SetVerbose()). Only the
+      * thread that called the segmentation prints to it; the fits and the likelihood update, which run concurrently,
+      * write to a stream they are given instead. */
+    std::ostream& GetProgressStream();
+
+    /** Get the distinct colors of the image, packed as 0xRRGGBB. */
+    std::vector<unsigned int> GetImageColors();
+
+    /** Copy every setting (everything the Set...() functions of the options set) to another GrabCut, such as a coarser
+      * pyramid level. A new option must be copied here too, or the pyramid levels silently ignore it. */
+    void CopySettingsTo(GrabCut<TImage>& other) const;
+
+    /** The segmentation, one bit per pixel (set for the foreground). It is the complement of the hard background until
+      * the first cut, then the segmentation of the last cut. */
+    BitMask SegmentationBits;
+
+    /** How the mixture models are fitted. */
+    MixtureFittingEnum MixtureFitting = MixtureFittingEnum::EXPECTATION_MAXIMIZATION;
+
+    /** The component of the mixture model of its label each pixel is assigned to by the hard assignment (empty until
+      * the first one), and the labels (set for the foreground) the pixels were counted in. */
+    std::vector<unsigned char> ComponentLabels;
+    BitMask AssignedBits;
+
+    /** The statistics of the components of the foreground and background mixture models under hard assignment. */
+    HardAssignmentMixture ForegroundAssignment;
+    HardAssignmentMixture BackgroundAssignment;
+
+    /** The segmentation as a mask, made from SegmentationBits when it is asked for (null until then). It is the initial
+      * mask until the first cut. A new mask is made after every cut, so a mask that was handed out is never changed. */
     ForegroundBackgroundSegmentMask::Pointer SegmentationMask;
 
-    /** The input mask. */
+    /** The input mask (shared with the caller). */
     ForegroundBackgroundSegmentMask::Pointer InitialMask;
 
-    /** The image to be segmented. */
+    /** The background pixels of the initial mask, the hard constraints. */
+    BitMask HardBackground;
+
+    /** The image to be segmented (shared with the caller, or wrapping the caller's buffer). */
     typename TImage::Pointer Image;
 
+    /** The colors of the foreground and the background pixels, one pixel per column, from PartitionPixels() until the EM
+      * fits take them. */
+    Eigen::MatrixXd ForegroundData;
+    Eigen::MatrixXd BackgroundData;
+
     /** The mixture model for the foreground. */
     MixtureModel ForegroundModels;
 
@@ -112,6 +570,109 @@ protected:
     /** The number of EM iterations to run for each GrabCut iteration. */
     unsigned int NumberOfEMIterations = 5;
 
+    /** How the first EM fits spread the components over the colors. */
+    MixtureInitializationEnum ModelInitialization = MixtureInitializationEnum::PRINCIPAL_AXIS;
+
+    /** The seed of the k-means++ initialization and of the EM subsamples. */
+    unsigned int Seed = 0;
+
+    /** The largest number of pixels each EM fit works on (0: all). */
+    unsigned int EMSampleSize = 0;
+
+    /** Whether a fit of a subsample ends with an EM iteration over all of the pixels. */
+    bool EMFullDataIteration = false;
+
+    /** The number of threads an iteration may use. */
+    unsigned int NumberOfThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    /** Whether the progress is printed to std::cout. */
+    bool Verbose = true;
+
+    /** A stream without a buffer, which discards the progress when it is not printed. */
+    std::ostream SilentStream{nullptr};
+
+    /** The n-link weights of the image, computed once per image. */
+    SmoothnessTerm Smoothness;
+
+    /** The graph cut, kept between iterations. */
+    BatchImageGraphCut<TImage> GraphCut;
+
+    /** The stopping criteria. */
+    unsigned int MaxIterations = 10;
+    double MinRelativeEnergyDecrease = 1e-3;
+    double MinFlippedPixelFraction = 1e-4;
+
+    /** Per iteration diagnostics of the last PerformSegmentation(). */
+    std::vector<double> Energies;
+    std::vector<unsigned int> FlippedPixels;
+    StopReasonEnum StopReason = StopReasonEnum::NOT_RUN;
+
+    /** The time spent in each stage by the last segmentation. */
+    std::array<double, static_cast<unsigned int>(GrabCutStageEnum::NUMBER_OF_STAGES)> StageDurations{};
+    std::mutex StageDurationsMutex;
+
+    /** The resident set size of the process at the end of each stage, the largest over the last segmentation (guarded by
+      * StageDurationsMutex). */
+    std::array<size_t, static_cast<unsigned int>(GrabCutStageEnum::NUMBER_OF_STAGES)> StageResidentSetSizes{};
+
+    /** Whether the stages measure the resident set size. */
+    bool MeasureStageResidentSetSizes = false;
+
+    /** The memory each structure holds and the most it held during the last segmentation, and the same for their sum. */
+    std::array<size_t, static_cast<unsigned int>(GrabCutMemoryEnum::NUMBER_OF_STRUCTURES)> CurrentMemory{};
+    std::array<size_t, static_cast<unsigned int>(GrabCutMemoryEnum::NUMBER_OF_STRUCTURES)> PeakMemory{};
+    size_t CurrentTotalMemory = 0;
+    size_t PeakTotalMemory = 0;
+    std::mutex MemoryMutex;
+
+    /** The pyramid. */
+    unsigned int NumberOfPyramidLevels = 1;
+    unsigned int PyramidBandWidth = 4;
+    unsigned int PyramidEMIterations = 0;
+
+    /** The superpixels, computed once per image and initial mask. */
+    unsigned int SuperpixelSize = 0;
+    float SuperpixelCompactness = 40.0f;
+    unsigned int SuperpixelBandWidth = 4;
+    Superpixels SuperpixelSegmentation;
+    bool SuperpixelsAreComputed = false;
+
+    /** While refining a pyramid level or a superpixel segmentation: the set pixels of RefinementSinks and RefinementSources
+      * are hard constraints, instead of the background of the initial mask (they are empty otherwise). */
+    BitMask RefinementSinks;
+    BitMask RefinementSources;
+
+    /** Where the segmented image of each iteration is written, if anywhere. */
+    SnapshotWriter* Snapshots = nullptr;
+    std::string SnapshotFilePrefix;
+
+    /** Whether the image wraps a buffer of the caller (SetImage(buffer, ...)) rather than sharing an image. */
+    bool ImageIsWrappedBuffer = false;
+
+    /** Whether the graph is kept between iterations. */
+    bool ReuseGraph = true;
+
+    /** Whether the graph only covers the bounding box of the pixels that are not hard background. */
+    bool CropGraph = true;
+
+    /** Whether GraphCut holds the graph of the current image and initial mask. */
+    bool GraphIsBuilt = false;
+
+    /** How the likelihoods are cached between EM fits. */
+    LikelihoodCacheModeEnum LikelihoodCacheMode = LikelihoodCacheModeEnum::NONE;
+
+    /** The foreground mixture model with its per-component terms precomputed (3 component images only). */
+    GaussianMixtureBatchEvaluator ForegroundEvaluator;
+
+    /** The background mixture model with its per-component terms precomputed (3 component images only). */
+    GaussianMixtureBatchEvaluator BackgroundEvaluator;
+
+    /** The cached likelihoods, valid after UpdateLikelihoods() when caching is enabled. */
+    ColorLikelihoodLookupTable LikelihoodTable;
+
+    /** Whether LikelihoodTable holds the colors of the current image (EXACT mode). */
+    bool LikelihoodTableHasImageColors = false;
+
     unsigned int GetDimensionality()
     {
         if(this->Image)
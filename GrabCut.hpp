@@ -24,20 +24,27 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "Helpers/Helpers.h"
 #include "ITKHelpers/ITKHelpers.h"
 
-#include "ExpectationMaximization/ExpectationMaximization.h"
 #include "ExpectationMaximization/GaussianModel.h"
 
+#include "GraphMaxFlow.h"
+#include "MemoryUsage.h"
+#include "ParallelExpectationMaximization.h"
+#include "Trace.h"
+
 // ITK
 #include "itkImageRegionIterator.h"
 #include "itkShapedNeighborhoodIterator.h"
 #include "itkMaskImageFilter.h"
 
 // STL
+#include <algorithm>
 #include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
 #include <sstream>
-
-// Boost
-#include <boost/graph/boykov_kolmogorov_max_flow.hpp>
+#include <stdexcept>
+#include <type_traits>
 
 template <typename TImage>
 GrabCut<TImage>::GrabCut()
@@ -50,38 +57,105 @@ GrabCut<TImage>::GrabCut()
 template <typename TImage>
 void GrabCut<TImage>::SetImage(TImage* const image)
 {
-    ITKHelpers::DeepCopy(image, this->Image.GetPointer());
+    if(image->GetBufferedRegion() != image->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("GrabCut::SetImage: the whole image must be buffered!");
+    }
+
+    this->Image = image;
+    this->ImageIsWrappedBuffer = false;
+    this->LikelihoodTableHasImageColors = false;
+    this->Smoothness.Clear();
+    this->SuperpixelsAreComputed = false;
+    this->GraphIsBuilt = false;
 }
 
 template <typename TImage>
-void GrabCut<TImage>::SetInitialMask(ForegroundBackgroundSegmentMask* const mask)
+void GrabCut<TImage>::SetImage(const typename TImage::PixelType::ComponentType* const buffer, const unsigned int width,
+                               const unsigned int height, const unsigned int rowStride, const ChannelLayoutEnum layout)
 {
-    // Save the initial mask
-    ITKHelpers::DeepCopy(mask, this->InitialMask.GetPointer());
+    typedef typename PixelType::ComponentType ComponentType;
+    const unsigned int numberOfComponents = PixelType::Dimension;
+    static_assert(sizeof(PixelType) == PixelType::Dimension * sizeof(ComponentType),
+                  "GrabCut::SetImage: the pixels must be a plain array of components");
 
-    // Initialize the segmentation mask from the initial mask
-    ITKHelpers::DeepCopy(mask, this->SegmentationMask.GetPointer());
-}
+    const unsigned int rowLength = layout == ChannelLayoutEnum::INTERLEAVED ? width * numberOfComponents : width;
+    if(!buffer || rowStride < rowLength)
+    {
+        throw std::runtime_error("GrabCut::SetImage: the buffer is missing or its row stride is shorter than a row!");
+    }
 
-template <typename TImage>
-Eigen::MatrixXd GrabCut<TImage>::CreateMatrixFromPixels(const std::vector<typename TImage::PixelType>& pixels)
-{
-    unsigned int dimensionality = this->GetDimensionality();
-    Eigen::MatrixXd data(dimensionality, pixels.size());
+    itk::Size<2> size;
+    size[0] = width;
+    size[1] = height;
+    const itk::ImageRegion<2> region(size);
+    const unsigned int numberOfPixels = width * height;
 
-    for(unsigned int i = 0; i < pixels.size(); i++)
+    typename TImage::Pointer image = TImage::New();
+    image->SetRegions(region);
+
+    const bool wrapped = layout == ChannelLayoutEnum::INTERLEAVED && rowStride == rowLength;
+    if(wrapped)
+    {
+        // The buffer already is an image buffer. It is only read, and the container does not own it.
+        typename TImage::PixelContainer::Pointer container = TImage::PixelContainer::New();
+        container->SetImportPointer(reinterpret_cast<PixelType*>(const_cast<ComponentType*>(buffer)), numberOfPixels, false);
+        image->SetPixelContainer(container);
+    }
+    else
     {
-        Eigen::VectorXd v(dimensionality);
-        PixelType p = pixels[i];
-        for(unsigned int d = 0; d < dimensionality; ++d)
+        image->Allocate();
+        PixelType* pixels = image->GetBufferPointer();
+        const unsigned long long planeStride = static_cast<unsigned long long>(rowStride) * height;
+        for(unsigned int y = 0; y < height; ++y)
         {
-            v(d) = p[d];
+            const ComponentType* row = buffer + static_cast<unsigned long long>(y) * rowStride;
+            for(unsigned int x = 0; x < width; ++x)
+            {
+                for(unsigned int c = 0; c < numberOfComponents; ++c)
+                {
+                    pixels[y * width + x][c] = layout == ChannelLayoutEnum::INTERLEAVED ? row[x * numberOfComponents + c] :
+                                                                                          row[c * planeStride + x];
+                }
+            }
         }
+    }
 
-        data.col(i) = v;
+    SetImage(image);
+    this->ImageIsWrappedBuffer = wrapped;
+}
+
+template <typename TImage>
+void GrabCut<TImage>::SetLikelihoodCacheMode(const LikelihoodCacheModeEnum mode)
+{
+    const bool isEightBitRGB = std::is_same<typename PixelType::ComponentType, unsigned char>::value &&
+                               PixelType::Dimension == 3;
+    if(mode != LikelihoodCacheModeEnum::NONE && !isEightBitRGB)
+    {
+        throw std::runtime_error("GrabCut::SetLikelihoodCacheMode: likelihood caching requires 3 unsigned char components per pixel!");
+    }
+
+    this->LikelihoodCacheMode = mode;
+    if(mode != LikelihoodCacheModeEnum::NONE)
+    {
+        this->LikelihoodTable.SetMode(mode);
     }
+}
+
+template <typename TImage>
+void GrabCut<TImage>::SetInitialMask(ForegroundBackgroundSegmentMask* const mask)
+{
+    // The initial mask is never written to, so it is the segmentation mask until the first cut. The labels themselves
+    // are kept as bits: the hard background, and the rest as foreground
+    this->InitialMask = mask;
+    this->SegmentationMask = mask;
+    this->HardBackground.FromMask(mask, ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+    this->SegmentationBits = this->HardBackground;
+    this->SegmentationBits.Invert();
 
-    return data;
+    // The hard constraints are part of the graph, and no superpixel crosses their boundary
+    this->GraphIsBuilt = false;
+    this->SuperpixelsAreComputed = false;
 }
 
 template <typename TImage>
@@ -109,97 +183,1498 @@ void GrabCut<TImage>::InitializeModels(const unsigned int numberOfModels)
 }
 
 template <typename TImage>
-MixtureModel GrabCut<TImage>::ClusterPixels(const std::vector<typename TImage::PixelType>& pixels, const MixtureModel& mixtureModel)
+void GrabCut<TImage>::PartitionPixels()
 {
-    Eigen::MatrixXd data = CreateMatrixFromPixels(pixels);
+    const unsigned int width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = this->Image->GetLargestPossibleRegion().GetSize()[1];
+    const unsigned int dimensionality = this->GetDimensionality();
 
-    ExpectationMaximization expectationMaximization;
-    expectationMaximization.SetData(data);
+    // The popcount of the segmentation bits gives the size of both matrices up front
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const unsigned int numberOfForegroundPixels = this->SegmentationBits.Count();
+    const unsigned int numberOfBackgroundPixels = width * height - numberOfForegroundPixels;
+    AddStageDuration(GrabCutStageEnum::MASK_SCAN, start);
+
+    // Every pixel is appended to the matrix of its label in row-major order, the order of the pixel lists they replace
+    start = std::chrono::steady_clock::now();
+    this->ForegroundData.resize(dimensionality, numberOfForegroundPixels);
+    this->BackgroundData.resize(dimensionality, numberOfBackgroundPixels);
+    double* foregroundColumn = this->ForegroundData.data();
+    double* backgroundColumn = this->BackgroundData.data();
+    const PixelType* pixels = this->Image->GetBufferPointer();
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        const BitMask::WordType* row = this->SegmentationBits.GetRow(y);
+        const PixelType* rowPixels = pixels + static_cast<size_t>(y) * width;
+        for(unsigned int x = 0; x < width; ++x)
+        {
+            const bool isForeground = (row[x / BitMask::BitsPerWord] >> (x % BitMask::BitsPerWord)) & 1;
+            double*& column = isForeground ? foregroundColumn : backgroundColumn;
+            for(unsigned int d = 0; d < dimensionality; ++d)
+            {
+                column[d] = rowPixels[x][d];
+            }
+            column += dimensionality;
+        }
+    }
+    AddStageDuration(GrabCutStageEnum::MATRIX_PACKING, start);
+    GRABCUT_TRACE_COUNTER("foreground pixels", numberOfForegroundPixels);
+    GRABCUT_TRACE_COUNTER("background pixels", numberOfBackgroundPixels);
+
+    // The matrices are held until the fits are done with them
+    AddMemoryUsage(GrabCutMemoryEnum::EM_MATRICES, (this->ForegroundData.size() + this->BackgroundData.size()) * sizeof(double));
+}
+
+template <typename TImage>
+MixtureModel GrabCut<TImage>::ClusterPixels(Eigen::MatrixXd&& data, const MixtureModel& mixtureModel,
+                                             const unsigned int numberOfEMIterations, std::ostream& progress)
+{
+    if(this->EMSampleSize == 0 || data.cols() <= this->EMSampleSize)
+    {
+        return FitMixtureModel(std::move(data), mixtureModel, numberOfEMIterations, progress);
+    }
+
+    Eigen::MatrixXd samples = SamplePixels(data, this->EMSampleSize);
+    AddMemoryUsage(GrabCutMemoryEnum::EM_MATRICES, samples.size() * sizeof(double));
+    // A fit without EM iterations only initializes the models, which the sample is enough for
+    if(!this->EMFullDataIteration || numberOfEMIterations == 0)
+    {
+        AddMemoryUsage(GrabCutMemoryEnum::EM_MATRICES, -static_cast<long long>(data.size() * sizeof(double)));
+        data = Eigen::MatrixXd();
+        return FitMixtureModel(std::move(samples), mixtureModel, numberOfEMIterations, progress);
+    }
+
+    // The E-step over every pixel also gives the M-step the statistics of all of them
+    const MixtureModel sampleModel = FitMixtureModel(std::move(samples), mixtureModel, numberOfEMIterations, progress);
+    return FitMixtureModel(std::move(data), sampleModel, 1, progress);
+}
+
+template <typename TImage>
+Eigen::MatrixXd GrabCut<TImage>::SamplePixels(const Eigen::MatrixXd& data, const unsigned int numberOfSamples) const
+{
+    const unsigned int numberOfPixels = data.cols();
+
+    // Raw 32 bit draws, like the k-means++ initialization, so the samples do not depend on the standard library
+    std::mt19937 generator(this->Seed);
+    Eigen::MatrixXd samples(data.rows(), numberOfSamples);
+    for(unsigned int i = 0; i < numberOfSamples; ++i)
+    {
+        const unsigned int begin = static_cast<unsigned long long>(i) * numberOfPixels / numberOfSamples;
+        const unsigned int end = static_cast<unsigned long long>(i + 1) * numberOfPixels / numberOfSamples;
+        samples.col(i) = data.col(begin + static_cast<unsigned int>(generator() / 4294967296.0 * (end - begin)));
+    }
+
+    return samples;
+}
+
+template <typename TImage>
+MixtureModel GrabCut<TImage>::FitMixtureModel(Eigen::MatrixXd&& data, const MixtureModel& mixtureModel,
+                                               const unsigned int numberOfEMIterations, std::ostream& progress)
+{
+    const unsigned int numberOfPixels = data.cols();
+    const long long dataBytes = data.size() * sizeof(double);
+
+    ParallelExpectationMaximization expectationMaximization;
+    expectationMaximization.SetData(std::move(data));
     expectationMaximization.SetMixtureModel(mixtureModel);
+    expectationMaximization.SetInitialization(this->ModelInitialization);
+    expectationMaximization.SetSeed(this->Seed);
     expectationMaximization.SetMinChange(1e-4); // Stop early if the model is doing well
-    expectationMaximization.SetMaxIterations(this->NumberOfEMIterations);
+    expectationMaximization.SetMaxIterations(numberOfEMIterations);
+    expectationMaximization.SetNumberOfThreads(this->NumberOfThreads);
+
+    // The data was accounted for when it was packed or sampled; it is released along with the EM
+    const long long emBytes = expectationMaximization.GetNumberOfBytes() - dataBytes;
+    AddMemoryUsage(GrabCutMemoryEnum::EM_MATRICES, emBytes);
     expectationMaximization.Compute();
+    AddMemoryUsage(GrabCutMemoryEnum::EM_MATRICES, -emBytes - dataBytes);
+
+    std::stringstream timings;
+    for(unsigned int i = 0; i < expectationMaximization.GetNumberOfIterations(); ++i)
+    {
+        timings << " " << expectationMaximization.GetExpectationDurations()[i] + expectationMaximization.GetMaximizationDurations()[i] << "s";
+    }
+    GRABCUT_TRACE_COUNTER("EM iterations", expectationMaximization.GetNumberOfIterations());
+    progress << "EM on " << numberOfPixels << " pixels: " << expectationMaximization.GetNumberOfIterations()
+              << " iterations (" << timings.str() << " )" << std::endl;
 
     MixtureModel finalModel = expectationMaximization.GetMixtureModel();
 
     return finalModel;
 }
 
+template <typename TImage>
+void GrabCut<TImage>::ClusterForeground(const unsigned int numberOfEMIterations, std::ostream& progress)
+{
+    progress << "Starting foreground EM..." << std::endl;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    this->ForegroundModels = ClusterPixels(std::move(this->ForegroundData), this->ForegroundModels, numberOfEMIterations, progress);
+    AddStageDuration(GrabCutStageEnum::FOREGROUND_EM, start);
+}
+
+template <typename TImage>
+void GrabCut<TImage>::ClusterBackground(const unsigned int numberOfEMIterations, std::ostream& progress)
+{
+    progress << "Starting background EM..." << std::endl;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    this->BackgroundModels = ClusterPixels(std::move(this->BackgroundData), this->BackgroundModels, numberOfEMIterations, progress);
+    AddStageDuration(GrabCutStageEnum::BACKGROUND_EM, start);
+}
+
+template <typename TImage>
+void GrabCut<TImage>::FitByHardAssignment(const unsigned int numberOfRounds, std::ostream& progress)
+{
+    const unsigned int width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = this->Image->GetLargestPossibleRegion().GetSize()[1];
+    const unsigned int dimensionality = this->GetDimensionality();
+    const unsigned char noComponent = 255;
+
+    if(this->ComponentLabels.empty())
+    {
+        // Both mixtures label their pixels with one byte, where noComponent marks a pixel that is not counted yet
+        if(std::max(this->ForegroundModels.GetNumberOfModels(), this->BackgroundModels.GetNumberOfModels()) >= noComponent)
+        {
+            throw std::runtime_error("GrabCut::FitByHardAssignment: the hard assignment supports at most 254 components per mixture model!");
+        }
+
+        // Fresh (identical) models have no components to assign to yet; they are spread over the colors by the
+        // initialization of the EM, without any EM iterations
+        const std::vector<Model*> models = this->ForegroundModels.GetModels();
+        bool identical = true;
+        for(unsigned int k = 1; k < models.size(); ++k)
+        {
+            identical = identical && models[k]->GetMean() == models[0]->GetMean() && models[k]->GetVariance() == models[0]->GetVariance();
+        }
+        if(identical)
+        {
+            PartitionPixels();
+            this->ForegroundModels = ClusterPixels(std::move(this->ForegroundData), this->ForegroundModels, 0, progress);
+            this->BackgroundModels = ClusterPixels(std::move(this->BackgroundData), this->BackgroundModels, 0, progress);
+        }
+
+        // Every pixel is added to the statistics of its component in the first round
+        this->ComponentLabels.assign(static_cast<size_t>(width) * height, noComponent);
+        this->AssignedBits = this->SegmentationBits;
+        this->ForegroundAssignment.Initialize(dimensionality, this->ForegroundModels.GetNumberOfModels());
+        this->BackgroundAssignment.Initialize(dimensionality, this->BackgroundModels.GetNumberOfModels());
+        AddMemoryUsage(GrabCutMemoryEnum::MASKS, this->ComponentLabels.size() + this->AssignedBits.GetNumberOfBytes());
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const PixelType* pixels = this->Image->GetBufferPointer();
+    const unsigned int numberOfThreads = std::min(this->NumberOfThreads, std::max(height, 1u));
+
+    // Every thread assigns a block of rows and keeps its changes to the statistics to itself. The sums of integer colors
+    // are exact, so the statistics do not depend on the number of threads.
+    std::vector<HardAssignmentMixture> foregroundChanges(numberOfThreads);
+    std::vector<HardAssignmentMixture> backgroundChanges(numberOfThreads);
+    std::vector<unsigned int> threadReassignedPixels(numberOfThreads);
+    auto assignRows = [&](const unsigned int thread)
+    {
+        HardAssignmentMixture& foregroundChange = foregroundChanges[thread];
+        HardAssignmentMixture& backgroundChange = backgroundChanges[thread];
+        foregroundChange.Initialize(dimensionality, this->ForegroundModels.GetNumberOfModels());
+        backgroundChange.Initialize(dimensionality, this->BackgroundModels.GetNumberOfModels());
+
+        std::vector<double> point(dimensionality);
+        unsigned int reassignedPixels = 0;
+        const unsigned int begin = static_cast<unsigned long long>(height) * thread / numberOfThreads;
+        const unsigned int end = static_cast<unsigned long long>(height) * (thread + 1) / numberOfThreads;
+        for(unsigned int y = begin; y < end; ++y)
+        {
+            const BitMask::WordType* row = this->SegmentationBits.GetRow(y);
+            const BitMask::WordType* assignedRow = this->AssignedBits.GetRow(y);
+            const size_t rowOffset = static_cast<size_t>(y) * width;
+            for(unsigned int x = 0; x < width; ++x)
+            {
+                const bool isForeground = (row[x / BitMask::BitsPerWord] >> (x % BitMask::BitsPerWord)) & 1;
+                const bool wasForeground = (assignedRow[x / BitMask::BitsPerWord] >> (x % BitMask::BitsPerWord)) & 1;
+                for(unsigned int d = 0; d < dimensionality; ++d)
+                {
+                    point[d] = pixels[rowOffset + x][d];
+                }
+
+                const HardAssignmentMixture& mixture = isForeground ? this->ForegroundAssignment : this->BackgroundAssignment;
+                const unsigned char component = mixture.FindMostLikelyComponent(point.data());
+                unsigned char& label = this->ComponentLabels[rowOffset + x];
+                if(component == label && isForeground == wasForeground)
+                {
+                    continue;
+                }
+
+                // Only a pixel that moved takes itself out of its old component and adds itself to its new one
+                if(label != noComponent)
+                {
+                    HardAssignmentMixture& oldChange = wasForeground ? foregroundChange : backgroundChange;
+                    oldChange.AddPoint(point.data(), label, -1);
+                }
+                HardAssignmentMixture& change = isForeground ? foregroundChange : backgroundChange;
+                change.AddPoint(point.data(), component, 1);
+                label = component;
+                reassignedPixels++;
+            }
+        }
+        threadReassignedPixels[thread] = reassignedPixels;
+    };
+
+    unsigned int numberOfRoundsRun = 0;
+    unsigned long long totalReassignedPixels = 0;
+    unsigned int reassignedPixels = 0;
+    for(unsigned int round = 0; round < numberOfRounds; ++round)
+    {
+        this->ForegroundAssignment.SetMixtureModel(this->ForegroundModels);
+        this->BackgroundAssignment.SetMixtureModel(this->BackgroundModels);
+
+        std::vector<std::thread> threads;
+        for(unsigned int thread = 1; thread < numberOfThreads; ++thread)
+        {
+            threads.push_back(std::thread(assignRows, thread));
+        }
+        assignRows(0);
+        for(unsigned int i = 0; i < threads.size(); ++i)
+        {
+            threads[i].join();
+        }
+
+        reassignedPixels = 0;
+        for(unsigned int thread = 0; thread < numberOfThreads; ++thread)
+        {
+            this->ForegroundAssignment.AddStatistics(foregroundChanges[thread]);
+            this->BackgroundAssignment.AddStatistics(backgroundChanges[thread]);
+            reassignedPixels += threadReassignedPixels[thread];
+        }
+        this->AssignedBits = this->SegmentationBits;
+
+        this->ForegroundAssignment.UpdateMixtureModel(this->ForegroundModels);
+        this->BackgroundAssignment.UpdateMixtureModel(this->BackgroundModels);
+
+        GRABCUT_TRACE_COUNTER("reassigned pixels", reassignedPixels);
+        numberOfRoundsRun++;
+        totalReassignedPixels += reassignedPixels;
+        if(reassignedPixels == 0)
+        {
+            break;
+        }
+    }
+    progress << "Hard assignment: " << numberOfRoundsRun << " rounds, " << totalReassignedPixels
+             << " pixels changed component (" << reassignedPixels << " in the last round)" << std::endl;
+    AddStageDuration(GrabCutStageEnum::COMPONENT_ASSIGNMENT, start);
+}
+
+template <typename TImage>
+void GrabCut<TImage>::ClearComponentLabels()
+{
+    this->ComponentLabels = std::vector<unsigned char>();
+    this->AssignedBits = BitMask();
+}
+
 template <typename TImage>
 void GrabCut<TImage>::ClusterForegroundAndBackground()
 {
-    // Foreground
-    std::vector<itk::Index<2> > foregroundPixelIndices =
-        ITKHelpers::GetPixelsWithValue(this->SegmentationMask.GetPointer(), ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+    if(this->MixtureFitting == MixtureFittingEnum::HARD_ASSIGNMENT)
+    {
+        FitByHardAssignment(this->NumberOfEMIterations, GetProgressStream());
+    }
+    else
+    {
+        PartitionPixels();
+        ClusterForeground(this->NumberOfEMIterations, GetProgressStream());
+        ClusterBackground(this->NumberOfEMIterations, GetProgressStream());
+    }
+    UpdateLikelihoods(GetProgressStream());
+}
 
-    std::vector<typename TImage::PixelType> foregroundPixels = ITKHelpers::GetPixelValues(this->Image.GetPointer(), foregroundPixelIndices);
+template <typename TImage>
+std::ostream& GrabCut<TImage>::GetProgressStream()
+{
+    if(this->Verbose)
+    {
+        return std::cout;
+    }
+    return this->SilentStream;
+}
 
-    std::cout << "Starting foreground EM..." << std::endl;
-    this->ForegroundModels = ClusterPixels(foregroundPixels, this->ForegroundModels);
+template <typename TImage>
+void GrabCut<TImage>::UpdateLikelihoods(std::ostream& progress)
+{
+    if(PixelType::Dimension != 3)
+    {
+        return; // The mixture models are evaluated directly
+    }
 
-    // Background
-    std::vector<itk::Index<2> > backgroundPixelIndices =
-        ITKHelpers::GetPixelsWithValue(this->SegmentationMask.GetPointer(), ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+    this->ForegroundEvaluator.SetMixtureModel(this->ForegroundModels);
+    this->BackgroundEvaluator.SetMixtureModel(this->BackgroundModels);
 
-    std::vector<typename TImage::PixelType> backgroundPixels = ITKHelpers::GetPixelValues(this->Image.GetPointer(), backgroundPixelIndices);
+    if(this->LikelihoodCacheMode == LikelihoodCacheModeEnum::NONE)
+    {
+        return;
+    }
+
+    if(this->LikelihoodCacheMode == LikelihoodCacheModeEnum::EXACT && !this->LikelihoodTableHasImageColors)
+    {
+        this->LikelihoodTable.SetColors(GetImageColors());
+        this->LikelihoodTableHasImageColors = true;
+        progress << "Likelihood cache holds " << this->LikelihoodTable.GetNumberOfColors() << " distinct colors." << std::endl;
+    }
+
+    this->LikelihoodTable.Build(this->ForegroundEvaluator, this->BackgroundEvaluator);
+}
+
+template <typename TImage>
+std::vector<unsigned int> GrabCut<TImage>::GetImageColors()
+{
+    // One bit per possible 24-bit color, so duplicate colors are collapsed without sorting every pixel
+    std::vector<unsigned long long> colorPresent((1u << 24) / 64, 0);
+
+    itk::ImageRegionConstIterator<TImage> imageIterator(this->Image, this->Image->GetLargestPossibleRegion());
+    while(!imageIterator.IsAtEnd())
+    {
+        const PixelType& pixel = imageIterator.Get();
+        const unsigned int color = (static_cast<unsigned int>(pixel[0]) << 16) |
+                                   (static_cast<unsigned int>(pixel[1]) << 8) |
+                                   static_cast<unsigned int>(pixel[2]);
+        colorPresent[color / 64] |= 1ull << (color % 64);
+        ++imageIterator;
+    }
+
+    std::vector<unsigned int> colors;
+    for(unsigned int word = 0; word < colorPresent.size(); ++word)
+    {
+        for(unsigned int bit = 0; bit < 64; ++bit)
+        {
+            if(colorPresent[word] & (1ull << bit))
+            {
+                colors.push_back(word * 64 + bit);
+            }
+        }
+    }
 
-    std::cout << "Starting background EM..." << std::endl;
-    this->BackgroundModels = ClusterPixels(backgroundPixels, this->BackgroundModels);
+    return colors;
 }
 
 template <typename TImage>
 void GrabCut<TImage>::PerformSegmentation()
 {
-  InitializeModels(5); // The GrabCut paper suggests using 5 models per mixture model
+  GRABCUT_TRACE_SCOPE("GrabCut segmentation");
+
+  this->Energies.clear();
+  this->FlippedPixels.clear();
+  this->StopReason = StopReasonEnum::NOT_RUN;
+  this->StageDurations.fill(0);
+  ClearComponentLabels();
+  ResetMemoryUsage();
+
+  const unsigned int width = this->Image->GetLargestPossibleRegion().GetSize()[0];
+  const unsigned int height = this->Image->GetLargestPossibleRegion().GetSize()[1];
+
+  if(this->SuperpixelSize > 0)
+  {
+      PerformSuperpixelSegmentation();
+  }
+  // Levels smaller than 32 pixels (across) are not worth it
+  else if(this->NumberOfPyramidLevels > 1 && width >= 64 && height >= 64)
+  {
+      PerformPyramidSegmentation();
+  }
+  else
+  {
+      InitializeModels(5); // The GrabCut paper suggests using 5 models per mixture model
+      Iterate(this->MaxIterations, this->NumberOfEMIterations);
+  }
+  FinishSnapshots();
+}
+
+template <typename TImage>
+void GrabCut<TImage>::RefineSegmentation(ForegroundBackgroundSegmentMask* const segmentation, const unsigned int bandWidth,
+                                         const unsigned int maxIterations)
+{
+    GRABCUT_TRACE_SCOPE("GrabCut refinement");
+
+    if(!HasMixtureModels())
+    {
+        throw std::runtime_error("GrabCut::RefineSegmentation: there are no mixture models to start from!");
+    }
+    if(segmentation->GetLargestPossibleRegion() != this->Image->GetLargestPossibleRegion() ||
+       this->InitialMask->GetLargestPossibleRegion() != this->Image->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("GrabCut::RefineSegmentation: the segmentation, the initial mask and the image must have the same size!");
+    }
+
+    this->Energies.clear();
+    this->FlippedPixels.clear();
+    this->StopReason = StopReasonEnum::NOT_RUN;
+    this->StageDurations.fill(0);
+    ClearComponentLabels();
+    ResetMemoryUsage();
+
+    // The first EM fits start from the current models and the given labels, so they only adapt to the new image
+    BitMask foreground;
+    foreground.FromMask(segmentation, ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND);
+    ConstrainToBand(foreground, bandWidth);
+    this->GraphIsBuilt = false;
+    Iterate(std::max(maxIterations, 1u), this->NumberOfEMIterations);
+
+    // The graph was built with the constraints of the band
+    this->RefinementSinks = BitMask();
+    this->RefinementSources = BitMask();
+    this->GraphIsBuilt = false;
+    FinishSnapshots();
+}
+
+template <typename TImage>
+double GrabCut<TImage>::ComputeMeanDataCost(const ForegroundBackgroundSegmentMask* const segmentation)
+{
+    const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+    if(segmentation->GetLargestPossibleRegion() != region)
+    {
+        throw std::runtime_error("GrabCut::ComputeMeanDataCost: the segmentation and the image must have the same size!");
+    }
+
+    // The likelihoods (and their cache) may still be those of another image
+    UpdateLikelihoods(GetProgressStream());
+
+    const unsigned int numberOfPixels = region.GetNumberOfPixels();
+    std::vector<float> foregroundCosts(numberOfPixels);
+    std::vector<float> backgroundCosts(numberOfPixels);
+    ComputeCosts(region, foregroundCosts.data(), backgroundCosts.data());
+
+    const ForegroundBackgroundSegmentMask::PixelType* labels = segmentation->GetBufferPointer();
+    double cost = 0;
+    for(unsigned int p = 0; p < numberOfPixels; ++p)
+    {
+        cost += labels[p] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND ? foregroundCosts[p] : backgroundCosts[p];
+    }
+
+    return numberOfPixels > 0 ? cost / numberOfPixels : 0;
+}
 
+template <typename TImage>
+void GrabCut<TImage>::Iterate(const unsigned int maxIterations, const unsigned int numberOfEMIterations)
+{
   unsigned int iteration = 0;
 
-  while(iteration < 10)
+  while(this->StopReason == StopReasonEnum::NOT_RUN)
   {
-      std::cout << "GrabCut iteration " << iteration << "..." << std::endl;
-      PerformIteration();
+      GetProgressStream() << "GrabCut iteration " << iteration << "..." << std::endl;
+      GRABCUT_TRACE_SCOPE("GrabCut iteration");
+      const unsigned int flippedPixels = PerformIteration(numberOfEMIterations);
+      const double energy = this->GraphCut.GetEnergy();
+
+      GetProgressStream() << "Energy " << energy << " (data " << this->GraphCut.GetDataEnergy() << ", smoothness "
+                          << this->GraphCut.GetSmoothnessEnergy() << "), " << flippedPixels << " pixels flipped" << std::endl;
+
+      this->StopReason = CheckStoppingCriteria(this->Energies, energy, flippedPixels, iteration, maxIterations);
+
+      this->Energies.push_back(energy);
+      this->FlippedPixels.push_back(flippedPixels);
 
-      // Get and write the result
-      std::stringstream ssOutput;
-      ssOutput << "result_" << iteration << ".png";
-      typename TImage::Pointer result = TImage::New();
-      this->GetSegmentedImage(result);
-      ITKHelpers::WriteImage(result.GetPointer(), ssOutput.str());
+      if(this->Snapshots)
+      {
+          WriteSnapshot(iteration);
+      }
 
       iteration++;
   }
 
+  GetProgressStream() << "GrabCut stopped after " << iteration << " iterations: " << GetStopReasonName(this->StopReason) << std::endl;
 }
 
 template <typename TImage>
-void GrabCut<TImage>::PerformIteration()
+StopReasonEnum GrabCut<TImage>::CheckStoppingCriteria(const std::vector<double>& previousEnergies, const double energy,
+                                                      const unsigned int flippedPixels, const unsigned int iteration,
+                                                      const unsigned int maxIterations) const
 {
-    ClusterForegroundAndBackground();
+    const unsigned int numberOfPixels = this->Image->GetLargestPossibleRegion().GetNumberOfPixels();
 
-    // The originally specified background pixels are the only ones that are definitely background (unless there is interactive refining performed)
-    std::vector<itk::Index<2> > backgroundPixels =
-        ITKHelpers::GetPixelsWithValue(this->InitialMask.GetPointer(), ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND);
+    // The first iteration has no previous energy; the energy of a later one can only be compared to the one before. A rise
+    // also stops the iterations, but is reported as such rather than as convergence.
+    if(!previousEnergies.empty() && this->MinRelativeEnergyDecrease > 0)
+    {
+        if(energy > previousEnergies.back())
+        {
+            return StopReasonEnum::ENERGY_INCREASED;
+        }
+        if(previousEnergies.back() - energy < this->MinRelativeEnergyDecrease * std::abs(previousEnergies.back()))
+        {
+            return StopReasonEnum::ENERGY_CONVERGED;
+        }
+    }
+    if(flippedPixels <= this->MinFlippedPixelFraction * numberOfPixels)
+    {
+        return StopReasonEnum::MASK_CONVERGED;
+    }
+    if(iteration + 1 >= maxIterations)
+    {
+        return StopReasonEnum::MAX_ITERATIONS;
+    }
+    return StopReasonEnum::NOT_RUN;
+}
+
+template <typename TImage>
+void GrabCut<TImage>::CopySettingsTo(GrabCut<TImage>& other) const
+{
+    // The mixture models
+    other.NumberOfEMIterations = this->NumberOfEMIterations;
+    other.ModelInitialization = this->ModelInitialization;
+    other.Seed = this->Seed;
+    other.MixtureFitting = this->MixtureFitting;
+    other.EMSampleSize = this->EMSampleSize;
+    other.EMFullDataIteration = this->EMFullDataIteration;
+
+    // The graph and the iterations
+    other.NumberOfThreads = this->NumberOfThreads;
+    other.SetReuseGraph(this->ReuseGraph);
+    other.SetCropGraph(this->CropGraph);
+    other.MaxIterations = this->MaxIterations;
+    other.MinRelativeEnergyDecrease = this->MinRelativeEnergyDecrease;
+    other.MinFlippedPixelFraction = this->MinFlippedPixelFraction;
+    other.Verbose = this->Verbose;
+    other.MeasureStageResidentSetSizes = this->MeasureStageResidentSetSizes;
+
+    // The coarse to fine schemes
+    other.NumberOfPyramidLevels = this->NumberOfPyramidLevels;
+    other.PyramidBandWidth = this->PyramidBandWidth;
+    other.PyramidEMIterations = this->PyramidEMIterations;
+    other.SetSuperpixelSize(this->SuperpixelSize);
+    other.SetSuperpixelCompactness(this->SuperpixelCompactness);
+    other.SetSuperpixelBandWidth(this->SuperpixelBandWidth);
+
+    // The likelihood cache (the mode is only set if it is enabled, since enabling it checks the pixel type)
+    if(this->LikelihoodCacheMode != LikelihoodCacheModeEnum::NONE)
+    {
+        other.SetLikelihoodCacheMode(this->LikelihoodCacheMode);
+    }
+    other.SetLikelihoodCacheBitsPerChannel(this->LikelihoodTable.GetBitsPerChannel());
+
+    // The snapshots
+    other.SetSnapshotWriter(this->Snapshots, this->SnapshotFilePrefix);
+}
+
+template <typename TImage>
+void GrabCut<TImage>::PerformPyramidSegmentation()
+{
+    // Segment a half resolution copy of the image first, with one level less
+    GrabCut<TImage> coarse;
+    CopySettingsTo(coarse);
+    coarse.NumberOfPyramidLevels = this->NumberOfPyramidLevels - 1;
+    if(this->Snapshots)
+    {
+        coarse.SnapshotFilePrefix = this->SnapshotFilePrefix + "coarse_";
+    }
+
+    coarse.SetImage(DownsampleImage(this->Image.GetPointer()));
+    coarse.SetInitialMask(DownsampleMask(this->InitialMask.GetPointer()));
+    GetProgressStream() << "Pyramid level " << coarse.GetImage()->GetLargestPossibleRegion().GetSize() << "..." << std::endl;
+    coarse.PerformSegmentation();
+    for(unsigned int stage = 0; stage < this->StageDurations.size(); ++stage)
+    {
+        this->StageDurations[stage] += coarse.StageDurations[stage];
+        this->StageResidentSetSizes[stage] = std::max(this->StageResidentSetSizes[stage], coarse.StageResidentSetSizes[stage]);
+    }
+
+    // The coarser level held its structures on top of what this level holds (the image and the initial mask)
+    for(unsigned int structure = 0; structure < this->PeakMemory.size(); ++structure)
+    {
+        this->PeakMemory[structure] = std::max(this->PeakMemory[structure],
+                                               this->CurrentMemory[structure] + coarse.PeakMemory[structure]);
+    }
+    this->PeakTotalMemory = std::max(this->PeakTotalMemory, this->CurrentTotalMemory + coarse.PeakTotalMemory);
 
-    // Perform the graph cut
-    ImageGraphCut<TImage> graphCut;
-    graphCut.SetImage(this->Image);
-    graphCut.SetForegroundLikelihoodFunction(boost::bind(
-                &GrabCut::
-                ForegroundLikelihood, this, _1));
+    // The mixture models start from those of the coarser level
+    InitializeModels(coarse.ForegroundModels.GetNumberOfModels());
+    CopyModelParameters(coarse.ForegroundModels, this->ForegroundModels);
+    CopyModelParameters(coarse.BackgroundModels, this->BackgroundModels);
 
-    graphCut.SetBackgroundLikelihoodFunction(boost::bind(
-                &GrabCut::
-                BackgroundLikelihood, this, _1));
-    graphCut.SetSinks(backgroundPixels);
-    graphCut.PerformSegmentation();
+    // Only the band around the propagated boundary is cut again
+    GetProgressStream() << "Pyramid level " << this->Image->GetLargestPossibleRegion().GetSize() << "..." << std::endl;
+    PropagateSegmentation(coarse.SegmentationBits);
+    this->GraphIsBuilt = false;
 
-    ITKHelpers::DeepCopy(graphCut.GetSegmentMask(), this->SegmentationMask.GetPointer());
+    // Without EM the models do not change, and a second cut would give the same result
+    Iterate(this->PyramidEMIterations > 0 ? this->MaxIterations : 1, this->PyramidEMIterations);
+
+    // The graph was built with the constraints of the band
+    this->RefinementSinks = BitMask();
+    this->RefinementSources = BitMask();
+    this->GraphIsBuilt = false;
+}
+
+template <typename TImage>
+typename TImage::Pointer GrabCut<TImage>::DownsampleImage(const TImage* const image)
+{
+    typedef typename PixelType::ComponentType ComponentType;
+
+    const unsigned int width = image->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = image->GetLargestPossibleRegion().GetSize()[1];
+    itk::Size<2> size;
+    size[0] = (width + 1) / 2;
+    size[1] = (height + 1) / 2;
+
+    typename TImage::Pointer result = TImage::New();
+    result->SetRegions(itk::ImageRegion<2>(size));
+    result->Allocate();
+
+    // Each pixel is the mean of the (up to) 2x2 pixels it covers
+    const PixelType* pixels = image->GetBufferPointer();
+    PixelType* resultPixels = result->GetBufferPointer();
+    for(unsigned int y = 0; y < size[1]; ++y)
+    {
+        const unsigned int rows = std::min(2u, height - 2 * y);
+        for(unsigned int x = 0; x < size[0]; ++x)
+        {
+            const unsigned int columns = std::min(2u, width - 2 * x);
+            for(unsigned int c = 0; c < PixelType::Dimension; ++c)
+            {
+                double sum = 0;
+                for(unsigned int dy = 0; dy < rows; ++dy)
+                {
+                    for(unsigned int dx = 0; dx < columns; ++dx)
+                    {
+                        sum += pixels[(2 * y + dy) * width + 2 * x + dx][c];
+                    }
+                }
+                const double mean = sum / (rows * columns);
+                resultPixels[y * size[0] + x][c] =
+                    static_cast<ComponentType>(std::numeric_limits<ComponentType>::is_integer ? std::floor(mean + 0.5) : mean);
+            }
+        }
+    }
+
+    return result;
+}
+
+template <typename TImage>
+ForegroundBackgroundSegmentMask::Pointer GrabCut<TImage>::DownsampleMask(const ForegroundBackgroundSegmentMask* const mask)
+{
+    const unsigned int width = mask->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = mask->GetLargestPossibleRegion().GetSize()[1];
+    itk::Size<2> size;
+    size[0] = (width + 1) / 2;
+    size[1] = (height + 1) / 2;
+
+    ForegroundBackgroundSegmentMask::Pointer result = ForegroundBackgroundSegmentMask::New();
+    result->SetRegions(itk::ImageRegion<2>(size));
+    result->Allocate();
+
+    // A pixel is only hard background if all of the pixels it covers are
+    const ForegroundBackgroundSegmentMask::PixelType* labels = mask->GetBufferPointer();
+    ForegroundBackgroundSegmentMask::PixelType* resultLabels = result->GetBufferPointer();
+    for(unsigned int y = 0; y < size[1]; ++y)
+    {
+        const unsigned int rows = std::min(2u, height - 2 * y);
+        for(unsigned int x = 0; x < size[0]; ++x)
+        {
+            const unsigned int columns = std::min(2u, width - 2 * x);
+            bool allBackground = true;
+            for(unsigned int dy = 0; dy < rows; ++dy)
+            {
+                for(unsigned int dx = 0; dx < columns; ++dx)
+                {
+                    allBackground &= labels[(2 * y + dy) * width + 2 * x + dx] == ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND;
+                }
+            }
+            resultLabels[y * size[0] + x] = allBackground ? ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND :
+                                                            ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND;
+        }
+    }
+
+    return result;
+}
+
+template <typename TImage>
+void GrabCut<TImage>::CopyModelParameters(const MixtureModel& source, MixtureModel& destination)
+{
+    for(unsigned int i = 0; i < source.GetNumberOfModels(); ++i)
+    {
+        destination.GetModel(i)->SetMean(source.GetModel(i)->GetMean());
+        destination.GetModel(i)->SetVariance(source.GetModel(i)->GetVariance());
+        destination.GetModel(i)->SetMixingCoefficient(source.GetModel(i)->GetMixingCoefficient());
+    }
+}
+
+template <typename TImage>
+void GrabCut<TImage>::PropagateSegmentation(const BitMask& coarseForeground)
+{
+    const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+    const unsigned int width = region.GetSize()[0];
+    const unsigned int height = region.GetSize()[1];
+
+    BitMask propagated;
+    propagated.SetSize(width, height);
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        for(unsigned int x = 0; x < width; ++x)
+        {
+            propagated.Set(x, y, coarseForeground.Get(x / 2, y / 2));
+        }
+    }
+
+    ConstrainToBand(propagated, this->PyramidBandWidth);
+}
+
+template <typename TImage>
+void GrabCut<TImage>::ConstrainToBand(const BitMask& foreground, const unsigned int bandWidth)
+{
+    const unsigned int numberOfPixels = this->Image->GetLargestPossibleRegion().GetNumberOfPixels();
+
+    // The pixels within a chessboard distance of bandWidth of the boundary of the segmentation: a dilation of the pixels
+    // on either side of it
+    BitMask band = foreground.GetBoundary();
+    band.Dilate(bandWidth);
+
+    // Outside of the band the labels become hard constraints, on top of the hard background of the initial mask
+    this->RefinementSinks = foreground;
+    this->RefinementSinks.Or(band);
+    this->RefinementSinks.Invert();
+    this->RefinementSinks.Or(this->HardBackground);
+    this->RefinementSources = foreground;
+    this->RefinementSources.AndNot(band);
+    this->RefinementSources.AndNot(this->HardBackground);
+
+    band.AndNot(this->HardBackground);
+    GetProgressStream() << "Refining " << band.Count() << " of " << numberOfPixels << " pixels." << std::endl;
+
+    this->SegmentationBits = foreground;
+    this->SegmentationMask = nullptr;
+
+    // The band is held until the constraints are made
+    UpdateHeldMemoryUsage();
+    const long long bandBytes = band.GetNumberOfBytes();
+    AddMemoryUsage(GrabCutMemoryEnum::MASKS, bandBytes);
+    AddMemoryUsage(GrabCutMemoryEnum::MASKS, -bandBytes);
+}
+
+template <typename TImage>
+void GrabCut<TImage>::PerformSuperpixelSegmentation()
+{
+    const itk::ImageRegion<2> region = this->Image->GetLargestPossibleRegion();
+    const unsigned int width = region.GetSize()[0];
+    const unsigned int height = region.GetSize()[1];
+    const unsigned int numberOfPixels = region.GetNumberOfPixels();
+
+    // The superpixels only depend on the image and the hard background, so they are kept across segmentations
+    if(!this->SuperpixelsAreComputed)
+    {
+        std::vector<unsigned char> hardBackground(numberOfPixels);
+        for(unsigned int y = 0; y < height; ++y)
+        {
+            for(unsigned int x = 0; x < width; ++x)
+            {
+                hardBackground[y * width + x] = this->HardBackground.Get(x, y);
+            }
+        }
+
+        this->SuperpixelSegmentation.SetSize(this->SuperpixelSize);
+        this->SuperpixelSegmentation.SetCompactness(this->SuperpixelCompactness);
+        this->SuperpixelSegmentation.SetNumberOfThreads(this->NumberOfThreads);
+        this->SuperpixelSegmentation.Compute(this->Image.GetPointer(), hardBackground.data());
+        this->SuperpixelsAreComputed = true;
+
+        // The clustering also held a float copy of every channel and the groups
+        const size_t clusteringBytes = static_cast<size_t>(numberOfPixels) * (PixelType::Dimension * sizeof(float) + 1);
+        SetMemoryUsage(GrabCutMemoryEnum::SUPERPIXELS, this->SuperpixelSegmentation.GetNumberOfBytes() + clusteringBytes);
+    }
+    UpdateHeldMemoryUsage();
+
+    const Superpixels& superpixels = this->SuperpixelSegmentation;
+    const unsigned int numberOfSuperpixels = superpixels.GetNumberOfSuperpixels();
+    const unsigned int numberOfChannels = superpixels.GetNumberOfChannels();
+    const std::vector<Superpixels::Edge>& edges = superpixels.GetEdges();
+
+    // Only the superpixels that are not hard background are graph nodes; the hard background ones are contracted into
+    // the sink, so their edges to a node are added to its sink t-link
+    const unsigned int noNode = std::numeric_limits<unsigned int>::max();
+    std::vector<unsigned int> nodes(numberOfSuperpixels, noNode);
+    std::vector<unsigned int> nodeSuperpixels;
+    for(unsigned int superpixel = 0; superpixel < numberOfSuperpixels; ++superpixel)
+    {
+        if(superpixels.GetGroup(superpixel) == 0)
+        {
+            nodes[superpixel] = nodeSuperpixels.size();
+            nodeSuperpixels.push_back(superpixel);
+        }
+    }
+    GetProgressStream() << numberOfSuperpixels << " superpixels, " << nodeSuperpixels.size() << " graph nodes." << std::endl;
+
+    // The edge weights gamma * |boundary| * exp(-beta |mean difference|^2), with beta = 1 / (2 <|mean difference|^2>)
+    // over the boundary pixel pairs
+    std::vector<double> squaredDifferences(edges.size(), 0.0);
+    double weightedSum = 0;
+    double totalLength = 0;
+    for(unsigned int e = 0; e < edges.size(); ++e)
+    {
+        const double* meanA = superpixels.GetMean(edges[e].A);
+        const double* meanB = superpixels.GetMean(edges[e].B);
+        for(unsigned int c = 0; c < numberOfChannels; ++c)
+        {
+            squaredDifferences[e] += (meanA[c] - meanB[c]) * (meanA[c] - meanB[c]);
+        }
+        weightedSum += edges[e].BoundaryLength * squaredDifferences[e];
+        totalLength += edges[e].BoundaryLength;
+    }
+    const double beta = weightedSum > 0 ? totalLength / (2 * weightedSum) : 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    GraphMaxFlow graph;
+    graph.Initialize(nodeSuperpixels.size());
+    std::vector<float> weights(edges.size());
+    std::vector<float> contractedSinkCapacities(nodeSuperpixels.size(), 0.0f);
+    for(unsigned int e = 0; e < edges.size(); ++e)
+    {
+        weights[e] = this->Smoothness.GetGamma() * edges[e].BoundaryLength * std::exp(-beta * squaredDifferences[e]);
+        const unsigned int nodeA = nodes[edges[e].A];
+        const unsigned int nodeB = nodes[edges[e].B];
+        if(nodeA != noNode && nodeB != noNode)
+        {
+            graph.AddEdge(nodeA, nodeB, weights[e]);
+        }
+        else if(nodeA != noNode)
+        {
+            contractedSinkCapacities[nodeA] += weights[e];
+        }
+        else if(nodeB != noNode)
+        {
+            contractedSinkCapacities[nodeB] += weights[e];
+        }
+    }
+
+    AddStageDuration(GrabCutStageEnum::GRAPH_BUILD, start);
+
+    // Everything that is not hard background starts as foreground
+    std::vector<unsigned char> isForeground(numberOfSuperpixels);
+    for(unsigned int superpixel = 0; superpixel < numberOfSuperpixels; ++superpixel)
+    {
+        isForeground[superpixel] = nodes[superpixel] != noNode;
+    }
+
+    InitializeModels(5);
+
+    std::vector<float> foregroundCosts;
+    std::vector<float> backgroundCosts;
+    std::vector<double> energies;
+    StopReasonEnum stopReason = StopReasonEnum::NOT_RUN;
+    for(unsigned int iteration = 0; stopReason == StopReasonEnum::NOT_RUN; ++iteration)
+    {
+        start = std::chrono::steady_clock::now();
+        this->ForegroundModels = ClusterSuperpixels(isForeground, true, this->ForegroundModels, this->NumberOfEMIterations);
+        AddStageDuration(GrabCutStageEnum::FOREGROUND_EM, start);
+        start = std::chrono::steady_clock::now();
+        this->BackgroundModels = ClusterSuperpixels(isForeground, false, this->BackgroundModels, this->NumberOfEMIterations);
+        AddStageDuration(GrabCutStageEnum::BACKGROUND_EM, start);
+        start = std::chrono::steady_clock::now();
+        ComputeSuperpixelCosts(foregroundCosts, backgroundCosts);
+        AddStageDuration(GrabCutStageEnum::LIKELIHOOD_UPDATE, start);
+
+        // A node on the sink side (background) cuts its source t-link and pays the background cost
+        start = std::chrono::steady_clock::now();
+        for(unsigned int node = 0; node < nodeSuperpixels.size(); ++node)
+        {
+            const unsigned int superpixel = nodeSuperpixels[node];
+            const float sourceCapacity = backgroundCosts[superpixel];
+            const float sinkCapacity = foregroundCosts[superpixel] + contractedSinkCapacities[node];
+            const float common = std::min(sourceCapacity, sinkCapacity);
+            graph.SetTerminalCapacities(node, sourceCapacity - common, sinkCapacity - common);
+        }
+        AddStageDuration(GrabCutStageEnum::GRAPH_BUILD, start);
+        start = std::chrono::steady_clock::now();
+        graph.ComputeMaxFlow();
+        AddStageDuration(GrabCutStageEnum::MAX_FLOW, start);
+
+        unsigned int flippedPixels = 0;
+        double energy = 0;
+        for(unsigned int node = 0; node < nodeSuperpixels.size(); ++node)
+        {
+            const unsigned int superpixel = nodeSuperpixels[node];
+            const bool foreground = graph.IsSource(node);
+            if(foreground != static_cast<bool>(isForeground[superpixel]))
+            {
+                flippedPixels += superpixels.GetPixelCount(superpixel);
+            }
+            isForeground[superpixel] = foreground;
+            energy += foreground ? foregroundCosts[superpixel] + contractedSinkCapacities[node] : backgroundCosts[superpixel];
+        }
+        for(unsigned int e = 0; e < edges.size(); ++e)
+        {
+            if(nodes[edges[e].A] != noNode && nodes[edges[e].B] != noNode && isForeground[edges[e].A] != isForeground[edges[e].B])
+            {
+                energy += weights[e];
+            }
+        }
+
+        GetProgressStream() << "Superpixel iteration " << iteration << ": energy " << energy << ", " << flippedPixels
+                            << " pixels flipped" << std::endl;
+
+        stopReason = CheckStoppingCriteria(energies, energy, flippedPixels, iteration, this->MaxIterations);
+        energies.push_back(energy);
+    }
+    GetProgressStream() << "Superpixel iterations stopped after " << energies.size() << " iterations: "
+                        << GetStopReasonName(stopReason) << std::endl;
+
+    // Cut the pixels along the boundary of the superpixel segmentation once, with the models fitted to the superpixels
+    BitMask segmentation;
+    segmentation.SetSize(width, height);
+    const std::vector<unsigned int>& superpixelLabels = superpixels.GetLabels();
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        for(unsigned int x = 0; x < width; ++x)
+        {
+            segmentation.Set(x, y, isForeground[superpixelLabels[y * width + x]]);
+        }
+    }
+
+    ConstrainToBand(segmentation, this->SuperpixelBandWidth);
+    this->GraphIsBuilt = false;
+    Iterate(1, 0);
+
+    // The graph was built with the constraints of the band
+    this->RefinementSinks = BitMask();
+    this->RefinementSources = BitMask();
+    this->GraphIsBuilt = false;
+    this->StopReason = stopReason;
+}
+
+template <typename TImage>
+MixtureModel GrabCut<TImage>::ClusterSuperpixels(const std::vector<unsigned char>& isForeground, const bool foreground,
+                                                  const MixtureModel& mixtureModel, const unsigned int numberOfEMIterations)
+{
+    const Superpixels& superpixels = this->SuperpixelSegmentation;
+    const unsigned int numberOfChannels = superpixels.GetNumberOfChannels();
+    const unsigned int scatterSize = superpixels.GetScatterSize();
+
+    std::vector<unsigned int> selected;
+    for(unsigned int superpixel = 0; superpixel < isForeground.size(); ++superpixel)
+    {
+        if(static_cast<bool>(isForeground[superpixel]) == foreground)
+        {
+            selected.push_back(superpixel);
+        }
+    }
+
+    Eigen::MatrixXd data(numberOfChannels, selected.size());
+    Eigen::VectorXd weights(selected.size());
+    Eigen::MatrixXd scatters(scatterSize, selected.size());
+    for(unsigned int i = 0; i < selected.size(); ++i)
+    {
+        data.col(i) = Eigen::Map<const Eigen::VectorXd>(superpixels.GetMean(selected[i]), numberOfChannels);
+        weights(i) = superpixels.GetPixelCount(selected[i]);
+        scatters.col(i) = Eigen::Map<const Eigen::VectorXd>(superpixels.GetScatter(selected[i]), scatterSize);
+    }
+
+    ParallelExpectationMaximization expectationMaximization;
+    expectationMaximization.SetData(data);
+    expectationMaximization.SetWeights(weights);
+    expectationMaximization.SetScatters(scatters);
+    expectationMaximization.SetMixtureModel(mixtureModel);
+    expectationMaximization.SetInitialization(this->ModelInitialization);
+    expectationMaximization.SetSeed(this->Seed);
+    expectationMaximization.SetMinChange(1e-4);
+    expectationMaximization.SetMaxIterations(numberOfEMIterations);
+    expectationMaximization.SetNumberOfThreads(this->NumberOfThreads);
+    const long long emBytes = (data.size() + weights.size() + scatters.size()) * sizeof(double) +
+                              expectationMaximization.GetNumberOfBytes();
+    AddMemoryUsage(GrabCutMemoryEnum::EM_MATRICES, emBytes);
+    expectationMaximization.Compute();
+    AddMemoryUsage(GrabCutMemoryEnum::EM_MATRICES, -emBytes);
+
+    GRABCUT_TRACE_COUNTER("EM iterations", expectationMaximization.GetNumberOfIterations());
+    GetProgressStream() << (foreground ? "Foreground" : "Background") << " EM on " << selected.size() << " superpixels: "
+                        << expectationMaximization.GetNumberOfIterations() << " iterations" << std::endl;
+
+    return expectationMaximization.GetMixtureModel();
+}
+
+template <typename TImage>
+void GrabCut<TImage>::ComputeSuperpixelCosts(std::vector<float>& foregroundCosts, std::vector<float>& backgroundCosts)
+{
+    const Superpixels& superpixels = this->SuperpixelSegmentation;
+    const unsigned int numberOfSuperpixels = superpixels.GetNumberOfSuperpixels();
+    const unsigned int numberOfChannels = superpixels.GetNumberOfChannels();
+    foregroundCosts.resize(numberOfSuperpixels);
+    backgroundCosts.resize(numberOfSuperpixels);
+
+    if(numberOfChannels == 3)
+    {
+        std::vector<float> red(numberOfSuperpixels);
+        std::vector<float> green(numberOfSuperpixels);
+        std::vector<float> blue(numberOfSuperpixels);
+        for(unsigned int superpixel = 0; superpixel < numberOfSuperpixels; ++superpixel)
+        {
+            red[superpixel] = superpixels.GetMean(superpixel)[0];
+            green[superpixel] = superpixels.GetMean(superpixel)[1];
+            blue[superpixel] = superpixels.GetMean(superpixel)[2];
+        }
+
+        this->ForegroundEvaluator.SetMixtureModel(this->ForegroundModels);
+        this->BackgroundEvaluator.SetMixtureModel(this->BackgroundModels);
+        this->ForegroundEvaluator.EvaluateNegativeLogLikelihood(red.data(), green.data(), blue.data(), numberOfSuperpixels,
+                                                                foregroundCosts.data());
+        this->BackgroundEvaluator.EvaluateNegativeLogLikelihood(red.data(), green.data(), blue.data(), numberOfSuperpixels,
+                                                                backgroundCosts.data());
+    }
+    else
+    {
+        const float smallestLikelihood = std::numeric_limits<float>::min();
+        for(unsigned int superpixel = 0; superpixel < numberOfSuperpixels; ++superpixel)
+        {
+            const Eigen::VectorXd mean = Eigen::Map<const Eigen::VectorXd>(superpixels.GetMean(superpixel), numberOfChannels);
+            foregroundCosts[superpixel] = -std::log(std::max<float>(this->ForegroundModels.WeightedEvaluate(mean), smallestLikelihood));
+            backgroundCosts[superpixel] = -std::log(std::max<float>(this->BackgroundModels.WeightedEvaluate(mean), smallestLikelihood));
+        }
+    }
+
+    // Every pixel of a superpixel is given the cost of the mean color
+    for(unsigned int superpixel = 0; superpixel < numberOfSuperpixels; ++superpixel)
+    {
+        foregroundCosts[superpixel] *= superpixels.GetPixelCount(superpixel);
+        backgroundCosts[superpixel] *= superpixels.GetPixelCount(superpixel);
+    }
+}
+
+template <typename TImage>
+void GrabCut<TImage>::WriteSnapshot(const unsigned int iteration)
+{
+    // Only the bits are copied (one bit per pixel); the mask is made on the writer thread, and not at all if the queue is
+    // full and the snapshot is dropped
+    const BitMask bits = this->SegmentationBits;
+    typename TImage::Pointer image = this->Image;
+    const unsigned int dimensionality = this->GetDimensionality();
+
+    std::stringstream ssOutput;
+    ssOutput << this->SnapshotFilePrefix << iteration << ".png";
+    const std::string fileName = ssOutput.str();
+
+    const bool queued = this->Snapshots->Submit([bits, image, dimensionality, fileName]()
+    {
+        ForegroundBackgroundSegmentMask::Pointer mask = bits.ToMask();
+        typename TImage::Pointer result = TImage::New();
+        ITKHelpers::DeepCopy(image.GetPointer(), result.GetPointer());
+        typename TImage::PixelType backgroundColor(dimensionality);
+        backgroundColor.Fill(0);
+        mask->ApplyToImage(result.GetPointer(), backgroundColor);
+        ITKHelpers::WriteImage(result.GetPointer(), fileName);
+    });
+
+    if(!queued)
+    {
+        GetProgressStream() << "Snapshot writer is busy, skipped " << fileName << std::endl;
+    }
+}
+
+template <typename TImage>
+void GrabCut<TImage>::FinishSnapshots()
+{
+    if(this->Snapshots && this->ImageIsWrappedBuffer)
+    {
+        this->Snapshots->Flush();
+    }
+}
+
+template <typename TImage>
+const char* GrabCut<TImage>::GetStopReasonName(const StopReasonEnum stopReason)
+{
+    switch(stopReason)
+    {
+        case StopReasonEnum::MAX_ITERATIONS:
+            return "maximum number of iterations reached";
+        case StopReasonEnum::ENERGY_CONVERGED:
+            return "energy converged";
+        case StopReasonEnum::ENERGY_INCREASED:
+            return "energy increased";
+        case StopReasonEnum::MASK_CONVERGED:
+            return "segmentation converged";
+        default:
+            return "not run";
+    }
+}
+
+template <typename TImage>
+const char* GrabCut<TImage>::GetStageName(const GrabCutStageEnum stage)
+{
+    switch(stage)
+    {
+        case GrabCutStageEnum::MASK_SCAN:
+            return "mask scan";
+        case GrabCutStageEnum::MATRIX_PACKING:
+            return "matrix packing";
+        case GrabCutStageEnum::FOREGROUND_EM:
+            return "foreground EM";
+        case GrabCutStageEnum::BACKGROUND_EM:
+            return "background EM";
+        case GrabCutStageEnum::COMPONENT_ASSIGNMENT:
+            return "component assignment";
+        case GrabCutStageEnum::LIKELIHOOD_UPDATE:
+            return "likelihood update";
+        case GrabCutStageEnum::GRAPH_BUILD:
+            return "graph build";
+        case GrabCutStageEnum::MAX_FLOW:
+            return "max flow";
+        case GrabCutStageEnum::MASK_COPY_BACK:
+            return "mask copy-back";
+        case GrabCutStageEnum::ENERGY:
+            return "energy";
+        default:
+            return "unknown";
+    }
+}
+
+template <typename TImage>
+void GrabCut<TImage>::AddStageDuration(const GrabCutStageEnum stage, const std::chrono::steady_clock::time_point& start)
+{
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    GRABCUT_TRACE_EVENT(GetStageName(stage), start, end);
+
+    const double duration = std::chrono::duration<double>(end - start).count();
+    const size_t residentSetSize = this->MeasureStageResidentSetSizes ? MemoryUsage::GetResidentSetSize() : 0;
+    std::lock_guard<std::mutex> lock(this->StageDurationsMutex);
+    this->StageDurations[static_cast<unsigned int>(stage)] += duration;
+    size_t& stageResidentSetSize = this->StageResidentSetSizes[static_cast<unsigned int>(stage)];
+    stageResidentSetSize = std::max(stageResidentSetSize, residentSetSize);
+}
+
+template <typename TImage>
+const char* GrabCut<TImage>::GetMemoryStructureName(const GrabCutMemoryEnum structure)
+{
+    switch(structure)
+    {
+        case GrabCutMemoryEnum::IMAGE:
+            return "image";
+        case GrabCutMemoryEnum::MASKS:
+            return "masks";
+        case GrabCutMemoryEnum::EM_MATRICES:
+            return "EM matrices";
+        case GrabCutMemoryEnum::N_LINK_WEIGHTS:
+            return "n-link weights";
+        case GrabCutMemoryEnum::GRAPH:
+            return "graph";
+        case GrabCutMemoryEnum::SOLVER_QUEUES:
+            return "solver queues";
+        case GrabCutMemoryEnum::LIKELIHOODS:
+            return "likelihoods";
+        case GrabCutMemoryEnum::SUPERPIXELS:
+            return "superpixels";
+        default:
+            return "unknown";
+    }
+}
+
+template <typename TImage>
+size_t GrabCut<TImage>::EstimateMemoryUsage(const itk::Size<2>& size, const GrabCutMemoryEnum structure) const
+{
+    const size_t numberOfPixels = static_cast<size_t>(size[0]) * size[1];
+    const size_t numberOfChannels = PixelType::Dimension;
+    const size_t channelBytes = numberOfPixels * numberOfChannels * sizeof(float);
+    const size_t maskPixelBytes = sizeof(ForegroundBackgroundSegmentMask::PixelType);
+    const size_t bitMaskBytes = static_cast<size_t>((size[0] + BitMask::BitsPerWord - 1) / BitMask::BitsPerWord) *
+                                size[1] * sizeof(BitMask::WordType);
+    const size_t scatterSize = numberOfChannels * (numberOfChannels + 1) / 2;
+    const size_t pixelsPerSuperpixel = static_cast<size_t>(this->SuperpixelSize) * this->SuperpixelSize;
+    const size_t numberOfSuperpixels = this->SuperpixelSize > 0 ? numberOfPixels / pixelsPerSuperpixel + 1 : 0;
+
+    // Pyramid levels and superpixel segmentations end with a band refinement
+    const bool refinesBand = this->NumberOfPyramidLevels > 1 || this->SuperpixelSize > 0;
+
+    switch(structure)
+    {
+        case GrabCutMemoryEnum::IMAGE:
+            return numberOfPixels * sizeof(PixelType);
+        case GrabCutMemoryEnum::MASKS:
+            // The initial mask and the segmentation mask that is handed out, and the bits of the hard background, the last
+            // segmentation and the new one; a band refinement adds the bits of the segmentation it starts from, of its band
+            // and of its two constraints, and the hard assignment the component of every pixel and the labels it counted
+            if(this->MixtureFitting == MixtureFittingEnum::HARD_ASSIGNMENT && this->SuperpixelSize == 0)
+            {
+                return 2 * numberOfPixels * maskPixelBytes + (refinesBand ? 8 : 4) * bitMaskBytes + numberOfPixels;
+            }
+            return 2 * numberOfPixels * maskPixelBytes + (refinesBand ? 7 : 3) * bitMaskBytes;
+        case GrabCutMemoryEnum::EM_MATRICES:
+            // Every pixel is packed into the matrix of one label, which the EM works on without copying, with the
+            // statistics of every chunk of 4096 pixels (5 components) of both fits, and the subsamples of both labels
+            // (superpixels: their means, sizes and scatters, and the copy the EM works on)
+            if(this->SuperpixelSize > 0)
+            {
+                return 4 * numberOfSuperpixels * (numberOfChannels + 1 + scatterSize) * sizeof(double);
+            }
+            return (numberOfPixels * numberOfChannels + (numberOfPixels / 4096 + 2) * (5 * (1 + numberOfChannels + scatterSize) + 1) +
+                    2 * std::min<size_t>(this->EMSampleSize, numberOfPixels) * numberOfChannels) * sizeof(double);
+        case GrabCutMemoryEnum::N_LINK_WEIGHTS:
+            return numberOfPixels * (this->Smoothness.GetEightConnected() ? 4 : 2) * sizeof(float) + channelBytes;
+        case GrabCutMemoryEnum::GRAPH:
+            // The grid, the constraints, and the contracted and applied t-link capacities of every pixel
+            return numberOfPixels * (GridMaxFlow::GetBytesPerNode(this->Smoothness.GetEightConnected()) +
+                                     sizeof(unsigned char) + 4 * sizeof(float));
+        case GrabCutMemoryEnum::SOLVER_QUEUES:
+            return GridMaxFlow::GetMaxQueueBytes(numberOfPixels);
+        case GrabCutMemoryEnum::LIKELIHOODS:
+        {
+            // The costs of every node while the t-links are filled, and the cache with what building it takes
+            // (the colors of its entries and their costs under each model)
+            size_t bytes = 2 * numberOfPixels * sizeof(float);
+            if(this->LikelihoodCacheMode == LikelihoodCacheModeEnum::QUANTIZED)
+            {
+                const size_t numberOfEntries = static_cast<size_t>(1) << (3 * this->LikelihoodTable.GetBitsPerChannel());
+                bytes += numberOfEntries * 7 * sizeof(float);
+            }
+            else if(this->LikelihoodCacheMode == LikelihoodCacheModeEnum::EXACT)
+            {
+                const size_t numberOfColors = std::min<size_t>(numberOfPixels, 1u << 24);
+                bytes += numberOfColors * (7 * sizeof(float) + sizeof(unsigned char) + 2 * sizeof(unsigned int)) +
+                         (256 * 256 + 1) * sizeof(unsigned int) + (1u << 24) / 8;
+            }
+            return bytes;
+        }
+        case GrabCutMemoryEnum::SUPERPIXELS:
+            // The labels and the statistics, and while clustering a float copy of every channel and the groups
+            if(this->SuperpixelSize == 0)
+            {
+                return 0;
+            }
+            return numberOfPixels * (sizeof(unsigned int) + sizeof(unsigned char)) + channelBytes +
+                   numberOfSuperpixels * (sizeof(unsigned int) + (numberOfChannels + scatterSize) * sizeof(double) +
+                                          (2 + numberOfChannels) * sizeof(float) + 4 * sizeof(Superpixels::Edge));
+        default:
+            return 0;
+    }
+}
+
+template <typename TImage>
+size_t GrabCut<TImage>::EstimateMemoryUsage(const itk::Size<2>& size) const
+{
+    // The coarser pyramid levels are segmented before this level builds anything but its masks, and need less
+    size_t bytes = 0;
+    for(unsigned int structure = 0; structure < static_cast<unsigned int>(GrabCutMemoryEnum::NUMBER_OF_STRUCTURES); ++structure)
+    {
+        bytes += EstimateMemoryUsage(size, static_cast<GrabCutMemoryEnum>(structure));
+    }
+    return bytes;
+}
+
+template <typename TImage>
+void GrabCut<TImage>::AddMemoryUsage(const GrabCutMemoryEnum structure, const long long bytes)
+{
+    const unsigned int index = static_cast<unsigned int>(structure);
+    std::lock_guard<std::mutex> lock(this->MemoryMutex);
+    this->CurrentMemory[index] += bytes;
+    this->CurrentTotalMemory += bytes;
+    this->PeakMemory[index] = std::max(this->PeakMemory[index], this->CurrentMemory[index]);
+    this->PeakTotalMemory = std::max(this->PeakTotalMemory, this->CurrentTotalMemory);
+}
+
+template <typename TImage>
+void GrabCut<TImage>::SetMemoryUsage(const GrabCutMemoryEnum structure, const size_t bytes)
+{
+    const unsigned int index = static_cast<unsigned int>(structure);
+    std::lock_guard<std::mutex> lock(this->MemoryMutex);
+    this->CurrentTotalMemory = this->CurrentTotalMemory - this->CurrentMemory[index] + bytes;
+    this->CurrentMemory[index] = bytes;
+    this->PeakMemory[index] = std::max(this->PeakMemory[index], bytes);
+    this->PeakTotalMemory = std::max(this->PeakTotalMemory, this->CurrentTotalMemory);
+}
+
+template <typename TImage>
+void GrabCut<TImage>::RecordTransientMemoryUsage(const GrabCutMemoryEnum structure, const size_t bytes)
+{
+    AddMemoryUsage(structure, bytes);
+    AddMemoryUsage(structure, -static_cast<long long>(bytes));
+}
+
+template <typename TImage>
+void GrabCut<TImage>::UpdateHeldMemoryUsage()
+{
+    SetMemoryUsage(GrabCutMemoryEnum::IMAGE, this->Image->GetLargestPossibleRegion().GetNumberOfPixels() * sizeof(PixelType));
+
+    // The initial mask is the segmentation mask until the first cut
+    size_t maskBytes = this->HardBackground.GetNumberOfBytes() + this->SegmentationBits.GetNumberOfBytes() +
+                       this->RefinementSinks.GetNumberOfBytes() + this->RefinementSources.GetNumberOfBytes() +
+                       this->GraphCut.GetSegmentBits().GetNumberOfBytes() + this->AssignedBits.GetNumberOfBytes() +
+                       this->ComponentLabels.size();
+    if(this->InitialMask)
+    {
+        maskBytes += this->InitialMask->GetLargestPossibleRegion().GetNumberOfPixels() * sizeof(ForegroundBackgroundSegmentMask::PixelType);
+    }
+    if(this->SegmentationMask && this->SegmentationMask != this->InitialMask)
+    {
+        maskBytes += this->SegmentationMask->GetLargestPossibleRegion().GetNumberOfPixels() * sizeof(ForegroundBackgroundSegmentMask::PixelType);
+    }
+    SetMemoryUsage(GrabCutMemoryEnum::MASKS, maskBytes);
+
+    SetMemoryUsage(GrabCutMemoryEnum::N_LINK_WEIGHTS, this->Smoothness.GetNumberOfBytes());
+    SetMemoryUsage(GrabCutMemoryEnum::GRAPH, this->GraphCut.GetNumberOfBytes());
+    SetMemoryUsage(GrabCutMemoryEnum::LIKELIHOODS, this->LikelihoodTable.GetNumberOfBytes());
+    SetMemoryUsage(GrabCutMemoryEnum::SUPERPIXELS, this->SuperpixelSegmentation.GetNumberOfBytes());
+}
+
+template <typename TImage>
+void GrabCut<TImage>::ResetMemoryUsage()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->MemoryMutex);
+        this->CurrentMemory.fill(0);
+        this->PeakMemory.fill(0);
+        this->CurrentTotalMemory = 0;
+        this->PeakTotalMemory = 0;
+    }
+    this->StageResidentSetSizes.fill(0);
+    UpdateHeldMemoryUsage();
+}
+
+template <typename TImage>
+unsigned int GrabCut<TImage>::PerformIteration(const unsigned int numberOfEMIterations)
+{
+    // Only the t-links change between iterations, so a graph that is kept keeps its n-links and its flow
+    const bool updateGraph = this->ReuseGraph && this->GraphIsBuilt;
+
+    // The two EM fits and the graph topology/n-links are independent of each other; only the t-links need all of them.
+    // The fits and the likelihood update report on their own streams, which are printed once the iteration is done.
+    std::stringstream foregroundProgress;
+    std::stringstream backgroundProgress;
+    std::stringstream likelihoodProgress;
+    TaskGraph iterationTasks;
+    std::vector<TaskGraph::TaskId> fits;
+    if(numberOfEMIterations > 0)
+    {
+        if(this->MixtureFitting == MixtureFittingEnum::HARD_ASSIGNMENT)
+        {
+            // A pixel that changes label moves between the statistics of both models, so they are fitted together
+            fits.push_back(iterationTasks.AddTask("Hard assignment", [this, numberOfEMIterations, &foregroundProgress]()
+            {
+                FitByHardAssignment(numberOfEMIterations, foregroundProgress);
+            }));
+        }
+        else
+        {
+            // Both fits take their pixels from one pass over the image
+            const TaskGraph::TaskId partition = iterationTasks.AddTask("Partition pixels", [this]() { PartitionPixels(); });
+            fits.push_back(iterationTasks.AddTask("Foreground EM", [this, numberOfEMIterations, &foregroundProgress]()
+            {
+                ClusterForeground(numberOfEMIterations, foregroundProgress);
+            }, {partition}));
+            fits.push_back(iterationTasks.AddTask("Background EM", [this, numberOfEMIterations, &backgroundProgress]()
+            {
+                ClusterBackground(numberOfEMIterations, backgroundProgress);
+            }, {partition}));
+        }
+    }
+
+    const TaskGraph::TaskId updateLikelihoods = iterationTasks.AddTask("Update likelihoods", [this, &likelihoodProgress]()
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        UpdateLikelihoods(likelihoodProgress);
+        AddStageDuration(GrabCutStageEnum::LIKELIHOOD_UPDATE, start);
+    }, fits);
+
+    // The t-links of the whole image are requested from ComputeCosts() in one call
+    if(updateGraph)
+    {
+        iterationTasks.AddTask("Update t-links", [this]()
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const long long costBytes = 2ll * this->GraphCut.GetNumberOfNodes() * sizeof(float);
+            AddMemoryUsage(GrabCutMemoryEnum::LIKELIHOODS, costBytes);
+            this->GraphCut.UpdateTerminalCapacities();
+            AddMemoryUsage(GrabCutMemoryEnum::LIKELIHOODS, -costBytes);
+            AddStageDuration(GrabCutStageEnum::GRAPH_BUILD, start);
+        }, {updateLikelihoods});
+    }
+    else
+    {
+        const TaskGraph::TaskId buildGraph = iterationTasks.AddTask("Build graph", [this]()
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            // The n-link weights only depend on the image, so they are kept across iterations and initial masks
+            if(!this->Smoothness.IsComputed())
+            {
+                this->Smoothness.SetNumberOfThreads(this->NumberOfThreads);
+                this->Smoothness.Compute(this->Image.GetPointer());
+
+                // The computation also held a float copy of every channel
+                const size_t channelBytes = this->Image->GetLargestPossibleRegion().GetNumberOfPixels() *
+                                            PixelType::Dimension * sizeof(float);
+                SetMemoryUsage(GrabCutMemoryEnum::N_LINK_WEIGHTS, this->Smoothness.GetNumberOfBytes());
+                RecordTransientMemoryUsage(GrabCutMemoryEnum::N_LINK_WEIGHTS, channelBytes);
+            }
+
+            this->GraphCut.SetImage(this->Image);
+            this->GraphCut.SetNumberOfThreads(this->NumberOfThreads);
+            this->GraphCut.SetSmoothnessTerm(&this->Smoothness);
+            this->GraphCut.SetDataTerm(this);
+            // The originally specified background pixels are the only ones that are definitely background (unless there is interactive refining performed),
+            // except when refining a pyramid level, where the pixels away from the propagated boundary are fixed as well
+            if(!this->RefinementSinks.IsEmpty())
+            {
+                this->GraphCut.SetSinks(this->RefinementSinks);
+                this->GraphCut.SetSources(this->RefinementSources);
+            }
+            else
+            {
+                this->GraphCut.SetSinks(this->HardBackground);
+            }
+            this->GraphCut.SetCropToUnconstrained(this->CropGraph);
+            this->GraphCut.BuildGraph();
+            SetMemoryUsage(GrabCutMemoryEnum::GRAPH, this->GraphCut.GetNumberOfBytes());
+            AddStageDuration(GrabCutStageEnum::GRAPH_BUILD, start);
+        });
+
+        iterationTasks.AddTask("Fill t-links", [this]()
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const long long costBytes = 2ll * this->GraphCut.GetNumberOfNodes() * sizeof(float);
+            AddMemoryUsage(GrabCutMemoryEnum::LIKELIHOODS, costBytes);
+            this->GraphCut.SetTerminalCapacities();
+            AddMemoryUsage(GrabCutMemoryEnum::LIKELIHOODS, -costBytes);
+            AddStageDuration(GrabCutStageEnum::GRAPH_BUILD, start);
+        }, {updateLikelihoods, buildGraph});
+    }
+
+    iterationTasks.Run(this->NumberOfThreads);
+    GetProgressStream() << foregroundProgress.str() << backgroundProgress.str() << likelihoodProgress.str();
+    UpdateHeldMemoryUsage();
+
+    // Besides the max flow, Solve() writes the cut into its bits and computes its energy
+    const std::chrono::steady_clock::time_point solveStart = std::chrono::steady_clock::now();
+    this->GraphCut.Solve();
+    this->GraphIsBuilt = true;
+    const double solveDuration = std::chrono::duration<double>(std::chrono::steady_clock::now() - solveStart).count();
+    const double maxFlowDuration = this->GraphCut.GetMaxFlowDuration();
+    const double energyDuration = this->GraphCut.GetEnergyDuration();
+    this->StageDurations[static_cast<unsigned int>(GrabCutStageEnum::MAX_FLOW)] += maxFlowDuration;
+    this->StageDurations[static_cast<unsigned int>(GrabCutStageEnum::ENERGY)] += energyDuration;
+    this->StageDurations[static_cast<unsigned int>(GrabCutStageEnum::MASK_COPY_BACK)] +=
+        solveDuration - maxFlowDuration - energyDuration;
+
+    // The queues were held during the max flow; the new bits are held along with the previous ones until they replace them
+    const size_t residentSetSize = this->MeasureStageResidentSetSizes ? MemoryUsage::GetResidentSetSize() : 0;
+    for(const GrabCutStageEnum stage : {GrabCutStageEnum::MAX_FLOW, GrabCutStageEnum::ENERGY})
+    {
+        size_t& stageResidentSetSize = this->StageResidentSetSizes[static_cast<unsigned int>(stage)];
+        stageResidentSetSize = std::max(stageResidentSetSize, residentSetSize);
+    }
+    RecordTransientMemoryUsage(GrabCutMemoryEnum::SOLVER_QUEUES, this->GraphCut.GetQueueBytes());
+    UpdateHeldMemoryUsage();
+
+    const std::chrono::steady_clock::time_point countStart = std::chrono::steady_clock::now();
+
+    // The previous segmentation (the complement of the hard background in the first iteration) has the same size as
+    // the new one
+    const BitMask& newBits = this->GraphCut.GetSegmentBits();
+    const unsigned int flippedPixels = newBits.CountDifferences(this->SegmentationBits);
+
+    // A segmentation mask that was handed out keeps the labels of the previous segmentation
+    this->SegmentationBits = newBits;
+    this->SegmentationMask = nullptr;
+    AddStageDuration(GrabCutStageEnum::MASK_COPY_BACK, countStart);
+    UpdateHeldMemoryUsage();
+
+    return flippedPixels;
 }
 
 template <typename TImage>
 ForegroundBackgroundSegmentMask* GrabCut<TImage>::GetSegmentationMask()
 {
-    return this->Segmentationmask;
+    if(this->SegmentationMask.IsNull())
+    {
+        this->SegmentationMask = this->SegmentationBits.ToMask();
+    }
+    return this->SegmentationMask;
 }
 
 template <typename TImage>
@@ -214,16 +1689,28 @@ void GrabCut<TImage>::GetSegmentedImage(TImage* result)
     ITKHelpers::DeepCopy(this->Image.GetPointer(), result);
     typename TImage::PixelType backgroundColor(this->GetDimensionality());
     backgroundColor.Fill(0);
-    this->SegmentationMask->ApplyToImage(result, backgroundColor);
+    GetSegmentationMask()->ApplyToImage(result, backgroundColor);
 }
 
 template <typename TImage>
 float GrabCut<TImage>::ForegroundLikelihood(const typename TImage::PixelType& pixel)
 {
-    Eigen::VectorXd p(this->GetDimensionality());
-    p(0) = pixel[0];
-    p(1) = pixel[1];
-    p(2) = pixel[2];
+    if(this->LikelihoodCacheMode != LikelihoodCacheModeEnum::NONE)
+    {
+        return std::exp(-this->LikelihoodTable.GetForegroundCost(pixel[0], pixel[1], pixel[2]));
+    }
+
+    if(PixelType::Dimension == 3)
+    {
+        return this->ForegroundEvaluator.EvaluateLikelihood(pixel[0], pixel[1], pixel[2]);
+    }
+
+    const unsigned int dimensionality = this->GetDimensionality();
+    Eigen::VectorXd p(dimensionality);
+    for(unsigned int d = 0; d < dimensionality; ++d)
+    {
+        p(d) = pixel[d];
+    }
 
     float likelihood = this->ForegroundModels.WeightedEvaluate(p);
 
@@ -233,14 +1720,79 @@ float GrabCut<TImage>::ForegroundLikelihood(const typename TImage::PixelType& pi
 template <typename TImage>
 float GrabCut<TImage>::BackgroundLikelihood(const typename TImage::PixelType& pixel)
 {
-    Eigen::VectorXd p(this->GetDimensionality());
-    p(0) = pixel[0];
-    p(1) = pixel[1];
-    p(2) = pixel[2];
+    if(this->LikelihoodCacheMode != LikelihoodCacheModeEnum::NONE)
+    {
+        return std::exp(-this->LikelihoodTable.GetBackgroundCost(pixel[0], pixel[1], pixel[2]));
+    }
+
+    if(PixelType::Dimension == 3)
+    {
+        return this->BackgroundEvaluator.EvaluateLikelihood(pixel[0], pixel[1], pixel[2]);
+    }
+
+    const unsigned int dimensionality = this->GetDimensionality();
+    Eigen::VectorXd p(dimensionality);
+    for(unsigned int d = 0; d < dimensionality; ++d)
+    {
+        p(d) = pixel[d];
+    }
 
     float likelihood = this->BackgroundModels.WeightedEvaluate(p);
 
     return likelihood;
 }
 
+template <typename TImage>
+void GrabCut<TImage>::ComputeCosts(const itk::ImageRegion<2>& region, float* foregroundCosts, float* backgroundCosts)
+{
+    const unsigned int width = region.GetSize()[0];
+    const unsigned int height = region.GetSize()[1];
+
+    itk::ImageRegionConstIterator<TImage> imageIterator(this->Image, region);
+
+    if(this->LikelihoodCacheMode != LikelihoodCacheModeEnum::NONE)
+    {
+        for(unsigned int p = 0; p < width * height; ++p, ++imageIterator)
+        {
+            const PixelType& pixel = imageIterator.Get();
+            foregroundCosts[p] = this->LikelihoodTable.GetForegroundCost(pixel[0], pixel[1], pixel[2]);
+            backgroundCosts[p] = this->LikelihoodTable.GetBackgroundCost(pixel[0], pixel[1], pixel[2]);
+        }
+        return;
+    }
+
+    if(PixelType::Dimension == 3)
+    {
+        // Convert one row at a time to planar buffers and evaluate it with one vectorized call per model
+        std::vector<float> red(width);
+        std::vector<float> green(width);
+        std::vector<float> blue(width);
+        for(unsigned int row = 0; row < height; ++row)
+        {
+            for(unsigned int x = 0; x < width; ++x, ++imageIterator)
+            {
+                const PixelType& pixel = imageIterator.Get();
+                red[x] = pixel[0];
+                green[x] = pixel[1];
+                blue[x] = pixel[2];
+            }
+
+            this->ForegroundEvaluator.EvaluateNegativeLogLikelihood(red.data(), green.data(), blue.data(), width,
+                                                                    foregroundCosts + row * width);
+            this->BackgroundEvaluator.EvaluateNegativeLogLikelihood(red.data(), green.data(), blue.data(), width,
+                                                                    backgroundCosts + row * width);
+        }
+        return;
+    }
+
+    // Other dimensions evaluate the mixture models directly; clamp so a vanishing likelihood still gives a finite cost
+    const float smallestLikelihood = std::numeric_limits<float>::min();
+    for(unsigned int p = 0; p < width * height; ++p, ++imageIterator)
+    {
+        const PixelType& pixel = imageIterator.Get();
+        foregroundCosts[p] = -std::log(std::max(ForegroundLikelihood(pixel), smallestLikelihood));
+        backgroundCosts[p] = -std::log(std::max(BackgroundLikelihood(pixel), smallestLikelihood));
+    }
+}
+
 #endif
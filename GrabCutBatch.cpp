@@ -0,0 +1,587 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BoundedQueue.h"
+#include "GrabCut.h"
+#include "MemoryUsage.h"
+#include "Trace.h"
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// ITK
+#include "itkImage.h"
+#include "itkImageFileReader.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The type of the images to segment
+typedef itk::Image<itk::CovariantVector<unsigned char, 3>, 2> ImageType;
+
+/** One (image, mask, output) line of the manifest, and what happened to it. */
+struct BatchItem
+{
+  /** The position in the manifest. */
+  unsigned int Index = 0;
+
+  std::string ImageFilename;
+  std::string MaskFilename;
+  std::string OutputFilename;
+
+  /** The data passed from stage to stage (released as soon as it is not needed). */
+  ImageType::Pointer Image;
+  ForegroundBackgroundSegmentMask::Pointer Mask;
+  ImageType::Pointer Result;
+
+  /** When decoding started. */
+  std::chrono::steady_clock::time_point Start;
+
+  /** The time spent in each stage, and from the start of decoding to the end of encoding (including the queues). */
+  double DecodeSeconds = 0;
+  double SegmentSeconds = 0;
+  double EncodeSeconds = 0;
+  double LatencySeconds = 0;
+
+  /** The number of GrabCut iterations. */
+  unsigned int Iterations = 0;
+
+  /** The memory GrabCut estimated before the segmentation and accounted for during it. */
+  size_t EstimatedBytes = 0;
+  size_t PeakBytes = 0;
+
+  /** The stage that failed and why (empty if the item succeeded). */
+  std::string FailedStage;
+  std::string Error;
+};
+
+typedef std::unique_ptr<BatchItem> BatchItemPointer;
+
+/** The command line options. */
+struct BatchOptions
+{
+  std::string ManifestFilename;
+  std::string ReportFilename;
+  std::string TraceFilename;
+  unsigned int NumberOfDecoders = 1;
+  unsigned int NumberOfWorkers = std::max(std::thread::hardware_concurrency(), 1u);
+  unsigned int NumberOfEncoders = 1;
+  unsigned int QueueCapacity = 0; // 0: twice the number of workers
+  unsigned int ThreadsPerItem = 1;
+  unsigned int MemoryBudget = 0; // In megabytes, 0: no budget
+  bool Verbose = false;
+};
+
+/** Read the manifest: one item per line, as three whitespace separated file names (image, mask, output).
+  * Empty lines and lines starting with # are skipped. */
+static std::vector<BatchItem> ReadManifest(const std::string& manifestFilename)
+{
+  std::ifstream manifest(manifestFilename.c_str());
+  if(!manifest)
+  {
+    throw std::runtime_error("ReadManifest: cannot open " + manifestFilename + "!");
+  }
+
+  std::vector<BatchItem> items;
+  std::string line;
+  unsigned int lineNumber = 0;
+  while(std::getline(manifest, line))
+  {
+    lineNumber++;
+    std::stringstream fields(line);
+    BatchItem item;
+    if(!(fields >> item.ImageFilename) || item.ImageFilename[0] == '#')
+    {
+      continue;
+    }
+
+    std::string extra;
+    if(!(fields >> item.MaskFilename >> item.OutputFilename) || (fields >> extra))
+    {
+      std::stringstream message;
+      message << "ReadManifest: line " << lineNumber << " of " << manifestFilename
+              << " is not 'image mask output'!";
+      throw std::runtime_error(message.str());
+    }
+
+    item.Index = items.size();
+    items.push_back(item);
+  }
+
+  return items;
+}
+
+/** Quote a field of the report as CSV does: in double quotes, with its own double quotes doubled. */
+static std::string QuoteCSV(const std::string& text)
+{
+  std::string quoted = "\"";
+  for(unsigned int i = 0; i < text.size(); ++i)
+  {
+    quoted += text[i];
+    if(text[i] == '"')
+    {
+      quoted += '"';
+    }
+  }
+  return quoted + "\"";
+}
+
+/** Get the value of a sorted list at a percentile (nearest rank). */
+static double Percentile(const std::vector<double>& sortedValues, const double percentile)
+{
+  if(sortedValues.empty())
+  {
+    return 0;
+  }
+  const unsigned int rank = std::min<unsigned int>(
+      static_cast<unsigned int>(std::ceil(percentile / 100.0 * sortedValues.size())), sortedValues.size());
+  return sortedValues[rank > 0 ? rank - 1 : 0];
+}
+
+/** Print the mean, median, 90th, 99th percentile and maximum of some durations. */
+static void PrintDurations(std::ostream& stream, const std::string& name, std::vector<double> durations)
+{
+  std::sort(durations.begin(), durations.end());
+  double sum = 0;
+  for(unsigned int i = 0; i < durations.size(); ++i)
+  {
+    sum += durations[i];
+  }
+
+  stream << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(3)
+         << " mean " << (durations.empty() ? 0 : sum / durations.size()) << "s"
+         << "  p50 " << Percentile(durations, 50) << "s"
+         << "  p90 " << Percentile(durations, 90) << "s"
+         << "  p99 " << Percentile(durations, 99) << "s"
+         << "  max " << (durations.empty() ? 0 : durations.back()) << "s" << std::endl;
+}
+
+static bool ParseArguments(int argc, char* argv[], BatchOptions& options)
+{
+  if(argc < 2)
+  {
+    return false;
+  }
+
+  options.ManifestFilename = argv[1];
+  for(int i = 2; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+    if(argument == "--verbose")
+    {
+      options.Verbose = true;
+      continue;
+    }
+    if(i + 1 >= argc)
+    {
+      return false;
+    }
+
+    const std::string value = argv[++i];
+    if(argument == "--report")
+    {
+      options.ReportFilename = value;
+      continue;
+    }
+    if(argument == "--trace")
+    {
+      options.TraceFilename = value;
+      continue;
+    }
+
+    const int number = std::atoi(value.c_str());
+    if(number <= 0)
+    {
+      return false;
+    }
+    if(argument == "--decoders")
+    {
+      options.NumberOfDecoders = number;
+    }
+    else if(argument == "--workers")
+    {
+      options.NumberOfWorkers = number;
+    }
+    else if(argument == "--encoders")
+    {
+      options.NumberOfEncoders = number;
+    }
+    else if(argument == "--queue")
+    {
+      options.QueueCapacity = number;
+    }
+    else if(argument == "--threads-per-item")
+    {
+      options.ThreadsPerItem = number;
+    }
+    else if(argument == "--memory-budget")
+    {
+      options.MemoryBudget = number;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  if(options.QueueCapacity == 0)
+  {
+    options.QueueCapacity = 2 * options.NumberOfWorkers;
+  }
+
+  return true;
+}
+
+int main(int argc, char*argv[])
+{
+  BatchOptions options;
+  if(!ParseArguments(argc, argv, options))
+  {
+    std::cerr << "Required: manifest.txt [--decoders N] [--workers N] [--encoders N] [--queue N] "
+              << "[--threads-per-item N] [--memory-budget MB] [--report report.csv] [--trace trace.json] [--verbose]" << std::endl
+              << "Each line of the manifest is: image.png mask.fbmask output.png" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<BatchItem> manifest;
+  try
+  {
+    manifest = ReadManifest(options.ManifestFilename);
+  }
+  catch(const std::exception& exception)
+  {
+    std::cerr << exception.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(!options.TraceFilename.empty() && !Trace::IsEnabled())
+  {
+    std::cerr << "--trace needs a build with tracing (cmake -DGrabCut_ENABLE_TRACING=ON)" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Segmenting " << manifest.size() << " images with " << options.NumberOfDecoders << " decoder(s), "
+            << options.NumberOfWorkers << " worker(s) and " << options.NumberOfEncoders << " encoder(s)..." << std::endl;
+
+  // decode -> decoded queue -> segment -> segmented queue -> encode -> finished.
+  // A full queue holds back the stage that feeds it, so at most about twice the queue capacity images are in memory.
+  BoundedQueue<BatchItemPointer> decoded(options.QueueCapacity);
+  BoundedQueue<BatchItemPointer> segmented(options.QueueCapacity);
+
+  std::vector<BatchItemPointer> finished(manifest.size());
+  unsigned int numberOfFinished = 0;
+  std::mutex finishedMutex;
+
+  // A failed item skips the remaining stages
+  auto finish = [&](BatchItemPointer item)
+  {
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    item->LatencySeconds = std::chrono::duration<double>(end - item->Start).count();
+    item->Image = nullptr;
+    item->Mask = nullptr;
+    item->Result = nullptr;
+
+    std::lock_guard<std::mutex> lock(finishedMutex);
+    numberOfFinished++;
+    std::cout << "[" << numberOfFinished << "/" << manifest.size() << "] ";
+    if(item->Error.empty())
+    {
+      std::cout << "ok " << std::fixed << std::setprecision(3) << item->LatencySeconds << "s " << item->OutputFilename;
+    }
+    else
+    {
+      std::cout << "FAILED (" << item->FailedStage << ") " << item->ImageFilename << ": " << item->Error;
+    }
+    std::cout << std::endl;
+
+    const unsigned int index = item->Index;
+    finished[index] = std::move(item);
+  };
+
+  // Runs a stage on an item, timing it and catching its errors. Returns false if it failed.
+  auto runStage = [](BatchItem& item, const char* stage, double& seconds, const std::function<void()>& function)
+  {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    try
+    {
+      function();
+    }
+    catch(const std::exception& exception)
+    {
+      item.FailedStage = stage;
+      item.Error = exception.what();
+    }
+    catch(...)
+    {
+      item.FailedStage = stage;
+      item.Error = "unknown error";
+    }
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    seconds = std::chrono::duration<double>(end - start).count();
+    GRABCUT_TRACE_EVENT(stage, start, end);
+    return item.Error.empty();
+  };
+
+  // With a memory budget, a segmentation only starts once its estimated memory fits next to that of the running ones
+  const size_t memoryBudget = static_cast<size_t>(options.MemoryBudget) * 1024 * 1024;
+  size_t admittedBytes = 0;
+  std::mutex admittedMutex;
+  std::condition_variable admittedReleased;
+
+  std::atomic<unsigned int> nextItem(0);
+  auto decoder = [&]()
+  {
+    for(unsigned int index = nextItem++; index < manifest.size(); index = nextItem++)
+    {
+      BatchItemPointer item(new BatchItem(manifest[index]));
+      item->Start = std::chrono::steady_clock::now();
+
+      const bool decodedOk = runStage(*item, "decode", item->DecodeSeconds, [&item]()
+      {
+        typedef itk::ImageFileReader<ImageType> ReaderType;
+        ReaderType::Pointer reader = ReaderType::New();
+        reader->SetFileName(item->ImageFilename);
+        reader->Update();
+        item->Image = reader->GetOutput();
+
+        item->Mask = ForegroundBackgroundSegmentMask::New();
+        item->Mask->Read(item->MaskFilename);
+        if(item->Mask->GetLargestPossibleRegion().GetSize() != item->Image->GetLargestPossibleRegion().GetSize())
+        {
+          throw std::runtime_error("the mask does not have the size of the image!");
+        }
+      });
+
+      if(decodedOk)
+      {
+        decoded.Push(std::move(item));
+      }
+      else
+      {
+        finish(std::move(item));
+      }
+    }
+  };
+
+  auto worker = [&]()
+  {
+    BatchItemPointer item;
+    while(decoded.Pop(item))
+    {
+      const bool segmentedOk = runStage(*item, "segment", item->SegmentSeconds, [&]()
+      {
+        GrabCut<ImageType> grabCut;
+        grabCut.SetNumberOfThreads(options.ThreadsPerItem);
+        grabCut.SetVerbose(options.Verbose);
+        item->EstimatedBytes = grabCut.EstimateMemoryUsage(item->Image->GetLargestPossibleRegion().GetSize());
+        if(memoryBudget > 0)
+        {
+          if(item->EstimatedBytes > memoryBudget)
+          {
+            std::stringstream message;
+            message << "the segmentation needs an estimated " << item->EstimatedBytes / (1024 * 1024)
+                    << " MB, more than the memory budget!";
+            throw std::runtime_error(message.str());
+          }
+          std::unique_lock<std::mutex> lock(admittedMutex);
+          admittedReleased.wait(lock, [&]() { return admittedBytes + item->EstimatedBytes <= memoryBudget; });
+          admittedBytes += item->EstimatedBytes;
+        }
+
+        // The admitted memory is given back however the segmentation ends
+        auto release = [&]()
+        {
+          if(memoryBudget > 0)
+          {
+            std::lock_guard<std::mutex> lock(admittedMutex);
+            admittedBytes -= item->EstimatedBytes;
+            admittedReleased.notify_all();
+          }
+        };
+        try
+        {
+          grabCut.SetImage(item->Image);
+          grabCut.SetInitialMask(item->Mask);
+          grabCut.PerformSegmentation();
+          item->Iterations = grabCut.GetNumberOfIterations();
+          item->PeakBytes = grabCut.GetPeakMemoryUsage();
+
+          item->Result = ImageType::New();
+          grabCut.GetSegmentedImage(item->Result);
+        }
+        catch(...)
+        {
+          release();
+          throw;
+        }
+        release();
+      });
+
+      item->Image = nullptr;
+      item->Mask = nullptr;
+      if(segmentedOk)
+      {
+        segmented.Push(std::move(item));
+      }
+      else
+      {
+        finish(std::move(item));
+      }
+    }
+  };
+
+  auto encoder = [&]()
+  {
+    BatchItemPointer item;
+    while(segmented.Pop(item))
+    {
+      runStage(*item, "encode", item->EncodeSeconds, [&item]()
+      {
+        ITKHelpers::WriteImage(item->Result.GetPointer(), item->OutputFilename);
+      });
+      finish(std::move(item));
+    }
+  };
+
+  const std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> decoders;
+  std::vector<std::thread> workers;
+  std::vector<std::thread> encoders;
+  for(unsigned int i = 0; i < options.NumberOfDecoders; ++i)
+  {
+    decoders.push_back(std::thread(decoder));
+  }
+  for(unsigned int i = 0; i < options.NumberOfWorkers; ++i)
+  {
+    workers.push_back(std::thread(worker));
+  }
+  for(unsigned int i = 0; i < options.NumberOfEncoders; ++i)
+  {
+    encoders.push_back(std::thread(encoder));
+  }
+
+  // Each queue is closed once everything that feeds it is done, and the stage after it then drains it
+  for(unsigned int i = 0; i < decoders.size(); ++i)
+  {
+    decoders[i].join();
+  }
+  decoded.Close();
+  for(unsigned int i = 0; i < workers.size(); ++i)
+  {
+    workers[i].join();
+  }
+  segmented.Close();
+  for(unsigned int i = 0; i < encoders.size(); ++i)
+  {
+    encoders[i].join();
+  }
+
+  const double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+
+  // Statistics of the items that succeeded
+  std::vector<double> latencies;
+  std::vector<double> decodeDurations;
+  std::vector<double> segmentDurations;
+  std::vector<double> encodeDurations;
+  unsigned int numberOfFailed = 0;
+  for(unsigned int i = 0; i < finished.size(); ++i)
+  {
+    const BatchItem& item = *finished[i];
+    if(!item.Error.empty())
+    {
+      numberOfFailed++;
+      continue;
+    }
+    latencies.push_back(item.LatencySeconds);
+    decodeDurations.push_back(item.DecodeSeconds);
+    segmentDurations.push_back(item.SegmentSeconds);
+    encodeDurations.push_back(item.EncodeSeconds);
+  }
+
+  std::cout << std::endl << manifest.size() - numberOfFailed << " of " << manifest.size() << " images segmented ("
+            << numberOfFailed << " failed) in " << std::fixed << std::setprecision(2) << batchSeconds << "s: "
+            << (batchSeconds > 0 ? latencies.size() / batchSeconds : 0) << " images/s" << std::endl;
+  PrintDurations(std::cout, "latency", latencies);
+  PrintDurations(std::cout, "decode", decodeDurations);
+  PrintDurations(std::cout, "segment", segmentDurations);
+  PrintDurations(std::cout, "encode", encodeDurations);
+  std::cout << "Queue high-water marks: decoded " << decoded.GetMaximumSize() << ", segmented "
+            << segmented.GetMaximumSize() << " (capacity " << options.QueueCapacity << ")" << std::endl;
+  std::cout << "Peak resident set size: " << std::setprecision(1)
+            << MemoryUsage::GetPeakResidentSetSize() / (1024.0 * 1024.0) << " MB" << std::endl;
+
+  if(!options.TraceFilename.empty())
+  {
+    std::cout << std::endl;
+    Trace::GetGlobal().WriteReport(std::cout);
+    try
+    {
+      Trace::GetGlobal().WriteChromeTrace(options.TraceFilename);
+    }
+    catch(const std::exception& exception)
+    {
+      std::cerr << exception.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(!options.ReportFilename.empty())
+  {
+    std::ofstream report(options.ReportFilename.c_str());
+    report << "index,image,mask,output,status,decode_s,segment_s,encode_s,latency_s,iterations,estimated_bytes,peak_bytes,error"
+           << std::endl;
+    for(unsigned int i = 0; i < finished.size(); ++i)
+    {
+      const BatchItem& item = *finished[i];
+      // Keep one line per item
+      std::string error = item.Error;
+      std::replace(error.begin(), error.end(), '\n', ' ');
+      report << item.Index << "," << QuoteCSV(item.ImageFilename) << "," << QuoteCSV(item.MaskFilename) << ","
+             << QuoteCSV(item.OutputFilename) << ","
+             << (item.Error.empty() ? "ok" : "failed_" + item.FailedStage) << "," << std::setprecision(4)
+             << item.DecodeSeconds << "," << item.SegmentSeconds << "," << item.EncodeSeconds << ","
+             << item.LatencySeconds << "," << item.Iterations << "," << item.EstimatedBytes << "," << item.PeakBytes << ","
+             << QuoteCSV(error) << std::endl;
+    }
+    if(!report)
+    {
+      std::cerr << "Could not write the report " << options.ReportFilename << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // The batch ran to the end either way, but a script should notice the failures
+  return numberOfFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,648 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GrabCut.h"
+#include "MemoryUsage.h"
+#include "Trace.h"
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// ITK
+#include "itkImage.h"
+#include "itkImageFileReader.h"
+
+// STL
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The type of the images to segment
+typedef itk::Image<itk::CovariantVector<unsigned char, 3>, 2> ImageType;
+
+// The type of the golden masks (255 for foreground, 0 for background)
+typedef itk::Image<unsigned char, 2> GoldenImageType;
+
+/** The command line options. */
+struct BenchmarkOptions
+{
+  std::string ImageFilename = "data/soldier.png";
+  std::string MaskFilename = "data/soldier_selection.fbmask";
+  std::vector<double> Megapixels = {1, 4, 16, 64};
+  unsigned int Repetitions = 1;
+  unsigned int NumberOfThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  std::string Initialization = "principal-axis";
+  unsigned int EMSampleSize = 0;
+  bool EMFullDataIteration = false;
+  bool HardAssignment = false;
+  std::string GoldenDirectory;
+  bool WriteGolden = false;
+  double MinimumIoU = 0.999;
+  std::string JSONFilename;
+  std::string CSVFilename;
+  std::string TraceDirectory;
+};
+
+/** One segmentation of one case. */
+struct BenchmarkRun
+{
+  std::string Case;
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  unsigned int Repetition = 0;
+  double Seconds = 0;
+  double StageSeconds[static_cast<unsigned int>(GrabCutStageEnum::NUMBER_OF_STAGES)] = {};
+  unsigned int Iterations = 0;
+  std::string StopReason;
+  double Energy = 0;
+  double IoU = -1; // -1: no golden mask to compare with
+  std::string Status;
+
+  /** The memory GrabCut estimated beforehand and accounted for (in total and per structure), and the resident set size
+    * of the process at the end of each stage. */
+  size_t EstimatedBytes = 0;
+  size_t PeakBytes = 0;
+  size_t StructurePeakBytes[static_cast<unsigned int>(GrabCutMemoryEnum::NUMBER_OF_STRUCTURES)] = {};
+  size_t StructureEstimatedBytes[static_cast<unsigned int>(GrabCutMemoryEnum::NUMBER_OF_STRUCTURES)] = {};
+  size_t StageResidentBytes[static_cast<unsigned int>(GrabCutStageEnum::NUMBER_OF_STAGES)] = {};
+};
+
+/** Convert bytes to megabytes for printing. */
+static double ToMegabytes(const size_t bytes)
+{
+  return bytes / (1024.0 * 1024.0);
+}
+
+/** Scale an image to width x height pixels (nearest neighbor, so the colors and the segmentation stay those of the
+  * original). */
+template <typename TImage>
+static typename TImage::Pointer Resample(const TImage* const image, const unsigned int width, const unsigned int height)
+{
+  const unsigned int originalWidth = image->GetLargestPossibleRegion().GetSize()[0];
+  const unsigned int originalHeight = image->GetLargestPossibleRegion().GetSize()[1];
+
+  itk::Size<2> size;
+  size[0] = width;
+  size[1] = height;
+  typename TImage::Pointer result = TImage::New();
+  result->SetRegions(itk::ImageRegion<2>(size));
+  result->Allocate();
+
+  const typename TImage::PixelType* pixels = image->GetBufferPointer();
+  typename TImage::PixelType* resultPixels = result->GetBufferPointer();
+  for(unsigned int y = 0; y < height; ++y)
+  {
+    const unsigned int originalY = static_cast<unsigned long long>(y) * originalHeight / height;
+    for(unsigned int x = 0; x < width; ++x)
+    {
+      const unsigned int originalX = static_cast<unsigned long long>(x) * originalWidth / width;
+      resultPixels[static_cast<size_t>(y) * width + x] = pixels[static_cast<size_t>(originalY) * originalWidth + originalX];
+    }
+  }
+
+  return result;
+}
+
+/** Get the intersection over union of the foreground of a segmentation and a golden mask. */
+static double ComputeIoU(const ForegroundBackgroundSegmentMask* const segmentation, const GoldenImageType* const golden)
+{
+  if(segmentation->GetLargestPossibleRegion().GetSize() != golden->GetLargestPossibleRegion().GetSize())
+  {
+    throw std::runtime_error("ComputeIoU: the golden mask does not have the size of the image!");
+  }
+
+  const unsigned int numberOfPixels = segmentation->GetLargestPossibleRegion().GetNumberOfPixels();
+  const ForegroundBackgroundSegmentMask::PixelType* labels = segmentation->GetBufferPointer();
+  const GoldenImageType::PixelType* goldenLabels = golden->GetBufferPointer();
+  unsigned long long intersection = 0;
+  unsigned long long unionSize = 0;
+  for(unsigned int p = 0; p < numberOfPixels; ++p)
+  {
+    const bool foreground = labels[p] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND;
+    const bool goldenForeground = goldenLabels[p] > 127;
+    intersection += foreground && goldenForeground;
+    unionSize += foreground || goldenForeground;
+  }
+
+  return unionSize > 0 ? static_cast<double>(intersection) / unionSize : 1.0;
+}
+
+/** Make a golden mask from a segmentation. */
+static GoldenImageType::Pointer CreateGolden(const ForegroundBackgroundSegmentMask* const segmentation)
+{
+  GoldenImageType::Pointer golden = GoldenImageType::New();
+  golden->SetRegions(segmentation->GetLargestPossibleRegion());
+  golden->Allocate();
+
+  const unsigned int numberOfPixels = segmentation->GetLargestPossibleRegion().GetNumberOfPixels();
+  const ForegroundBackgroundSegmentMask::PixelType* labels = segmentation->GetBufferPointer();
+  GoldenImageType::PixelType* goldenLabels = golden->GetBufferPointer();
+  for(unsigned int p = 0; p < numberOfPixels; ++p)
+  {
+    goldenLabels[p] = labels[p] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND ? 255 : 0;
+  }
+
+  return golden;
+}
+
+/** Get a stage or structure name as an identifier ("mask copy-back" -> "mask_copy_back"). */
+static std::string GetKey(const std::string& name)
+{
+  std::string key = name;
+  for(unsigned int i = 0; i < key.size(); ++i)
+  {
+    key[i] = std::isalnum(static_cast<unsigned char>(key[i])) ? std::tolower(static_cast<unsigned char>(key[i])) : '_';
+  }
+  return key;
+}
+
+/** Quote a string for JSON. */
+static std::string QuoteJSON(const std::string& text)
+{
+  std::stringstream quoted;
+  quoted << '"';
+  for(unsigned int i = 0; i < text.size(); ++i)
+  {
+    const unsigned char c = text[i];
+    if(c == '"' || c == '\\')
+    {
+      quoted << '\\' << c;
+    }
+    else if(c < 0x20)
+    {
+      quoted << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<unsigned int>(c) << std::dec;
+    }
+    else
+    {
+      quoted << c;
+    }
+  }
+  quoted << '"';
+  return quoted.str();
+}
+
+static void WriteJSON(const std::string& fileName, const BenchmarkOptions& options, const std::vector<BenchmarkRun>& runs)
+{
+  const unsigned int numberOfStages = static_cast<unsigned int>(GrabCutStageEnum::NUMBER_OF_STAGES);
+  const unsigned int numberOfStructures = static_cast<unsigned int>(GrabCutMemoryEnum::NUMBER_OF_STRUCTURES);
+
+  std::ofstream json(fileName.c_str());
+  json << std::setprecision(6) << "{" << std::endl
+       << "  \"image\": " << QuoteJSON(options.ImageFilename) << "," << std::endl
+       << "  \"mask\": " << QuoteJSON(options.MaskFilename) << "," << std::endl
+       << "  \"threads\": " << options.NumberOfThreads << "," << std::endl
+       << "  \"initialization\": " << QuoteJSON(options.Initialization) << "," << std::endl
+       << "  \"em_sample_size\": " << options.EMSampleSize << "," << std::endl
+       << "  \"em_full_data_iteration\": " << (options.EMFullDataIteration ? "true" : "false") << "," << std::endl
+       << "  \"hard_assignment\": " << (options.HardAssignment ? "true" : "false") << "," << std::endl
+       << "  \"min_iou\": " << options.MinimumIoU << "," << std::endl
+       << "  \"runs\": [" << std::endl;
+  for(unsigned int i = 0; i < runs.size(); ++i)
+  {
+    const BenchmarkRun& run = runs[i];
+    json << "    {\"case\": " << QuoteJSON(run.Case) << ", \"width\": " << run.Width << ", \"height\": " << run.Height
+         << ", \"repetition\": " << run.Repetition << ", \"seconds\": " << run.Seconds
+         << ", \"iterations\": " << run.Iterations << ", \"stop_reason\": " << QuoteJSON(run.StopReason)
+         << ", \"energy\": " << run.Energy << ", \"iou\": ";
+    if(run.IoU >= 0)
+    {
+      json << run.IoU;
+    }
+    else
+    {
+      json << "null";
+    }
+    json << ", \"status\": " << QuoteJSON(run.Status) << ", \"stages\": {";
+    for(unsigned int stage = 0; stage < numberOfStages; ++stage)
+    {
+      json << (stage > 0 ? ", " : "") << QuoteJSON(GetKey(GrabCut<ImageType>::GetStageName(static_cast<GrabCutStageEnum>(stage)))) << ": "
+           << run.StageSeconds[stage];
+    }
+    json << "}, \"estimated_bytes\": " << run.EstimatedBytes << ", \"peak_bytes\": " << run.PeakBytes << ", \"memory\": {";
+    for(unsigned int structure = 0; structure < numberOfStructures; ++structure)
+    {
+      json << (structure > 0 ? ", " : "")
+           << QuoteJSON(GetKey(GrabCut<ImageType>::GetMemoryStructureName(static_cast<GrabCutMemoryEnum>(structure))))
+           << ": {\"peak\": " << run.StructurePeakBytes[structure] << ", \"estimate\": " << run.StructureEstimatedBytes[structure] << "}";
+    }
+    json << "}, \"stage_rss_bytes\": {";
+    for(unsigned int stage = 0; stage < numberOfStages; ++stage)
+    {
+      json << (stage > 0 ? ", " : "") << QuoteJSON(GetKey(GrabCut<ImageType>::GetStageName(static_cast<GrabCutStageEnum>(stage))))
+           << ": " << run.StageResidentBytes[stage];
+    }
+    json << "}}" << (i + 1 < runs.size() ? "," : "") << std::endl;
+  }
+  json << "  ]" << std::endl << "}" << std::endl;
+
+  if(!json)
+  {
+    throw std::runtime_error("WriteJSON: cannot write " + fileName + "!");
+  }
+}
+
+static void WriteCSV(const std::string& fileName, const BenchmarkOptions& options, const std::vector<BenchmarkRun>& runs)
+{
+  const unsigned int numberOfStages = static_cast<unsigned int>(GrabCutStageEnum::NUMBER_OF_STAGES);
+  const unsigned int numberOfStructures = static_cast<unsigned int>(GrabCutMemoryEnum::NUMBER_OF_STRUCTURES);
+
+  std::ofstream csv(fileName.c_str());
+  csv << "case,width,height,repetition,threads,seconds,iterations,stop_reason,energy,iou,status";
+  for(unsigned int stage = 0; stage < numberOfStages; ++stage)
+  {
+    csv << "," << GetKey(GrabCut<ImageType>::GetStageName(static_cast<GrabCutStageEnum>(stage))) << "_s";
+  }
+  csv << ",estimated_bytes,peak_bytes";
+  for(unsigned int structure = 0; structure < numberOfStructures; ++structure)
+  {
+    csv << "," << GetKey(GrabCut<ImageType>::GetMemoryStructureName(static_cast<GrabCutMemoryEnum>(structure))) << "_bytes";
+  }
+  for(unsigned int structure = 0; structure < numberOfStructures; ++structure)
+  {
+    csv << "," << GetKey(GrabCut<ImageType>::GetMemoryStructureName(static_cast<GrabCutMemoryEnum>(structure))) << "_estimated_bytes";
+  }
+  for(unsigned int stage = 0; stage < numberOfStages; ++stage)
+  {
+    csv << "," << GetKey(GrabCut<ImageType>::GetStageName(static_cast<GrabCutStageEnum>(stage))) << "_rss_bytes";
+  }
+  csv << std::endl;
+
+  csv << std::setprecision(6);
+  for(unsigned int i = 0; i < runs.size(); ++i)
+  {
+    const BenchmarkRun& run = runs[i];
+    csv << run.Case << "," << run.Width << "," << run.Height << "," << run.Repetition << "," << options.NumberOfThreads
+        << "," << run.Seconds << "," << run.Iterations << "," << run.StopReason << "," << run.Energy << ",";
+    if(run.IoU >= 0)
+    {
+      csv << run.IoU;
+    }
+    csv << "," << run.Status;
+    for(unsigned int stage = 0; stage < numberOfStages; ++stage)
+    {
+      csv << "," << run.StageSeconds[stage];
+    }
+    csv << "," << run.EstimatedBytes << "," << run.PeakBytes;
+    for(unsigned int structure = 0; structure < numberOfStructures; ++structure)
+    {
+      csv << "," << run.StructurePeakBytes[structure];
+    }
+    for(unsigned int structure = 0; structure < numberOfStructures; ++structure)
+    {
+      csv << "," << run.StructureEstimatedBytes[structure];
+    }
+    for(unsigned int stage = 0; stage < numberOfStages; ++stage)
+    {
+      csv << "," << run.StageResidentBytes[stage];
+    }
+    csv << std::endl;
+  }
+
+  if(!csv)
+  {
+    throw std::runtime_error("WriteCSV: cannot write " + fileName + "!");
+  }
+}
+
+/** Get the initialization a --initialization value names. */
+static MixtureInitializationEnum GetModelInitialization(const std::string& name)
+{
+  if(name == "orchard-bouman")
+  {
+    return MixtureInitializationEnum::ORCHARD_BOUMAN;
+  }
+  if(name == "kmeans++")
+  {
+    return MixtureInitializationEnum::KMEANS_PLUS_PLUS;
+  }
+  return MixtureInitializationEnum::PRINCIPAL_AXIS;
+}
+
+static bool ParseArguments(int argc, char* argv[], BenchmarkOptions& options)
+{
+  int i = 1;
+  if(argc >= 3 && argv[1][0] != '-')
+  {
+    options.ImageFilename = argv[1];
+    options.MaskFilename = argv[2];
+    i = 3;
+  }
+
+  for(; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+    if(argument == "--write-golden")
+    {
+      options.WriteGolden = true;
+      continue;
+    }
+    if(argument == "--em-full-data-iteration")
+    {
+      options.EMFullDataIteration = true;
+      continue;
+    }
+    if(argument == "--hard-assignment")
+    {
+      options.HardAssignment = true;
+      continue;
+    }
+    if(i + 1 >= argc)
+    {
+      return false;
+    }
+
+    const std::string value = argv[++i];
+    if(argument == "--golden-dir")
+    {
+      options.GoldenDirectory = value;
+    }
+    else if(argument == "--json")
+    {
+      options.JSONFilename = value;
+    }
+    else if(argument == "--csv")
+    {
+      options.CSVFilename = value;
+    }
+    else if(argument == "--trace-dir")
+    {
+      options.TraceDirectory = value;
+    }
+    else if(argument == "--min-iou")
+    {
+      options.MinimumIoU = std::atof(value.c_str());
+    }
+    else if(argument == "--megapixels")
+    {
+      // A comma separated list; an empty one only runs the original image
+      options.Megapixels.clear();
+      std::stringstream list(value);
+      std::string item;
+      while(std::getline(list, item, ','))
+      {
+        const double megapixels = std::atof(item.c_str());
+        if(megapixels <= 0)
+        {
+          return false;
+        }
+        options.Megapixels.push_back(megapixels);
+      }
+    }
+    else if(argument == "--repetitions" && std::atoi(value.c_str()) > 0)
+    {
+      options.Repetitions = std::atoi(value.c_str());
+    }
+    else if(argument == "--threads" && std::atoi(value.c_str()) > 0)
+    {
+      options.NumberOfThreads = std::atoi(value.c_str());
+    }
+    else if(argument == "--initialization" &&
+            (value == "principal-axis" || value == "orchard-bouman" || value == "kmeans++"))
+    {
+      options.Initialization = value;
+    }
+    else if(argument == "--em-sample-size")
+    {
+      options.EMSampleSize = std::atoi(value.c_str());
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  return !options.WriteGolden || !options.GoldenDirectory.empty();
+}
+
+int main(int argc, char*argv[])
+{
+  BenchmarkOptions options;
+  if(!ParseArguments(argc, argv, options))
+  {
+    std::cerr << "Required: [image.png mask.fbmask] [--megapixels 1,4,16,64] [--repetitions N] [--threads N] "
+              << "[--initialization principal-axis|orchard-bouman|kmeans++] [--em-sample-size N [--em-full-data-iteration]] [--hard-assignment] "
+              << "[--golden-dir directory [--write-golden]] [--min-iou 0.999] [--json results.json] [--csv results.csv] "
+              << "[--trace-dir directory]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(!options.TraceDirectory.empty() && !Trace::IsEnabled())
+  {
+    std::cerr << "--trace-dir needs a build with tracing (cmake -DGrabCut_ENABLE_TRACING=ON)" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Read the image and the mask
+  typedef itk::ImageFileReader<ImageType> ReaderType;
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(options.ImageFilename);
+  reader->Update();
+  ImageType::Pointer image = reader->GetOutput();
+
+  ForegroundBackgroundSegmentMask::Pointer mask = ForegroundBackgroundSegmentMask::New();
+  mask->Read(options.MaskFilename);
+
+  // The original image, then nearest neighbor upscaled (or downscaled) versions of it
+  std::string baseName = options.ImageFilename.substr(options.ImageFilename.find_last_of("/\\") + 1);
+  baseName = baseName.substr(0, baseName.find_last_of('.'));
+  const unsigned int width = image->GetLargestPossibleRegion().GetSize()[0];
+  const unsigned int height = image->GetLargestPossibleRegion().GetSize()[1];
+
+  std::vector<std::string> caseNames(1, baseName);
+  std::vector<itk::Size<2> > caseSizes(1, image->GetLargestPossibleRegion().GetSize());
+  for(unsigned int i = 0; i < options.Megapixels.size(); ++i)
+  {
+    const double scale = std::sqrt(options.Megapixels[i] * 1e6 / (static_cast<double>(width) * height));
+    itk::Size<2> size;
+    size[0] = std::max(1u, static_cast<unsigned int>(std::floor(width * scale + 0.5)));
+    size[1] = std::max(1u, static_cast<unsigned int>(std::floor(height * scale + 0.5)));
+
+    std::stringstream caseName;
+    caseName << baseName << "_" << options.Megapixels[i] << "mp";
+    caseNames.push_back(caseName.str());
+    caseSizes.push_back(size);
+  }
+
+  const unsigned int numberOfStages = static_cast<unsigned int>(GrabCutStageEnum::NUMBER_OF_STAGES);
+  const unsigned int numberOfStructures = static_cast<unsigned int>(GrabCutMemoryEnum::NUMBER_OF_STRUCTURES);
+  std::vector<BenchmarkRun> runs;
+  unsigned int numberOfRegressions = 0;
+  for(unsigned int c = 0; c < caseNames.size(); ++c)
+  {
+    ImageType::Pointer caseImage = image;
+    ForegroundBackgroundSegmentMask::Pointer caseMask = mask;
+    if(c > 0)
+    {
+      caseImage = Resample(image.GetPointer(), caseSizes[c][0], caseSizes[c][1]);
+      caseMask = Resample(mask.GetPointer(), caseSizes[c][0], caseSizes[c][1]);
+    }
+
+    const std::string goldenFilename = options.GoldenDirectory.empty() ? "" :
+                                       options.GoldenDirectory + "/" + caseNames[c] + ".png";
+    GoldenImageType::Pointer golden;
+    if(!goldenFilename.empty() && !options.WriteGolden)
+    {
+      try
+      {
+        typedef itk::ImageFileReader<GoldenImageType> GoldenReaderType;
+        GoldenReaderType::Pointer goldenReader = GoldenReaderType::New();
+        goldenReader->SetFileName(goldenFilename);
+        goldenReader->Update();
+        golden = goldenReader->GetOutput();
+      }
+      catch(const std::exception& exception)
+      {
+        std::cout << "No golden mask for " << caseNames[c] << ": " << exception.what() << std::endl;
+      }
+    }
+
+    for(unsigned int repetition = 0; repetition < options.Repetitions; ++repetition)
+    {
+      BenchmarkRun run;
+      run.Case = caseNames[c];
+      run.Width = caseSizes[c][0];
+      run.Height = caseSizes[c][1];
+      run.Repetition = repetition;
+
+      GrabCut<ImageType> grabCut;
+      grabCut.SetNumberOfThreads(options.NumberOfThreads);
+      grabCut.SetVerbose(false); // The benchmark only reports runs
+      grabCut.SetMeasureStageResidentSetSizes(true);
+      grabCut.SetModelInitialization(GetModelInitialization(options.Initialization));
+      grabCut.SetEMSampleSize(options.EMSampleSize);
+      grabCut.SetEMFullDataIteration(options.EMFullDataIteration);
+      grabCut.SetMixtureFitting(options.HardAssignment ? MixtureFittingEnum::HARD_ASSIGNMENT :
+                                                         MixtureFittingEnum::EXPECTATION_MAXIMIZATION);
+      grabCut.SetImage(caseImage);
+      grabCut.SetInitialMask(caseMask);
+      run.EstimatedBytes = grabCut.EstimateMemoryUsage(caseSizes[c]);
+      for(unsigned int structure = 0; structure < numberOfStructures; ++structure)
+      {
+        run.StructureEstimatedBytes[structure] = grabCut.EstimateMemoryUsage(caseSizes[c], static_cast<GrabCutMemoryEnum>(structure));
+      }
+
+      Trace::GetGlobal().Clear();
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      grabCut.PerformSegmentation();
+      run.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      for(unsigned int stage = 0; stage < numberOfStages; ++stage)
+      {
+        run.StageSeconds[stage] = grabCut.GetStageDuration(static_cast<GrabCutStageEnum>(stage));
+        run.StageResidentBytes[stage] = grabCut.GetStageResidentSetSize(static_cast<GrabCutStageEnum>(stage));
+      }
+      run.PeakBytes = grabCut.GetPeakMemoryUsage();
+      for(unsigned int structure = 0; structure < numberOfStructures; ++structure)
+      {
+        run.StructurePeakBytes[structure] = grabCut.GetPeakMemoryUsage(static_cast<GrabCutMemoryEnum>(structure));
+      }
+      run.Iterations = grabCut.GetNumberOfIterations();
+      run.StopReason = GrabCut<ImageType>::GetStopReasonName(grabCut.GetStopReason());
+      run.Energy = grabCut.GetEnergies().empty() ? 0 : grabCut.GetEnergies().back();
+
+      // A changed segmentation is a regression, however much faster it is
+      if(options.WriteGolden && repetition == 0)
+      {
+        ITKHelpers::WriteImage(CreateGolden(grabCut.GetSegmentationMask()).GetPointer(), goldenFilename);
+        run.Status = "golden_written";
+      }
+      else if(golden.IsNotNull())
+      {
+        run.IoU = ComputeIoU(grabCut.GetSegmentationMask(), golden);
+        run.Status = run.IoU >= options.MinimumIoU ? "ok" : "changed";
+        numberOfRegressions += run.IoU < options.MinimumIoU;
+      }
+      else
+      {
+        run.Status = "no_golden";
+      }
+
+      std::cout << std::left << std::setw(20) << run.Case << std::right << " " << run.Width << "x" << run.Height
+                << " #" << repetition << ": " << std::fixed << std::setprecision(3) << run.Seconds << "s, "
+                << run.Iterations << " iterations";
+      if(run.IoU >= 0)
+      {
+        std::cout << ", IoU " << std::setprecision(5) << run.IoU;
+      }
+      std::cout << " [" << run.Status << "]" << std::endl << std::setprecision(3);
+      for(unsigned int stage = 0; stage < numberOfStages; ++stage)
+      {
+        std::cout << "    " << std::left << std::setw(18) << GrabCut<ImageType>::GetStageName(static_cast<GrabCutStageEnum>(stage))
+                  << std::right << std::setw(9) << run.StageSeconds[stage] << "s" << std::setprecision(1) << std::setw(10)
+                  << ToMegabytes(run.StageResidentBytes[stage]) << " MB resident" << std::setprecision(3) << std::endl;
+      }
+      std::cout << std::setprecision(1) << "    memory: peak " << ToMegabytes(run.PeakBytes) << " MB, estimated "
+                << ToMegabytes(run.EstimatedBytes) << " MB, process peak " << ToMegabytes(MemoryUsage::GetPeakResidentSetSize())
+                << " MB resident" << std::endl;
+      for(unsigned int structure = 0; structure < numberOfStructures; ++structure)
+      {
+        std::cout << "      " << std::left << std::setw(16)
+                  << GrabCut<ImageType>::GetMemoryStructureName(static_cast<GrabCutMemoryEnum>(structure)) << std::right
+                  << std::setw(9) << ToMegabytes(run.StructurePeakBytes[structure]) << " MB (estimated "
+                  << ToMegabytes(run.StructureEstimatedBytes[structure]) << " MB)" << std::endl;
+      }
+      std::cout << std::setprecision(3);
+
+      // The trace of every run on its own, with the counters (pixels, EM iterations, graph size, max flow work)
+      if(!options.TraceDirectory.empty())
+      {
+        std::stringstream traceFilename;
+        traceFilename << options.TraceDirectory << "/" << run.Case << "_" << repetition << ".json";
+        Trace::GetGlobal().WriteReport(std::cout);
+        Trace::GetGlobal().WriteChromeTrace(traceFilename.str());
+      }
+
+      runs.push_back(run);
+    }
+  }
+
+  try
+  {
+    if(!options.JSONFilename.empty())
+    {
+      WriteJSON(options.JSONFilename, options, runs);
+    }
+    if(!options.CSVFilename.empty())
+    {
+      WriteCSV(options.CSVFilename, options, runs);
+    }
+  }
+  catch(const std::exception& exception)
+  {
+    std::cerr << exception.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(numberOfRegressions > 0)
+  {
+    std::cout << numberOfRegressions << " run(s) differ from the golden masks (IoU below " << options.MinimumIoU << ")"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
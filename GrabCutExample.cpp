@@ -32,7 +32,7 @@ int main(int argc, char*argv[])
   // Verify arguments
   if(argc != 4)
   {
-    std::cerr << "Required: image.png mask.fgmask output.png" << std::endl;
+    std::cerr << "Required: image.png mask.fbmask output.png" << std::endl;
     return EXIT_FAILURE;
   }
 
@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GrabCutSequence_H
+#define GrabCutSequence_H
+
+#include "GrabCut.h"
+
+/** How GrabCutSequence started the segmentation of a frame: from scratch (the first frame), from the models and the
+  * segmentation of the previous frame, or from scratch because they did not fit the frame (a scene cut). */
+enum class FrameStartEnum { FULL, WARM_START, SCENE_CUT };
+
+/** Segment the frames of a video (or a turntable sequence) one after the other.
+  * The first frame is segmented by the full GrabCut iterations. Every later frame starts from the mixture models and
+  * the segmentation of the previous one: the pixels well inside (outside) its foreground stay foreground (background),
+  * and only a band around its boundary is refined for a few iterations. If the previous models and segmentation explain
+  * the new frame much worse than they explained the previous one, the frame is segmented from scratch instead. */
+template <typename TImage>
+class GrabCutSequence
+{
+public:
+
+    /** Get the GrabCut that segments the frames, to set its options (threads, stopping criteria, pyramid, ...).
+      * Its maximum number of iterations, pyramid and superpixel settings only apply to the frames segmented from scratch. */
+    GrabCut<TImage>& GetGrabCut()
+    {
+        return this->Segmenter;
+    }
+
+    /** Provide the mask whose background pixels are hard background in every frame (e.g. a rectangle around the
+      * object). The mask is shared, not copied, and must have the size of the frames. */
+    void SetInitialMask(ForegroundBackgroundSegmentMask* const mask)
+    {
+        this->InitialMask = mask;
+    }
+
+    /** Set how far (in pixels) from the boundary of the previous segmentation the pixels of a warm-started frame are
+      * refined (8 by default). The object should move less than this between frames. */
+    void SetBandWidth(const unsigned int bandWidth)
+    {
+        this->BandWidth = bandWidth;
+    }
+
+    /** Set the maximum number of iterations of a warm-started frame (2 by default). */
+    void SetWarmStartIterations(const unsigned int warmStartIterations)
+    {
+        this->WarmStartIterations = std::max(warmStartIterations, 1u);
+    }
+
+    /** Set by how much (in nats per pixel) the mean data cost of the previous models and segmentation on a new frame may
+      * exceed their cost on the previous frame before the new frame is treated as a scene cut (1 by default). */
+    void SetSceneCutCostIncrease(const double sceneCutCostIncrease)
+    {
+        this->SceneCutCostIncrease = sceneCutCostIncrease;
+    }
+
+    /** Segment the next frame. The frame is used by reference, not copied, until the next one is segmented. */
+    void SegmentFrame(TImage* const frame);
+
+    /** Forget the previous frame, so the next one is segmented from scratch. */
+    void Reset()
+    {
+        this->PreviousSegmentation = nullptr;
+    }
+
+    /** Get the segmentation of the last frame. */
+    ForegroundBackgroundSegmentMask* GetSegmentationMask()
+    {
+        return this->Segmenter.GetSegmentationMask();
+    }
+
+    /** Get how the segmentation of the last frame was started. */
+    FrameStartEnum GetFrameStart() const
+    {
+        return this->FrameStart;
+    }
+
+    /** Get the mean data cost of the previous models and segmentation on the last frame (0 for the first frame). */
+    double GetCarriedOverCost() const
+    {
+        return this->CarriedOverCost;
+    }
+
+    /** Get the mean data cost of the final models and segmentation of the last frame. */
+    double GetFinalCost() const
+    {
+        return this->PreviousCost;
+    }
+
+    /** Get the number of frames segmented so far. */
+    unsigned int GetNumberOfFrames() const
+    {
+        return this->NumberOfFrames;
+    }
+
+    /** Get a readable description of how a frame was started. */
+    static const char* GetFrameStartName(const FrameStartEnum frameStart);
+
+protected:
+
+    /** The segmentation of every frame. It keeps the mixture models from one frame to the next. */
+    GrabCut<TImage> Segmenter;
+
+    /** The hard background of every frame. */
+    ForegroundBackgroundSegmentMask::Pointer InitialMask;
+
+    /** The segmentation of the previous frame, if there is one to start from. */
+    ForegroundBackgroundSegmentMask::Pointer PreviousSegmentation;
+
+    /** The mean data cost of the final models and segmentation of the previous frame. */
+    double PreviousCost = 0;
+
+    /** The mean data cost of the previous models and segmentation on the last frame. */
+    double CarriedOverCost = 0;
+
+    /** The parameters. */
+    unsigned int BandWidth = 8;
+    unsigned int WarmStartIterations = 2;
+    double SceneCutCostIncrease = 1.0;
+
+    /** How the last frame was started. */
+    FrameStartEnum FrameStart = FrameStartEnum::FULL;
+
+    unsigned int NumberOfFrames = 0;
+};
+
+#include "GrabCutSequence.hpp"
+
+#endif
@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GrabCutSequence_HPP
+#define GrabCutSequence_HPP
+
+#include "GrabCutSequence.h"
+
+// STL
+#include <iostream>
+#include <stdexcept>
+
+template <typename TImage>
+void GrabCutSequence<TImage>::SegmentFrame(TImage* const frame)
+{
+    if(this->InitialMask.IsNull() ||
+       this->InitialMask->GetLargestPossibleRegion() != frame->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("GrabCutSequence::SegmentFrame: the initial mask is missing or does not have the size of the frame!");
+    }
+
+    this->Segmenter.SetImage(frame);
+    this->Segmenter.SetInitialMask(this->InitialMask);
+
+    this->FrameStart = FrameStartEnum::FULL;
+    this->CarriedOverCost = 0;
+    if(this->PreviousSegmentation.IsNotNull() && this->Segmenter.HasMixtureModels() &&
+       this->PreviousSegmentation->GetLargestPossibleRegion() == frame->GetLargestPossibleRegion())
+    {
+        // If the scene changed, the previous models explain the frame (under the previous labels) much worse than they
+        // explained the previous frame, and refining a band around the old boundary would not recover
+        this->CarriedOverCost = this->Segmenter.ComputeMeanDataCost(this->PreviousSegmentation);
+        this->FrameStart = this->CarriedOverCost > this->PreviousCost + this->SceneCutCostIncrease ?
+                           FrameStartEnum::SCENE_CUT : FrameStartEnum::WARM_START;
+    }
+
+    if(this->FrameStart == FrameStartEnum::WARM_START)
+    {
+        this->Segmenter.RefineSegmentation(this->PreviousSegmentation, this->BandWidth, this->WarmStartIterations);
+    }
+    else
+    {
+        this->Segmenter.PerformSegmentation();
+    }
+
+    // Every segmentation makes a new mask, so the previous one can be kept without copying
+    this->PreviousSegmentation = this->Segmenter.GetSegmentationMask();
+    this->PreviousCost = this->Segmenter.ComputeMeanDataCost(this->PreviousSegmentation);
+
+    if(this->Segmenter.GetVerbose())
+    {
+        std::cout << "Frame " << this->NumberOfFrames << ": " << GetFrameStartName(this->FrameStart) << " (carried over cost "
+                  << this->CarriedOverCost << ", final cost " << this->PreviousCost << " per pixel), "
+                  << this->Segmenter.GetNumberOfIterations() << " iterations" << std::endl;
+    }
+    this->NumberOfFrames++;
+}
+
+template <typename TImage>
+const char* GrabCutSequence<TImage>::GetFrameStartName(const FrameStartEnum frameStart)
+{
+    switch(frameStart)
+    {
+        case FrameStartEnum::WARM_START:
+            return "warm start";
+        case FrameStartEnum::SCENE_CUT:
+            return "scene cut, segmented from scratch";
+        default:
+            return "segmented from scratch";
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GraphMaxFlow.h"
+
+// Boost
+#include <boost/graph/boykov_kolmogorov_max_flow.hpp>
+
+void GraphMaxFlow::Initialize(const unsigned int numberOfNodes)
+{
+    this->NumberOfNodes = numberOfNodes;
+    this->Graph = GraphType(numberOfNodes + 2);
+
+    const VertexDescriptor source = numberOfNodes;
+    const VertexDescriptor sink = numberOfNodes + 1;
+    this->SourceEdges.resize(numberOfNodes);
+    this->SinkEdges.resize(numberOfNodes);
+    for(unsigned int node = 0; node < numberOfNodes; ++node)
+    {
+        this->SourceEdges[node] = AddEdgePair(source, node, 0, 0);
+        this->SinkEdges[node] = AddEdgePair(node, sink, 0, 0);
+    }
+
+    this->IsSourceSide.assign(numberOfNodes, 0);
+}
+
+GraphMaxFlow::EdgeDescriptor GraphMaxFlow::AddEdgePair(const VertexDescriptor from, const VertexDescriptor to,
+                                                       const float capacity, const float reverseCapacity)
+{
+    const EdgeDescriptor edge = boost::add_edge(from, to, this->Graph).first;
+    const EdgeDescriptor reverseEdge = boost::add_edge(to, from, this->Graph).first;
+
+    boost::put(boost::edge_capacity, this->Graph, edge, capacity);
+    boost::put(boost::edge_capacity, this->Graph, reverseEdge, reverseCapacity);
+    boost::put(boost::edge_reverse, this->Graph, edge, reverseEdge);
+    boost::put(boost::edge_reverse, this->Graph, reverseEdge, edge);
+
+    return edge;
+}
+
+void GraphMaxFlow::AddEdge(const unsigned int a, const unsigned int b, const float capacity)
+{
+    AddEdgePair(a, b, capacity, capacity);
+}
+
+void GraphMaxFlow::SetTerminalCapacities(const unsigned int node, const float sourceCapacity, const float sinkCapacity)
+{
+    boost::put(boost::edge_capacity, this->Graph, this->SourceEdges[node], sourceCapacity);
+    boost::put(boost::edge_capacity, this->Graph, this->SinkEdges[node], sinkCapacity);
+}
+
+double GraphMaxFlow::ComputeMaxFlow()
+{
+    if(this->NumberOfNodes == 0)
+    {
+        return 0;
+    }
+
+    const VertexDescriptor source = this->NumberOfNodes;
+    const VertexDescriptor sink = this->NumberOfNodes + 1;
+    const double flow = boost::boykov_kolmogorov_max_flow(this->Graph, source, sink);
+
+    // Nodes in the source tree of the final residual graph are on the source side
+    const boost::default_color_type sourceColor = boost::get(boost::vertex_color, this->Graph, source);
+    for(unsigned int node = 0; node < this->NumberOfNodes; ++node)
+    {
+        this->IsSourceSide[node] = boost::get(boost::vertex_color, this->Graph, node) == sourceColor;
+    }
+
+    return flow;
+}
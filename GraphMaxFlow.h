@@ -0,0 +1,89 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GraphMaxFlow_H
+#define GraphMaxFlow_H
+
+// STL
+#include <vector>
+
+// Boost
+#include <boost/graph/adjacency_list.hpp>
+
+/** The minimum s-t cut of a small graph with arbitrary (undirected) edges between its nodes, such as the graph of the
+  * superpixels of an image, solved with Boost's boykov_kolmogorov_max_flow. GridMaxFlow is the solver for pixel grids. */
+class GraphMaxFlow
+{
+public:
+    /** Create a graph of nodes without edges. */
+    void Initialize(const unsigned int numberOfNodes);
+
+    /** Get the number of nodes (without the terminals). */
+    unsigned int GetNumberOfNodes() const
+    {
+        return this->NumberOfNodes;
+    }
+
+    /** Link two nodes with the same capacity in both directions. */
+    void AddEdge(const unsigned int a, const unsigned int b, const float capacity);
+
+    /** Set the capacities of the source -> node and node -> sink edges. */
+    void SetTerminalCapacities(const unsigned int node, const float sourceCapacity, const float sinkCapacity);
+
+    /** Compute the maximum flow and return it. */
+    double ComputeMaxFlow();
+
+    /** Get whether a node is on the source side of the minimum cut. */
+    bool IsSource(const unsigned int node) const
+    {
+        return this->IsSourceSide[node] != 0;
+    }
+
+protected:
+
+    typedef boost::adjacency_list_traits<boost::vecS, boost::vecS, boost::directedS> GraphTraitsType;
+
+    typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::directedS,
+        boost::property<boost::vertex_color_t, boost::default_color_type,
+        boost::property<boost::vertex_distance_t, long,
+        boost::property<boost::vertex_predecessor_t, GraphTraitsType::edge_descriptor> > >,
+        boost::property<boost::edge_capacity_t, float,
+        boost::property<boost::edge_residual_capacity_t, float,
+        boost::property<boost::edge_reverse_t, GraphTraitsType::edge_descriptor> > > > GraphType;
+
+    typedef GraphTraitsType::vertex_descriptor VertexDescriptor;
+    typedef GraphTraitsType::edge_descriptor EdgeDescriptor;
+
+    /** Add an edge and its reverse edge with the given capacities. Returns the forward edge. */
+    EdgeDescriptor AddEdgePair(const VertexDescriptor from, const VertexDescriptor to,
+                               const float capacity, const float reverseCapacity);
+
+    /** The graph. The source and the sink are the last two vertices. */
+    GraphType Graph;
+
+    /** The number of nodes. */
+    unsigned int NumberOfNodes = 0;
+
+    /** The terminal edges of each node. */
+    std::vector<EdgeDescriptor> SourceEdges;
+    std::vector<EdgeDescriptor> SinkEdges;
+
+    /** The side of the cut of each node, after ComputeMaxFlow(). */
+    std::vector<unsigned char> IsSourceSide;
+};
+
+#endif
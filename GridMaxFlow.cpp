@@ -0,0 +1,770 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GridMaxFlow.h"
+#include "SmoothnessTerm.h"
+#include "Trace.h"
+
+// STL
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+    const unsigned int QueueBlockSize = 1024;
+    const int InfiniteDistance = std::numeric_limits<int>::max();
+
+    // Strips thinner than this are not worth a thread: most of their flow would cross into the neighboring strips
+    const unsigned int MinimumStripHeight = 64;
+}
+
+GridMaxFlow::GridMaxFlow()
+{
+    std::fill(this->Offsets, this->Offsets + 8, 0);
+}
+
+GridMaxFlow::Region::Region(const unsigned int begin, const unsigned int end)
+{
+    this->Begin = begin;
+    this->End = end;
+    this->QueueItemBlock = new DBlock<QueueItem>(QueueBlockSize);
+}
+
+GridMaxFlow::Region::~Region()
+{
+    delete this->QueueItemBlock;
+}
+
+size_t GridMaxFlow::Region::GetQueueBytes() const
+{
+    // A DBlock never gives a block back, so it holds as many blocks as the most items that were in use at once needed
+    const size_t numberOfBlocks = (this->MaxNumberOfQueueItems + QueueBlockSize - 1) / QueueBlockSize;
+    return numberOfBlocks * QueueBlockSize * sizeof(QueueItem);
+}
+
+void GridMaxFlow::Initialize(const unsigned int width, const unsigned int height, const bool eightConnected)
+{
+    this->Width = width;
+    this->Height = height;
+    this->NumberOfDirections = eightConnected ? 8 : 4;
+
+    const int w = static_cast<int>(width);
+    const int offsets[8] = {1, -1, w, -w, w + 1, -(w + 1), w - 1, -(w - 1)};
+    std::copy(offsets, offsets + 8, this->Offsets);
+
+    const unsigned int numberOfNodes = width * height;
+    for(unsigned int direction = 0; direction < 8; ++direction)
+    {
+        this->ResidualCapacities[direction].assign(direction < this->NumberOfDirections ? numberOfNodes : 0, 0.0f);
+    }
+    this->TerminalCapacities.assign(numberOfNodes, 0.0f);
+    this->Parents.assign(numberOfNodes, FREE);
+    this->InSinkTree.assign(numberOfNodes, 0);
+    this->IsActive.assign(numberOfNodes, 0);
+    this->Timestamps.assign(numberOfNodes, 0);
+    this->Distances.assign(numberOfNodes, 0);
+
+    this->NeighborMasks.resize(numberOfNodes);
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        for(unsigned int x = 0; x < width; ++x)
+        {
+            const bool hasNeighbor[8] = {x + 1 < width, x > 0, y + 1 < height, y > 0,
+                                         x + 1 < width && y + 1 < height, x > 0 && y > 0,
+                                         x > 0 && y + 1 < height, x + 1 < width && y > 0};
+            unsigned char mask = 0;
+            for(unsigned int direction = 0; direction < this->NumberOfDirections; ++direction)
+            {
+                if(hasNeighbor[direction])
+                {
+                    mask |= 1 << direction;
+                }
+            }
+            this->NeighborMasks[y * width + x] = mask;
+        }
+    }
+}
+
+void GridMaxFlow::SetNeighborCapacities(const SmoothnessTerm& smoothnessTerm)
+{
+    if(smoothnessTerm.GetWidth() != this->Width || smoothnessTerm.GetHeight() != this->Height ||
+       smoothnessTerm.GetEightConnected() != (this->NumberOfDirections == 8))
+    {
+        throw std::runtime_error("GridMaxFlow::SetNeighborCapacities: the smoothness term does not match the grid!");
+    }
+
+    // Each weight is the capacity of a link in both directions
+    const DirectionEnum forward[4] = {EAST, SOUTH, SOUTH_EAST, SOUTH_WEST};
+    const unsigned int numberOfNodes = this->Width * this->Height;
+    for(unsigned int i = 0; i < this->NumberOfDirections / 2; ++i)
+    {
+        const float* weights = smoothnessTerm.GetWeights(static_cast<SmoothnessTerm::DirectionEnum>(i));
+        std::vector<float>& forwardCapacities = this->ResidualCapacities[forward[i]];
+        std::vector<float>& reverseCapacities = this->ResidualCapacities[forward[i] ^ 1];
+        for(unsigned int p = 0; p < numberOfNodes; ++p)
+        {
+            if(this->NeighborMasks[p] & (1 << forward[i]))
+            {
+                forwardCapacities[p] = weights[p];
+                reverseCapacities[Neighbor(p, forward[i])] = weights[p];
+            }
+        }
+    }
+}
+
+unsigned int GridMaxFlow::GetBytesPerNode() const
+{
+    return GetBytesPerNode(this->NumberOfDirections == 8);
+}
+
+unsigned int GridMaxFlow::GetBytesPerNode(const bool eightConnected)
+{
+    return (eightConnected ? 8 : 4) * sizeof(float) + sizeof(float) + 4 * sizeof(unsigned char) + 2 * sizeof(int);
+}
+
+size_t GridMaxFlow::GetMaxQueueBytes(const unsigned int numberOfNodes)
+{
+    const size_t numberOfBlocks = (2 * static_cast<size_t>(numberOfNodes) + QueueBlockSize - 1) / QueueBlockSize;
+    return numberOfBlocks * QueueBlockSize * sizeof(QueueItem);
+}
+
+GridMaxFlow::QueueItem* GridMaxFlow::NewQueueItem(Region& region)
+{
+    region.NumberOfQueueItems++;
+    region.MaxNumberOfQueueItems = std::max(region.MaxNumberOfQueueItems, region.NumberOfQueueItems);
+    return region.QueueItemBlock->New();
+}
+
+void GridMaxFlow::DeleteQueueItem(Region& region, QueueItem* const item)
+{
+    region.NumberOfQueueItems--;
+    region.QueueItemBlock->Delete(item);
+}
+
+void GridMaxFlow::SetActive(Region& region, const unsigned int p)
+{
+    if(this->IsActive[p])
+    {
+        return;
+    }
+
+    QueueItem* item = NewQueueItem(region);
+    item->Node = p;
+    item->Next = nullptr;
+    if(region.ActiveQueue.Last)
+    {
+        region.ActiveQueue.Last->Next = item;
+    }
+    else
+    {
+        region.ActiveQueue.First = item;
+    }
+    region.ActiveQueue.Last = item;
+    this->IsActive[p] = 1;
+}
+
+bool GridMaxFlow::NextActive(Region& region, unsigned int& p)
+{
+    while(region.ActiveQueue.First)
+    {
+        QueueItem* item = region.ActiveQueue.First;
+        region.ActiveQueue.First = item->Next;
+        if(!region.ActiveQueue.First)
+        {
+            region.ActiveQueue.Last = nullptr;
+        }
+
+        p = item->Node;
+        DeleteQueueItem(region, item);
+        this->IsActive[p] = 0;
+
+        if(this->Parents[p] != FREE)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void GridMaxFlow::AddOrphan(Region& region, const unsigned int p, const bool front)
+{
+    this->Parents[p] = ORPHAN;
+
+    QueueItem* item = NewQueueItem(region);
+    item->Node = p;
+    if(front)
+    {
+        item->Next = region.OrphanQueue.First;
+        region.OrphanQueue.First = item;
+        if(!region.OrphanQueue.Last)
+        {
+            region.OrphanQueue.Last = item;
+        }
+    }
+    else
+    {
+        item->Next = nullptr;
+        if(region.OrphanQueue.Last)
+        {
+            region.OrphanQueue.Last->Next = item;
+        }
+        else
+        {
+            region.OrphanQueue.First = item;
+        }
+        region.OrphanQueue.Last = item;
+    }
+}
+
+double GridMaxFlow::Augment(Region& region, const unsigned int sourceSide, const unsigned int direction)
+{
+    const unsigned int sinkSide = Neighbor(sourceSide, direction);
+
+    // The bottleneck: the middle edge, the path back to the source and the path on to the sink
+    float bottleneck = this->ResidualCapacities[direction][sourceSide];
+    for(unsigned int p = sourceSide; ; )
+    {
+        const unsigned int parentDirection = this->Parents[p];
+        if(parentDirection == TERMINAL)
+        {
+            bottleneck = std::min(bottleneck, this->TerminalCapacities[p]);
+            break;
+        }
+        const unsigned int parent = Neighbor(p, parentDirection);
+        bottleneck = std::min(bottleneck, this->ResidualCapacities[parentDirection ^ 1][parent]);
+        p = parent;
+    }
+    for(unsigned int p = sinkSide; ; )
+    {
+        const unsigned int parentDirection = this->Parents[p];
+        if(parentDirection == TERMINAL)
+        {
+            bottleneck = std::min(bottleneck, -this->TerminalCapacities[p]);
+            break;
+        }
+        bottleneck = std::min(bottleneck, this->ResidualCapacities[parentDirection][p]);
+        p = Neighbor(p, parentDirection);
+    }
+
+    // Push it. The nodes whose edge to their parent becomes saturated are orphaned.
+    this->ResidualCapacities[direction][sourceSide] -= bottleneck;
+    this->ResidualCapacities[direction ^ 1][sinkSide] += bottleneck;
+
+    for(unsigned int p = sourceSide; ; )
+    {
+        const unsigned int parentDirection = this->Parents[p];
+        if(parentDirection == TERMINAL)
+        {
+            this->TerminalCapacities[p] -= bottleneck;
+            if(this->TerminalCapacities[p] == 0)
+            {
+                AddOrphan(region, p, true);
+            }
+            break;
+        }
+        const unsigned int parent = Neighbor(p, parentDirection);
+        this->ResidualCapacities[parentDirection][p] += bottleneck;
+        this->ResidualCapacities[parentDirection ^ 1][parent] -= bottleneck;
+        if(this->ResidualCapacities[parentDirection ^ 1][parent] == 0)
+        {
+            AddOrphan(region, p, true);
+        }
+        p = parent;
+    }
+    for(unsigned int p = sinkSide; ; )
+    {
+        const unsigned int parentDirection = this->Parents[p];
+        if(parentDirection == TERMINAL)
+        {
+            this->TerminalCapacities[p] += bottleneck;
+            if(this->TerminalCapacities[p] == 0)
+            {
+                AddOrphan(region, p, true);
+            }
+            break;
+        }
+        const unsigned int parent = Neighbor(p, parentDirection);
+        this->ResidualCapacities[parentDirection ^ 1][parent] += bottleneck;
+        this->ResidualCapacities[parentDirection][p] -= bottleneck;
+        if(this->ResidualCapacities[parentDirection][p] == 0)
+        {
+            AddOrphan(region, p, true);
+        }
+        p = parent;
+    }
+
+    return bottleneck;
+}
+
+void GridMaxFlow::ProcessSourceOrphan(Region& region, const unsigned int p)
+{
+    const unsigned char mask = this->NeighborMasks[p];
+
+    // Look for a neighbor in the source tree that still reaches the source and has residual capacity towards p
+    int minimumDistance = InfiniteDistance;
+    unsigned int bestDirection = FREE;
+    for(unsigned int direction = 0; direction < this->NumberOfDirections; ++direction)
+    {
+        if(!(mask & (1 << direction)))
+        {
+            continue;
+        }
+        const unsigned int q = Neighbor(p, direction);
+        if(!region.Contains(q))
+        {
+            continue;
+        }
+        if(this->InSinkTree[q] || this->Parents[q] == FREE || this->ResidualCapacities[direction ^ 1][q] <= 0)
+        {
+            continue;
+        }
+
+        int distance = 0;
+        for(unsigned int k = q; ; )
+        {
+            if(this->Timestamps[k] == region.Time)
+            {
+                distance += this->Distances[k];
+                break;
+            }
+            const unsigned int parentDirection = this->Parents[k];
+            distance++;
+            if(parentDirection == TERMINAL)
+            {
+                this->Timestamps[k] = region.Time;
+                this->Distances[k] = 1;
+                break;
+            }
+            if(parentDirection == ORPHAN)
+            {
+                distance = InfiniteDistance;
+                break;
+            }
+            k = Neighbor(k, parentDirection);
+        }
+
+        if(distance < InfiniteDistance)
+        {
+            if(distance < minimumDistance)
+            {
+                bestDirection = direction;
+                minimumDistance = distance;
+            }
+            // Remember the distances along the path for the next orphans
+            int pathDistance = distance;
+            for(unsigned int k = q; this->Timestamps[k] != region.Time; k = Neighbor(k, this->Parents[k]))
+            {
+                this->Timestamps[k] = region.Time;
+                this->Distances[k] = pathDistance--;
+            }
+        }
+    }
+
+    if(bestDirection != FREE)
+    {
+        this->Parents[p] = bestDirection;
+        this->Timestamps[p] = region.Time;
+        this->Distances[p] = minimumDistance + 1;
+        return;
+    }
+
+    // No new parent: p becomes free, its children become orphans and its neighbors may grow into it again
+    for(unsigned int direction = 0; direction < this->NumberOfDirections; ++direction)
+    {
+        if(!(mask & (1 << direction)))
+        {
+            continue;
+        }
+        const unsigned int q = Neighbor(p, direction);
+        if(!region.Contains(q))
+        {
+            continue;
+        }
+        const unsigned int parentDirection = this->Parents[q];
+        if(this->InSinkTree[q] || parentDirection == FREE)
+        {
+            continue;
+        }
+        if(this->ResidualCapacities[direction ^ 1][q] > 0)
+        {
+            SetActive(region, q);
+        }
+        if(parentDirection < TERMINAL && Neighbor(q, parentDirection) == p)
+        {
+            AddOrphan(region, q, false);
+        }
+    }
+    this->Parents[p] = FREE;
+}
+
+void GridMaxFlow::ProcessSinkOrphan(Region& region, const unsigned int p)
+{
+    const unsigned char mask = this->NeighborMasks[p];
+
+    int minimumDistance = InfiniteDistance;
+    unsigned int bestDirection = FREE;
+    for(unsigned int direction = 0; direction < this->NumberOfDirections; ++direction)
+    {
+        if(!(mask & (1 << direction)))
+        {
+            continue;
+        }
+        const unsigned int q = Neighbor(p, direction);
+        if(!region.Contains(q))
+        {
+            continue;
+        }
+        if(!this->InSinkTree[q] || this->Parents[q] == FREE || this->ResidualCapacities[direction][p] <= 0)
+        {
+            continue;
+        }
+
+        int distance = 0;
+        for(unsigned int k = q; ; )
+        {
+            if(this->Timestamps[k] == region.Time)
+            {
+                distance += this->Distances[k];
+                break;
+            }
+            const unsigned int parentDirection = this->Parents[k];
+            distance++;
+            if(parentDirection == TERMINAL)
+            {
+                this->Timestamps[k] = region.Time;
+                this->Distances[k] = 1;
+                break;
+            }
+            if(parentDirection == ORPHAN)
+            {
+                distance = InfiniteDistance;
+                break;
+            }
+            k = Neighbor(k, parentDirection);
+        }
+
+        if(distance < InfiniteDistance)
+        {
+            if(distance < minimumDistance)
+            {
+                bestDirection = direction;
+                minimumDistance = distance;
+            }
+            int pathDistance = distance;
+            for(unsigned int k = q; this->Timestamps[k] != region.Time; k = Neighbor(k, this->Parents[k]))
+            {
+                this->Timestamps[k] = region.Time;
+                this->Distances[k] = pathDistance--;
+            }
+        }
+    }
+
+    if(bestDirection != FREE)
+    {
+        this->Parents[p] = bestDirection;
+        this->Timestamps[p] = region.Time;
+        this->Distances[p] = minimumDistance + 1;
+        return;
+    }
+
+    for(unsigned int direction = 0; direction < this->NumberOfDirections; ++direction)
+    {
+        if(!(mask & (1 << direction)))
+        {
+            continue;
+        }
+        const unsigned int q = Neighbor(p, direction);
+        if(!region.Contains(q))
+        {
+            continue;
+        }
+        const unsigned int parentDirection = this->Parents[q];
+        if(!this->InSinkTree[q] || parentDirection == FREE)
+        {
+            continue;
+        }
+        if(this->ResidualCapacities[direction][p] > 0)
+        {
+            SetActive(region, q);
+        }
+        if(parentDirection < TERMINAL && Neighbor(q, parentDirection) == p)
+        {
+            AddOrphan(region, q, false);
+        }
+    }
+    this->Parents[p] = FREE;
+}
+
+double GridMaxFlow::ComputeMaxFlow()
+{
+    double flow = 0;
+    Region grid(0, this->Width * this->Height);
+    this->NumberOfAugmentations = 0;
+    this->NumberOfOrphans = 0;
+    this->QueueBytes = 0;
+
+    // Solve horizontal strips independently (ignoring the links between them), then finish on the whole grid.
+    // Flow pushed inside a strip is a valid flow of the whole grid, so the final pass only pushes what crosses the strips
+    // and the cut is the same as that of a serial solve.
+    const unsigned int numberOfStrips = std::min(this->NumberOfThreads, this->Height / MinimumStripHeight);
+    if(numberOfStrips > 1)
+    {
+        std::vector<double> stripFlows(numberOfStrips, 0);
+        std::vector<int> stripTimes(numberOfStrips, 0);
+        std::vector<unsigned long long> stripAugmentations(numberOfStrips, 0);
+        std::vector<unsigned long long> stripOrphans(numberOfStrips, 0);
+        std::vector<size_t> stripQueueBytes(numberOfStrips, 0);
+        std::vector<unsigned int> firstRows(numberOfStrips + 1);
+        for(unsigned int strip = 0; strip <= numberOfStrips; ++strip)
+        {
+            firstRows[strip] = static_cast<unsigned long long>(this->Height) * strip / numberOfStrips;
+        }
+
+        auto solveStrip = [&](const unsigned int strip)
+        {
+            GRABCUT_TRACE_SCOPE("max flow strip");
+            Region region(firstRows[strip] * this->Width, firstRows[strip + 1] * this->Width);
+            InitializeTrees(region);
+            stripFlows[strip] = Grow(region);
+            stripTimes[strip] = region.Time;
+            stripAugmentations[strip] = region.NumberOfAugmentations;
+            stripOrphans[strip] = region.NumberOfOrphans;
+            stripQueueBytes[strip] = region.GetQueueBytes();
+        };
+
+        std::vector<std::thread> threads;
+        for(unsigned int strip = 1; strip < numberOfStrips; ++strip)
+        {
+            threads.push_back(std::thread(solveStrip, strip));
+        }
+        solveStrip(0);
+        for(unsigned int i = 0; i < threads.size(); ++i)
+        {
+            threads[i].join();
+        }
+
+        for(unsigned int strip = 0; strip < numberOfStrips; ++strip)
+        {
+            flow += stripFlows[strip];
+            this->NumberOfAugmentations += stripAugmentations[strip];
+            this->NumberOfOrphans += stripOrphans[strip];
+            this->QueueBytes += stripQueueBytes[strip]; // The strips are solved at the same time
+        }
+
+        // The trees of the strips are kept: every node has already tried all of its links except those that cross into
+        // another strip, so only the nodes on either side of a strip boundary have to grow again
+        grid.Time = *std::max_element(stripTimes.begin(), stripTimes.end()) + 1;
+        for(unsigned int strip = 1; strip < numberOfStrips; ++strip)
+        {
+            for(unsigned int p = (firstRows[strip] - 1) * this->Width; p < (firstRows[strip] + 1) * this->Width; ++p)
+            {
+                if(this->Parents[p] != FREE)
+                {
+                    SetActive(grid, p);
+                }
+            }
+        }
+    }
+    else
+    {
+        InitializeTrees(grid);
+    }
+
+    {
+        GRABCUT_TRACE_SCOPE("max flow pass");
+        flow += Grow(grid);
+    }
+    this->NumberOfAugmentations += grid.NumberOfAugmentations;
+    this->NumberOfOrphans += grid.NumberOfOrphans;
+    this->QueueBytes = std::max(this->QueueBytes, grid.GetQueueBytes());
+
+    return flow;
+}
+
+void GridMaxFlow::InitializeTrees(Region& region)
+{
+    // Start the search trees from the nodes with a terminal residual
+    region.Time = 0;
+    for(unsigned int p = region.Begin; p < region.End; ++p)
+    {
+        this->IsActive[p] = 0;
+        this->Timestamps[p] = 0;
+        if(this->TerminalCapacities[p] != 0)
+        {
+            this->Parents[p] = TERMINAL;
+            this->InSinkTree[p] = this->TerminalCapacities[p] < 0;
+            this->Distances[p] = 1;
+            SetActive(region, p);
+        }
+        else
+        {
+            this->Parents[p] = FREE;
+        }
+    }
+}
+
+double GridMaxFlow::Grow(Region& region)
+{
+    double flow = 0;
+    bool haveCurrent = false;
+    unsigned int current = 0;
+    while(true)
+    {
+        // Keep growing from the node that found the last path, as it is likely to find another one
+        unsigned int i = 0;
+        bool haveNode = false;
+        if(haveCurrent)
+        {
+            haveCurrent = false;
+            this->IsActive[current] = 0;
+            if(this->Parents[current] != FREE)
+            {
+                i = current;
+                haveNode = true;
+            }
+        }
+        if(!haveNode && !NextActive(region, i))
+        {
+            break;
+        }
+
+        // Grow the tree of i. A path is found when it touches the other tree; it is given by the edge that joins them.
+        bool foundPath = false;
+        unsigned int pathSourceSide = 0;
+        unsigned int pathDirection = 0;
+        const unsigned char mask = this->NeighborMasks[i];
+        if(!this->InSinkTree[i])
+        {
+            for(unsigned int direction = 0; direction < this->NumberOfDirections; ++direction)
+            {
+                if(!(mask & (1 << direction)) || this->ResidualCapacities[direction][i] <= 0)
+                {
+                    continue;
+                }
+                const unsigned int j = Neighbor(i, direction);
+                if(!region.Contains(j))
+                {
+                    continue;
+                }
+                if(this->Parents[j] == FREE)
+                {
+                    this->InSinkTree[j] = 0;
+                    this->Parents[j] = direction ^ 1;
+                    this->Timestamps[j] = this->Timestamps[i];
+                    this->Distances[j] = this->Distances[i] + 1;
+                    SetActive(region, j);
+                }
+                else if(this->InSinkTree[j])
+                {
+                    foundPath = true;
+                    pathSourceSide = i;
+                    pathDirection = direction;
+                    break;
+                }
+                else if(this->Timestamps[j] <= this->Timestamps[i] && this->Distances[j] > this->Distances[i])
+                {
+                    // Make j's path to the source shorter
+                    this->Parents[j] = direction ^ 1;
+                    this->Timestamps[j] = this->Timestamps[i];
+                    this->Distances[j] = this->Distances[i] + 1;
+                }
+            }
+        }
+        else
+        {
+            for(unsigned int direction = 0; direction < this->NumberOfDirections; ++direction)
+            {
+                if(!(mask & (1 << direction)))
+                {
+                    continue;
+                }
+                const unsigned int j = Neighbor(i, direction);
+                if(!region.Contains(j))
+                {
+                    continue;
+                }
+                if(this->ResidualCapacities[direction ^ 1][j] <= 0)
+                {
+                    continue;
+                }
+                if(this->Parents[j] == FREE)
+                {
+                    this->InSinkTree[j] = 1;
+                    this->Parents[j] = direction ^ 1;
+                    this->Timestamps[j] = this->Timestamps[i];
+                    this->Distances[j] = this->Distances[i] + 1;
+                    SetActive(region, j);
+                }
+                else if(!this->InSinkTree[j])
+                {
+                    foundPath = true;
+                    pathSourceSide = j;
+                    pathDirection = direction ^ 1;
+                    break;
+                }
+                else if(this->Timestamps[j] <= this->Timestamps[i] && this->Distances[j] > this->Distances[i])
+                {
+                    this->Parents[j] = direction ^ 1;
+                    this->Timestamps[j] = this->Timestamps[i];
+                    this->Distances[j] = this->Distances[i] + 1;
+                }
+            }
+        }
+
+        region.Time++;
+
+        if(!foundPath)
+        {
+            continue;
+        }
+
+        // Mark i as active so it is not queued while it is the current node
+        this->IsActive[i] = 1;
+        current = i;
+        haveCurrent = true;
+
+        flow += Augment(region, pathSourceSide, pathDirection);
+        region.NumberOfAugmentations++;
+
+        // Adoption
+        while(region.OrphanQueue.First)
+        {
+            QueueItem* item = region.OrphanQueue.First;
+            region.OrphanQueue.First = item->Next;
+            if(!region.OrphanQueue.First)
+            {
+                region.OrphanQueue.Last = nullptr;
+            }
+            const unsigned int orphan = item->Node;
+            DeleteQueueItem(region, item);
+            region.NumberOfOrphans++;
+
+            if(this->InSinkTree[orphan])
+            {
+                ProcessSinkOrphan(region, orphan);
+            }
+            else
+            {
+                ProcessSourceOrphan(region, orphan);
+            }
+        }
+    }
+
+    return flow;
+}
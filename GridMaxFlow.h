@@ -0,0 +1,257 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GridMaxFlow_H
+#define GridMaxFlow_H
+
+// STL
+#include <cstddef>
+#include <vector>
+
+#include "block.h"
+
+class SmoothnessTerm;
+
+/** The Boykov-Kolmogorov max flow algorithm specialized for a 4 or 8 connected 2D grid.
+  * Node p is pixel (p % width, p / width). Its neighbors are found by fixed offsets rather than stored edges, the residual
+  * capacity of each of the (up to) 8 edges leaving a node lives in one flat array per direction, and the two terminal
+  * edges of a node are folded into a single signed residual (positive: from the source, negative: to the sink).
+  * The active node and orphan queues are linked lists allocated from a DBlock (one per concurrently solved region).
+  * The residual capacities are kept after ComputeMaxFlow(), so adding to the terminal capacities afterwards and calling
+  * ComputeMaxFlow() again only pushes the flow that changed. */
+class GridMaxFlow
+{
+public:
+    /** The directions of the edges leaving a node. The reverse of direction d is d ^ 1. */
+    enum DirectionEnum { EAST, WEST, SOUTH, NORTH, SOUTH_EAST, NORTH_WEST, SOUTH_WEST, NORTH_EAST };
+
+    /** Constructor. */
+    GridMaxFlow();
+
+    /** Set how many threads ComputeMaxFlow() may use. This does not change the cut. */
+    void SetNumberOfThreads(const unsigned int numberOfThreads)
+    {
+        this->NumberOfThreads = numberOfThreads > 0 ? numberOfThreads : 1;
+    }
+
+    /** Create a grid with all capacities zero. */
+    void Initialize(const unsigned int width, const unsigned int height, const bool eightConnected);
+
+    /** Set the capacity of the edge from node p to its neighbor in a direction. */
+    void SetNeighborCapacity(const unsigned int p, const DirectionEnum direction, const float capacity)
+    {
+        this->ResidualCapacities[direction][p] = capacity;
+    }
+
+    /** Set the capacities of all edges (in both directions) from the n-link weights of the image. */
+    void SetNeighborCapacities(const SmoothnessTerm& smoothnessTerm);
+
+    /** Set the capacities of the source -> p and p -> sink edges, replacing what is left of the previous ones. */
+    void SetTerminalCapacities(const unsigned int p, const float sourceCapacity, const float sinkCapacity)
+    {
+        this->TerminalCapacities[p] = sourceCapacity - sinkCapacity;
+    }
+
+    /** Add to the capacities of the source -> p and p -> sink edges, keeping the flow already pushed through them.
+      * The capacities may decrease; the residual of p is signed, so this is always feasible. */
+    void AddTerminalCapacities(const unsigned int p, const float sourceCapacity, const float sinkCapacity)
+    {
+        this->TerminalCapacities[p] += sourceCapacity - sinkCapacity;
+    }
+
+    /** Push as much flow as possible and return the amount that was pushed by this call.
+      * With several threads, horizontal strips of the grid are first solved concurrently without the links between them;
+      * a serial pass over the whole grid then continues from their search trees and pushes the remaining flow, so the cut
+      * is exactly that of the serial solver. */
+    double ComputeMaxFlow();
+
+    /** Get whether node p is on the source side of the minimum cut (reachable from the source in the residual graph). */
+    bool IsSource(const unsigned int p) const
+    {
+        return this->Parents[p] != FREE && !this->InSinkTree[p];
+    }
+
+    /** Get the number of bytes used per node. */
+    unsigned int GetBytesPerNode() const;
+
+    /** Get the number of bytes used per node of a 4 or 8 connected grid. */
+    static unsigned int GetBytesPerNode(const bool eightConnected);
+
+    /** Get the most bytes the queues of a grid of this many nodes can take (every node in both queues at once). */
+    static size_t GetMaxQueueBytes(const unsigned int numberOfNodes);
+
+    /** Get the number of bytes of the grid (every node, without the queues). */
+    size_t GetNumberOfBytes() const
+    {
+        return static_cast<size_t>(this->Width) * this->Height * GetBytesPerNode();
+    }
+
+    /** Get the number of bytes the active node and orphan queues of the last ComputeMaxFlow() took at their largest
+      * (the queue items are allocated in blocks, so this is a multiple of the block size). */
+    size_t GetQueueBytes() const
+    {
+        return this->QueueBytes;
+    }
+
+    /** Get the number of augmenting paths the last ComputeMaxFlow() pushed flow along. */
+    unsigned long long GetNumberOfAugmentations() const
+    {
+        return this->NumberOfAugmentations;
+    }
+
+    /** Get the number of orphans the last ComputeMaxFlow() processed. */
+    unsigned long long GetNumberOfOrphans() const
+    {
+        return this->NumberOfOrphans;
+    }
+
+protected:
+
+    /** Special parents. Values below 8 are the direction to the parent. */
+    enum ParentEnum { TERMINAL = 8, ORPHAN = 9, FREE = 10 };
+
+    /** An entry of the active node or orphan queue. */
+    struct QueueItem
+    {
+        unsigned int Node;
+        QueueItem* Next;
+    };
+
+    /** A singly linked queue of QueueItems. */
+    struct Queue
+    {
+        QueueItem* First = nullptr;
+        QueueItem* Last = nullptr;
+    };
+
+    /** A range of nodes (whole rows) that is solved on its own, with the search state of that solve. */
+    struct Region
+    {
+        Region(const unsigned int begin, const unsigned int end);
+        ~Region();
+
+        Region(const Region&) = delete;
+        Region& operator=(const Region&) = delete;
+
+        bool Contains(const unsigned int p) const
+        {
+            return p >= this->Begin && p < this->End;
+        }
+
+        /** The nodes [Begin, End). */
+        unsigned int Begin;
+        unsigned int End;
+
+        /** The storage of the queue items. */
+        DBlock<QueueItem>* QueueItemBlock;
+
+        /** The active nodes. */
+        Queue ActiveQueue;
+
+        /** The orphans. */
+        Queue OrphanQueue;
+
+        /** The current time of the distance heuristic. */
+        int Time = 0;
+
+        /** The work done: augmenting paths and orphans. */
+        unsigned long long NumberOfAugmentations = 0;
+        unsigned long long NumberOfOrphans = 0;
+
+        /** The number of queue items in use, and the most that were in use at once. */
+        unsigned int NumberOfQueueItems = 0;
+        unsigned int MaxNumberOfQueueItems = 0;
+
+        /** Get the number of bytes the queue item blocks took at their largest. */
+        size_t GetQueueBytes() const;
+    };
+
+    /** Make every node of a region with a terminal residual the (active) root of its search tree, and free the others. */
+    void InitializeTrees(Region& region);
+
+    /** Run the BK algorithm on the nodes of a region and the links between them, starting from the current search trees
+      * and active nodes. Returns the flow that was pushed. */
+    double Grow(Region& region);
+
+    /** Get the neighbor of node p in a direction. */
+    unsigned int Neighbor(const unsigned int p, const unsigned int direction) const
+    {
+        return p + this->Offsets[direction];
+    }
+
+    /** Append a node to the active queue, if it is not in it yet. */
+    void SetActive(Region& region, const unsigned int p);
+
+    /** Take the next node from the active queue, skipping nodes that have become free. Returns false if there are none. */
+    bool NextActive(Region& region, unsigned int& p);
+
+    /** Take a queue item from the block of a region, or give one back. */
+    QueueItem* NewQueueItem(Region& region);
+    void DeleteQueueItem(Region& region, QueueItem* const item);
+
+    /** Add an orphan, at the front (while augmenting) or at the back (while adopting). */
+    void AddOrphan(Region& region, const unsigned int p, const bool front);
+
+    /** Push the bottleneck flow along the path through the edge from sourceSide to sinkSide. */
+    double Augment(Region& region, const unsigned int sourceSide, const unsigned int direction);
+
+    /** Find a new parent for an orphan of the source or sink tree, or free it. */
+    void ProcessSourceOrphan(Region& region, const unsigned int p);
+    void ProcessSinkOrphan(Region& region, const unsigned int p);
+
+    /** The grid size. */
+    unsigned int Width = 0;
+    unsigned int Height = 0;
+
+    /** The number of directions: 4 or 8. */
+    unsigned int NumberOfDirections = 8;
+
+    /** The offset from a node to its neighbor in each direction. */
+    int Offsets[8];
+
+    /** The residual capacity of the edge from each node in each direction. */
+    std::vector<float> ResidualCapacities[8];
+
+    /** The signed residual terminal capacity of each node. */
+    std::vector<float> TerminalCapacities;
+
+    /** The bit 1 << d is set if a node has a neighbor in direction d. */
+    std::vector<unsigned char> NeighborMasks;
+
+    /** The search trees: the direction to the parent (or a ParentEnum) and the tree of each node. */
+    std::vector<unsigned char> Parents;
+    std::vector<unsigned char> InSinkTree;
+
+    /** Whether a node is in the active queue. */
+    std::vector<unsigned char> IsActive;
+
+    /** The distance heuristic: the time a node's distance to its terminal was last verified, and that distance. */
+    std::vector<int> Timestamps;
+    std::vector<int> Distances;
+
+    /** The number of threads. */
+    unsigned int NumberOfThreads = 1;
+
+    /** The work done by the last ComputeMaxFlow(). */
+    unsigned long long NumberOfAugmentations = 0;
+    unsigned long long NumberOfOrphans = 0;
+
+    /** The memory the queues of the last ComputeMaxFlow() took at their largest. */
+    size_t QueueBytes = 0;
+};
+
+#endif
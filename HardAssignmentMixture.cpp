@@ -0,0 +1,220 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "HardAssignmentMixture.h"
+
+// Submodules
+#include "ExpectationMaximization/Model.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+void HardAssignmentMixture::Initialize(const unsigned int dimensionality, const unsigned int numberOfComponents)
+{
+    this->Dimensionality = dimensionality;
+    this->Statistics.assign(static_cast<size_t>(numberOfComponents) * GetComponentStride(), 0.0);
+    this->Components.clear();
+}
+
+void HardAssignmentMixture::SetMixtureModel(const MixtureModel& mixtureModel)
+{
+    const std::vector<Model*> models = mixtureModel.GetModels();
+    const unsigned int dimensionality = this->Dimensionality;
+    if(models.size() * GetComponentStride() != this->Statistics.size())
+    {
+        throw std::runtime_error("HardAssignmentMixture::SetMixtureModel: the mixture model does not have the components that were initialized!");
+    }
+
+    this->Components.resize(models.size());
+    bool anyValid = false;
+    for(unsigned int k = 0; k < models.size(); ++k)
+    {
+        Component& component = this->Components[k];
+        const Eigen::VectorXd mean = models[k]->GetMean();
+        component.Mean.assign(mean.data(), mean.data() + dimensionality);
+
+        const double weight = models[k]->GetMixingCoefficient();
+        if(!(weight > 0))
+        {
+            component.LogNormalizer = -std::numeric_limits<double>::infinity();
+            continue;
+        }
+
+        Eigen::MatrixXd covariance = models[k]->GetVariance();
+        Eigen::LLT<Eigen::MatrixXd> cholesky(covariance);
+        double jitter = 1e-6 * std::max(covariance.trace() / dimensionality, 1.0);
+        while(cholesky.info() != Eigen::Success)
+        {
+            covariance += jitter * Eigen::MatrixXd::Identity(dimensionality, dimensionality);
+            cholesky.compute(covariance);
+            jitter *= 10;
+        }
+
+        const Eigen::MatrixXd lower = cholesky.matrixL();
+        const Eigen::MatrixXd inverseCholesky = lower.triangularView<Eigen::Lower>().solve(
+            Eigen::MatrixXd::Identity(dimensionality, dimensionality));
+        component.InverseCholesky.clear();
+        for(unsigned int i = 0; i < dimensionality; ++i)
+        {
+            for(unsigned int j = 0; j <= i; ++j)
+            {
+                component.InverseCholesky.push_back(inverseCholesky(i, j));
+            }
+        }
+
+        double logDeterminant = 0;
+        for(unsigned int i = 0; i < dimensionality; ++i)
+        {
+            logDeterminant += 2 * std::log(lower(i, i));
+        }
+        component.LogNormalizer = std::log(weight) - 0.5 * (dimensionality * std::log(2 * M_PI) + logDeterminant);
+        anyValid = true;
+    }
+
+    if(!anyValid)
+    {
+        throw std::runtime_error("HardAssignmentMixture::SetMixtureModel: no component has a positive mixing coefficient!");
+    }
+}
+
+unsigned int HardAssignmentMixture::FindMostLikelyComponent(const double* point) const
+{
+    // The largest log-density is the most likely component, so there is no exponential to take
+    unsigned int mostLikely = 0;
+    double largestLogDensity = -std::numeric_limits<double>::infinity();
+    for(unsigned int k = 0; k < this->Components.size(); ++k)
+    {
+        const Component& component = this->Components[k];
+        if(!std::isfinite(component.LogNormalizer))
+        {
+            continue;
+        }
+
+        const double* inverseCholesky = component.InverseCholesky.data();
+        double mahalanobis = 0;
+        for(unsigned int i = 0; i < this->Dimensionality; ++i)
+        {
+            double z = 0;
+            for(unsigned int j = 0; j <= i; ++j)
+            {
+                z += *inverseCholesky++ * (point[j] - component.Mean[j]);
+            }
+            mahalanobis += z * z;
+        }
+
+        const double logDensity = component.LogNormalizer - 0.5 * mahalanobis;
+        if(logDensity > largestLogDensity)
+        {
+            mostLikely = k;
+            largestLogDensity = logDensity;
+        }
+    }
+
+    return mostLikely;
+}
+
+void HardAssignmentMixture::AddPoint(const double* point, const unsigned int component, const double weight)
+{
+    double* statistics = this->Statistics.data() + static_cast<size_t>(component) * GetComponentStride();
+    statistics[0] += weight;
+    for(unsigned int i = 0; i < this->Dimensionality; ++i)
+    {
+        statistics[1 + i] += weight * point[i];
+    }
+
+    unsigned int productIndex = 1 + this->Dimensionality;
+    for(unsigned int i = 0; i < this->Dimensionality; ++i)
+    {
+        for(unsigned int j = i; j < this->Dimensionality; ++j)
+        {
+            statistics[productIndex++] += weight * point[i] * point[j];
+        }
+    }
+}
+
+void HardAssignmentMixture::AddStatistics(const HardAssignmentMixture& other)
+{
+    if(other.Dimensionality != this->Dimensionality || other.Statistics.size() != this->Statistics.size())
+    {
+        throw std::runtime_error("HardAssignmentMixture::AddStatistics: the mixtures do not have the same components!");
+    }
+
+    for(size_t i = 0; i < this->Statistics.size(); ++i)
+    {
+        this->Statistics[i] += other.Statistics[i];
+    }
+}
+
+void HardAssignmentMixture::UpdateMixtureModel(const MixtureModel& mixtureModel) const
+{
+    const std::vector<Model*> models = mixtureModel.GetModels();
+    const unsigned int dimensionality = this->Dimensionality;
+    const unsigned int componentStride = GetComponentStride();
+    if(models.size() * componentStride != this->Statistics.size())
+    {
+        throw std::runtime_error("HardAssignmentMixture::UpdateMixtureModel: the mixture model does not have the components that were initialized!");
+    }
+
+    double totalCount = 0;
+    for(unsigned int k = 0; k < models.size(); ++k)
+    {
+        totalCount += this->Statistics[k * componentStride];
+    }
+    if(totalCount < 0.5)
+    {
+        return; // No points to fit, like an EM without data
+    }
+
+    for(unsigned int k = 0; k < models.size(); ++k)
+    {
+        const double* statistics = this->Statistics.data() + k * componentStride;
+        const double count = statistics[0];
+        if(count < 0.5)
+        {
+            models[k]->SetMixingCoefficient(0);
+            continue;
+        }
+
+        Eigen::VectorXd mean(dimensionality);
+        for(unsigned int i = 0; i < dimensionality; ++i)
+        {
+            mean(i) = statistics[1 + i] / count;
+        }
+
+        Eigen::MatrixXd covariance(dimensionality, dimensionality);
+        unsigned int productIndex = 1 + dimensionality;
+        for(unsigned int i = 0; i < dimensionality; ++i)
+        {
+            for(unsigned int j = i; j < dimensionality; ++j)
+            {
+                covariance(i, j) = statistics[productIndex++] / count - mean(i) * mean(j);
+                covariance(j, i) = covariance(i, j);
+            }
+        }
+
+        // Keep components of a single color invertible, like the EM does
+        covariance += 1e-6 * std::max(covariance.trace() / dimensionality, 1.0) *
+                      Eigen::MatrixXd::Identity(dimensionality, dimensionality);
+
+        models[k]->SetMean(mean);
+        models[k]->SetVariance(covariance);
+        models[k]->SetMixingCoefficient(count / totalCount);
+    }
+}
@@ -0,0 +1,92 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HardAssignmentMixture_H
+#define HardAssignmentMixture_H
+
+// STL
+#include <vector>
+
+// Eigen
+#include <Eigen/Dense>
+
+// Submodules
+#include "ExpectationMaximization/MixtureModel.h"
+
+/** Fit a Gaussian mixture model by hard assignment, as in the GrabCut paper: every point belongs to its single most
+  * likely component, and each component is the mean and covariance of its points, with their share of all points as
+  * its weight. The count, sum and outer products of the points of every component are kept, so a point that moves to
+  * another component (or into or out of the mixture) only subtracts itself from one component and adds itself to
+  * another; points that stay where they are cost nothing to update. The sums of integer colors are exact in doubles, so
+  * adding and removing points leaves no rounding behind. */
+class HardAssignmentMixture
+{
+public:
+    /** Clear the statistics of numberOfComponents components of points of a dimensionality. */
+    void Initialize(const unsigned int dimensionality, const unsigned int numberOfComponents);
+
+    /** Derive the terms of FindMostLikelyComponent() from the components of a mixture model. */
+    void SetMixtureModel(const MixtureModel& mixtureModel);
+
+    /** Get the component with the largest weighted density at a point. */
+    unsigned int FindMostLikelyComponent(const double* point) const;
+
+    /** Add a point to (weight 1) or remove a point from (weight -1) the statistics of a component. */
+    void AddPoint(const double* point, const unsigned int component, const double weight);
+
+    /** Add the statistics of another mixture of the same components, such as the points one thread added and removed. */
+    void AddStatistics(const HardAssignmentMixture& other);
+
+    /** Set every component of a mixture model to the mean and covariance of its points. A component without points
+      * keeps its mean and covariance and gets no weight. */
+    void UpdateMixtureModel(const MixtureModel& mixtureModel) const;
+
+    /** Get the number of bytes of the statistics. */
+    size_t GetNumberOfBytes() const
+    {
+        return this->Statistics.size() * sizeof(double);
+    }
+
+protected:
+
+    /** The precomputed terms of one component, in plain arrays for the loop over the pixels. The Mahalanobis distance
+      * is |L^-1 (x - mu)|^2 with the lower triangular L^-1 stored row by row. */
+    struct Component
+    {
+        std::vector<double> Mean;
+        std::vector<double> InverseCholesky;
+        double LogNormalizer; // log(w) - 0.5 * (d log(2 pi) + log|Sigma|)
+    };
+
+    /** Get the number of statistics of a component: the count, the sum (d) and the upper triangle of the outer
+      * products (d(d+1)/2). */
+    unsigned int GetComponentStride() const
+    {
+        return 1 + this->Dimensionality + this->Dimensionality * (this->Dimensionality + 1) / 2;
+    }
+
+    /** The dimensionality of the points. */
+    unsigned int Dimensionality = 0;
+
+    /** The statistics of every component, one after the other. */
+    std::vector<double> Statistics;
+
+    /** The terms of the components of the last SetMixtureModel(). */
+    std::vector<Component> Components;
+};
+
+#endif
@@ -0,0 +1,35 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MemoryUsage_H
+#define MemoryUsage_H
+
+// STL
+#include <cstddef>
+
+/** The memory of the whole process, as the operating system reports it. GrabCut accounts for its own structures itself
+  * (GrabCut::GetPeakMemoryUsage()); these are what that accounting is checked against. */
+namespace MemoryUsage
+{
+    /** Get the current resident set size of the process in bytes, or 0 where it cannot be measured. */
+    size_t GetResidentSetSize();
+
+    /** Get the largest resident set size the process has had so far in bytes, or 0 where it cannot be measured. */
+    size_t GetPeakResidentSetSize();
+}
+
+#endif
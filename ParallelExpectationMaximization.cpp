@@ -0,0 +1,708 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ParallelExpectationMaximization.h"
+#include "Trace.h"
+
+// Submodules
+#include "ExpectationMaximization/Model.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+size_t ParallelExpectationMaximization::GetNumberOfBytes() const
+{
+    const size_t dimensionality = this->Data.rows();
+    const size_t numberOfPoints = this->Data.cols();
+    const size_t componentStride = 1 + dimensionality + dimensionality * (dimensionality + 1) / 2;
+    const size_t statisticsSize = this->Mixture.GetNumberOfModels() * componentStride + 1;
+    const size_t numberOfChunks = (numberOfPoints + this->ChunkSize - 1) / this->ChunkSize;
+    return (this->Data.size() + this->Weights.size() + this->Scatters.size() + numberOfChunks * statisticsSize) * sizeof(double);
+}
+
+void ParallelExpectationMaximization::Compute()
+{
+    this->LogLikelihoods.clear();
+    this->ExpectationDurations.clear();
+    this->MaximizationDurations.clear();
+
+    const std::vector<Model*> models = this->Mixture.GetModels();
+    const unsigned int dimensionality = this->Data.rows();
+    const unsigned int numberOfPoints = this->Data.cols();
+    const unsigned int numberOfComponents = models.size();
+    if(numberOfPoints == 0 || numberOfComponents == 0)
+    {
+        return;
+    }
+
+    for(unsigned int k = 0; k < numberOfComponents; ++k)
+    {
+        if(models[k]->GetMean().size() != dimensionality)
+        {
+            throw std::runtime_error("ParallelExpectationMaximization::Compute: the models do not have the dimensionality of the data!");
+        }
+    }
+
+    if(this->Weights.size() > 0 && this->Weights.size() != numberOfPoints)
+    {
+        throw std::runtime_error("ParallelExpectationMaximization::Compute: there must be one weight per point!");
+    }
+
+    const unsigned int scatterSize = dimensionality * (dimensionality + 1) / 2;
+    if(this->Scatters.size() > 0 && (this->Scatters.rows() != scatterSize || this->Scatters.cols() != numberOfPoints))
+    {
+        throw std::runtime_error("ParallelExpectationMaximization::Compute: there must be one scatter (upper triangle) per point!");
+    }
+
+    const double totalWeight = this->Weights.size() > 0 ? this->Weights.sum() : static_cast<double>(numberOfPoints);
+    if(!(totalWeight > 0))
+    {
+        throw std::runtime_error("ParallelExpectationMaximization::Compute: the total weight of the points must be positive!");
+    }
+
+    InitializeComponents();
+
+    const unsigned int componentStride = 1 + dimensionality + dimensionality * (dimensionality + 1) / 2;
+    const unsigned int statisticsSize = numberOfComponents * componentStride + 1;
+    const unsigned int numberOfChunks = (numberOfPoints + this->ChunkSize - 1) / this->ChunkSize;
+    std::vector<double> statistics(static_cast<size_t>(numberOfChunks) * statisticsSize);
+
+    const unsigned int numberOfThreads = std::min(this->NumberOfThreads, numberOfChunks);
+
+    for(unsigned int iteration = 0; iteration < this->MaxIterations; ++iteration)
+    {
+        const std::chrono::steady_clock::time_point expectationStart = std::chrono::steady_clock::now();
+
+        const std::vector<Component> components = PrepareComponents();
+
+        // The chunks are handed out dynamically, but each one writes only its own statistics block
+        std::atomic<unsigned int> nextChunk(0);
+        auto worker = [&]()
+        {
+            for(unsigned int chunk = nextChunk++; chunk < numberOfChunks; chunk = nextChunk++)
+            {
+                AccumulateChunk(components, chunk, &statistics[static_cast<size_t>(chunk) * statisticsSize]);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(unsigned int i = 1; i < numberOfThreads; ++i)
+        {
+            threads.push_back(std::thread(worker));
+        }
+        worker();
+        for(unsigned int i = 0; i < threads.size(); ++i)
+        {
+            threads[i].join();
+        }
+
+        const std::chrono::steady_clock::time_point maximizationStart = std::chrono::steady_clock::now();
+
+        // Pairwise tree reduction into the first block, in an order fixed by the number of chunks only
+        for(unsigned int stride = 1; stride < numberOfChunks; stride *= 2)
+        {
+            for(unsigned int chunk = 0; chunk + stride < numberOfChunks; chunk += 2 * stride)
+            {
+                double* target = &statistics[static_cast<size_t>(chunk) * statisticsSize];
+                const double* source = &statistics[static_cast<size_t>(chunk + stride) * statisticsSize];
+                for(unsigned int i = 0; i < statisticsSize; ++i)
+                {
+                    target[i] += source[i];
+                }
+            }
+        }
+        const double* total = &statistics[0];
+
+        const double logLikelihood = total[statisticsSize - 1] / totalWeight;
+        this->LogLikelihoods.push_back(logLikelihood);
+
+        for(unsigned int k = 0; k < numberOfComponents; ++k)
+        {
+            const double* componentStatistics = total + k * componentStride;
+            const double weight = componentStatistics[0];
+            if(weight < 1e-8)
+            {
+                // No point belongs to this component; keep its parameters but drop it from the mixture
+                models[k]->SetMixingCoefficient(0);
+                continue;
+            }
+
+            // The sums are relative to the mean the responsibilities were computed with
+            Eigen::VectorXd shift(dimensionality);
+            for(unsigned int i = 0; i < dimensionality; ++i)
+            {
+                shift(i) = componentStatistics[1 + i] / weight;
+            }
+
+            Eigen::MatrixXd covariance(dimensionality, dimensionality);
+            unsigned int productIndex = 1 + dimensionality;
+            for(unsigned int i = 0; i < dimensionality; ++i)
+            {
+                for(unsigned int j = i; j < dimensionality; ++j)
+                {
+                    covariance(i, j) = componentStatistics[productIndex++] / weight - shift(i) * shift(j);
+                    covariance(j, i) = covariance(i, j);
+                }
+            }
+
+            // Keep components that collapsed onto a single color invertible
+            covariance += 1e-6 * std::max(covariance.trace() / dimensionality, 1.0) *
+                          Eigen::MatrixXd::Identity(dimensionality, dimensionality);
+
+            models[k]->SetMean(components[k].Mean + shift);
+            models[k]->SetVariance(covariance);
+            models[k]->SetMixingCoefficient(weight / totalWeight);
+        }
+
+        const std::chrono::steady_clock::time_point maximizationEnd = std::chrono::steady_clock::now();
+        this->ExpectationDurations.push_back(std::chrono::duration<double>(maximizationStart - expectationStart).count());
+        this->MaximizationDurations.push_back(std::chrono::duration<double>(maximizationEnd - maximizationStart).count());
+        GRABCUT_TRACE_EVENT("EM E-step", expectationStart, maximizationStart);
+        GRABCUT_TRACE_EVENT("EM M-step", maximizationStart, maximizationEnd);
+
+        if(iteration > 0 && std::abs(logLikelihood - this->LogLikelihoods[iteration - 1]) < this->MinChange)
+        {
+            break;
+        }
+    }
+}
+
+void ParallelExpectationMaximization::InitializeComponents()
+{
+    const std::vector<Model*> models = this->Mixture.GetModels();
+    for(unsigned int k = 1; k < models.size(); ++k)
+    {
+        if(models[k]->GetMean() != models[0]->GetMean() || models[k]->GetVariance() != models[0]->GetVariance())
+        {
+            return; // The caller provided a real starting point (e.g. the previous GrabCut iteration)
+        }
+    }
+
+    const unsigned int dimensionality = this->Data.rows();
+    const unsigned int numberOfPoints = this->Data.cols();
+
+    double totalWeight = 0;
+    Eigen::VectorXd mean = Eigen::VectorXd::Zero(dimensionality);
+    for(unsigned int p = 0; p < numberOfPoints; ++p)
+    {
+        mean += GetWeight(p) * this->Data.col(p);
+        totalWeight += GetWeight(p);
+    }
+    mean /= totalWeight;
+
+    Eigen::MatrixXd covariance = Eigen::MatrixXd::Zero(dimensionality, dimensionality);
+    for(unsigned int p = 0; p < numberOfPoints; ++p)
+    {
+        const Eigen::VectorXd difference = this->Data.col(p) - mean;
+        covariance += GetWeight(p) * difference * difference.transpose();
+        AddScatter(p, covariance);
+    }
+    covariance /= totalWeight;
+    covariance += 1e-6 * std::max(covariance.trace() / dimensionality, 1.0) *
+                  Eigen::MatrixXd::Identity(dimensionality, dimensionality);
+
+    if(this->Initialization == MixtureInitializationEnum::PRINCIPAL_AXIS)
+    {
+        InitializeAlongPrincipalAxis(mean, covariance);
+        return;
+    }
+
+    // The clusters are labeled with a byte per point
+    if(models.size() > 256)
+    {
+        throw std::runtime_error("ParallelExpectationMaximization::InitializeComponents: clustering initializations support at most 256 components!");
+    }
+
+    if(this->Initialization == MixtureInitializationEnum::ORCHARD_BOUMAN)
+    {
+        InitializeByOrchardBouman(mean, covariance);
+    }
+    else
+    {
+        InitializeByKMeansPlusPlus(mean, covariance);
+    }
+}
+
+void ParallelExpectationMaximization::InitializeAlongPrincipalAxis(const Eigen::VectorXd& mean, const Eigen::MatrixXd& covariance)
+{
+    const std::vector<Model*> models = this->Mixture.GetModels();
+    const unsigned int dimensionality = this->Data.rows();
+    const unsigned int numberOfPoints = this->Data.cols();
+    const double totalWeight = this->Weights.size() > 0 ? this->Weights.sum() : static_cast<double>(numberOfPoints);
+
+    // Place the means at evenly spaced quantiles along the direction of largest variance
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigenSolver(covariance);
+    const Eigen::VectorXd principalAxis = eigenSolver.eigenvectors().col(dimensionality - 1);
+
+    std::vector<std::pair<double, unsigned int> > projections(numberOfPoints);
+    for(unsigned int p = 0; p < numberOfPoints; ++p)
+    {
+        projections[p] = std::make_pair(principalAxis.dot(this->Data.col(p) - mean), p);
+    }
+
+    if(this->Weights.size() == 0)
+    {
+        for(unsigned int k = 0; k < models.size(); ++k)
+        {
+            const unsigned int rank = std::min(static_cast<unsigned int>((k + 0.5) * numberOfPoints / models.size()),
+                                               numberOfPoints - 1);
+            std::nth_element(projections.begin(), projections.begin() + rank, projections.end());
+
+            models[k]->SetMean(this->Data.col(projections[rank].second));
+            models[k]->SetVariance(covariance);
+            models[k]->SetMixingCoefficient(1.0 / models.size());
+        }
+        return;
+    }
+
+    // Weighted points: the quantiles of the cumulative weight along the axis
+    std::sort(projections.begin(), projections.end());
+    unsigned int rank = 0;
+    double cumulativeWeight = GetWeight(projections[0].second);
+    for(unsigned int k = 0; k < models.size(); ++k)
+    {
+        const double quantile = (k + 0.5) * totalWeight / models.size();
+        while(cumulativeWeight < quantile && rank + 1 < numberOfPoints)
+        {
+            rank++;
+            cumulativeWeight += GetWeight(projections[rank].second);
+        }
+
+        models[k]->SetMean(this->Data.col(projections[rank].second));
+        models[k]->SetVariance(covariance);
+        models[k]->SetMixingCoefficient(1.0 / models.size());
+    }
+}
+
+void ParallelExpectationMaximization::InitializeByOrchardBouman(const Eigen::VectorXd& mean, const Eigen::MatrixXd& covariance)
+{
+    const unsigned int numberOfComponents = this->Mixture.GetNumberOfModels();
+    const unsigned int dimensionality = this->Data.rows();
+    const unsigned int numberOfPoints = this->Data.cols();
+
+    std::vector<unsigned char> labels(numberOfPoints, 0);
+    std::vector<Cluster> clusters = ComputeClusters(labels, 1);
+    while(clusters.size() < numberOfComponents)
+    {
+        // Split the cluster that varies the most along one direction, at its mean
+        unsigned int splitCluster = 0;
+        double largestEigenvalue = 0;
+        Eigen::VectorXd axis;
+        for(unsigned int c = 0; c < clusters.size(); ++c)
+        {
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigenSolver(clusters[c].Covariance);
+            if(eigenSolver.eigenvalues()(dimensionality - 1) > largestEigenvalue)
+            {
+                splitCluster = c;
+                largestEigenvalue = eigenSolver.eigenvalues()(dimensionality - 1);
+                axis = eigenSolver.eigenvectors().col(dimensionality - 1);
+            }
+        }
+
+        if(!(largestEigenvalue > 0))
+        {
+            break; // Every cluster is a single color
+        }
+
+        const unsigned char newLabel = clusters.size();
+        const double threshold = axis.dot(clusters[splitCluster].Mean);
+        for(unsigned int p = 0; p < numberOfPoints; ++p)
+        {
+            if(labels[p] == splitCluster && axis.dot(this->Data.col(p)) > threshold)
+            {
+                labels[p] = newLabel;
+            }
+        }
+
+        clusters = ComputeClusters(labels, clusters.size() + 1);
+    }
+
+    SetComponentsFromClusters(clusters, mean, covariance);
+}
+
+void ParallelExpectationMaximization::InitializeByKMeansPlusPlus(const Eigen::VectorXd& mean, const Eigen::MatrixXd& covariance)
+{
+    const unsigned int numberOfComponents = this->Mixture.GetNumberOfModels();
+    const unsigned int numberOfPoints = this->Data.cols();
+    const unsigned int maxKMeansIterations = 10;
+
+    // Raw 32 bit draws, since the output of std::uniform_real_distribution differs between standard libraries
+    std::mt19937 generator(this->Seed);
+    auto uniform = [&generator]() { return generator() / 4294967296.0; };
+
+    std::vector<unsigned int> sample;
+    if(numberOfPoints <= this->InitializationSampleSize)
+    {
+        for(unsigned int p = 0; p < numberOfPoints; ++p)
+        {
+            sample.push_back(p);
+        }
+    }
+    else
+    {
+        for(unsigned int i = 0; i < this->InitializationSampleSize; ++i)
+        {
+            sample.push_back(std::min(static_cast<unsigned int>(uniform() * numberOfPoints), numberOfPoints - 1));
+        }
+    }
+
+    std::vector<Eigen::VectorXd> centers;
+    auto findNearestCenter = [this, &centers](const unsigned int point)
+    {
+        unsigned int nearest = 0;
+        double nearestDistance = std::numeric_limits<double>::infinity();
+        for(unsigned int c = 0; c < centers.size(); ++c)
+        {
+            const double distance = (this->Data.col(point) - centers[c]).squaredNorm();
+            if(distance < nearestDistance)
+            {
+                nearest = c;
+                nearestDistance = distance;
+            }
+        }
+        return std::make_pair(nearest, nearestDistance);
+    };
+
+    // k-means++: the first center is drawn in proportion to the weights, every next one in proportion to the weight
+    // times the squared distance to the nearest center so far
+    std::vector<double> distances(sample.size(), 1.0);
+    while(centers.size() < numberOfComponents)
+    {
+        double total = 0;
+        for(unsigned int i = 0; i < sample.size(); ++i)
+        {
+            total += GetWeight(sample[i]) * distances[i];
+        }
+        if(!(total > 0))
+        {
+            break; // Every point of the sample is a center
+        }
+
+        double target = uniform() * total;
+        unsigned int chosen = sample.size() - 1;
+        for(unsigned int i = 0; i < sample.size(); ++i)
+        {
+            target -= GetWeight(sample[i]) * distances[i];
+            if(target < 0)
+            {
+                chosen = i;
+                break;
+            }
+        }
+
+        centers.push_back(this->Data.col(sample[chosen]));
+        for(unsigned int i = 0; i < sample.size(); ++i)
+        {
+            distances[i] = findNearestCenter(sample[i]).second;
+        }
+    }
+
+    // Weighted k-means on the sample; a center that loses all its points stays where it is
+    std::vector<unsigned char> sampleLabels(sample.size(), 0);
+    for(unsigned int iteration = 0; iteration < maxKMeansIterations; ++iteration)
+    {
+        bool changed = false;
+        for(unsigned int i = 0; i < sample.size(); ++i)
+        {
+            const unsigned char label = findNearestCenter(sample[i]).first;
+            changed = changed || label != sampleLabels[i];
+            sampleLabels[i] = label;
+        }
+        if(iteration > 0 && !changed)
+        {
+            break;
+        }
+
+        std::vector<double> weights(centers.size(), 0);
+        std::vector<Eigen::VectorXd> sums(centers.size(), Eigen::VectorXd::Zero(this->Data.rows()));
+        for(unsigned int i = 0; i < sample.size(); ++i)
+        {
+            weights[sampleLabels[i]] += GetWeight(sample[i]);
+            sums[sampleLabels[i]] += GetWeight(sample[i]) * this->Data.col(sample[i]);
+        }
+        for(unsigned int c = 0; c < centers.size(); ++c)
+        {
+            if(weights[c] > 0)
+            {
+                centers[c] = sums[c] / weights[c];
+            }
+        }
+    }
+
+    // Every point goes to its nearest center, so the components are fitted to all of the data
+    std::vector<unsigned char> labels(numberOfPoints);
+    for(unsigned int p = 0; p < numberOfPoints; ++p)
+    {
+        labels[p] = findNearestCenter(p).first;
+    }
+
+    SetComponentsFromClusters(ComputeClusters(labels, centers.size()), mean, covariance);
+}
+
+std::vector<ParallelExpectationMaximization::Cluster> ParallelExpectationMaximization::ComputeClusters(
+    const std::vector<unsigned char>& labels, const unsigned int numberOfClusters) const
+{
+    const unsigned int dimensionality = this->Data.rows();
+    const unsigned int numberOfPoints = this->Data.cols();
+
+    std::vector<Cluster> clusters(numberOfClusters);
+    for(unsigned int c = 0; c < numberOfClusters; ++c)
+    {
+        clusters[c].Weight = 0;
+        clusters[c].Mean = Eigen::VectorXd::Zero(dimensionality);
+        clusters[c].Covariance = Eigen::MatrixXd::Zero(dimensionality, dimensionality);
+    }
+
+    for(unsigned int p = 0; p < numberOfPoints; ++p)
+    {
+        clusters[labels[p]].Weight += GetWeight(p);
+        clusters[labels[p]].Mean += GetWeight(p) * this->Data.col(p);
+    }
+    for(unsigned int c = 0; c < numberOfClusters; ++c)
+    {
+        if(clusters[c].Weight > 0)
+        {
+            clusters[c].Mean /= clusters[c].Weight;
+        }
+    }
+
+    // The outer products about the means of the clusters, which loses no precision to colors far from 0
+    Eigen::VectorXd difference(dimensionality);
+    for(unsigned int p = 0; p < numberOfPoints; ++p)
+    {
+        Cluster& cluster = clusters[labels[p]];
+        difference = this->Data.col(p) - cluster.Mean;
+        cluster.Covariance.noalias() += GetWeight(p) * difference * difference.transpose();
+        AddScatter(p, cluster.Covariance);
+    }
+    for(unsigned int c = 0; c < numberOfClusters; ++c)
+    {
+        if(clusters[c].Weight > 0)
+        {
+            clusters[c].Covariance /= clusters[c].Weight;
+        }
+    }
+
+    return clusters;
+}
+
+void ParallelExpectationMaximization::SetComponentsFromClusters(const std::vector<Cluster>& clusters, const Eigen::VectorXd& mean,
+                                                                const Eigen::MatrixXd& covariance)
+{
+    const std::vector<Model*> models = this->Mixture.GetModels();
+    const unsigned int dimensionality = this->Data.rows();
+
+    double totalWeight = 0;
+    for(unsigned int c = 0; c < clusters.size(); ++c)
+    {
+        totalWeight += clusters[c].Weight;
+    }
+
+    for(unsigned int k = 0; k < models.size(); ++k)
+    {
+        if(k >= clusters.size() || !(clusters[k].Weight > 0))
+        {
+            // There were fewer distinct colors than components
+            models[k]->SetMean(mean);
+            models[k]->SetVariance(covariance);
+            models[k]->SetMixingCoefficient(0);
+            continue;
+        }
+
+        const Eigen::MatrixXd& clusterCovariance = clusters[k].Covariance;
+        models[k]->SetMean(clusters[k].Mean);
+        models[k]->SetVariance(clusterCovariance + 1e-6 * std::max(clusterCovariance.trace() / dimensionality, 1.0) *
+                               Eigen::MatrixXd::Identity(dimensionality, dimensionality));
+        models[k]->SetMixingCoefficient(clusters[k].Weight / totalWeight);
+    }
+}
+
+void ParallelExpectationMaximization::AddScatter(const unsigned int point, Eigen::MatrixXd& covariance) const
+{
+    if(this->Scatters.size() == 0)
+    {
+        return;
+    }
+
+    const unsigned int dimensionality = this->Data.rows();
+    unsigned int productIndex = 0;
+    for(unsigned int i = 0; i < dimensionality; ++i)
+    {
+        for(unsigned int j = i; j < dimensionality; ++j)
+        {
+            covariance(i, j) += GetWeight(point) * this->Scatters(productIndex, point);
+            if(j != i)
+            {
+                covariance(j, i) += GetWeight(point) * this->Scatters(productIndex, point);
+            }
+            productIndex++;
+        }
+    }
+}
+
+std::vector<ParallelExpectationMaximization::Component> ParallelExpectationMaximization::PrepareComponents() const
+{
+    const std::vector<Model*> models = this->Mixture.GetModels();
+    const unsigned int dimensionality = this->Data.rows();
+
+    std::vector<Component> components(models.size());
+    bool anyValid = false;
+    for(unsigned int k = 0; k < models.size(); ++k)
+    {
+        components[k].Mean = models[k]->GetMean();
+
+        const double weight = models[k]->GetMixingCoefficient();
+        if(!(weight > 0))
+        {
+            components[k].LogNormalizer = -std::numeric_limits<double>::infinity();
+            continue;
+        }
+
+        Eigen::MatrixXd covariance = models[k]->GetVariance();
+        Eigen::LLT<Eigen::MatrixXd> cholesky(covariance);
+        double jitter = 1e-6 * std::max(covariance.trace() / dimensionality, 1.0);
+        while(cholesky.info() != Eigen::Success)
+        {
+            covariance += jitter * Eigen::MatrixXd::Identity(dimensionality, dimensionality);
+            cholesky.compute(covariance);
+            jitter *= 10;
+        }
+
+        const Eigen::MatrixXd lower = cholesky.matrixL();
+        components[k].InverseCholesky = lower.triangularView<Eigen::Lower>().solve(
+            Eigen::MatrixXd::Identity(dimensionality, dimensionality));
+
+        double logDeterminant = 0;
+        for(unsigned int i = 0; i < dimensionality; ++i)
+        {
+            logDeterminant += 2 * std::log(lower(i, i));
+        }
+        components[k].LogNormalizer = std::log(weight) - 0.5 * (dimensionality * std::log(2 * M_PI) + logDeterminant);
+        anyValid = true;
+    }
+
+    if(!anyValid)
+    {
+        throw std::runtime_error("ParallelExpectationMaximization::PrepareComponents: no component has a positive mixing coefficient!");
+    }
+
+    return components;
+}
+
+void ParallelExpectationMaximization::AccumulateChunk(const std::vector<Component>& components, const unsigned int chunk,
+                                                      double* statistics) const
+{
+    const unsigned int dimensionality = this->Data.rows();
+    const unsigned int numberOfComponents = components.size();
+    const unsigned int componentStride = 1 + dimensionality + dimensionality * (dimensionality + 1) / 2;
+    const unsigned int statisticsSize = numberOfComponents * componentStride + 1;
+    std::fill(statistics, statistics + statisticsSize, 0.0);
+
+    const unsigned int begin = chunk * this->ChunkSize;
+    const unsigned int end = std::min(begin + this->ChunkSize, static_cast<unsigned int>(this->Data.cols()));
+
+    std::vector<double> logDensities(numberOfComponents);
+    std::vector<double> difference(dimensionality);
+
+    for(unsigned int p = begin; p < end; ++p)
+    {
+        const double* point = this->Data.data() + static_cast<size_t>(p) * dimensionality;
+
+        double maximum = -std::numeric_limits<double>::infinity();
+        for(unsigned int k = 0; k < numberOfComponents; ++k)
+        {
+            const Component& component = components[k];
+            if(!std::isfinite(component.LogNormalizer))
+            {
+                logDensities[k] = -std::numeric_limits<double>::infinity();
+                continue;
+            }
+
+            double mahalanobis = 0;
+            for(unsigned int i = 0; i < dimensionality; ++i)
+            {
+                difference[i] = point[i] - component.Mean(i);
+            }
+            for(unsigned int i = 0; i < dimensionality; ++i)
+            {
+                double z = 0;
+                for(unsigned int j = 0; j <= i; ++j)
+                {
+                    z += component.InverseCholesky(i, j) * difference[j];
+                }
+                mahalanobis += z * z;
+            }
+
+            logDensities[k] = component.LogNormalizer - 0.5 * mahalanobis;
+            maximum = std::max(maximum, logDensities[k]);
+        }
+
+        double sum = 0;
+        for(unsigned int k = 0; k < numberOfComponents; ++k)
+        {
+            sum += std::exp(logDensities[k] - maximum);
+        }
+        const double logLikelihood = maximum + std::log(sum);
+        const double pointWeight = GetWeight(p);
+        statistics[statisticsSize - 1] += pointWeight * logLikelihood;
+        const double* scatter = this->Scatters.size() > 0 ? this->Scatters.data() + static_cast<size_t>(p) * this->Scatters.rows() : nullptr;
+
+        for(unsigned int k = 0; k < numberOfComponents; ++k)
+        {
+            const double responsibility = pointWeight * std::exp(logDensities[k] - logLikelihood);
+            if(responsibility == 0)
+            {
+                continue;
+            }
+
+            double* componentStatistics = statistics + k * componentStride;
+            componentStatistics[0] += responsibility;
+
+            for(unsigned int i = 0; i < dimensionality; ++i)
+            {
+                difference[i] = point[i] - components[k].Mean(i);
+                componentStatistics[1 + i] += responsibility * difference[i];
+            }
+
+            unsigned int productIndex = 1 + dimensionality;
+            for(unsigned int i = 0; i < dimensionality; ++i)
+            {
+                const double weightedDifference = responsibility * difference[i];
+                for(unsigned int j = i; j < dimensionality; ++j)
+                {
+                    componentStatistics[productIndex++] += weightedDifference * difference[j];
+                }
+            }
+
+            if(scatter)
+            {
+                productIndex = 1 + dimensionality;
+                for(unsigned int i = 0; i < dimensionality * (dimensionality + 1) / 2; ++i)
+                {
+                    componentStatistics[productIndex++] += responsibility * scatter[i];
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,252 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ParallelExpectationMaximization_H
+#define ParallelExpectationMaximization_H
+
+// STL
+#include <utility>
+#include <vector>
+
+// Eigen
+#include <Eigen/Dense>
+
+// Submodules
+#include "ExpectationMaximization/MixtureModel.h"
+
+/** How EM spreads identical (e.g. freshly constructed) components over the data before its first iteration: the means
+  * at evenly spaced quantiles along the principal axis of the data, the color quantization of Orchard and Bouman used
+  * by the GrabCut paper (the cluster of largest variance is split at its mean along its principal axis until there is
+  * one cluster per component), or k-means++ seeding and a few k-means iterations on a random subsample of the data.
+  * The last two fit each component to the points of its cluster. All of them are deterministic. */
+enum class MixtureInitializationEnum { PRINCIPAL_AXIS, ORCHARD_BOUMAN, KMEANS_PLUS_PLUS };
+
+/** Fit a Gaussian mixture model with EM on several threads.
+  * The data is split into fixed size chunks of columns. Each chunk computes the responsibilities of its points and
+  * accumulates the per-component sufficient statistics (weight, weighted sum, weighted outer products); the chunk
+  * statistics are then added in a fixed pairwise tree. Since neither the chunks nor the order of the additions depend
+  * on the number of threads, the fitted model is bit-for-bit the same for any number of threads. */
+class ParallelExpectationMaximization
+{
+public:
+    /** Set the points to cluster, one point per column. */
+    void SetData(const Eigen::MatrixXd& data)
+    {
+        this->Data = data;
+    }
+
+    /** Take the points to cluster, one point per column, without copying them. */
+    void SetData(Eigen::MatrixXd&& data)
+    {
+        this->Data = std::move(data);
+    }
+
+    /** Give each point a weight, e.g. the number of pixels it stands for (all 1 if this is not called or is given an
+      * empty vector). */
+    void SetWeights(const Eigen::VectorXd& weights)
+    {
+        this->Weights = weights;
+    }
+
+    /** Give each point the covariance of the pixels it stands for about it, as the upper triangle stored row by row,
+      * one point per column (none if this is not called or is given an empty matrix). It is added to the outer products
+      * of the M-step, so a component fitted to the means of groups of pixels gets the spread of the pixels themselves. */
+    void SetScatters(const Eigen::MatrixXd& scatters)
+    {
+        this->Scatters = scatters;
+    }
+
+    /** Set the initial model. The Gaussian models it points to are updated in place by Compute().
+      * If all components are identical (e.g. freshly constructed), they are first spread over the data. */
+    void SetMixtureModel(const MixtureModel& mixtureModel)
+    {
+        this->Mixture = mixtureModel;
+    }
+
+    /** Get the fitted model. */
+    MixtureModel GetMixtureModel() const
+    {
+        return this->Mixture;
+    }
+
+    /** Choose how identical initial components are spread over the data (PRINCIPAL_AXIS by default). */
+    void SetInitialization(const MixtureInitializationEnum initialization)
+    {
+        this->Initialization = initialization;
+    }
+
+    /** Set the seed of the subsample and the seeding of KMEANS_PLUS_PLUS. The same seed gives the same model. */
+    void SetSeed(const unsigned int seed)
+    {
+        this->Seed = seed;
+    }
+
+    /** Set how many points KMEANS_PLUS_PLUS draws to seed and iterate on. */
+    void SetInitializationSampleSize(const unsigned int initializationSampleSize)
+    {
+        this->InitializationSampleSize = initializationSampleSize > 0 ? initializationSampleSize : 1;
+    }
+
+    /** Stop when the mean log-likelihood per point changes less than this between iterations. */
+    void SetMinChange(const double minChange)
+    {
+        this->MinChange = minChange;
+    }
+
+    /** Set the maximum number of iterations. */
+    void SetMaxIterations(const unsigned int maxIterations)
+    {
+        this->MaxIterations = maxIterations;
+    }
+
+    /** Set the number of threads. This does not change the result. */
+    void SetNumberOfThreads(const unsigned int numberOfThreads)
+    {
+        this->NumberOfThreads = numberOfThreads > 0 ? numberOfThreads : 1;
+    }
+
+    /** Set the number of points per chunk. Changing this changes the rounding of the statistics slightly. */
+    void SetChunkSize(const unsigned int chunkSize)
+    {
+        this->ChunkSize = chunkSize > 0 ? chunkSize : 1;
+    }
+
+    /** Run EM. */
+    void Compute();
+
+    /** Get the number of bytes Compute() works on: the copy of the data, the weights and scatters, and the statistics of
+      * every chunk. */
+    size_t GetNumberOfBytes() const;
+
+    /** Get the number of iterations the last Compute() ran. */
+    unsigned int GetNumberOfIterations() const
+    {
+        return this->LogLikelihoods.size();
+    }
+
+    /** Get the mean log-likelihood per point (per unit of weight) of the model each iteration started from. */
+    const std::vector<double>& GetLogLikelihoods() const
+    {
+        return this->LogLikelihoods;
+    }
+
+    /** Get the wall time (in seconds) of the E-step (responsibilities and statistics) of each iteration. */
+    const std::vector<double>& GetExpectationDurations() const
+    {
+        return this->ExpectationDurations;
+    }
+
+    /** Get the wall time (in seconds) of the statistics reduction and M-step of each iteration. */
+    const std::vector<double>& GetMaximizationDurations() const
+    {
+        return this->MaximizationDurations;
+    }
+
+protected:
+
+    /** The precomputed terms of one component for the E-step. */
+    struct Component
+    {
+        Eigen::VectorXd Mean;
+        Eigen::MatrixXd InverseCholesky; // Lower triangular, the Mahalanobis distance is |L^-1 (x - mu)|^2
+        double LogNormalizer; // log(w) - 0.5 * (d log(2 pi) + log|Sigma|)
+    };
+
+    /** Spread identical initial components over the data as chosen by SetInitialization(). */
+    void InitializeComponents();
+
+    /** Evenly spaced points along the principal axis of the data as the means, the data covariance as the variances. */
+    void InitializeAlongPrincipalAxis(const Eigen::VectorXd& mean, const Eigen::MatrixXd& covariance);
+
+    /** Split the cluster with the largest eigenvalue of its covariance until there is one cluster per component. */
+    void InitializeByOrchardBouman(const Eigen::VectorXd& mean, const Eigen::MatrixXd& covariance);
+
+    /** Cluster a subsample with k-means++ seeding and k-means, and assign every point to its nearest center. */
+    void InitializeByKMeansPlusPlus(const Eigen::VectorXd& mean, const Eigen::MatrixXd& covariance);
+
+    /** The weight, mean and covariance (with the scatters) of the points of one cluster. */
+    struct Cluster
+    {
+        double Weight;
+        Eigen::VectorXd Mean;
+        Eigen::MatrixXd Covariance;
+    };
+
+    /** Add the weighted scatter of a point (if there are scatters) to a covariance. */
+    void AddScatter(const unsigned int point, Eigen::MatrixXd& covariance) const;
+
+    /** Compute the clusters of the points given the cluster of each point. */
+    std::vector<Cluster> ComputeClusters(const std::vector<unsigned char>& labels, const unsigned int numberOfClusters) const;
+
+    /** Fit each component to one cluster. Components without points get the mean and covariance of the data and no weight. */
+    void SetComponentsFromClusters(const std::vector<Cluster>& clusters, const Eigen::VectorXd& mean,
+                                   const Eigen::MatrixXd& covariance);
+
+    /** Derive the E-step terms of every component from the current models. */
+    std::vector<Component> PrepareComponents() const;
+
+    /** Compute the responsibilities of the points of one chunk and add up its statistics.
+      * The statistics are laid out per component as: weight, sum (d), upper triangle of the outer products (d(d+1)/2),
+      * all relative to the component's current mean; the last entry is the log-likelihood of the chunk. */
+    void AccumulateChunk(const std::vector<Component>& components, const unsigned int chunk, double* statistics) const;
+
+    /** The points, one per column. */
+    Eigen::MatrixXd Data;
+
+    /** The weight of each point (empty: all 1). */
+    Eigen::VectorXd Weights;
+
+    /** The scatter of each point, one per column (empty: none). */
+    Eigen::MatrixXd Scatters;
+
+    /** Get the weight of a point. */
+    double GetWeight(const unsigned int point) const
+    {
+        return this->Weights.size() > 0 ? this->Weights(point) : 1.0;
+    }
+
+    /** The model being fitted. */
+    MixtureModel Mixture;
+
+    /** How identical initial components are spread over the data. */
+    MixtureInitializationEnum Initialization = MixtureInitializationEnum::PRINCIPAL_AXIS;
+
+    /** The seed of KMEANS_PLUS_PLUS. */
+    unsigned int Seed = 0;
+
+    /** The number of points KMEANS_PLUS_PLUS clusters. */
+    unsigned int InitializationSampleSize = 4096;
+
+    /** The convergence threshold on the change of the mean log-likelihood. */
+    double MinChange = 1e-4;
+
+    /** The maximum number of iterations. */
+    unsigned int MaxIterations = 100;
+
+    /** The number of threads. */
+    unsigned int NumberOfThreads = 1;
+
+    /** The number of points per chunk. */
+    unsigned int ChunkSize = 4096;
+
+    /** Per iteration diagnostics of the last Compute(). */
+    std::vector<double> LogLikelihoods;
+    std::vector<double> ExpectationDurations;
+    std::vector<double> MaximizationDurations;
+};
+
+#endif
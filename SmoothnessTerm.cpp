@@ -0,0 +1,218 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SmoothnessTerm.h"
+#include "GaussianMixtureBatchEvaluator.h"
+#include "Trace.h"
+#include "VectorMath.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+    /** Add the squared difference of every pixel of a row segment and its neighbor at a fixed offset. */
+    void AddSquaredDifferences(const float* channel, const unsigned int begin, const unsigned int end,
+                               const int neighborOffset, float* squaredDifferences)
+    {
+        for(unsigned int p = begin; p < end; ++p)
+        {
+            const float difference = channel[p + neighborOffset] - channel[p];
+            squaredDifferences[p] += difference * difference;
+        }
+    }
+
+#ifdef GRABCUT_HAVE_X86_KERNELS
+    GRABCUT_TARGET_AVX2 unsigned int ScaledExpAVX2(const float scale, const float factor, float* values, const unsigned int numberOfValues)
+    {
+        unsigned int i = 0;
+        for(; i + 8 <= numberOfValues; i += 8)
+        {
+            const __m256 x = _mm256_mul_ps(_mm256_loadu_ps(values + i), _mm256_set1_ps(scale));
+            _mm256_storeu_ps(values + i, _mm256_mul_ps(VectorMath::ExpAVX2(x), _mm256_set1_ps(factor)));
+        }
+        return i;
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    GRABCUT_TARGET_AVX512 unsigned int ScaledExpAVX512(const float scale, const float factor, float* values, const unsigned int numberOfValues)
+    {
+        unsigned int i = 0;
+        for(; i + 16 <= numberOfValues; i += 16)
+        {
+            const __m512 x = _mm512_mul_ps(_mm512_loadu_ps(values + i), _mm512_set1_ps(scale));
+            _mm512_storeu_ps(values + i, _mm512_mul_ps(VectorMath::ExpAVX512(x), _mm512_set1_ps(factor)));
+        }
+        return i;
+    }
+#pragma GCC diagnostic pop
+#endif
+
+    /** Replace every value v by factor * exp(scale * v). */
+    void ScaledExp(const InstructionSetEnum instructionSet, const float scale, const float factor,
+                   float* values, const unsigned int numberOfValues)
+    {
+        unsigned int handled = 0;
+#ifdef GRABCUT_HAVE_X86_KERNELS
+        if(instructionSet == InstructionSetEnum::AVX512)
+        {
+            handled = ScaledExpAVX512(scale, factor, values, numberOfValues);
+        }
+        else if(instructionSet == InstructionSetEnum::AVX2)
+        {
+            handled = ScaledExpAVX2(scale, factor, values, numberOfValues);
+        }
+#else
+        (void)instructionSet;
+#endif
+        for(unsigned int i = handled; i < numberOfValues; ++i)
+        {
+            values[i] = factor * std::exp(scale * values[i]);
+        }
+    }
+}
+
+template <typename TFunction>
+void SmoothnessTerm::ForEachRow(const TFunction& function) const
+{
+    const unsigned int numberOfThreads = std::min(this->NumberOfThreads, std::max(this->Height, 1u));
+
+    auto rowBlock = [&](const unsigned int thread)
+    {
+        const unsigned int begin = static_cast<unsigned long long>(this->Height) * thread / numberOfThreads;
+        const unsigned int end = static_cast<unsigned long long>(this->Height) * (thread + 1) / numberOfThreads;
+        for(unsigned int y = begin; y < end; ++y)
+        {
+            function(y);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned int thread = 1; thread < numberOfThreads; ++thread)
+    {
+        threads.push_back(std::thread(rowBlock, thread));
+    }
+    rowBlock(0);
+    for(unsigned int i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+}
+
+void SmoothnessTerm::Compute(const std::vector<const float*>& channels, const unsigned int width, const unsigned int height)
+{
+    GRABCUT_TRACE_SCOPE("n-link weights");
+
+    this->Width = width;
+    this->Height = height;
+
+    const unsigned int numberOfPixels = width * height;
+    const unsigned int numberOfDirections = this->EightConnected ? 4 : 2;
+    for(unsigned int direction = 0; direction < 4; ++direction)
+    {
+        this->Weights[direction].assign(direction < numberOfDirections ? numberOfPixels : 0, 0.0f);
+    }
+
+    // The first and last pixel (along x) of a row that have a neighbor in each direction, and the offset to that neighbor
+    const unsigned int firstX[4] = {0, 0, 0, 1};
+    const unsigned int endX[4] = {width > 0 ? width - 1 : 0, width, width > 0 ? width - 1 : 0, width};
+    const int neighborOffset[4] = {1, static_cast<int>(width), static_cast<int>(width) + 1, static_cast<int>(width) - 1};
+
+    // Squared differences, and their sum per row for beta
+    std::vector<double> rowSums(height, 0);
+    ForEachRow([&](const unsigned int y)
+    {
+        double rowSum = 0;
+        for(unsigned int direction = 0; direction < numberOfDirections; ++direction)
+        {
+            if(direction != RIGHT && y + 1 >= height)
+            {
+                continue; // The last row has no neighbors below it
+            }
+
+            float* squaredDifferences = this->Weights[direction].data();
+            const unsigned int begin = y * width + firstX[direction];
+            const unsigned int end = y * width + endX[direction];
+            for(unsigned int c = 0; c < channels.size(); ++c)
+            {
+                AddSquaredDifferences(channels[c], begin, end, neighborOffset[direction], squaredDifferences);
+            }
+            for(unsigned int p = begin; p < end; ++p)
+            {
+                rowSum += squaredDifferences[p];
+            }
+        }
+        rowSums[y] = rowSum;
+    });
+
+    double sum = 0;
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        sum += rowSums[y];
+    }
+
+    unsigned long long numberOfPairs = 0;
+    if(width > 0 && height > 0)
+    {
+        numberOfPairs = static_cast<unsigned long long>(width - 1) * height + static_cast<unsigned long long>(width) * (height - 1);
+        if(this->EightConnected)
+        {
+            numberOfPairs += 2ull * (width - 1) * (height - 1);
+        }
+    }
+
+    // A constant image gets beta = 0: every n-link gets the full weight
+    this->Beta = (numberOfPairs == 0 || sum == 0) ? 0.0f : static_cast<float>(numberOfPairs / (2.0 * sum));
+
+    // Weights
+    const float gammas[4] = {this->Gamma, this->Gamma, this->Gamma / std::sqrt(2.0f), this->Gamma / std::sqrt(2.0f)};
+    const InstructionSetEnum instructionSet = GaussianMixtureBatchEvaluator::GetBestInstructionSet();
+    ForEachRow([&](const unsigned int y)
+    {
+        for(unsigned int direction = 0; direction < numberOfDirections; ++direction)
+        {
+            if(direction != RIGHT && y + 1 >= height)
+            {
+                continue;
+            }
+
+            const unsigned int begin = y * width + firstX[direction];
+            const unsigned int end = y * width + endX[direction];
+            if(end > begin)
+            {
+                ScaledExp(instructionSet, -this->Beta, gammas[direction], this->Weights[direction].data() + begin, end - begin);
+            }
+        }
+    });
+
+    this->Computed = true;
+}
+
+void SmoothnessTerm::Clear()
+{
+    for(unsigned int direction = 0; direction < 4; ++direction)
+    {
+        std::vector<float>().swap(this->Weights[direction]);
+    }
+    this->Width = 0;
+    this->Height = 0;
+    this->Beta = 0;
+    this->Computed = false;
+}
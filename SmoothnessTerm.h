@@ -0,0 +1,176 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SmoothnessTerm_H
+#define SmoothnessTerm_H
+
+// STL
+#include <stdexcept>
+#include <vector>
+
+// ITK
+#include "itkImage.h"
+
+/** The n-link weights of an image: gamma * exp(-beta ||Ia - Ib||^2) / dist(a, b), with beta = 1 / (2 <||Ia - Ib||^2>).
+  * They only depend on the image, so they are computed once and kept as one float per pixel per direction: the weight
+  * of the link from a pixel to its neighbor in that direction, or 0 where that neighbor is outside of the image.
+  * The squared differences are computed on planar float channels and the exponentials with the AVX2/AVX-512 exp,
+  * with the rows split over several threads. Beta is summed per row and then in row order, so it does not depend on
+  * the number of threads. */
+class SmoothnessTerm
+{
+public:
+    /** The directions of the n-links of a pixel. Each neighboring pair is linked once, from the pixel that comes first. */
+    enum DirectionEnum { RIGHT, DOWN, DOWN_RIGHT, DOWN_LEFT };
+
+    /** Set the weight of the smoothness term (50 in the GrabCut paper). */
+    void SetGamma(const float gamma)
+    {
+        this->Gamma = gamma;
+    }
+
+    /** Get the weight of the smoothness term. */
+    float GetGamma() const
+    {
+        return this->Gamma;
+    }
+
+    /** Use 8-connected (the default) or 4-connected n-links. */
+    void SetEightConnected(const bool eightConnected)
+    {
+        this->EightConnected = eightConnected;
+    }
+
+    /** Get whether the diagonal n-links are used. */
+    bool GetEightConnected() const
+    {
+        return this->EightConnected;
+    }
+
+    /** Set how many threads Compute() uses. This does not change the result. */
+    void SetNumberOfThreads(const unsigned int numberOfThreads)
+    {
+        this->NumberOfThreads = numberOfThreads > 0 ? numberOfThreads : 1;
+    }
+
+    /** Compute the weights of an image. The whole image must be buffered. */
+    template <typename TImage>
+    void Compute(const TImage* const image);
+
+    /** Compute the weights from planar channels of width * height floats each. */
+    void Compute(const std::vector<const float*>& channels, const unsigned int width, const unsigned int height);
+
+    /** Forget the weights, e.g. because the image changed. */
+    void Clear();
+
+    /** Get whether the weights have been computed. */
+    bool IsComputed() const
+    {
+        return this->Computed;
+    }
+
+    /** Get the size of the image the weights were computed for. */
+    unsigned int GetWidth() const
+    {
+        return this->Width;
+    }
+    unsigned int GetHeight() const
+    {
+        return this->Height;
+    }
+
+    /** Get beta = 1 / (2 <||Ia - Ib||^2>) over all neighboring pairs (0 for a constant image). */
+    float GetBeta() const
+    {
+        return this->Beta;
+    }
+
+    /** Get the number of bytes of the weights. */
+    size_t GetNumberOfBytes() const
+    {
+        return (this->Weights[0].size() + this->Weights[1].size() + this->Weights[2].size() + this->Weights[3].size()) *
+               sizeof(float);
+    }
+
+    /** Get the weights of the n-links in one direction, one per pixel in row-major order. */
+    const float* GetWeights(const DirectionEnum direction) const
+    {
+        return this->Weights[direction].data();
+    }
+
+protected:
+
+    /** Run a function on every row, with the rows split into contiguous blocks over the threads. */
+    template <typename TFunction>
+    void ForEachRow(const TFunction& function) const;
+
+    /** The weight of the smoothness term. */
+    float Gamma = 50.0f;
+
+    /** Whether the diagonal n-links are used. */
+    bool EightConnected = true;
+
+    /** The number of threads. */
+    unsigned int NumberOfThreads = 1;
+
+    /** Whether the weights are up to date. */
+    bool Computed = false;
+
+    /** The size of the image. */
+    unsigned int Width = 0;
+    unsigned int Height = 0;
+
+    /** The contrast normalization. */
+    float Beta = 0;
+
+    /** The weights, one array per direction (the diagonal ones are empty when 4-connected). */
+    std::vector<float> Weights[4];
+};
+
+template <typename TImage>
+void SmoothnessTerm::Compute(const TImage* const image)
+{
+    if(image->GetBufferedRegion() != image->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("SmoothnessTerm::Compute: the whole image must be buffered!");
+    }
+
+    const unsigned int width = image->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = image->GetLargestPossibleRegion().GetSize()[1];
+    const unsigned int numberOfPixels = width * height;
+    const unsigned int numberOfChannels = TImage::PixelType::Dimension;
+
+    std::vector<std::vector<float> > channels(numberOfChannels, std::vector<float>(numberOfPixels));
+    const typename TImage::PixelType* buffer = image->GetBufferPointer();
+    for(unsigned int p = 0; p < numberOfPixels; ++p)
+    {
+        for(unsigned int c = 0; c < numberOfChannels; ++c)
+        {
+            channels[c][p] = static_cast<float>(buffer[p][c]);
+        }
+    }
+
+    std::vector<const float*> channelPointers(numberOfChannels);
+    for(unsigned int c = 0; c < numberOfChannels; ++c)
+    {
+        channelPointers[c] = channels[c].data();
+    }
+
+    Compute(channelPointers, width, height);
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SnapshotWriter.h"
+
+// STL
+#include <exception>
+#include <iostream>
+
+SnapshotWriter::SnapshotWriter(const unsigned int queueCapacity) : QueueCapacity(queueCapacity > 0 ? queueCapacity : 1)
+{
+    this->Thread = std::thread(&SnapshotWriter::RunJobs, this);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Stopping = true;
+    }
+    this->StateChanged.notify_all();
+    this->Thread.join();
+}
+
+bool SnapshotWriter::Submit(const std::function<void()>& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        if(this->Jobs.size() >= this->QueueCapacity)
+        {
+            this->NumberOfDropped++;
+            return false;
+        }
+        this->Jobs.push_back(job);
+    }
+    this->StateChanged.notify_all();
+    return true;
+}
+
+void SnapshotWriter::Flush()
+{
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    this->StateChanged.wait(lock, [this]() { return this->Jobs.empty() && !this->Busy; });
+}
+
+unsigned int SnapshotWriter::GetNumberOfCompleted()
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    return this->NumberOfCompleted;
+}
+
+unsigned int SnapshotWriter::GetNumberOfDropped()
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    return this->NumberOfDropped;
+}
+
+unsigned int SnapshotWriter::GetNumberOfFailed()
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    return this->NumberOfFailed;
+}
+
+void SnapshotWriter::RunJobs()
+{
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    while(true)
+    {
+        this->StateChanged.wait(lock, [this]() { return !this->Jobs.empty() || this->Stopping; });
+        if(this->Jobs.empty())
+        {
+            return; // Stopping, and every job has been run
+        }
+
+        std::function<void()> job = this->Jobs.front();
+        this->Jobs.pop_front();
+        this->Busy = true;
+        lock.unlock();
+
+        bool failed = false;
+        try
+        {
+            job();
+        }
+        catch(const std::exception& exception)
+        {
+            std::cerr << "SnapshotWriter: a job failed: " << exception.what() << std::endl;
+            failed = true;
+        }
+        catch(...)
+        {
+            std::cerr << "SnapshotWriter: a job failed!" << std::endl;
+            failed = true;
+        }
+
+        lock.lock();
+        this->Busy = false;
+        this->NumberOfCompleted++;
+        this->NumberOfFailed += failed;
+        this->StateChanged.notify_all();
+    }
+}
@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SnapshotWriter_H
+#define SnapshotWriter_H
+
+// STL
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/** Runs jobs such as encoding and writing debug images on a background thread, in the order they were submitted.
+  * The queue holds a bounded number of jobs. Submit() never waits for a job to run: when the queue is full, the new job
+  * is dropped and counted, so whoever submits it is never slowed down by the disk. */
+class SnapshotWriter
+{
+public:
+    /** Start the background thread. At most queueCapacity jobs wait behind the one being run. */
+    SnapshotWriter(const unsigned int queueCapacity = 4);
+
+    /** Run the jobs still in the queue and stop the background thread. */
+    ~SnapshotWriter();
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    /** Queue a job. Returns false (and drops the job) if the queue is full. */
+    bool Submit(const std::function<void()>& job);
+
+    /** Wait until every queued job has been run. */
+    void Flush();
+
+    /** Get the number of jobs that were run, including those that threw. */
+    unsigned int GetNumberOfCompleted();
+
+    /** Get the number of jobs that were dropped because the queue was full. */
+    unsigned int GetNumberOfDropped();
+
+    /** Get the number of jobs that threw. Their error is printed to std::cerr, since nobody waits for them. */
+    unsigned int GetNumberOfFailed();
+
+protected:
+
+    /** Run the queued jobs until the writer is destroyed. */
+    void RunJobs();
+
+    /** The maximum number of waiting jobs. */
+    unsigned int QueueCapacity;
+
+    /** The waiting jobs. */
+    std::deque<std::function<void()> > Jobs;
+
+    /** Whether a job is being run. */
+    bool Busy = false;
+
+    /** Whether the background thread should exit once the queue is empty. */
+    bool Stopping = false;
+
+    /** Counters. */
+    unsigned int NumberOfCompleted = 0;
+    unsigned int NumberOfDropped = 0;
+    unsigned int NumberOfFailed = 0;
+
+    /** Guards everything above. */
+    std::mutex Mutex;
+
+    /** Signalled when a job is queued, a job finishes or the writer stops. */
+    std::condition_variable StateChanged;
+
+    /** The background thread. */
+    std::thread Thread;
+};
+
+#endif
@@ -0,0 +1,473 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Superpixels.h"
+#include "Trace.h"
+
+// STL
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+namespace
+{
+    /** A pixel that belongs to no center (or superpixel) yet. */
+    const unsigned int Unassigned = std::numeric_limits<unsigned int>::max();
+
+    /** Run a function on every row, with the rows split into contiguous blocks over the threads. */
+    template <typename TFunction>
+    void ForEachRow(const unsigned int height, const unsigned int numberOfThreads, const TFunction& function)
+    {
+        const unsigned int threadCount = std::min(numberOfThreads, std::max(height, 1u));
+
+        auto rowBlock = [&](const unsigned int thread)
+        {
+            const unsigned int begin = static_cast<unsigned long long>(height) * thread / threadCount;
+            const unsigned int end = static_cast<unsigned long long>(height) * (thread + 1) / threadCount;
+            for(unsigned int y = begin; y < end; ++y)
+            {
+                function(y);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(unsigned int thread = 1; thread < threadCount; ++thread)
+        {
+            threads.push_back(std::thread(rowBlock, thread));
+        }
+        rowBlock(0);
+        for(unsigned int i = 0; i < threads.size(); ++i)
+        {
+            threads[i].join();
+        }
+    }
+}
+
+void Superpixels::Compute(const std::vector<const float*>& channels, const unsigned int width, const unsigned int height,
+                          const unsigned char* const groups)
+{
+    GRABCUT_TRACE_SCOPE("superpixels");
+
+    if(channels.empty() || width == 0 || height == 0)
+    {
+        throw std::runtime_error("Superpixels::Compute: the image is empty!");
+    }
+
+    this->Width = width;
+    this->Height = height;
+    this->NumberOfChannels = channels.size();
+    this->GridWidth = (width + this->Size - 1) / this->Size;
+    this->GridHeight = (height + this->Size - 1) / this->Size;
+
+    const unsigned int numberOfChannels = this->NumberOfChannels;
+    const unsigned int numberOfCenters = this->GridWidth * this->GridHeight;
+    this->CenterPositions.assign(2 * numberOfCenters, 0.0f);
+    this->CenterColors.assign(static_cast<size_t>(numberOfCenters) * numberOfChannels, 0.0f);
+    this->CenterGroups.assign(numberOfCenters, 0);
+
+    // Seed each center in the middle of its grid cell, moved to the smallest gradient in the 3x3 pixels around it
+    // (among the pixels of the group of the middle pixel) so that it does not start on an edge
+    auto gradient = [&](const unsigned int x, const unsigned int y)
+    {
+        const unsigned int left = x > 0 ? x - 1 : x;
+        const unsigned int right = x + 1 < width ? x + 1 : x;
+        const unsigned int up = y > 0 ? y - 1 : y;
+        const unsigned int down = y + 1 < height ? y + 1 : y;
+        float sum = 0;
+        for(unsigned int c = 0; c < numberOfChannels; ++c)
+        {
+            const float dx = channels[c][y * width + right] - channels[c][y * width + left];
+            const float dy = channels[c][down * width + x] - channels[c][up * width + x];
+            sum += dx * dx + dy * dy;
+        }
+        return sum;
+    };
+
+    for(unsigned int gy = 0; gy < this->GridHeight; ++gy)
+    {
+        for(unsigned int gx = 0; gx < this->GridWidth; ++gx)
+        {
+            const unsigned int seedX = std::min(gx * this->Size + this->Size / 2, width - 1);
+            const unsigned int seedY = std::min(gy * this->Size + this->Size / 2, height - 1);
+            const unsigned char group = groups ? groups[seedY * width + seedX] : 0;
+
+            unsigned int bestX = seedX;
+            unsigned int bestY = seedY;
+            float bestGradient = gradient(seedX, seedY);
+            for(unsigned int y = seedY > 0 ? seedY - 1 : 0; y <= std::min(seedY + 1, height - 1); ++y)
+            {
+                for(unsigned int x = seedX > 0 ? seedX - 1 : 0; x <= std::min(seedX + 1, width - 1); ++x)
+                {
+                    if(groups && groups[y * width + x] != group)
+                    {
+                        continue;
+                    }
+                    const float candidate = gradient(x, y);
+                    if(candidate < bestGradient)
+                    {
+                        bestGradient = candidate;
+                        bestX = x;
+                        bestY = y;
+                    }
+                }
+            }
+
+            const unsigned int center = gy * this->GridWidth + gx;
+            this->CenterPositions[2 * center] = bestX;
+            this->CenterPositions[2 * center + 1] = bestY;
+            for(unsigned int c = 0; c < numberOfChannels; ++c)
+            {
+                this->CenterColors[static_cast<size_t>(center) * numberOfChannels + c] = channels[c][bestY * width + bestX];
+            }
+            this->CenterGroups[center] = group;
+        }
+    }
+
+    this->Labels.assign(static_cast<size_t>(width) * height, Unassigned);
+    for(unsigned int iteration = 0; iteration < this->NumberOfIterations; ++iteration)
+    {
+        AssignPixels(channels, groups);
+        UpdateCenters(channels);
+    }
+    if(this->NumberOfIterations == 0)
+    {
+        AssignPixels(channels, groups);
+    }
+
+    EnforceConnectivity(groups);
+    ComputeStatistics(channels, groups);
+}
+
+void Superpixels::AssignPixels(const std::vector<const float*>& channels, const unsigned char* const groups)
+{
+    const unsigned int width = this->Width;
+    const unsigned int numberOfChannels = this->NumberOfChannels;
+
+    // D = |color difference|^2 + (m / S)^2 |position difference|^2
+    const float spatialWeight = (this->Compactness / this->Size) * (this->Compactness / this->Size);
+
+    ForEachRow(this->Height, this->NumberOfThreads, [&](const unsigned int y)
+    {
+        const unsigned int gy = std::min(y / this->Size, this->GridHeight - 1);
+        const unsigned int firstGy = gy > 0 ? gy - 1 : 0;
+        const unsigned int lastGy = std::min(gy + 1, this->GridHeight - 1);
+
+        // The pixels of a row within one grid cell share their candidate centers, so those are gathered once per cell
+        unsigned int candidates[9];
+        unsigned char candidateGroups[9];
+        float candidateX[9];
+        float candidateOffsets[9]; // (m / S)^2 (y - center y)^2
+        std::vector<float> candidateColors(9 * numberOfChannels);
+
+        for(unsigned int gx = 0; gx < this->GridWidth; ++gx)
+        {
+            unsigned int numberOfCandidates = 0;
+            for(unsigned int cy = firstGy; cy <= lastGy; ++cy)
+            {
+                for(unsigned int cx = gx > 0 ? gx - 1 : 0; cx <= std::min(gx + 1, this->GridWidth - 1); ++cx)
+                {
+                    const unsigned int center = cy * this->GridWidth + cx;
+                    const float dy = y - this->CenterPositions[2 * center + 1];
+                    candidates[numberOfCandidates] = center;
+                    candidateGroups[numberOfCandidates] = this->CenterGroups[center];
+                    candidateX[numberOfCandidates] = this->CenterPositions[2 * center];
+                    candidateOffsets[numberOfCandidates] = spatialWeight * dy * dy;
+                    for(unsigned int c = 0; c < numberOfChannels; ++c)
+                    {
+                        candidateColors[numberOfCandidates * numberOfChannels + c] =
+                            this->CenterColors[static_cast<size_t>(center) * numberOfChannels + c];
+                    }
+                    numberOfCandidates++;
+                }
+            }
+
+            const unsigned int beginX = gx * this->Size;
+            const unsigned int endX = gx + 1 < this->GridWidth ? beginX + this->Size : width;
+            for(unsigned int x = beginX; x < endX; ++x)
+            {
+                const unsigned int p = y * width + x;
+                const unsigned char group = groups ? groups[p] : 0;
+
+                float bestDistance = std::numeric_limits<float>::max();
+                unsigned int bestCenter = Unassigned;
+                // Without branches: which candidate is nearest is unpredictable in noisy regions
+                for(unsigned int candidate = 0; candidate < numberOfCandidates; ++candidate)
+                {
+                    const float dx = x - candidateX[candidate];
+                    float distance = candidateOffsets[candidate] + spatialWeight * dx * dx;
+                    const float* centerColor = &candidateColors[candidate * numberOfChannels];
+                    for(unsigned int c = 0; c < numberOfChannels; ++c)
+                    {
+                        const float difference = channels[c][p] - centerColor[c];
+                        distance += difference * difference;
+                    }
+
+                    const bool nearer = distance < bestDistance && candidateGroups[candidate] == group;
+                    bestDistance = nearer ? distance : bestDistance;
+                    bestCenter = nearer ? candidates[candidate] : bestCenter;
+                }
+
+                this->Labels[p] = bestCenter;
+            }
+        }
+    });
+}
+
+void Superpixels::UpdateCenters(const std::vector<const float*>& channels)
+{
+    const unsigned int numberOfChannels = this->NumberOfChannels;
+    const unsigned int numberOfCenters = this->CenterGroups.size();
+    const unsigned int stride = numberOfChannels + 3; // count, x, y, colors
+
+    std::vector<double> sums(static_cast<size_t>(numberOfCenters) * stride, 0.0);
+    for(unsigned int y = 0; y < this->Height; ++y)
+    {
+        for(unsigned int x = 0; x < this->Width; ++x)
+        {
+            const unsigned int p = y * this->Width + x;
+            const unsigned int center = this->Labels[p];
+            if(center == Unassigned)
+            {
+                continue;
+            }
+
+            double* centerSums = &sums[static_cast<size_t>(center) * stride];
+            centerSums[0] += 1;
+            centerSums[1] += x;
+            centerSums[2] += y;
+            for(unsigned int c = 0; c < numberOfChannels; ++c)
+            {
+                centerSums[3 + c] += channels[c][p];
+            }
+        }
+    }
+
+    // A center that lost all of its pixels stays where it is
+    for(unsigned int center = 0; center < numberOfCenters; ++center)
+    {
+        const double* centerSums = &sums[static_cast<size_t>(center) * stride];
+        if(centerSums[0] == 0)
+        {
+            continue;
+        }
+
+        this->CenterPositions[2 * center] = centerSums[1] / centerSums[0];
+        this->CenterPositions[2 * center + 1] = centerSums[2] / centerSums[0];
+        for(unsigned int c = 0; c < numberOfChannels; ++c)
+        {
+            this->CenterColors[static_cast<size_t>(center) * numberOfChannels + c] = centerSums[3 + c] / centerSums[0];
+        }
+    }
+}
+
+void Superpixels::EnforceConnectivity(const unsigned char* const groups)
+{
+    const unsigned int width = this->Width;
+    const unsigned int height = this->Height;
+    const unsigned int minimumSize = std::max(this->Size * this->Size / 4, 1u);
+
+    auto groupOf = [groups](const unsigned int p) -> unsigned char
+    {
+        return groups ? groups[p] : 0;
+    };
+
+    std::vector<unsigned int> superpixels(this->Labels.size(), Unassigned);
+    std::vector<unsigned int> component;
+    unsigned int numberOfSuperpixels = 0;
+
+    for(unsigned int start = 0; start < superpixels.size(); ++start)
+    {
+        if(superpixels[start] != Unassigned)
+        {
+            continue;
+        }
+
+        // Flood the 4-connected pixels of the same center and group
+        const unsigned int label = this->Labels[start];
+        const unsigned char group = groupOf(start);
+        const unsigned int newLabel = numberOfSuperpixels;
+        component.clear();
+        component.push_back(start);
+        superpixels[start] = newLabel;
+        for(unsigned int i = 0; i < component.size(); ++i)
+        {
+            const unsigned int p = component[i];
+            const unsigned int x = p % width;
+            const unsigned int y = p / width;
+            const unsigned int neighbors[4] = {x > 0 ? p - 1 : p, x + 1 < width ? p + 1 : p,
+                                               y > 0 ? p - width : p, y + 1 < height ? p + width : p};
+            for(unsigned int n = 0; n < 4; ++n)
+            {
+                const unsigned int q = neighbors[n];
+                if(superpixels[q] == Unassigned && this->Labels[q] == label && groupOf(q) == group)
+                {
+                    superpixels[q] = newLabel;
+                    component.push_back(q);
+                }
+            }
+        }
+
+        if(component.size() >= minimumSize && label != Unassigned)
+        {
+            numberOfSuperpixels++;
+            continue;
+        }
+
+        // Merge a fragment into a finished superpixel of the same group next to it, if there is one
+        unsigned int adjacent = Unassigned;
+        for(unsigned int i = 0; i < component.size() && adjacent == Unassigned; ++i)
+        {
+            const unsigned int p = component[i];
+            const unsigned int x = p % width;
+            const unsigned int y = p / width;
+            const unsigned int neighbors[4] = {x > 0 ? p - 1 : p, x + 1 < width ? p + 1 : p,
+                                               y > 0 ? p - width : p, y + 1 < height ? p + width : p};
+            for(unsigned int n = 0; n < 4; ++n)
+            {
+                const unsigned int q = neighbors[n];
+                if(superpixels[q] != Unassigned && superpixels[q] != newLabel && groupOf(q) == group)
+                {
+                    adjacent = superpixels[q];
+                    break;
+                }
+            }
+        }
+
+        if(adjacent == Unassigned)
+        {
+            numberOfSuperpixels++;
+            continue;
+        }
+
+        for(unsigned int i = 0; i < component.size(); ++i)
+        {
+            superpixels[component[i]] = adjacent;
+        }
+    }
+
+    this->Labels.swap(superpixels);
+    this->PixelCounts.assign(numberOfSuperpixels, 0);
+}
+
+void Superpixels::ComputeStatistics(const std::vector<const float*>& channels, const unsigned char* const groups)
+{
+    const unsigned int width = this->Width;
+    const unsigned int height = this->Height;
+    const unsigned int numberOfChannels = this->NumberOfChannels;
+    const unsigned int numberOfSuperpixels = this->PixelCounts.size();
+    const unsigned int scatterSize = GetScatterSize();
+
+    this->Groups.assign(numberOfSuperpixels, 0);
+    this->Means.assign(static_cast<size_t>(numberOfSuperpixels) * numberOfChannels, 0.0);
+    this->Scatters.assign(static_cast<size_t>(numberOfSuperpixels) * scatterSize, 0.0);
+
+    // The neighbors of each superpixel with a larger label, and the length of the boundary with each of them
+    std::vector<std::vector<std::pair<unsigned int, unsigned int> > > neighbors(numberOfSuperpixels);
+    auto addBoundary = [&neighbors](unsigned int a, unsigned int b)
+    {
+        if(a > b)
+        {
+            std::swap(a, b);
+        }
+        for(unsigned int i = 0; i < neighbors[a].size(); ++i)
+        {
+            if(neighbors[a][i].first == b)
+            {
+                neighbors[a][i].second++;
+                return;
+            }
+        }
+        neighbors[a].push_back(std::make_pair(b, 1u));
+    };
+
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        for(unsigned int x = 0; x < width; ++x)
+        {
+            const unsigned int p = y * width + x;
+            const unsigned int superpixel = this->Labels[p];
+            this->PixelCounts[superpixel]++;
+            this->Groups[superpixel] = groups ? groups[p] : 0;
+
+            double* mean = &this->Means[static_cast<size_t>(superpixel) * numberOfChannels];
+            double* scatter = &this->Scatters[static_cast<size_t>(superpixel) * scatterSize];
+            unsigned int productIndex = 0;
+            for(unsigned int i = 0; i < numberOfChannels; ++i)
+            {
+                mean[i] += channels[i][p];
+                for(unsigned int j = i; j < numberOfChannels; ++j)
+                {
+                    scatter[productIndex++] += static_cast<double>(channels[i][p]) * channels[j][p];
+                }
+            }
+
+            if(x + 1 < width && this->Labels[p + 1] != superpixel)
+            {
+                addBoundary(superpixel, this->Labels[p + 1]);
+            }
+            if(y + 1 < height && this->Labels[p + width] != superpixel)
+            {
+                addBoundary(superpixel, this->Labels[p + width]);
+            }
+        }
+    }
+
+    // Turn the sums into the mean and the covariance about it
+    for(unsigned int superpixel = 0; superpixel < numberOfSuperpixels; ++superpixel)
+    {
+        const double count = this->PixelCounts[superpixel];
+        double* mean = &this->Means[static_cast<size_t>(superpixel) * numberOfChannels];
+        double* scatter = &this->Scatters[static_cast<size_t>(superpixel) * scatterSize];
+        for(unsigned int i = 0; i < numberOfChannels; ++i)
+        {
+            mean[i] /= count;
+        }
+
+        unsigned int productIndex = 0;
+        for(unsigned int i = 0; i < numberOfChannels; ++i)
+        {
+            for(unsigned int j = i; j < numberOfChannels; ++j)
+            {
+                scatter[productIndex] = scatter[productIndex] / count - mean[i] * mean[j];
+                if(i == j)
+                {
+                    scatter[productIndex] = std::max(scatter[productIndex], 0.0); // Rounding of a constant superpixel
+                }
+                productIndex++;
+            }
+        }
+    }
+
+    this->Edges.clear();
+    for(unsigned int a = 0; a < numberOfSuperpixels; ++a)
+    {
+        std::sort(neighbors[a].begin(), neighbors[a].end());
+        for(unsigned int i = 0; i < neighbors[a].size(); ++i)
+        {
+            Edge edge;
+            edge.A = a;
+            edge.B = neighbors[a][i].first;
+            edge.BoundaryLength = neighbors[a][i].second;
+            this->Edges.push_back(edge);
+        }
+    }
+
+    // The clustering state is not needed anymore
+    this->CenterPositions.clear();
+    this->CenterColors.clear();
+    this->CenterGroups.clear();
+}
@@ -0,0 +1,228 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef Superpixels_H
+#define Superpixels_H
+
+// STL
+#include <stdexcept>
+#include <vector>
+
+// ITK
+#include "itkImage.h"
+
+/** An over-segmentation of an image into SLIC superpixels (Achanta et al.), with the color statistics of each superpixel
+  * and the length of the boundary between each pair of adjacent superpixels.
+  * The clustering uses the channels of the image as they are (no conversion to CIELAB), so the statistics are in the
+  * color space the mixture models are fitted in. Every pixel also has a group (e.g. hard background or not), and a
+  * superpixel never contains pixels of two groups. Each pixel is compared with the centers that started in the 3x3 grid
+  * cells around its own, so the assignment is done per row, split over the threads, and does not depend on their number. */
+class Superpixels
+{
+public:
+    /** The boundary between two adjacent superpixels A < B: the number of 4-connected pixel pairs across it. */
+    struct Edge
+    {
+        unsigned int A;
+        unsigned int B;
+        unsigned int BoundaryLength;
+    };
+
+    /** Set the approximate side length of a superpixel in pixels (the SLIC grid interval S). */
+    void SetSize(const unsigned int size)
+    {
+        this->Size = size > 1 ? size : 2;
+    }
+
+    /** Get the approximate side length of a superpixel. */
+    unsigned int GetSize() const
+    {
+        return this->Size;
+    }
+
+    /** Set the weight of the spatial distance against the color distance (the SLIC m, default 40). The color distance is
+      * in the units of the channels, so the usual CIELAB values (around 10) are too small for 0-255 RGB. */
+    void SetCompactness(const float compactness)
+    {
+        this->Compactness = compactness;
+    }
+
+    /** Set the number of assignment/update iterations (default 10). */
+    void SetNumberOfIterations(const unsigned int numberOfIterations)
+    {
+        this->NumberOfIterations = numberOfIterations;
+    }
+
+    /** Set how many threads Compute() uses. This does not change the result. */
+    void SetNumberOfThreads(const unsigned int numberOfThreads)
+    {
+        this->NumberOfThreads = numberOfThreads > 0 ? numberOfThreads : 1;
+    }
+
+    /** Over-segment an image. groups holds one value per pixel in row-major order (or is null for a single group).
+      * The whole image must be buffered. */
+    template <typename TImage>
+    void Compute(const TImage* const image, const unsigned char* const groups);
+
+    /** Over-segment planar channels of width * height floats each. */
+    void Compute(const std::vector<const float*>& channels, const unsigned int width, const unsigned int height,
+                 const unsigned char* const groups);
+
+    /** Get the number of superpixels. */
+    unsigned int GetNumberOfSuperpixels() const
+    {
+        return this->PixelCounts.size();
+    }
+
+    /** Get the number of channels the statistics have. */
+    unsigned int GetNumberOfChannels() const
+    {
+        return this->NumberOfChannels;
+    }
+
+    /** Get the superpixel of each pixel, in row-major order. */
+    const std::vector<unsigned int>& GetLabels() const
+    {
+        return this->Labels;
+    }
+
+    /** Get the number of pixels of a superpixel. */
+    unsigned int GetPixelCount(const unsigned int superpixel) const
+    {
+        return this->PixelCounts[superpixel];
+    }
+
+    /** Get the group of the pixels of a superpixel. */
+    unsigned char GetGroup(const unsigned int superpixel) const
+    {
+        return this->Groups[superpixel];
+    }
+
+    /** Get the mean color of a superpixel (one value per channel). */
+    const double* GetMean(const unsigned int superpixel) const
+    {
+        return &this->Means[static_cast<size_t>(superpixel) * this->NumberOfChannels];
+    }
+
+    /** Get the covariance of the colors of a superpixel about its mean, as the upper triangle stored row by row
+      * (c(c+1)/2 values for c channels). */
+    const double* GetScatter(const unsigned int superpixel) const
+    {
+        return &this->Scatters[static_cast<size_t>(superpixel) * GetScatterSize()];
+    }
+
+    /** Get the number of values of a scatter matrix. */
+    unsigned int GetScatterSize() const
+    {
+        return this->NumberOfChannels * (this->NumberOfChannels + 1) / 2;
+    }
+
+    /** Get the pairs of adjacent superpixels, ordered by A and then B. */
+    const std::vector<Edge>& GetEdges() const
+    {
+        return this->Edges;
+    }
+
+    /** Get the number of bytes of the labels, the statistics and the adjacency (and of the clustering state left over). */
+    size_t GetNumberOfBytes() const
+    {
+        return this->Labels.size() * sizeof(unsigned int) + this->PixelCounts.size() * sizeof(unsigned int) +
+               this->Groups.size() + (this->Means.size() + this->Scatters.size()) * sizeof(double) +
+               this->Edges.size() * sizeof(Edge) + (this->CenterPositions.size() + this->CenterColors.size()) * sizeof(float) +
+               this->CenterGroups.size();
+    }
+
+protected:
+
+    /** Assign every pixel to the nearest center of its group among those that started in the surrounding grid cells,
+      * or to none if there is no such center. */
+    void AssignPixels(const std::vector<const float*>& channels, const unsigned char* const groups);
+
+    /** Move the centers to the mean position and color of their pixels. */
+    void UpdateCenters(const std::vector<const float*>& channels);
+
+    /** Relabel the pixels so that every superpixel is 4-connected, merging components smaller than a quarter of a grid
+      * cell (and unassigned pixels) into an adjacent superpixel of the same group. */
+    void EnforceConnectivity(const unsigned char* const groups);
+
+    /** Compute the statistics of the final superpixels and their adjacency. */
+    void ComputeStatistics(const std::vector<const float*>& channels, const unsigned char* const groups);
+
+    /** The parameters. */
+    unsigned int Size = 16;
+    float Compactness = 40.0f;
+    unsigned int NumberOfIterations = 10;
+    unsigned int NumberOfThreads = 1;
+
+    /** The image and grid size. */
+    unsigned int Width = 0;
+    unsigned int Height = 0;
+    unsigned int GridWidth = 0;
+    unsigned int GridHeight = 0;
+    unsigned int NumberOfChannels = 0;
+
+    /** The clustering state: per center its position, its color and its group, in grid cell order. */
+    std::vector<float> CenterPositions;
+    std::vector<float> CenterColors;
+    std::vector<unsigned char> CenterGroups;
+
+    /** The superpixel (or, while clustering, the center) of each pixel. */
+    std::vector<unsigned int> Labels;
+
+    /** The statistics of each superpixel. */
+    std::vector<unsigned int> PixelCounts;
+    std::vector<unsigned char> Groups;
+    std::vector<double> Means;
+    std::vector<double> Scatters;
+
+    /** The adjacency. */
+    std::vector<Edge> Edges;
+};
+
+template <typename TImage>
+void Superpixels::Compute(const TImage* const image, const unsigned char* const groups)
+{
+    if(image->GetBufferedRegion() != image->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("Superpixels::Compute: the whole image must be buffered!");
+    }
+
+    const unsigned int width = image->GetLargestPossibleRegion().GetSize()[0];
+    const unsigned int height = image->GetLargestPossibleRegion().GetSize()[1];
+    const unsigned int numberOfPixels = width * height;
+    const unsigned int numberOfChannels = TImage::PixelType::Dimension;
+
+    std::vector<std::vector<float> > channels(numberOfChannels, std::vector<float>(numberOfPixels));
+    const typename TImage::PixelType* buffer = image->GetBufferPointer();
+    for(unsigned int p = 0; p < numberOfPixels; ++p)
+    {
+        for(unsigned int c = 0; c < numberOfChannels; ++c)
+        {
+            channels[c][p] = static_cast<float>(buffer[p][c]);
+        }
+    }
+
+    std::vector<const float*> channelPointers(numberOfChannels);
+    for(unsigned int c = 0; c < numberOfChannels; ++c)
+    {
+        channelPointers[c] = channels[c].data();
+    }
+
+    Compute(channelPointers, width, height, groups);
+}
+
+#endif
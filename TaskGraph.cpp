@@ -0,0 +1,144 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TaskGraph.h"
+#include "Trace.h"
+
+// STL
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+TaskGraph::TaskId TaskGraph::AddTask(const std::string& name, const std::function<void()>& function,
+                                     const std::vector<TaskId>& dependencies)
+{
+    const TaskId taskId = this->Tasks.size();
+
+    for(unsigned int i = 0; i < dependencies.size(); ++i)
+    {
+        if(dependencies[i] >= taskId)
+        {
+            throw std::runtime_error("TaskGraph::AddTask: a task can only depend on tasks added before it!");
+        }
+        this->Tasks[dependencies[i]].Dependents.push_back(taskId);
+    }
+
+    Task task;
+    task.Name = name;
+    task.Function = function;
+    task.NumberOfDependencies = dependencies.size();
+    task.Duration = 0;
+    this->Tasks.push_back(task);
+
+    return taskId;
+}
+
+void TaskGraph::Run(const unsigned int numberOfThreads)
+{
+    if(this->HasRun)
+    {
+        throw std::runtime_error("TaskGraph::Run: a task graph can only be run once!");
+    }
+    this->HasRun = true;
+
+    std::mutex mutex;
+    std::condition_variable stateChanged;
+    std::deque<TaskId> readyTasks;
+    std::vector<unsigned int> remainingDependencies(this->Tasks.size());
+    unsigned int unfinishedTasks = this->Tasks.size();
+    std::exception_ptr firstException;
+
+    for(TaskId taskId = 0; taskId < this->Tasks.size(); ++taskId)
+    {
+        remainingDependencies[taskId] = this->Tasks[taskId].NumberOfDependencies;
+        if(remainingDependencies[taskId] == 0)
+        {
+            readyTasks.push_back(taskId);
+        }
+    }
+
+    auto worker = [&]()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            stateChanged.wait(lock, [&]() { return !readyTasks.empty() || unfinishedTasks == 0; });
+            if(unfinishedTasks == 0)
+            {
+                return;
+            }
+
+            const TaskId taskId = readyTasks.front();
+            readyTasks.pop_front();
+            const bool skip = static_cast<bool>(firstException);
+            lock.unlock();
+
+            if(!skip)
+            {
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                try
+                {
+                    this->Tasks[taskId].Function();
+                }
+                catch(...)
+                {
+                    std::lock_guard<std::mutex> exceptionLock(mutex);
+                    if(!firstException)
+                    {
+                        firstException = std::current_exception();
+                    }
+                }
+                const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+                this->Tasks[taskId].Duration = std::chrono::duration<double>(end - start).count();
+                GRABCUT_TRACE_EVENT(this->Tasks[taskId].Name, start, end);
+            }
+
+            lock.lock();
+            const std::vector<TaskId>& dependents = this->Tasks[taskId].Dependents;
+            for(unsigned int i = 0; i < dependents.size(); ++i)
+            {
+                if(--remainingDependencies[dependents[i]] == 0)
+                {
+                    readyTasks.push_back(dependents[i]);
+                }
+            }
+            unfinishedTasks--;
+            stateChanged.notify_all();
+        }
+    };
+
+    // The calling thread is one of the workers
+    std::vector<std::thread> threads;
+    for(unsigned int i = 1; i < numberOfThreads && i < this->Tasks.size(); ++i)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for(unsigned int i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+
+    if(firstException)
+    {
+        std::rethrow_exception(firstException);
+    }
+}
@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TaskGraph_H
+#define TaskGraph_H
+
+// STL
+#include <functional>
+#include <string>
+#include <vector>
+
+/** A small scheduler for a fixed set of tasks with dependencies.
+  * Tasks are added with the tasks they depend on, then Run() executes every task once all of its
+  * dependencies have finished, using up to the requested number of threads (the calling thread included).
+  * If a task throws, the tasks that have not started yet are skipped and the first exception is rethrown by Run(). */
+class TaskGraph
+{
+public:
+    /** The handle of a task, used to express dependencies. */
+    typedef unsigned int TaskId;
+
+    /** Add a task. Its dependencies must have been added before it, so the graph can not have cycles. */
+    TaskId AddTask(const std::string& name, const std::function<void()>& function,
+                   const std::vector<TaskId>& dependencies = std::vector<TaskId>());
+
+    /** Execute all tasks and wait for them. A task graph can only be run once. */
+    void Run(const unsigned int numberOfThreads);
+
+    /** Get the number of tasks. */
+    unsigned int GetNumberOfTasks() const
+    {
+        return this->Tasks.size();
+    }
+
+    /** Get the name a task was added with. */
+    const std::string& GetTaskName(const TaskId taskId) const
+    {
+        return this->Tasks[taskId].Name;
+    }
+
+    /** Get the wall time (in seconds) a task took in Run(). */
+    double GetTaskDuration(const TaskId taskId) const
+    {
+        return this->Tasks[taskId].Duration;
+    }
+
+protected:
+
+    struct Task
+    {
+        std::string Name;
+        std::function<void()> Function;
+        std::vector<TaskId> Dependents;
+        unsigned int NumberOfDependencies;
+        double Duration;
+    };
+
+    /** All tasks, in the order they were added. */
+    std::vector<Task> Tasks;
+
+    /** Whether Run() has been called. */
+    bool HasRun = false;
+};
+
+#endif
@@ -0,0 +1,288 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Compare the word-parallel operations of BitMask with pixel by pixel versions on random masks. The widths cross the
+  * 64 bit word boundaries, so the padding of the last word of each row and the carries between words are exercised. */
+
+#include "BitMask.h"
+
+// STL
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    /** A mask as one value per pixel, in row-major order. */
+    struct Pixels
+    {
+        int Width;
+        int Height;
+        std::vector<char> Values;
+
+        bool Get(const int x, const int y) const
+        {
+            return this->Values[y * this->Width + x] != 0;
+        }
+
+        bool IsInside(const int x, const int y) const
+        {
+            return x >= 0 && y >= 0 && x < this->Width && y < this->Height;
+        }
+    };
+
+    Pixels CreatePixels(std::mt19937& generator, const int width, const int height)
+    {
+        Pixels pixels;
+        pixels.Width = width;
+        pixels.Height = height;
+        pixels.Values.resize(width * height);
+
+        // A random density per mask, so that some masks are mostly runs and others mostly isolated pixels
+        std::uniform_int_distribution<int> percentage(0, 100);
+        const int density = percentage(generator);
+        for(char& value : pixels.Values)
+        {
+            value = percentage(generator) < density;
+        }
+        return pixels;
+    }
+
+    BitMask ToBitMask(const Pixels& pixels)
+    {
+        BitMask mask;
+        mask.SetSize(pixels.Width, pixels.Height);
+        for(int y = 0; y < pixels.Height; ++y)
+        {
+            for(int x = 0; x < pixels.Width; ++x)
+            {
+                mask.Set(x, y, pixels.Get(x, y));
+            }
+        }
+        return mask;
+    }
+
+    /** Set (true) or clear (false) the pixels that have a pixel of that value within a chessboard distance of radius. */
+    Pixels Grow(const Pixels& pixels, const int radius, const bool value)
+    {
+        Pixels result = pixels;
+        for(int y = 0; y < pixels.Height; ++y)
+        {
+            for(int x = 0; x < pixels.Width; ++x)
+            {
+                for(int dy = -radius; dy <= radius; ++dy)
+                {
+                    for(int dx = -radius; dx <= radius; ++dx)
+                    {
+                        if(pixels.IsInside(x + dx, y + dy) && pixels.Get(x + dx, y + dy) == value)
+                        {
+                            result.Values[y * pixels.Width + x] = value;
+                        }
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    /** Get the offsets of the pixels that differ from their neighbor (x + neighborX, y + neighborY). */
+    std::vector<unsigned int> GetDifferentNeighbors(const Pixels& pixels, const int neighborX, const int neighborY)
+    {
+        std::vector<unsigned int> offsets;
+        for(int y = 0; y < pixels.Height; ++y)
+        {
+            for(int x = 0; x < pixels.Width; ++x)
+            {
+                if(pixels.IsInside(x + neighborX, y + neighborY) && pixels.Get(x, y) != pixels.Get(x + neighborX, y + neighborY))
+                {
+                    offsets.push_back(y * pixels.Width + x);
+                }
+            }
+        }
+        return offsets;
+    }
+
+    void Compare(const BitMask& mask, const Pixels& pixels, const std::string& description)
+    {
+        for(int y = 0; y < pixels.Height; ++y)
+        {
+            for(int x = 0; x < pixels.Width; ++x)
+            {
+                if(mask.Get(x, y) != pixels.Get(x, y))
+                {
+                    std::stringstream message;
+                    message << description << ": pixel (" << x << ", " << y << ") differs!";
+                    throw std::runtime_error(message.str());
+                }
+            }
+        }
+
+        // The padding past the end of the rows must stay clear, or the counts would be off
+        if(mask.Count() != static_cast<size_t>(std::count(pixels.Values.begin(), pixels.Values.end(), 1)))
+        {
+            throw std::runtime_error(description + ": the count differs!");
+        }
+    }
+
+    void TestMasks(std::mt19937& generator, const int width, const int height, const std::string& description)
+    {
+        const Pixels a = CreatePixels(generator, width, height);
+        const Pixels b = CreatePixels(generator, width, height);
+        const BitMask maskA = ToBitMask(a);
+        const BitMask maskB = ToBitMask(b);
+        Compare(maskA, a, description + " Set");
+
+        // Set operations and counts
+        size_t differences = 0;
+        Pixels andPixels = a, orPixels = a, andNotPixels = a, invertPixels = a;
+        for(size_t i = 0; i < a.Values.size(); ++i)
+        {
+            differences += a.Values[i] != b.Values[i];
+            andPixels.Values[i] = a.Values[i] && b.Values[i];
+            orPixels.Values[i] = a.Values[i] || b.Values[i];
+            andNotPixels.Values[i] = a.Values[i] && !b.Values[i];
+            invertPixels.Values[i] = !a.Values[i];
+        }
+        if(maskA.CountDifferences(maskB) != differences)
+        {
+            throw std::runtime_error(description + ": CountDifferences differs!");
+        }
+        BitMask mask = maskA;
+        mask.And(maskB);
+        Compare(mask, andPixels, description + " And");
+        mask = maskA;
+        mask.Or(maskB);
+        Compare(mask, orPixels, description + " Or");
+        mask = maskA;
+        mask.AndNot(maskB);
+        Compare(mask, andNotPixels, description + " AndNot");
+        mask = maskA;
+        mask.Invert();
+        Compare(mask, invertPixels, description + " Invert");
+
+        // Morphology, with radii up to past the size of the mask
+        const unsigned int radii[] = {0, 1, 2, 5, 70};
+        for(const unsigned int radius : radii)
+        {
+            if(radius > 64 && width * height > 2000)
+            {
+                continue;
+            }
+            std::stringstream radiusDescription;
+            radiusDescription << " of radius " << radius;
+            mask = maskA;
+            mask.Dilate(radius);
+            Compare(mask, Grow(a, radius, true), description + " Dilate" + radiusDescription.str());
+            mask = maskA;
+            mask.Erode(radius);
+            Compare(mask, Grow(a, radius, false), description + " Erode" + radiusDescription.str());
+        }
+
+        Pixels boundary = a;
+        for(int y = 0; y < height; ++y)
+        {
+            for(int x = 0; x < width; ++x)
+            {
+                const int dx[4] = {1, -1, 0, 0};
+                const int dy[4] = {0, 0, 1, -1};
+                boundary.Values[y * width + x] = 0;
+                for(unsigned int direction = 0; direction < 4; ++direction)
+                {
+                    if(a.IsInside(x + dx[direction], y + dy[direction]) &&
+                       a.Get(x + dx[direction], y + dy[direction]) != a.Get(x, y))
+                    {
+                        boundary.Values[y * width + x] = 1;
+                    }
+                }
+            }
+        }
+        Compare(maskA.GetBoundary(), boundary, description + " GetBoundary");
+
+        // Iteration
+        std::vector<unsigned int> expected[2];
+        for(unsigned int i = 0; i < a.Values.size(); ++i)
+        {
+            expected[a.Values[i] != 0].push_back(i);
+        }
+        std::vector<unsigned int> offsets;
+        for(unsigned int value = 0; value < 2; ++value)
+        {
+            maskA.GetOffsets(value == 1, offsets);
+            if(offsets != expected[value])
+            {
+                throw std::runtime_error(description + ": GetOffsets differs!");
+            }
+        }
+        offsets.clear();
+        maskA.ForEachSetBit([&offsets](const unsigned int offset) { offsets.push_back(offset); });
+        if(offsets != expected[1])
+        {
+            throw std::runtime_error(description + ": ForEachSetBit differs!");
+        }
+
+        for(int neighborY = 0; neighborY <= 1; ++neighborY)
+        {
+            for(int neighborX = -1; neighborX <= 1; ++neighborX)
+            {
+                if(neighborX == 0 && neighborY == 0)
+                {
+                    continue;
+                }
+                offsets.clear();
+                maskA.ForEachDifferentNeighbor(neighborX, neighborY,
+                                               [&offsets](const unsigned int offset) { offsets.push_back(offset); });
+                std::sort(offsets.begin(), offsets.end());
+                if(offsets != GetDifferentNeighbors(a, neighborX, neighborY))
+                {
+                    std::stringstream message;
+                    message << description << ": ForEachDifferentNeighbor(" << neighborX << ", " << neighborY << ") differs!";
+                    throw std::runtime_error(message.str());
+                }
+            }
+        }
+    }
+}
+
+int main()
+{
+    try
+    {
+        std::mt19937 generator(0);
+        std::uniform_int_distribution<int> size(1, 200);
+        for(unsigned int i = 0; i < 200; ++i)
+        {
+            // Every other mask has a width at or next to a multiple of the word size
+            const int width = i % 2 == 0 ? size(generator) : 64 * (1 + i % 3) + static_cast<int>(i % 3) - 1;
+            const int height = size(generator) / 4 + 1;
+            std::stringstream description;
+            description << "Mask " << i << " (" << width << "x" << height << ")";
+            TestMasks(generator, width, height, description.str());
+        }
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "BitMask matches the pixel by pixel operations on 200 random masks." << std::endl;
+    return EXIT_SUCCESS;
+}
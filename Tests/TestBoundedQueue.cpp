@@ -0,0 +1,210 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Pass numbered items through a BoundedQueue from several producers to several consumers with random delays, and
+  * check that every item arrives exactly once, in order per producer, without the queue ever holding more than its
+  * capacity; then check Close(): the consumers drain the items left, and Push() fails, also when it was waiting. */
+
+#include "BoundedQueue.h"
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const unsigned int ItemsPerProducer = 2000;
+
+    /** Sleep for a random short while now and then, so the threads interleave differently. */
+    void Delay(std::mt19937& generator)
+    {
+        std::uniform_int_distribution<int> delay(0, 200);
+        const int microseconds = delay(generator);
+        if(microseconds < 10)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(microseconds));
+        }
+    }
+
+    void TestProducersAndConsumers(const unsigned int capacity, const unsigned int numberOfProducers,
+                                   const unsigned int numberOfConsumers, const std::string& description)
+    {
+        BoundedQueue<unsigned int> queue(capacity);
+        std::vector<std::vector<unsigned int> > received(numberOfConsumers);
+
+        std::vector<std::thread> consumers;
+        for(unsigned int c = 0; c < numberOfConsumers; ++c)
+        {
+            consumers.push_back(std::thread([&queue, &received, c]()
+            {
+                std::mt19937 generator(1000 + c);
+                unsigned int item;
+                while(queue.Pop(item))
+                {
+                    received[c].push_back(item);
+                    Delay(generator);
+                }
+            }));
+        }
+
+        std::vector<std::thread> producers;
+        for(unsigned int p = 0; p < numberOfProducers; ++p)
+        {
+            producers.push_back(std::thread([&queue, p]()
+            {
+                std::mt19937 generator(p);
+                for(unsigned int i = 0; i < ItemsPerProducer; ++i)
+                {
+                    if(!queue.Push(p * ItemsPerProducer + i))
+                    {
+                        throw std::logic_error("Push failed before Close!"); // Terminates, which fails the test
+                    }
+                    Delay(generator);
+                }
+            }));
+        }
+        for(std::thread& producer : producers)
+        {
+            producer.join();
+        }
+
+        // Close while the consumers may still be draining
+        queue.Close();
+        for(std::thread& consumer : consumers)
+        {
+            consumer.join();
+        }
+
+        if(queue.GetMaximumSize() > capacity)
+        {
+            throw std::runtime_error(description + ": the queue held more items than its capacity!");
+        }
+
+        // Every consumer sees the items of a producer in the order they were pushed
+        std::vector<unsigned int> all;
+        for(const std::vector<unsigned int>& items : received)
+        {
+            std::vector<unsigned int> lastItem(numberOfProducers, 0);
+            std::vector<bool> seen(numberOfProducers, false);
+            for(const unsigned int item : items)
+            {
+                const unsigned int producer = item / ItemsPerProducer;
+                if(seen[producer] && item <= lastItem[producer])
+                {
+                    throw std::runtime_error(description + ": the items of a producer arrived out of order!");
+                }
+                seen[producer] = true;
+                lastItem[producer] = item;
+            }
+            all.insert(all.end(), items.begin(), items.end());
+        }
+
+        std::sort(all.begin(), all.end());
+        if(all.size() != numberOfProducers * ItemsPerProducer)
+        {
+            throw std::runtime_error(description + ": items were lost or duplicated!");
+        }
+        for(unsigned int i = 0; i < all.size(); ++i)
+        {
+            if(all[i] != i)
+            {
+                throw std::runtime_error(description + ": items were lost or duplicated!");
+            }
+        }
+    }
+
+    void TestClose()
+    {
+        // The items pushed before Close() are still popped, then Pop() and Push() fail
+        BoundedQueue<int> queue(3);
+        queue.Push(1);
+        queue.Push(2);
+        queue.Close();
+        int item = 0;
+        if(queue.Push(3))
+        {
+            throw std::runtime_error("Close: Push succeeded after Close!");
+        }
+        if(!queue.Pop(item) || item != 1 || !queue.Pop(item) || item != 2)
+        {
+            throw std::runtime_error("Close: the items left were not drained in order!");
+        }
+        if(queue.Pop(item))
+        {
+            throw std::runtime_error("Close: Pop succeeded on a closed and empty queue!");
+        }
+
+        // A Push() waiting on a full queue gives up when the queue is closed, and a waiting Pop() returns
+        BoundedQueue<int> fullQueue(1);
+        fullQueue.Push(1);
+        bool pushed = true;
+        std::thread producer([&fullQueue, &pushed]() { pushed = fullQueue.Push(2); });
+        BoundedQueue<int> emptyQueue(1);
+        bool popped = true;
+        std::thread consumer([&emptyQueue, &popped]() { int value; popped = emptyQueue.Pop(value); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        fullQueue.Close();
+        emptyQueue.Close();
+        producer.join();
+        consumer.join();
+        if(pushed || popped)
+        {
+            throw std::runtime_error("Close: a waiting Push or Pop did not fail when the queue was closed!");
+        }
+        if(!fullQueue.Pop(item) || item != 1 || fullQueue.Pop(item))
+        {
+            throw std::runtime_error("Close: a full queue was not drained!");
+        }
+    }
+}
+
+int main()
+{
+    try
+    {
+        const unsigned int capacities[] = {1, 2, 7, 64};
+        for(const unsigned int capacity : capacities)
+        {
+            for(unsigned int numberOfProducers = 1; numberOfProducers <= 4; numberOfProducers += 3)
+            {
+                for(unsigned int numberOfConsumers = 1; numberOfConsumers <= 4; numberOfConsumers += 3)
+                {
+                    std::stringstream description;
+                    description << "Capacity " << capacity << ", " << numberOfProducers << " producers, "
+                                << numberOfConsumers << " consumers";
+                    TestProducersAndConsumers(capacity, numberOfProducers, numberOfConsumers, description.str());
+                }
+            }
+        }
+        TestClose();
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "BoundedQueue delivered every item once and drained on Close." << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Compare the likelihoods and costs of GaussianMixtureBatchEvaluator, on every instruction set this CPU supports, with
+  * a direct evaluation in double precision on random mixtures; and check that every cost is finite, also for colors
+  * far from every component and for a mixture whose components were all dropped. */
+
+#include "GaussianMixtureBatchEvaluator.h"
+
+// Submodules
+#include "ExpectationMaximization/GaussianModel.h"
+#include "ExpectationMaximization/MixtureModel.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    const unsigned int NumberOfComponents = 5;
+
+    /** Get log(sum_k w_k N(x)) in double precision. */
+    double ComputeLogLikelihood(const MixtureModel& mixtureModel, const Eigen::Vector3d& color)
+    {
+        std::vector<double> logDensities;
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            const Model* model = mixtureModel.GetModel(k);
+            if(!(model->GetMixingCoefficient() > 0))
+            {
+                continue;
+            }
+            const Eigen::Matrix3d covariance = model->GetVariance();
+            const Eigen::Vector3d difference = color - model->GetMean();
+            logDensities.push_back(std::log(model->GetMixingCoefficient()) -
+                                   0.5 * (3 * std::log(2 * M_PI) + std::log(covariance.determinant()) +
+                                          difference.dot(covariance.inverse() * difference)));
+        }
+
+        double maximum = -INFINITY;
+        for(const double logDensity : logDensities)
+        {
+            maximum = std::max(maximum, logDensity);
+        }
+        double sum = 0;
+        for(const double logDensity : logDensities)
+        {
+            sum += std::exp(logDensity - maximum);
+        }
+        return maximum + std::log(sum);
+    }
+
+    void TestMixture(std::mt19937& generator, const bool allDropped, const std::string& description)
+    {
+        std::uniform_real_distribution<double> uniform(0, 255);
+        std::normal_distribution<double> normal(0, 1);
+        std::uniform_int_distribution<int> dropped(0, 3);
+
+        std::vector<Model*> models;
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            Eigen::VectorXd mean(3);
+            Eigen::MatrixXd factor(3, 3);
+            for(unsigned int i = 0; i < 3; ++i)
+            {
+                mean(i) = uniform(generator);
+                for(unsigned int j = 0; j < 3; ++j)
+                {
+                    factor(i, j) = 10 * normal(generator);
+                }
+            }
+            Model* model = new GaussianModel(3);
+            model->SetMean(mean);
+            model->SetVariance(factor * factor.transpose() + Eigen::MatrixXd::Identity(3, 3));
+            model->SetMixingCoefficient(allDropped || (k > 0 && dropped(generator) == 0) ? 0 : 0.1 + uniform(generator) / 255);
+            models.push_back(model);
+        }
+        MixtureModel mixtureModel;
+        mixtureModel.SetModels(models);
+
+        // Colors in the cube, and colors far outside of it where the likelihood underflows; an odd number of them, so
+        // the vector kernels leave some to the scalar one
+        const unsigned int numberOfColors = 1001;
+        std::vector<float> red(numberOfColors), green(numberOfColors), blue(numberOfColors);
+        for(unsigned int i = 0; i < numberOfColors; ++i)
+        {
+            const double scale = i % 5 == 0 ? 20 : 1;
+            red[i] = scale * uniform(generator);
+            green[i] = scale * uniform(generator);
+            blue[i] = scale * uniform(generator);
+        }
+
+        const InstructionSetEnum instructionSets[] = {InstructionSetEnum::SCALAR, InstructionSetEnum::AVX2,
+                                                      InstructionSetEnum::AVX512};
+        for(const InstructionSetEnum instructionSet : instructionSets)
+        {
+            if(static_cast<int>(instructionSet) > static_cast<int>(GaussianMixtureBatchEvaluator::GetBestInstructionSet()))
+            {
+                continue;
+            }
+            std::stringstream instructionSetDescription;
+            instructionSetDescription << description << ", instruction set " << static_cast<int>(instructionSet);
+
+            GaussianMixtureBatchEvaluator evaluator;
+            evaluator.SetInstructionSet(instructionSet);
+            evaluator.SetMixtureModel(mixtureModel);
+            std::vector<float> likelihoods(numberOfColors), costs(numberOfColors);
+            evaluator.EvaluateLikelihood(red.data(), green.data(), blue.data(), numberOfColors, likelihoods.data());
+            evaluator.EvaluateNegativeLogLikelihood(red.data(), green.data(), blue.data(), numberOfColors, costs.data());
+
+            for(unsigned int i = 0; i < numberOfColors; ++i)
+            {
+                if(!std::isfinite(costs[i]))
+                {
+                    throw std::runtime_error(instructionSetDescription.str() + ": a cost is not finite!");
+                }
+                if(allDropped)
+                {
+                    if(costs[i] != GaussianMixtureBatchEvaluator::MaximumCost || likelihoods[i] != 0)
+                    {
+                        throw std::runtime_error(instructionSetDescription.str() + ": a mixture without components has a likelihood!");
+                    }
+                    continue;
+                }
+
+                const double logLikelihood = ComputeLogLikelihood(mixtureModel, Eigen::Vector3d(red[i], green[i], blue[i]));
+                const double likelihood = std::exp(logLikelihood);
+                if(std::abs(costs[i] + logLikelihood) > 1e-4 * std::max(1.0, std::abs(logLikelihood)) ||
+                   std::abs(likelihoods[i] - likelihood) > 1e-4 * likelihood + 1e-30)
+                {
+                    std::stringstream message;
+                    message << instructionSetDescription.str() << ": color " << i << " has cost " << costs[i]
+                            << " and likelihood " << likelihoods[i] << " instead of " << -logLikelihood << " and "
+                            << likelihood << "!";
+                    throw std::runtime_error(message.str());
+                }
+            }
+        }
+
+        for(Model* model : models)
+        {
+            delete model;
+        }
+    }
+}
+
+int main()
+{
+    try
+    {
+        std::mt19937 generator(0);
+        for(unsigned int i = 0; i < 50; ++i)
+        {
+            std::stringstream description;
+            description << "Mixture " << i;
+            TestMixture(generator, i % 10 == 9, description.str());
+        }
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "GaussianMixtureBatchEvaluator matches the direct evaluation on 50 random mixtures." << std::endl;
+    return EXIT_SUCCESS;
+}
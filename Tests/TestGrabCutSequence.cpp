@@ -0,0 +1,234 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Segment a synthetic sequence with a scene cut in it: a red disc that moves over a blue background, then a yellow
+  * square on a green background somewhere else. Check that the frames of the disc after the first are warm-started, and
+  * that the cut is detected and segmented from scratch, exactly as a new GrabCut segments that frame on its own. */
+
+#include "GrabCutSequence.h"
+
+// STL
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef itk::Image<itk::CovariantVector<unsigned char, 3>, 2> ImageType;
+
+    const unsigned int Size = 80;
+
+    /** The hard background: everything outside a rectangle 4 pixels in from the border. */
+    const unsigned int Border = 4;
+
+    /** A color with uniform noise on every channel. */
+    void SetNoisyColor(ImageType::PixelType& pixel, const int red, const int green, const int blue, std::mt19937& generator)
+    {
+        std::uniform_int_distribution<int> noise(-16, 16);
+        const int color[3] = {red, green, blue};
+        for(unsigned int c = 0; c < 3; ++c)
+        {
+            pixel[c] = static_cast<unsigned char>(std::min(std::max(color[c] + noise(generator), 0), 255));
+        }
+    }
+
+    ImageType::Pointer CreateImage()
+    {
+        itk::Size<2> size;
+        size.Fill(Size);
+        ImageType::Pointer image = ImageType::New();
+        image->SetRegions(itk::ImageRegion<2>(size));
+        image->Allocate();
+        return image;
+    }
+
+    /** A red disc of radius 15 centered at (centerX, 35) on a blue background. */
+    ImageType::Pointer CreateDiscFrame(const int centerX, std::mt19937& generator)
+    {
+        ImageType::Pointer image = CreateImage();
+        ImageType::PixelType* pixels = image->GetBufferPointer();
+        for(unsigned int y = 0; y < Size; ++y)
+        {
+            for(unsigned int x = 0; x < Size; ++x)
+            {
+                const int dx = static_cast<int>(x) - centerX;
+                const int dy = static_cast<int>(y) - 35;
+                if(dx * dx + dy * dy <= 15 * 15)
+                {
+                    SetNoisyColor(pixels[y * Size + x], 200, 40, 40, generator);
+                }
+                else
+                {
+                    SetNoisyColor(pixels[y * Size + x], 40, 60, 180, generator);
+                }
+            }
+        }
+        return image;
+    }
+
+    /** Whether (x, y) is in the yellow square of the second scene, which starts at (left, 56). */
+    bool IsInSquare(const unsigned int x, const unsigned int y, const unsigned int left)
+    {
+        return x >= left && x < left + 18 && y >= 56 && y < 74;
+    }
+
+    /** A yellow square on a green background, away from where the disc was. */
+    ImageType::Pointer CreateSquareFrame(const unsigned int left, std::mt19937& generator)
+    {
+        ImageType::Pointer image = CreateImage();
+        ImageType::PixelType* pixels = image->GetBufferPointer();
+        for(unsigned int y = 0; y < Size; ++y)
+        {
+            for(unsigned int x = 0; x < Size; ++x)
+            {
+                if(IsInSquare(x, y, left))
+                {
+                    SetNoisyColor(pixels[y * Size + x], 230, 220, 50, generator);
+                }
+                else
+                {
+                    SetNoisyColor(pixels[y * Size + x], 60, 150, 70, generator);
+                }
+            }
+        }
+        return image;
+    }
+
+    ForegroundBackgroundSegmentMask::Pointer CreateInitialMask()
+    {
+        itk::Size<2> size;
+        size.Fill(Size);
+        ForegroundBackgroundSegmentMask::Pointer mask = ForegroundBackgroundSegmentMask::New();
+        mask->SetRegions(itk::ImageRegion<2>(size));
+        mask->Allocate();
+        ForegroundBackgroundSegmentMask::PixelType* labels = mask->GetBufferPointer();
+        for(unsigned int y = 0; y < Size; ++y)
+        {
+            for(unsigned int x = 0; x < Size; ++x)
+            {
+                const bool inside = x >= Border && y >= Border && x < Size - Border && y < Size - Border;
+                labels[y * Size + x] = inside ? ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND :
+                                                ForegroundBackgroundSegmentMaskPixelTypeEnum::BACKGROUND;
+            }
+        }
+        return mask;
+    }
+
+    void CheckFrameStart(GrabCutSequence<ImageType>& sequence, const FrameStartEnum expected)
+    {
+        if(sequence.GetFrameStart() != expected)
+        {
+            std::stringstream message;
+            message << "Frame " << sequence.GetNumberOfFrames() - 1 << " was started by \""
+                    << GrabCutSequence<ImageType>::GetFrameStartName(sequence.GetFrameStart()) << "\" instead of \""
+                    << GrabCutSequence<ImageType>::GetFrameStartName(expected) << "\" (carried over cost "
+                    << sequence.GetCarriedOverCost() << ")!";
+            throw std::runtime_error(message.str());
+        }
+    }
+
+    void TestSceneCut()
+    {
+        std::mt19937 generator(0);
+        ForegroundBackgroundSegmentMask::Pointer initialMask = CreateInitialMask();
+
+        GrabCutSequence<ImageType> sequence;
+        sequence.GetGrabCut().SetNumberOfThreads(2);
+        sequence.GetGrabCut().SetVerbose(false);
+        sequence.SetInitialMask(initialMask);
+
+        // The colors are so far apart that the pixels the disc moves over raise the mean cost by about 6 nats, while the
+        // cut raises it by about 240
+        sequence.SetSceneCutCostIncrease(20);
+
+        // The disc moves by 2 pixels a frame, well within the refined band
+        std::vector<ImageType::Pointer> frames;
+        for(unsigned int frame = 0; frame < 3; ++frame)
+        {
+            frames.push_back(CreateDiscFrame(30 + 2 * frame, generator));
+            sequence.SegmentFrame(frames.back());
+            CheckFrameStart(sequence, frame == 0 ? FrameStartEnum::FULL : FrameStartEnum::WARM_START);
+        }
+
+        // The cut: none of the colors of the previous models are left
+        ImageType::Pointer cutFrame = CreateSquareFrame(56, generator);
+        sequence.SegmentFrame(cutFrame);
+        CheckFrameStart(sequence, FrameStartEnum::SCENE_CUT);
+
+        // A full segmentation from fresh models gives the same cut as a new GrabCut; refining a band around the disc
+        // would not even reach the square
+        GrabCut<ImageType> fresh;
+        fresh.SetNumberOfThreads(2);
+        fresh.SetVerbose(false);
+        fresh.SetImage(cutFrame);
+        fresh.SetInitialMask(initialMask);
+        fresh.PerformSegmentation();
+        const ForegroundBackgroundSegmentMask::PixelType* sequenceLabels = sequence.GetSegmentationMask()->GetBufferPointer();
+        const ForegroundBackgroundSegmentMask::PixelType* freshLabels = fresh.GetSegmentationMask()->GetBufferPointer();
+        unsigned int squareForeground = 0;
+        unsigned int otherForeground = 0;
+        for(unsigned int y = 0; y < Size; ++y)
+        {
+            for(unsigned int x = 0; x < Size; ++x)
+            {
+                if(sequenceLabels[y * Size + x] != freshLabels[y * Size + x])
+                {
+                    std::stringstream message;
+                    message << "The scene cut differs from a full segmentation at (" << x << ", " << y << ")!";
+                    throw std::runtime_error(message.str());
+                }
+                if(sequenceLabels[y * Size + x] == ForegroundBackgroundSegmentMaskPixelTypeEnum::FOREGROUND)
+                {
+                    (IsInSquare(x, y, 56) ? squareForeground : otherForeground)++;
+                }
+            }
+        }
+        if(squareForeground < 18 * 18 * 9 / 10 || otherForeground > 18 * 18 / 10)
+        {
+            std::stringstream message;
+            message << "The scene cut found " << squareForeground << " pixels of the square and " << otherForeground
+                    << " others as foreground!";
+            throw std::runtime_error(message.str());
+        }
+
+        // The new scene is warm-started again
+        ImageType::Pointer nextFrame = CreateSquareFrame(54, generator);
+        sequence.SegmentFrame(nextFrame);
+        CheckFrameStart(sequence, FrameStartEnum::WARM_START);
+    }
+}
+
+int main(int, char*[])
+{
+    try
+    {
+        TestSceneCut();
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "GrabCutSequence warm-starts the moving object and segments the scene cut from scratch." << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,313 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Compare the cuts of GridMaxFlow with those of Boost's boykov_kolmogorov_max_flow on random 4 and 8 connected grids,
+  * on one and several threads, for a first solve and after AddTerminalCapacities(). The capacities are small integers,
+  * so both flows are exact, and the source side (the nodes reachable from the source in the residual graph of a maximum
+  * flow) is unique, so the labels must be identical. */
+
+#include "GridMaxFlow.h"
+
+// Boost
+#include <boost/graph/adjacency_list.hpp>
+#include <boost/graph/boykov_kolmogorov_max_flow.hpp>
+
+// STL
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    typedef boost::adjacency_list_traits<boost::vecS, boost::vecS, boost::directedS> GraphTraitsType;
+
+    typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::directedS,
+        boost::property<boost::vertex_color_t, boost::default_color_type,
+        boost::property<boost::vertex_distance_t, long,
+        boost::property<boost::vertex_predecessor_t, GraphTraitsType::edge_descriptor> > >,
+        boost::property<boost::edge_capacity_t, float,
+        boost::property<boost::edge_residual_capacity_t, float,
+        boost::property<boost::edge_reverse_t, GraphTraitsType::edge_descriptor> > > > GraphType;
+
+    /** A random grid problem: the capacity of the edge from every node in every direction (0 where there is no
+      * neighbor) and of its two terminal edges. */
+    struct Problem
+    {
+        unsigned int Width;
+        unsigned int Height;
+        bool EightConnected;
+        std::vector<float> NeighborCapacities[8];
+        std::vector<float> SourceCapacities;
+        std::vector<float> SinkCapacities;
+
+        unsigned int GetNumberOfDirections() const
+        {
+            return this->EightConnected ? 8 : 4;
+        }
+
+        /** Get the neighbor of (x, y) in a direction of GridMaxFlow::DirectionEnum, or false if it is outside. */
+        bool GetNeighbor(const unsigned int x, const unsigned int y, const unsigned int direction, unsigned int& neighbor) const
+        {
+            const int dx[8] = {1, -1, 0, 0, 1, -1, -1, 1};
+            const int dy[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+            const int nx = static_cast<int>(x) + dx[direction];
+            const int ny = static_cast<int>(y) + dy[direction];
+            if(nx < 0 || ny < 0 || nx >= static_cast<int>(this->Width) || ny >= static_cast<int>(this->Height))
+            {
+                return false;
+            }
+            neighbor = ny * this->Width + nx;
+            return true;
+        }
+    };
+
+    /** Make a random problem. Many terminal capacities are 0 and many n-links are strong, so the trees have to grow. */
+    Problem CreateProblem(std::mt19937& generator, const unsigned int width, const unsigned int height, const bool eightConnected)
+    {
+        Problem problem;
+        problem.Width = width;
+        problem.Height = height;
+        problem.EightConnected = eightConnected;
+
+        const unsigned int numberOfNodes = width * height;
+        std::uniform_int_distribution<int> capacity(0, 20);
+        std::uniform_int_distribution<int> coin(0, 2);
+        for(unsigned int direction = 0; direction < 8; ++direction)
+        {
+            problem.NeighborCapacities[direction].assign(numberOfNodes, 0);
+        }
+        problem.SourceCapacities.resize(numberOfNodes);
+        problem.SinkCapacities.resize(numberOfNodes);
+        for(unsigned int y = 0; y < height; ++y)
+        {
+            for(unsigned int x = 0; x < width; ++x)
+            {
+                const unsigned int p = y * width + x;
+                unsigned int neighbor;
+                for(unsigned int direction = 0; direction < problem.GetNumberOfDirections(); ++direction)
+                {
+                    if(problem.GetNeighbor(x, y, direction, neighbor))
+                    {
+                        problem.NeighborCapacities[direction][p] = capacity(generator);
+                    }
+                }
+                problem.SourceCapacities[p] = coin(generator) == 0 ? capacity(generator) : 0;
+                problem.SinkCapacities[p] = coin(generator) == 0 ? capacity(generator) : 0;
+            }
+        }
+
+        return problem;
+    }
+
+    /** Add an edge and its reverse edge to a Boost graph. */
+    void AddEdgePair(GraphType& graph, const unsigned int from, const unsigned int to, const float capacity,
+                     const float reverseCapacity)
+    {
+        const GraphTraitsType::edge_descriptor edge = boost::add_edge(from, to, graph).first;
+        const GraphTraitsType::edge_descriptor reverseEdge = boost::add_edge(to, from, graph).first;
+        boost::put(boost::edge_capacity, graph, edge, capacity);
+        boost::put(boost::edge_capacity, graph, reverseEdge, reverseCapacity);
+        boost::put(boost::edge_reverse, graph, edge, reverseEdge);
+        boost::put(boost::edge_reverse, graph, reverseEdge, edge);
+    }
+
+    /** Solve a problem with Boost, filling whether each node is on the source side. Returns the flow. */
+    double SolveWithBoost(const Problem& problem, std::vector<bool>& isSource)
+    {
+        const unsigned int numberOfNodes = problem.Width * problem.Height;
+        const unsigned int source = numberOfNodes;
+        const unsigned int sink = numberOfNodes + 1;
+        GraphType graph(numberOfNodes + 2);
+        for(unsigned int y = 0; y < problem.Height; ++y)
+        {
+            for(unsigned int x = 0; x < problem.Width; ++x)
+            {
+                const unsigned int p = y * problem.Width + x;
+                AddEdgePair(graph, source, p, problem.SourceCapacities[p], 0);
+                AddEdgePair(graph, p, sink, problem.SinkCapacities[p], 0);
+
+                // Every pair of neighbors once, from the even direction; the reverse of direction d is d ^ 1
+                unsigned int neighbor;
+                for(unsigned int direction = 0; direction < problem.GetNumberOfDirections(); direction += 2)
+                {
+                    if(problem.GetNeighbor(x, y, direction, neighbor))
+                    {
+                        AddEdgePair(graph, p, neighbor, problem.NeighborCapacities[direction][p],
+                                    problem.NeighborCapacities[direction ^ 1][neighbor]);
+                    }
+                }
+            }
+        }
+
+        const double flow = boost::boykov_kolmogorov_max_flow(graph, source, sink);
+        const boost::default_color_type sourceColor = boost::get(boost::vertex_color, graph, source);
+        isSource.resize(numberOfNodes);
+        for(unsigned int p = 0; p < numberOfNodes; ++p)
+        {
+            isSource[p] = boost::get(boost::vertex_color, graph, p) == sourceColor;
+        }
+        return flow;
+    }
+
+    /** Get the capacity of the cut that separates the source side from the rest. */
+    double ComputeCutValue(const Problem& problem, const std::vector<bool>& isSource)
+    {
+        double value = 0;
+        for(unsigned int y = 0; y < problem.Height; ++y)
+        {
+            for(unsigned int x = 0; x < problem.Width; ++x)
+            {
+                const unsigned int p = y * problem.Width + x;
+                value += isSource[p] ? problem.SinkCapacities[p] : problem.SourceCapacities[p];
+
+                unsigned int neighbor;
+                for(unsigned int direction = 0; direction < problem.GetNumberOfDirections(); ++direction)
+                {
+                    if(problem.GetNeighbor(x, y, direction, neighbor) && isSource[p] && !isSource[neighbor])
+                    {
+                        value += problem.NeighborCapacities[direction][p];
+                    }
+                }
+            }
+        }
+        return value;
+    }
+
+    /** Check the cut of GridMaxFlow against that of Boost. */
+    void CompareCuts(const Problem& problem, const GridMaxFlow& grid, const std::string& description)
+    {
+        std::vector<bool> boostIsSource;
+        const double boostFlow = SolveWithBoost(problem, boostIsSource);
+
+        std::vector<bool> gridIsSource(problem.Width * problem.Height);
+        for(unsigned int p = 0; p < gridIsSource.size(); ++p)
+        {
+            gridIsSource[p] = grid.IsSource(p);
+        }
+
+        if(ComputeCutValue(problem, boostIsSource) != boostFlow)
+        {
+            throw std::runtime_error(description + ": the Boost cut is not a minimum cut!");
+        }
+        if(ComputeCutValue(problem, gridIsSource) != boostFlow)
+        {
+            std::stringstream message;
+            message << description << ": the cut value " << ComputeCutValue(problem, gridIsSource)
+                    << " differs from the maximum flow " << boostFlow << "!";
+            throw std::runtime_error(message.str());
+        }
+        if(gridIsSource != boostIsSource)
+        {
+            throw std::runtime_error(description + ": the labels differ from those of Boost!");
+        }
+    }
+
+    /** Solve a random problem, then change its terminal capacities (up and down) and solve again. */
+    void TestProblem(std::mt19937& generator, const unsigned int width, const unsigned int height, const bool eightConnected,
+                     const unsigned int numberOfThreads, const std::string& description)
+    {
+        Problem problem = CreateProblem(generator, width, height, eightConnected);
+        const unsigned int numberOfNodes = width * height;
+
+        GridMaxFlow grid;
+        grid.SetNumberOfThreads(numberOfThreads);
+        grid.Initialize(width, height, eightConnected);
+        for(unsigned int p = 0; p < numberOfNodes; ++p)
+        {
+            for(unsigned int direction = 0; direction < problem.GetNumberOfDirections(); ++direction)
+            {
+                grid.SetNeighborCapacity(p, static_cast<GridMaxFlow::DirectionEnum>(direction),
+                                         problem.NeighborCapacities[direction][p]);
+            }
+            grid.SetTerminalCapacities(p, problem.SourceCapacities[p], problem.SinkCapacities[p]);
+        }
+
+        // The two terminal edges of a node are folded into one residual, so their common part is not pushed as flow
+        double commonCapacity = 0;
+        for(unsigned int p = 0; p < numberOfNodes; ++p)
+        {
+            commonCapacity += std::min(problem.SourceCapacities[p], problem.SinkCapacities[p]);
+        }
+        std::vector<bool> boostIsSource;
+        const double flow = grid.ComputeMaxFlow();
+        if(flow + commonCapacity != SolveWithBoost(problem, boostIsSource))
+        {
+            throw std::runtime_error(description + ": the flow differs from that of Boost!");
+        }
+        CompareCuts(problem, grid, description);
+
+        // Incremental updates keep the flow already pushed; decreases may take back more than is left of a t-link
+        std::uniform_int_distribution<int> change(-10, 10);
+        for(unsigned int p = 0; p < numberOfNodes; ++p)
+        {
+            const float sourceChange = std::max<float>(change(generator), -problem.SourceCapacities[p]);
+            const float sinkChange = std::max<float>(change(generator), -problem.SinkCapacities[p]);
+            problem.SourceCapacities[p] += sourceChange;
+            problem.SinkCapacities[p] += sinkChange;
+            grid.AddTerminalCapacities(p, sourceChange, sinkChange);
+        }
+        grid.ComputeMaxFlow();
+        CompareCuts(problem, grid, description + " after AddTerminalCapacities");
+    }
+}
+
+int main()
+{
+    try
+    {
+        std::mt19937 generator(0);
+        std::uniform_int_distribution<unsigned int> size(1, 40);
+        std::uniform_int_distribution<unsigned int> stripHeight(130, 260);
+        std::uniform_int_distribution<unsigned int> threads(2, 5);
+        for(unsigned int i = 0; i < 200; ++i)
+        {
+            std::stringstream description;
+            const bool eightConnected = i % 2 == 1;
+
+            // Half of the grids (the last two of every four, one of each connectivity) are tall enough to be split into
+            // strips (64 rows at least) on several threads; the others are solved on one thread
+            if(i % 4 < 2)
+            {
+                const unsigned int width = size(generator);
+                const unsigned int height = size(generator);
+                description << "Problem " << i << " (" << width << "x" << height << ", " << (eightConnected ? 8 : 4) << " connected)";
+                TestProblem(generator, width, height, eightConnected, 1, description.str());
+            }
+            else
+            {
+                const unsigned int width = size(generator);
+                const unsigned int height = stripHeight(generator);
+                const unsigned int numberOfThreads = threads(generator);
+                description << "Problem " << i << " (" << width << "x" << height << ", " << (eightConnected ? 8 : 4)
+                            << " connected, " << numberOfThreads << " threads)";
+                TestProblem(generator, width, height, eightConnected, numberOfThreads, description.str());
+            }
+        }
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "GridMaxFlow matches Boost on 200 random grids." << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,309 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Check that moving points between the components of a HardAssignmentMixture (and adding and removing points) leaves
+  * exactly the statistics of the final assignment, that adding up the statistics of parts of the points gives those of
+  * all of them, and that FindMostLikelyComponent() agrees with the densities of the components. */
+
+#include "HardAssignmentMixture.h"
+
+// Submodules
+#include "ExpectationMaximization/GaussianModel.h"
+#include "ExpectationMaximization/MixtureModel.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    const unsigned int Dimensionality = 3;
+    const unsigned int NumberOfComponents = 5;
+
+    /** A mixture model of new GaussianModels, which the caller deletes with DeleteModels(). */
+    MixtureModel CreateMixtureModel()
+    {
+        std::vector<Model*> models;
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            models.push_back(new GaussianModel(Dimensionality));
+        }
+        MixtureModel mixtureModel;
+        mixtureModel.SetModels(models);
+        return mixtureModel;
+    }
+
+    void DeleteModels(const MixtureModel& mixtureModel)
+    {
+        for(Model* model : mixtureModel.GetModels())
+        {
+            delete model;
+        }
+    }
+
+    /** Compare the fitted components bit for bit. */
+    void CompareMixtureModels(const MixtureModel& a, const MixtureModel& b, const std::string& description)
+    {
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            if(a.GetModel(k)->GetMixingCoefficient() != b.GetModel(k)->GetMixingCoefficient() ||
+               a.GetModel(k)->GetMean() != b.GetModel(k)->GetMean() ||
+               a.GetModel(k)->GetVariance() != b.GetModel(k)->GetVariance())
+            {
+                std::stringstream message;
+                message << description << ": component " << k << " differs!";
+                throw std::runtime_error(message.str());
+            }
+        }
+    }
+
+    /** Moves, additions and removals must leave the same statistics as adding the final points once. */
+    void TestRoundTrips(std::mt19937& generator, const unsigned int numberOfPoints, const std::string& description)
+    {
+        // Colors, and a cluster of a single color so that a component can have no variance
+        std::uniform_int_distribution<int> color(0, 255);
+        std::uniform_int_distribution<unsigned int> component(0, NumberOfComponents - 1);
+        std::vector<double> points(numberOfPoints * Dimensionality);
+        for(unsigned int i = 0; i < numberOfPoints; ++i)
+        {
+            for(unsigned int d = 0; d < Dimensionality; ++d)
+            {
+                points[i * Dimensionality + d] = i % 7 == 0 ? 100 : color(generator);
+            }
+        }
+        std::vector<unsigned int> labels(numberOfPoints);
+        for(unsigned int i = 0; i < numberOfPoints; ++i)
+        {
+            labels[i] = i % 7 == 0 ? 0 : component(generator);
+        }
+
+        HardAssignmentMixture fresh;
+        fresh.Initialize(Dimensionality, NumberOfComponents);
+        for(unsigned int i = 0; i < numberOfPoints; ++i)
+        {
+            fresh.AddPoint(&points[i * Dimensionality], labels[i], 1);
+        }
+
+        // Start from another assignment with points that are removed again, then move every point over several rounds
+        HardAssignmentMixture incremental;
+        incremental.Initialize(Dimensionality, NumberOfComponents);
+        std::vector<unsigned int> currentLabels(numberOfPoints);
+        for(unsigned int i = 0; i < numberOfPoints; ++i)
+        {
+            currentLabels[i] = component(generator);
+            incremental.AddPoint(&points[i * Dimensionality], currentLabels[i], 1);
+        }
+        std::vector<double> extraPoint(Dimensionality);
+        std::vector<std::vector<double> > extraPoints;
+        for(unsigned int i = 0; i < numberOfPoints / 3; ++i)
+        {
+            for(unsigned int d = 0; d < Dimensionality; ++d)
+            {
+                extraPoint[d] = color(generator);
+            }
+            extraPoints.push_back(extraPoint);
+            incremental.AddPoint(extraPoint.data(), i % NumberOfComponents, 1);
+        }
+        for(unsigned int round = 0; round < 3; ++round)
+        {
+            for(unsigned int i = 0; i < numberOfPoints; ++i)
+            {
+                const unsigned int label = round == 2 ? labels[i] : component(generator);
+                incremental.AddPoint(&points[i * Dimensionality], currentLabels[i], -1);
+                incremental.AddPoint(&points[i * Dimensionality], label, 1);
+                currentLabels[i] = label;
+            }
+        }
+        for(unsigned int i = 0; i < extraPoints.size(); ++i)
+        {
+            incremental.AddPoint(extraPoints[i].data(), i % NumberOfComponents, -1);
+        }
+
+        // The points split over three mixtures, like the rows of the threads of a hard assignment
+        std::vector<HardAssignmentMixture> parts(3);
+        for(unsigned int part = 0; part < parts.size(); ++part)
+        {
+            parts[part].Initialize(Dimensionality, NumberOfComponents);
+        }
+        for(unsigned int i = 0; i < numberOfPoints; ++i)
+        {
+            parts[i * parts.size() / numberOfPoints].AddPoint(&points[i * Dimensionality], labels[i], 1);
+        }
+        HardAssignmentMixture combined;
+        combined.Initialize(Dimensionality, NumberOfComponents);
+        for(unsigned int part = 0; part < parts.size(); ++part)
+        {
+            combined.AddStatistics(parts[part]);
+        }
+
+        const MixtureModel freshModel = CreateMixtureModel();
+        const MixtureModel incrementalModel = CreateMixtureModel();
+        const MixtureModel combinedModel = CreateMixtureModel();
+        fresh.UpdateMixtureModel(freshModel);
+        incremental.UpdateMixtureModel(incrementalModel);
+        combined.UpdateMixtureModel(combinedModel);
+        CompareMixtureModels(freshModel, incrementalModel, description);
+        CompareMixtureModels(freshModel, combinedModel, description + " (combined parts)");
+
+        // The means are those of the points of each component
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            Eigen::VectorXd sum = Eigen::VectorXd::Zero(Dimensionality);
+            unsigned int count = 0;
+            for(unsigned int i = 0; i < numberOfPoints; ++i)
+            {
+                if(labels[i] == k)
+                {
+                    sum += Eigen::Map<const Eigen::VectorXd>(&points[i * Dimensionality], Dimensionality);
+                    ++count;
+                }
+            }
+            const double expectedWeight = static_cast<double>(count) / numberOfPoints;
+            if(std::abs(freshModel.GetModel(k)->GetMixingCoefficient() - expectedWeight) > 1e-12 ||
+               (count > 0 && (freshModel.GetModel(k)->GetMean() - sum / count).norm() > 1e-9))
+            {
+                throw std::runtime_error(description + ": a component is not the mean of its points!");
+            }
+        }
+
+        DeleteModels(freshModel);
+        DeleteModels(incrementalModel);
+        DeleteModels(combinedModel);
+    }
+
+    /** The component of the largest weighted Gaussian density, evaluated directly. */
+    unsigned int FindMostLikelyComponent(const MixtureModel& mixtureModel, const Eigen::VectorXd& point)
+    {
+        unsigned int mostLikely = 0;
+        double largestLogDensity = -INFINITY;
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            const Model* model = mixtureModel.GetModel(k);
+            if(!(model->GetMixingCoefficient() > 0))
+            {
+                continue;
+            }
+            const Eigen::MatrixXd covariance = model->GetVariance();
+            const Eigen::VectorXd difference = point - model->GetMean();
+            const double logDensity = std::log(model->GetMixingCoefficient()) -
+                0.5 * (Dimensionality * std::log(2 * M_PI) + std::log(covariance.determinant()) +
+                       difference.dot(covariance.inverse() * difference));
+            if(logDensity > largestLogDensity)
+            {
+                mostLikely = k;
+                largestLogDensity = logDensity;
+            }
+        }
+        return mostLikely;
+    }
+
+    void TestMostLikelyComponent(std::mt19937& generator, const std::string& description)
+    {
+        std::uniform_real_distribution<double> uniform(0, 255);
+        std::normal_distribution<double> normal(0, 1);
+        std::uniform_int_distribution<int> dropped(0, 3);
+        const MixtureModel mixtureModel = CreateMixtureModel();
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            Eigen::VectorXd mean(Dimensionality);
+            Eigen::MatrixXd factor(Dimensionality, Dimensionality);
+            for(unsigned int i = 0; i < Dimensionality; ++i)
+            {
+                mean(i) = uniform(generator);
+                for(unsigned int j = 0; j < Dimensionality; ++j)
+                {
+                    factor(i, j) = 20 * normal(generator);
+                }
+            }
+            mixtureModel.GetModel(k)->SetMean(mean);
+            mixtureModel.GetModel(k)->SetVariance(factor * factor.transpose() +
+                                                  Eigen::MatrixXd::Identity(Dimensionality, Dimensionality));
+
+            // Some components have been dropped (no weight), but never the first
+            mixtureModel.GetModel(k)->SetMixingCoefficient(k > 0 && dropped(generator) == 0 ? 0 : 0.1 + uniform(generator));
+        }
+
+        HardAssignmentMixture mixture;
+        mixture.Initialize(Dimensionality, NumberOfComponents);
+        mixture.SetMixtureModel(mixtureModel);
+        Eigen::VectorXd point(Dimensionality);
+        for(unsigned int i = 0; i < 1000; ++i)
+        {
+            for(unsigned int d = 0; d < Dimensionality; ++d)
+            {
+                point(d) = uniform(generator);
+            }
+            if(mixture.FindMostLikelyComponent(point.data()) != FindMostLikelyComponent(mixtureModel, point))
+            {
+                throw std::runtime_error(description + ": FindMostLikelyComponent differs from the densities!");
+            }
+        }
+
+        // A mixture without any weight has no most likely component
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            mixtureModel.GetModel(k)->SetMixingCoefficient(0);
+        }
+        bool threw = false;
+        try
+        {
+            mixture.SetMixtureModel(mixtureModel);
+        }
+        catch(const std::runtime_error&)
+        {
+            threw = true;
+        }
+        if(!threw)
+        {
+            throw std::runtime_error(description + ": SetMixtureModel accepted a mixture without weights!");
+        }
+
+        DeleteModels(mixtureModel);
+    }
+}
+
+int main()
+{
+    try
+    {
+        std::mt19937 generator(0);
+        std::uniform_int_distribution<unsigned int> size(1, 2000);
+        for(unsigned int i = 0; i < 100; ++i)
+        {
+            std::stringstream description;
+            description << "Mixture " << i;
+            TestRoundTrips(generator, size(generator), description.str());
+            TestMostLikelyComponent(generator, description.str());
+        }
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "HardAssignmentMixture round trips and component choices match on 100 random mixtures." << std::endl;
+    return EXIT_SUCCESS;
+}
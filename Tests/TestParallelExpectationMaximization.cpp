@@ -0,0 +1,159 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Fit random mixtures with ParallelExpectationMaximization on different numbers of threads, with every initialization,
+  * and check that the fitted models are bit-for-bit the same and that the log-likelihood never decreases. */
+
+#include "ParallelExpectationMaximization.h"
+
+// Submodules
+#include "ExpectationMaximization/GaussianModel.h"
+#include "ExpectationMaximization/MixtureModel.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    const unsigned int Dimensionality = 3;
+    const unsigned int NumberOfComponents = 5;
+
+    /** Colors drawn around a few random centers, as the pixels of one label would be. */
+    Eigen::MatrixXd CreateData(std::mt19937& generator, const unsigned int numberOfPoints)
+    {
+        std::uniform_real_distribution<double> uniform(0, 255);
+        std::normal_distribution<double> normal(0, 1);
+        std::uniform_int_distribution<unsigned int> cluster(0, 3);
+        Eigen::MatrixXd centers(Dimensionality, 4);
+        Eigen::VectorXd spreads(4);
+        for(unsigned int c = 0; c < 4; ++c)
+        {
+            for(unsigned int d = 0; d < Dimensionality; ++d)
+            {
+                centers(d, c) = uniform(generator);
+            }
+            spreads(c) = 1 + uniform(generator) / 10;
+        }
+
+        Eigen::MatrixXd data(Dimensionality, numberOfPoints);
+        for(unsigned int i = 0; i < numberOfPoints; ++i)
+        {
+            const unsigned int c = cluster(generator);
+            for(unsigned int d = 0; d < Dimensionality; ++d)
+            {
+                data(d, i) = centers(d, c) + spreads(c) * normal(generator);
+            }
+        }
+        return data;
+    }
+
+    /** Fit a mixture of fresh components to the data, and return the fitted means, variances and weights in a row. */
+    std::vector<double> Fit(const Eigen::MatrixXd& data, const MixtureInitializationEnum initialization,
+                            const unsigned int numberOfThreads, const std::string& description)
+    {
+        std::vector<Model*> models;
+        for(unsigned int k = 0; k < NumberOfComponents; ++k)
+        {
+            models.push_back(new GaussianModel(Dimensionality));
+        }
+        MixtureModel mixtureModel;
+        mixtureModel.SetModels(models);
+
+        ParallelExpectationMaximization expectationMaximization;
+        expectationMaximization.SetData(data);
+        expectationMaximization.SetMixtureModel(mixtureModel);
+        expectationMaximization.SetInitialization(initialization);
+        expectationMaximization.SetSeed(7);
+        expectationMaximization.SetInitializationSampleSize(500);
+        expectationMaximization.SetMinChange(1e-6);
+        expectationMaximization.SetMaxIterations(30);
+        expectationMaximization.SetChunkSize(256);
+        expectationMaximization.SetNumberOfThreads(numberOfThreads);
+        expectationMaximization.Compute();
+
+        // EM never lowers the likelihood; the covariance regularization may cost a little
+        const std::vector<double>& logLikelihoods = expectationMaximization.GetLogLikelihoods();
+        for(unsigned int i = 1; i < logLikelihoods.size(); ++i)
+        {
+            if(logLikelihoods[i] < logLikelihoods[i - 1] - 1e-6)
+            {
+                throw std::runtime_error(description + ": the log-likelihood decreased!");
+            }
+        }
+
+        std::vector<double> parameters;
+        for(Model* model : models)
+        {
+            const Eigen::VectorXd mean = model->GetMean();
+            const Eigen::MatrixXd variance = model->GetVariance();
+            parameters.insert(parameters.end(), mean.data(), mean.data() + mean.size());
+            parameters.insert(parameters.end(), variance.data(), variance.data() + variance.size());
+            parameters.push_back(model->GetMixingCoefficient());
+            delete model;
+        }
+        return parameters;
+    }
+}
+
+int main()
+{
+    try
+    {
+        std::mt19937 generator(0);
+        std::uniform_int_distribution<unsigned int> numberOfPoints(1, 5000);
+        const MixtureInitializationEnum initializations[] = {MixtureInitializationEnum::PRINCIPAL_AXIS,
+                                                             MixtureInitializationEnum::ORCHARD_BOUMAN,
+                                                             MixtureInitializationEnum::KMEANS_PLUS_PLUS};
+        const unsigned int threads[] = {2, 3, 8};
+        for(unsigned int i = 0; i < 20; ++i)
+        {
+            const Eigen::MatrixXd data = CreateData(generator, numberOfPoints(generator));
+            for(unsigned int initialization = 0; initialization < 3; ++initialization)
+            {
+                std::stringstream description;
+                description << "Data " << i << " (" << data.cols() << " points), initialization " << initialization;
+                const std::vector<double> serial = Fit(data, initializations[initialization], 1, description.str());
+                for(const unsigned int numberOfThreads : threads)
+                {
+                    if(Fit(data, initializations[initialization], numberOfThreads, description.str()) != serial)
+                    {
+                        std::stringstream message;
+                        message << description.str() << ": the model fitted on " << numberOfThreads
+                                << " threads differs from the one fitted on 1!";
+                        throw std::runtime_error(message.str());
+                    }
+                }
+            }
+        }
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "ParallelExpectationMaximization fits the same models on 1, 2, 3 and 8 threads." << std::endl;
+    return EXIT_SUCCESS;
+}
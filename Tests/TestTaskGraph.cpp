@@ -0,0 +1,175 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** Run random task graphs on several threads and check that every task runs once, after all of its dependencies; and
+  * that when a task throws, Run() rethrows its exception and none of the tasks that depend on it run. */
+
+#include "TaskGraph.h"
+
+// STL
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    void TestGraph(std::mt19937& generator, const unsigned int numberOfTasks, const unsigned int numberOfThreads,
+                   const bool throwing, const std::string& description)
+    {
+        std::uniform_int_distribution<unsigned int> numberOfDependencies(0, 3);
+        std::uniform_int_distribution<int> work(0, 20000);
+        std::uniform_int_distribution<unsigned int> throwingTaskDistribution(0, numberOfTasks - 1);
+        const unsigned int throwingTask = throwing ? throwingTaskDistribution(generator) : numberOfTasks;
+
+        // Every task takes a ticket when it starts and when it finishes
+        std::atomic<unsigned int> ticket(0);
+        std::vector<unsigned int> started(numberOfTasks, 0);
+        std::vector<unsigned int> finished(numberOfTasks, 0);
+        std::vector<unsigned int> runs(numberOfTasks, 0);
+        std::vector<std::vector<TaskGraph::TaskId> > dependencies(numberOfTasks);
+
+        TaskGraph taskGraph;
+        for(unsigned int t = 0; t < numberOfTasks; ++t)
+        {
+            if(t > 0)
+            {
+                std::uniform_int_distribution<unsigned int> dependency(0, t - 1);
+                const unsigned int count = numberOfDependencies(generator);
+                for(unsigned int i = 0; i < count; ++i)
+                {
+                    dependencies[t].push_back(dependency(generator));
+                }
+            }
+
+            const int amount = work(generator);
+            std::stringstream name;
+            name << "task " << t;
+            taskGraph.AddTask(name.str(), [&, t, amount]()
+            {
+                started[t] = ++ticket;
+                ++runs[t];
+                volatile double sum = 0;
+                for(int i = 0; i < amount; ++i)
+                {
+                    sum = sum + i;
+                }
+                if(t == throwingTask)
+                {
+                    throw std::runtime_error("thrown by a task");
+                }
+                finished[t] = ++ticket;
+            }, dependencies[t]);
+        }
+
+        bool threw = false;
+        try
+        {
+            taskGraph.Run(numberOfThreads);
+        }
+        catch(const std::runtime_error& exception)
+        {
+            if(std::string(exception.what()) != "thrown by a task")
+            {
+                throw;
+            }
+            threw = true;
+        }
+        if(threw != throwing)
+        {
+            throw std::runtime_error(description + ": Run did not rethrow the exception of the task!");
+        }
+
+        // A task may only run once its dependencies finished; the dependents of a failed task must not run at all
+        std::vector<bool> failed(numberOfTasks, false);
+        for(unsigned int t = 0; t < numberOfTasks; ++t)
+        {
+            failed[t] = t == throwingTask;
+            for(const TaskGraph::TaskId dependency : dependencies[t])
+            {
+                failed[t] = failed[t] || failed[dependency];
+                if(runs[t] > 0 && (finished[dependency] == 0 || finished[dependency] > started[t]))
+                {
+                    throw std::runtime_error(description + ": a task started before one of its dependencies finished!");
+                }
+            }
+            if(runs[t] > 1 || (failed[t] && t != throwingTask && runs[t] > 0) || (!throwing && runs[t] != 1))
+            {
+                throw std::runtime_error(description + ": a task ran the wrong number of times!");
+            }
+        }
+
+        bool ranTwice = false;
+        try
+        {
+            taskGraph.Run(numberOfThreads);
+        }
+        catch(const std::runtime_error&)
+        {
+            ranTwice = true;
+        }
+        if(!ranTwice)
+        {
+            throw std::runtime_error(description + ": a task graph ran twice!");
+        }
+    }
+}
+
+int main()
+{
+    try
+    {
+        std::mt19937 generator(0);
+        std::uniform_int_distribution<unsigned int> numberOfTasks(1, 60);
+        std::uniform_int_distribution<unsigned int> numberOfThreads(1, 8);
+        for(unsigned int i = 0; i < 500; ++i)
+        {
+            const unsigned int tasks = numberOfTasks(generator);
+            const unsigned int threads = numberOfThreads(generator);
+            std::stringstream description;
+            description << "Graph " << i << " (" << tasks << " tasks, " << threads << " threads)";
+            TestGraph(generator, tasks, threads, i % 3 == 2, description.str());
+        }
+
+        // Dependencies on tasks that have not been added would allow cycles
+        TaskGraph taskGraph;
+        bool threw = false;
+        try
+        {
+            taskGraph.AddTask("task", []() {}, std::vector<TaskGraph::TaskId>(1, 0));
+        }
+        catch(const std::runtime_error&)
+        {
+            threw = true;
+        }
+        if(!threw)
+        {
+            throw std::runtime_error("AddTask accepted a dependency on a task that was not added!");
+        }
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "TaskGraph ran 500 random graphs in dependency order." << std::endl;
+    return EXIT_SUCCESS;
+}
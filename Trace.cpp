@@ -0,0 +1,184 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Trace.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+Trace& Trace::GetGlobal()
+{
+    static Trace trace;
+    return trace;
+}
+
+unsigned int Trace::GetThreadNumber()
+{
+    static std::atomic<unsigned int> numberOfThreads(0);
+    thread_local const unsigned int threadNumber = numberOfThreads++;
+    return threadNumber;
+}
+
+void Trace::AddEvent(const std::string& name, const Clock::time_point& start, const Clock::time_point& end)
+{
+    Event event;
+    event.Name = name;
+    event.Phase = 'X';
+    event.Thread = GetThreadNumber();
+
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    event.Start = GetMicroseconds(start);
+    event.Value = std::chrono::duration<double, std::micro>(end - start).count();
+    this->Events.push_back(event);
+}
+
+void Trace::AddCounter(const std::string& name, const double value)
+{
+    Event event;
+    event.Name = name;
+    event.Phase = 'C';
+    event.Thread = GetThreadNumber();
+    const Clock::time_point now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    double& total = this->Counters[name];
+    total += value;
+    event.Start = GetMicroseconds(now);
+    event.Value = total;
+    this->Events.push_back(event);
+}
+
+void Trace::Clear()
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Events.clear();
+    this->Counters.clear();
+    this->Origin = Clock::now();
+}
+
+void Trace::WriteReport(std::ostream& stream) const
+{
+    struct Summary
+    {
+        unsigned int Calls = 0;
+        double Total = 0;
+        double Longest = 0;
+    };
+
+    // In the order the names first ended
+    std::vector<std::string> names;
+    std::map<std::string, Summary> summaries;
+    std::map<std::string, double> counters;
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        for(unsigned int i = 0; i < this->Events.size(); ++i)
+        {
+            const Event& event = this->Events[i];
+            if(event.Phase != 'X')
+            {
+                continue;
+            }
+            if(summaries.find(event.Name) == summaries.end())
+            {
+                names.push_back(event.Name);
+            }
+            Summary& summary = summaries[event.Name];
+            summary.Calls++;
+            summary.Total += event.Value;
+            summary.Longest = std::max(summary.Longest, event.Value);
+        }
+        counters = this->Counters;
+    }
+
+    stream << std::left << std::setw(28) << "event" << std::right << std::setw(8) << "calls" << std::setw(12) << "total ms"
+           << std::setw(12) << "mean ms" << std::setw(12) << "max ms" << std::endl;
+    stream << std::fixed << std::setprecision(3);
+    for(unsigned int i = 0; i < names.size(); ++i)
+    {
+        const Summary& summary = summaries[names[i]];
+        stream << std::left << std::setw(28) << names[i] << std::right << std::setw(8) << summary.Calls
+               << std::setw(12) << summary.Total / 1000 << std::setw(12) << summary.Total / summary.Calls / 1000
+               << std::setw(12) << summary.Longest / 1000 << std::endl;
+    }
+
+    stream << std::setprecision(0);
+    for(std::map<std::string, double>::const_iterator counter = counters.begin(); counter != counters.end(); ++counter)
+    {
+        stream << std::left << std::setw(28) << counter->first << std::right << std::setw(20) << counter->second << std::endl;
+    }
+    stream.unsetf(std::ios::floatfield);
+    stream << std::left;
+}
+
+void Trace::WriteChromeTrace(const std::string& fileName) const
+{
+    auto quote = [](const std::string& text)
+    {
+        std::stringstream quoted;
+        quoted << '"';
+        for(unsigned int i = 0; i < text.size(); ++i)
+        {
+            const unsigned char c = text[i];
+            if(c == '"' || c == '\\')
+            {
+                quoted << '\\' << c;
+            }
+            else if(c < 0x20)
+            {
+                quoted << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<unsigned int>(c) << std::dec;
+            }
+            else
+            {
+                quoted << c;
+            }
+        }
+        quoted << '"';
+        return quoted.str();
+    };
+
+    std::ofstream json(fileName.c_str());
+    json << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        for(unsigned int i = 0; i < this->Events.size(); ++i)
+        {
+            const Event& event = this->Events[i];
+            json << "{\"name\": " << quote(event.Name) << ", \"ph\": \"" << event.Phase << "\", \"pid\": 1, \"tid\": "
+                 << event.Thread << ", \"ts\": " << event.Start;
+            if(event.Phase == 'X')
+            {
+                json << ", \"dur\": " << event.Value << "}";
+            }
+            else
+            {
+                json << ", \"args\": {\"value\": " << event.Value << "}}";
+            }
+            json << (i + 1 < this->Events.size() ? "," : "") << std::endl;
+        }
+    }
+    json << "]}" << std::endl;
+
+    if(!json)
+    {
+        throw std::runtime_error("Trace::WriteChromeTrace: cannot write " + fileName + "!");
+    }
+}
@@ -0,0 +1,136 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef Trace_H
+#define Trace_H
+
+// STL
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/** The tracing macros. They record into Trace::GetGlobal() when GRABCUT_ENABLE_TRACING is defined (the CMake option
+  * GrabCut_ENABLE_TRACING), and expand to nothing otherwise, so their arguments are not even evaluated.
+  * GRABCUT_TRACE_SCOPE(name) times the rest of the enclosing block; GRABCUT_TRACE_EVENT(name, start, end) records an
+  * interval that was timed anyway; GRABCUT_TRACE_COUNTER(name, value) adds to a counter. */
+#ifdef GRABCUT_ENABLE_TRACING
+#define GRABCUT_TRACE_CONCATENATE_(a, b) a##b
+#define GRABCUT_TRACE_CONCATENATE(a, b) GRABCUT_TRACE_CONCATENATE_(a, b)
+#define GRABCUT_TRACE_SCOPE(name) Trace::Scope GRABCUT_TRACE_CONCATENATE(traceScope, __LINE__)(name)
+#define GRABCUT_TRACE_EVENT(name, start, end) Trace::GetGlobal().AddEvent(name, start, end)
+#define GRABCUT_TRACE_COUNTER(name, value) Trace::GetGlobal().AddCounter(name, value)
+#else
+#define GRABCUT_TRACE_SCOPE(name)
+#define GRABCUT_TRACE_EVENT(name, start, end)
+#define GRABCUT_TRACE_COUNTER(name, value)
+#endif
+
+/** A record of what ran when and on which thread, with counters of the work that was done.
+  * It can be summarized per name (WriteReport) or written in the Chrome trace event format (WriteChromeTrace), which
+  * chrome://tracing and ui.perfetto.dev show as one timeline per thread. Recording is thread safe. */
+class Trace
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /** Times the scope it lives in and records it into the global trace when it is destroyed. */
+    class Scope
+    {
+    public:
+        explicit Scope(const char* const name) : Name(name), Start(Clock::now())
+        {
+        }
+
+        ~Scope()
+        {
+            Trace::GetGlobal().AddEvent(this->Name, this->Start, Clock::now());
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* Name;
+        Clock::time_point Start;
+    };
+
+    /** Get the trace the GRABCUT_TRACE_ macros record into. */
+    static Trace& GetGlobal();
+
+    /** Whether the GRABCUT_TRACE_ macros are compiled in. */
+    static bool IsEnabled()
+    {
+#ifdef GRABCUT_ENABLE_TRACING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /** Record that something ran on the calling thread from start to end. */
+    void AddEvent(const std::string& name, const Clock::time_point& start, const Clock::time_point& end);
+
+    /** Add a value to a counter. The total so far is recorded with the current time. */
+    void AddCounter(const std::string& name, const double value);
+
+    /** Forget all events and counters. Time is measured from here on. */
+    void Clear();
+
+    /** Write the number of calls and the total, mean and longest duration of the events of each name, and the total of
+      * each counter. */
+    void WriteReport(std::ostream& stream) const;
+
+    /** Write the events and counters as Chrome trace event JSON. */
+    void WriteChromeTrace(const std::string& fileName) const;
+
+protected:
+
+    /** An event ('X', with a duration) or a counter sample ('C', with the counter total). */
+    struct Event
+    {
+        std::string Name;
+        char Phase;
+        unsigned int Thread;
+        double Start; // microseconds since the origin
+        double Value; // the duration (microseconds) or the counter total
+    };
+
+    /** Get a small number that identifies the calling thread. */
+    static unsigned int GetThreadNumber();
+
+    /** Get the microseconds from the origin to a time point. */
+    double GetMicroseconds(const Clock::time_point& time) const
+    {
+        return std::chrono::duration<double, std::micro>(time - this->Origin).count();
+    }
+
+    mutable std::mutex Mutex;
+
+    /** When the trace started. */
+    Clock::time_point Origin = Clock::now();
+
+    /** The events, in the order they ended. */
+    std::vector<Event> Events;
+
+    /** The total of each counter. */
+    std::map<std::string, double> Counters;
+};
+
+#endif
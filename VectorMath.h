@@ -0,0 +1,150 @@
+/*
+Copyright (C) 2015 David Doria, daviddoria@gmail.com
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VectorMath_H
+#define VectorMath_H
+
+/** The AVX2/AVX-512 exp and log approximations shared by the vectorized kernels.
+  * This header is only meant to be included by the .cpp files that contain such kernels. */
+
+// The vector kernels are compiled with per-function target attributes, so the rest of the
+// project does not need to be built with -mavx2/-mavx512f and the choice is made at runtime.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define GRABCUT_HAVE_X86_KERNELS
+#include <immintrin.h>
+#define GRABCUT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define GRABCUT_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+
+namespace VectorMath
+{
+    // Coefficients of the Cephes single precision exp/log approximations
+    const float ExpHigh = 88.3762626647949f;
+    const float ExpLow = -87.0f; // Keeps 2^n a normal float; exp(-87) ~ 1.6e-38
+    const float Log2e = 1.44269504088896341f;
+    const float ExpC1 = 0.693359375f;
+    const float ExpC2 = -2.12194440e-4f;
+    const float ExpP[6] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+                           4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+    const float SqrtHalf = 0.707106781186547524f;
+    const float LogP[9] = {7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f,
+                           -1.2420140846e-1f, 1.4249322787e-1f, -1.6668057665e-1f,
+                           2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f};
+    const float LogQ1 = -2.12194440e-4f;
+    const float LogQ2 = 0.693359375f;
+
+#ifdef GRABCUT_HAVE_X86_KERNELS
+
+    /** exp(x), clamped to the range of normal floats. */
+    GRABCUT_TARGET_AVX2 inline __m256 ExpAVX2(__m256 x)
+    {
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(ExpLow)), _mm256_set1_ps(ExpHigh));
+
+        // exp(x) = 2^n exp(r) with n = round(x / log(2)) and |r| <= log(2) / 2
+        const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(Log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        x = _mm256_fnmadd_ps(n, _mm256_set1_ps(ExpC1), x);
+        x = _mm256_fnmadd_ps(n, _mm256_set1_ps(ExpC2), x);
+
+        __m256 y = _mm256_set1_ps(ExpP[0]);
+        for(unsigned int i = 1; i < 6; ++i)
+        {
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(ExpP[i]));
+        }
+        y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+        const __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+    }
+
+    /** Natural log of positive, normal floats. */
+    GRABCUT_TARGET_AVX2 inline __m256 LogAVX2(__m256 x)
+    {
+        // x = m 2^e with m in [0.5, 1)
+        const __m256i bits = _mm256_castps_si256(x);
+        __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+        x = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F000000)));
+
+        // Shift m into [sqrt(1/2), sqrt(2)) and take m - 1
+        const __m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(SqrtHalf), _CMP_LT_OQ);
+        e = _mm256_sub_ps(e, _mm256_and_ps(small, _mm256_set1_ps(1.0f)));
+        x = _mm256_sub_ps(_mm256_add_ps(x, _mm256_and_ps(small, x)), _mm256_set1_ps(1.0f));
+
+        const __m256 z = _mm256_mul_ps(x, x);
+        __m256 y = _mm256_set1_ps(LogP[0]);
+        for(unsigned int i = 1; i < 9; ++i)
+        {
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LogP[i]));
+        }
+        y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+        y = _mm256_fmadd_ps(e, _mm256_set1_ps(LogQ1), y);
+        y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+        x = _mm256_add_ps(x, y);
+        return _mm256_fmadd_ps(e, _mm256_set1_ps(LogQ2), x);
+    }
+
+// GCC's own AVX-512 headers trip -Wmaybe-uninitialized (their _mm512_undefined_* helpers)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+    GRABCUT_TARGET_AVX512 inline __m512 ExpAVX512(__m512 x)
+    {
+        x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(ExpLow)), _mm512_set1_ps(ExpHigh));
+
+        const __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(Log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        x = _mm512_fnmadd_ps(n, _mm512_set1_ps(ExpC1), x);
+        x = _mm512_fnmadd_ps(n, _mm512_set1_ps(ExpC2), x);
+
+        __m512 y = _mm512_set1_ps(ExpP[0]);
+        for(unsigned int i = 1; i < 6; ++i)
+        {
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(ExpP[i]));
+        }
+        y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+
+        return _mm512_scalef_ps(y, n);
+    }
+
+    GRABCUT_TARGET_AVX512 inline __m512 LogAVX512(__m512 x)
+    {
+        const __m512i bits = _mm512_castps_si512(x);
+        __m512 e = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(126)));
+        x = _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007FFFFF)), _mm512_set1_epi32(0x3F000000)));
+
+        const __mmask16 small = _mm512_cmp_ps_mask(x, _mm512_set1_ps(SqrtHalf), _CMP_LT_OQ);
+        e = _mm512_mask_sub_ps(e, small, e, _mm512_set1_ps(1.0f));
+        x = _mm512_sub_ps(_mm512_mask_add_ps(x, small, x, x), _mm512_set1_ps(1.0f));
+
+        const __m512 z = _mm512_mul_ps(x, x);
+        __m512 y = _mm512_set1_ps(LogP[0]);
+        for(unsigned int i = 1; i < 9; ++i)
+        {
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(LogP[i]));
+        }
+        y = _mm512_mul_ps(_mm512_mul_ps(y, x), z);
+        y = _mm512_fmadd_ps(e, _mm512_set1_ps(LogQ1), y);
+        y = _mm512_fnmadd_ps(z, _mm512_set1_ps(0.5f), y);
+        x = _mm512_add_ps(x, y);
+        return _mm512_fmadd_ps(e, _mm512_set1_ps(LogQ2), x);
+    }
+
+#pragma GCC diagnostic pop
+
+#endif
+}
+
+#endif